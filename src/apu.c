@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+
+#define OAM_DMA 0x14
+#define APU_STATUS 0x15
+#define CONTROLLER_PORT_1 0x16
+#define APU_FRAME_COUNTER 0x17
+#define DMC_CONTROL 0x10
+#define DMC_SAMPLE_ADDRESS 0x12
+#define DMC_SAMPLE_LENGTH 0x13
+
+// CPU cycles per DMC output bit for each rate index (NTSC)
+static const u16 DMC_RATES[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+static void update_irq_line(Apu* apu) {
+    set_irq_line(apu->cpu, IRQ_APU_FRAME, apu->frame_irq);
+    set_irq_line(apu->cpu, IRQ_APU_DMC, apu->dmc_irq);
+}
+
+static void restart_dmc_sample(Apu* apu) {
+    apu->dmc_address = 0xC000 | (apu->registers[DMC_SAMPLE_ADDRESS] << 6);
+    apu->dmc_bytes_remaining = (apu->registers[DMC_SAMPLE_LENGTH] << 4) + 1;
+}
+
+static void apu_catch_up(void __attribute__((__unused__)) *ctx, u64 __attribute__((__unused__)) from,
+                         u64 __attribute__((__unused__)) to) {
+    // The channels are not synthesized, everything the CPU sees is driven by events
+}
+
+static void frame_irq_event(void* ctx, u64 timestamp) {
+    Apu* apu = ctx;
+    sync_component(&apu->component, apu->cpu->cycles);
+
+    apu->frame_irq = true;
+    update_irq_line(apu);
+
+    schedule_event(apu->scheduler, EVENT_FRAME_IRQ, timestamp + APU_FRAME_SEQUENCE_CYCLES);
+}
+
+static void dmc_fetch_event(void* ctx, u64 timestamp) {
+    Apu* apu = ctx;
+    Cpu* cpu = apu->cpu;
+    sync_component(&apu->component, cpu->cycles);
+
+    // The DMA unit takes the bus away from the CPU for the fetch
+    apu->dmc_sample_buffer = bus_read(&cpu->bus, apu->dmc_address);
+    apu->dmc_address = apu->dmc_address == 0xFFFF ? 0x8000 : apu->dmc_address + 1;
+    apu->dmc_bytes_remaining--;
+    apu->dmc_fetches++;
+    cpu->cycles += APU_DMC_FETCH_STALL_CYCLES;
+
+    if (apu->dmc_bytes_remaining == 0) {
+        if (apu->dmc_loop) {
+            restart_dmc_sample(apu);
+        } else if (apu->dmc_irq_enable) {
+            apu->dmc_irq = true;
+            update_irq_line(apu);
+        }
+    }
+
+    if (apu->dmc_bytes_remaining > 0) {
+        schedule_event(apu->scheduler, EVENT_DMC_FETCH, timestamp + 8 * apu->dmc_period);
+    }
+}
+
+static u8 apu_register_read(void* ctx, u16 addr) {
+    Apu* apu = ctx;
+    const u8 reg = addr & 0xFF;
+
+    if ((reg == CONTROLLER_PORT_1 || reg == CONTROLLER_PORT_1 + 1) && apu->controllers) {
+        // The upper bits are open bus, which usually holds the high byte of the address
+        return (addr >> 8 & 0xE0) | read_controller(&apu->controllers[reg - CONTROLLER_PORT_1]);
+    }
+
+    if (reg != APU_STATUS) {
+        return reg < sizeof(apu->registers) ? apu->registers[reg] : bus_open_read(NULL, addr);
+    }
+
+    sync_component(&apu->component, apu->cpu->cycles);
+
+    const u8 val = (apu->dmc_irq ? 0x80 : 0)
+        | (apu->frame_irq ? 0x40 : 0)
+        | (apu->dmc_bytes_remaining > 0 ? 0x10 : 0);
+
+    // Reading the status acknowledges the frame IRQ
+    apu->frame_irq = false;
+    update_irq_line(apu);
+
+    return val;
+}
+
+static void apu_register_write(void* ctx, u16 addr, u8 val) {
+    Apu* apu = ctx;
+    const u8 reg = addr & 0xFF;
+    const u64 now = apu->cpu->cycles;
+
+    if (reg >= sizeof(apu->registers)) {
+        return;
+    }
+
+    sync_component(&apu->component, now);
+    apu->registers[reg] = val;
+
+    switch (reg) {
+        case CONTROLLER_PORT_1:
+            // One strobe line is shared by both ports
+            if (apu->controllers) {
+                write_controller_strobe(&apu->controllers[0], val);
+                write_controller_strobe(&apu->controllers[1], val);
+            }
+            break;
+        case OAM_DMA:
+            if (apu->ppu) {
+                start_oam_dma(apu->ppu, val);
+            }
+            break;
+        case DMC_CONTROL:
+            apu->dmc_irq_enable = val & 0x80;
+            apu->dmc_loop = val & 0x40;
+            apu->dmc_period = DMC_RATES[val & 0x0F];
+
+            if (!apu->dmc_irq_enable) {
+                apu->dmc_irq = false;
+            }
+            break;
+        case APU_STATUS:
+            apu->dmc_irq = false;
+
+            if (!(val & 0x10)) {
+                apu->dmc_bytes_remaining = 0;
+                cancel_event(apu->scheduler, EVENT_DMC_FETCH);
+            } else if (apu->dmc_bytes_remaining == 0) {
+                restart_dmc_sample(apu);
+                schedule_event(apu->scheduler, EVENT_DMC_FETCH, now + apu->dmc_period);
+            }
+            break;
+        case APU_FRAME_COUNTER:
+            apu->five_step_mode = val & 0x80;
+            apu->frame_irq_inhibit = val & 0x40;
+
+            if (apu->frame_irq_inhibit) {
+                apu->frame_irq = false;
+            }
+
+            // Only the 4-step sequence raises the frame IRQ
+            if (!apu->five_step_mode && !apu->frame_irq_inhibit) {
+                schedule_event(apu->scheduler, EVENT_FRAME_IRQ, now + APU_FRAME_SEQUENCE_CYCLES);
+            } else {
+                cancel_event(apu->scheduler, EVENT_FRAME_IRQ);
+            }
+            break;
+        default:
+            break;
+    }
+
+    update_irq_line(apu);
+}
+
+Apu* build_apu(Cpu* cpu, Scheduler* scheduler) {
+    Apu* apu = malloc(sizeof(Apu));
+
+    memset(apu, 0, sizeof(Apu));
+    apu->cpu = cpu;
+    apu->scheduler = scheduler;
+    apu->dmc_period = DMC_RATES[0];
+    apu->component = (Component) {
+        .cycles = cpu->cycles,
+        .catch_up = apu_catch_up,
+        .ctx = apu,
+        .syncs = 0
+    };
+
+    bus_map_read_handler(&cpu->bus, 0x40, 0x01, apu_register_read, apu);
+    bus_map_write_handler(&cpu->bus, 0x40, 0x01, apu_register_write, apu);
+
+    set_event_handler(scheduler, EVENT_FRAME_IRQ, frame_irq_event, apu);
+    set_event_handler(scheduler, EVENT_DMC_FETCH, dmc_fetch_event, apu);
+
+    // The frame counter powers up in 4-step mode with the IRQ enabled
+    schedule_event(scheduler, EVENT_FRAME_IRQ, cpu->cycles + APU_FRAME_SEQUENCE_CYCLES);
+
+    return apu;
+}
+
+void free_apu(Apu* apu) {
+    free(apu);
+}
@@ -0,0 +1,47 @@
+#ifndef APU_H
+#define APU_H
+
+#include <stdbool.h>
+#include "types.h"
+#include "cpu.h"
+#include "scheduler.h"
+#include "controller.h"
+#include "ppu.h"
+
+// 4-step frame counter sequence length in CPU cycles (NTSC)
+#define APU_FRAME_SEQUENCE_CYCLES 29830
+// Cycles the CPU is stalled while the DMC fetches a sample byte
+#define APU_DMC_FETCH_STALL_CYCLES 4
+
+// APU timing and registers. The channels are not synthesized yet; what is modelled is
+// everything that affects the CPU: the frame counter IRQ and the DMC sample fetches,
+// which steal CPU cycles and raise an IRQ at the end of a sample.
+typedef struct Apu {
+    u8 registers[0x18];
+    // Frame counter ($4017)
+    bool five_step_mode;
+    bool frame_irq_inhibit;
+    bool frame_irq;
+    // DMC ($4010-$4013)
+    bool dmc_irq_enable;
+    bool dmc_loop;
+    bool dmc_irq;
+    u16 dmc_period;
+    u16 dmc_address;
+    u16 dmc_bytes_remaining;
+    u8 dmc_sample_buffer;
+    u64 dmc_fetches;
+    Component component;
+    Scheduler* scheduler;
+    Cpu* cpu;
+    // The two controller ports share the I/O page with the APU, NULL when unplugged
+    Controller* controllers;
+    // Does the OAM DMA ($4014), NULL when there is no PPU
+    Ppu* ppu;
+} Apu;
+
+// Maps the APU and I/O registers ($4000-$40FF) on the CPU bus and starts the frame counter
+Apu* build_apu(Cpu* cpu, Scheduler* scheduler);
+void free_apu(Apu* apu);
+
+#endif
@@ -0,0 +1,78 @@
+#include <stddef.h>
+
+#include "bus.h"
+
+void bus_map_memory(Bus* bus, u8 first_page, u16 page_count, u8* mem) {
+    for (u16 i = 0; i < page_count; i++) {
+        const u8 page = first_page + i;
+        u8* page_mem = &mem[i * BUS_PAGE_SIZE];
+
+        bus->read_pages[page] = page_mem;
+        bus->write_pages[page] = page_mem;
+        bus->page_generation[page] = 0;
+    }
+}
+
+void bus_map_rom(Bus* bus, u8 first_page, u16 page_count, const u8* mem) {
+    for (u16 i = 0; i < page_count; i++) {
+        const u8 page = first_page + i;
+
+        bus->read_pages[page] = &mem[i * BUS_PAGE_SIZE];
+        bus->page_generation[page] = ++bus->generation;
+    }
+}
+
+// Generations of bank pages, far above anything the counter of bus_map_rom reaches
+#define BANK_GENERATION_BASE 0x80000000u
+
+bool bus_map_rom_bank(Bus* bus, u8 first_page, u16 page_count, const u8* mem, u32 first_rom_page) {
+    bool changed = false;
+
+    for (u16 i = 0; i < page_count; i++) {
+        const u8 page = first_page + i;
+        const u8* page_mem = &mem[i * BUS_PAGE_SIZE];
+        const u32 generation = BANK_GENERATION_BASE + first_rom_page + i;
+
+        if (bus->read_pages[page] != page_mem || bus->page_generation[page] != generation) {
+            bus->read_pages[page] = page_mem;
+            bus->page_generation[page] = generation;
+            changed = true;
+        }
+    }
+
+    // Anything that caches per bus rather than per page sees the switch
+    if (changed) {
+        bus->generation++;
+    }
+
+    return changed;
+}
+
+void bus_map_read_handler(Bus* bus, u8 first_page, u16 page_count, bus_read_handler handler, void* ctx) {
+    for (u16 i = 0; i < page_count; i++) {
+        const u8 page = first_page + i;
+
+        bus->read_pages[page] = NULL;
+        bus->page_generation[page] = 0;
+        bus->read_handlers[page] = handler;
+        bus->read_ctx[page] = ctx;
+    }
+}
+
+void bus_map_write_handler(Bus* bus, u8 first_page, u16 page_count, bus_write_handler handler, void* ctx) {
+    for (u16 i = 0; i < page_count; i++) {
+        const u8 page = first_page + i;
+
+        bus->write_pages[page] = NULL;
+        bus->write_handlers[page] = handler;
+        bus->write_ctx[page] = ctx;
+    }
+}
+
+u8 bus_open_read(void __attribute__((__unused__)) *ctx, u16 addr) {
+    // Nothing drives the data bus, it keeps the last value on it. That is the high byte of
+    // the address for nearly every read, the last operand byte the CPU fetched.
+    return addr >> 8;
+}
+
+void bus_ignore_write(void __attribute__((__unused__)) *ctx, u16 __attribute__((__unused__)) addr, u8 __attribute__((__unused__)) val) {}
@@ -0,0 +1,85 @@
+#ifndef BUS_H
+#define BUS_H
+
+#include <stdbool.h>
+#include "types.h"
+
+#define BUS_PAGE_COUNT 0x100
+#define BUS_PAGE_SIZE 0x100
+
+typedef u8 (*bus_read_handler)(void* ctx, u16 addr);
+typedef void (*bus_write_handler)(void* ctx, u16 addr, u8 val);
+
+// CPU address space split into 256 byte pages. A page is either backed by host memory
+// (RAM, PRG-ROM, PRG-RAM), in which case an access is a single indexed load/store, or
+// it is served by a handler (memory mapped I/O, mapper registers).
+// Reads and writes are mapped separately, so ROM pages can have a direct read pointer
+// and a handler that catches writes to mapper registers.
+typedef struct Bus {
+    const u8* read_pages[BUS_PAGE_COUNT];
+    u8* write_pages[BUS_PAGE_COUNT];
+    bus_read_handler read_handlers[BUS_PAGE_COUNT];
+    bus_write_handler write_handlers[BUS_PAGE_COUNT];
+    void* read_ctx[BUS_PAGE_COUNT];
+    void* write_ctx[BUS_PAGE_COUNT];
+    // Non-zero for pages mapped with bus_map_rom. Every ROM mapping gets a fresh value, so
+    // anything derived from the contents of a ROM page (like predecoded instructions) stays
+    // valid exactly as long as the generation of the page does not change.
+    u32 page_generation[BUS_PAGE_COUNT];
+    u32 generation;
+} Bus;
+
+// Maps page_count pages starting at first_page to the host memory at mem, both for reads
+// and writes. Remapping is a pointer swap per page.
+void bus_map_memory(Bus* bus, u8 first_page, u16 page_count, u8* mem);
+// Maps immutable memory for reads only, writes keep going to the installed write handler.
+void bus_map_rom(Bus* bus, u8 first_page, u16 page_count, const u8* mem);
+// Maps a bank of a ROM like bus_map_rom, for mappers that switch banks. first_rom_page is
+// the position of mem in the ROM in pages: instead of a fresh generation each page gets
+// one derived from it, so switching back to a bank revalidates whatever was derived from
+// it before. Returns whether any page changed, mapping the bank that is already there is free.
+bool bus_map_rom_bank(Bus* bus, u8 first_page, u16 page_count, const u8* mem, u32 first_rom_page);
+void bus_map_read_handler(Bus* bus, u8 first_page, u16 page_count, bus_read_handler handler, void* ctx);
+void bus_map_write_handler(Bus* bus, u8 first_page, u16 page_count, bus_write_handler handler, void* ctx);
+
+// Handlers for unmapped or read-only space
+u8 bus_open_read(void* ctx, u16 addr);
+void bus_ignore_write(void* ctx, u16 addr, u8 val);
+
+static inline u8 bus_read(const Bus* bus, u16 addr) {
+    const u8 page = addr >> 8;
+    const u8* mem = bus->read_pages[page];
+
+    if (mem) {
+        return mem[addr & 0xFF];
+    }
+
+    return bus->read_handlers[page](bus->read_ctx[page], addr);
+}
+
+// Reads addr without any side effects, for debuggers and stop conditions: only pages backed
+// by memory can be read, for pages served by a handler (registers whose reads change state)
+// it returns false and leaves val alone.
+static inline bool bus_peek(const Bus* bus, u16 addr, u8* val) {
+    const u8* mem = bus->read_pages[addr >> 8];
+
+    if (mem) {
+        *val = mem[addr & 0xFF];
+    }
+
+    return mem;
+}
+
+static inline void bus_write(const Bus* bus, u16 addr, u8 val) {
+    const u8 page = addr >> 8;
+    u8* mem = bus->write_pages[page];
+
+    if (mem) {
+        mem[addr & 0xFF] = val;
+        return;
+    }
+
+    bus->write_handlers[page](bus->write_ctx[page], addr, val);
+}
+
+#endif
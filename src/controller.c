@@ -0,0 +1,21 @@
+#include "controller.h"
+
+void write_controller_strobe(Controller* controller, u8 val) {
+    controller->strobe = val & 0x01;
+
+    if (controller->strobe) {
+        controller->shift = controller->buttons;
+    }
+}
+
+u8 read_controller(Controller* controller) {
+    if (controller->strobe) {
+        return controller->buttons & BUTTON_A;
+    }
+
+    const u8 bit = controller->shift & 0x01;
+    // Official controllers report 1 after all 8 buttons have been read
+    controller->shift = (controller->shift >> 1) | 0x80;
+
+    return bit;
+}
@@ -0,0 +1,30 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <stdbool.h>
+#include "types.h"
+
+// Bits of Controller.buttons, in the order the shift register reports them
+typedef enum ControllerButton {
+    BUTTON_A = (1 << 0),
+    BUTTON_B = (1 << 1),
+    BUTTON_SELECT = (1 << 2),
+    BUTTON_START = (1 << 3),
+    BUTTON_UP = (1 << 4),
+    BUTTON_DOWN = (1 << 5),
+    BUTTON_LEFT = (1 << 6),
+    BUTTON_RIGHT = (1 << 7)
+} ControllerButton;
+
+// Standard controller on $4016/$4017. While the strobe bit is set the shift register is
+// reloaded continuously, once cleared every read shifts out the next button.
+typedef struct Controller {
+    u8 buttons;
+    u8 shift;
+    bool strobe;
+} Controller;
+
+void write_controller_strobe(Controller* controller, u8 val);
+u8 read_controller(Controller* controller);
+
+#endif
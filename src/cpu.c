@@ -1,18 +1,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "cpu.h"
 #include "utils.h"
+#ifdef PYROTOBOX_TRACE
+#include "trace.h"
+#endif
 
-inline static u16 reset_vector(u8* cpu_mem);
-inline static u16 irq_interrupt_vector(u8* cpu_mem);
-static u8 read_u8(Cpu* cpu, u16 addr);
+inline static u16 reset_vector(Cpu* cpu);
+inline static u16 irq_interrupt_vector(Cpu* cpu);
+static void init_bus(Bus* bus, u8* cpu_mem, size_t mem_size);
 
-static void write_u8(Cpu* cpu, u16 addr, u8 val);
-static void disassemble(const Cpu* cpu, const operand_t* operand, const Instruction* inst);
-
-static operand_t get_operand(Cpu* cpu, AddrMode addr_mode);
+static operand_t get_operand(Cpu* cpu, AddrMode addr_mode, OperandAccess access);
 
 // CPU flag ops
 static void set_cpu_flag(Cpu* cpu, StatusFlag flag, bool set);
@@ -81,374 +82,476 @@ static inline void txs(Cpu* cpu, operand_t* operand);
 static void tya(Cpu* cpu, operand_t* operand);
 
 
-static Instruction MOS_6502_INSTRUCTION_SET[] = {
-    {.mnemonic = "BRK", .addr_mode = IMPLIED, .cycles = 7, .exec = brk},
-    {.mnemonic = "ORA", .addr_mode = INDIRECT_X, .cycles = 6, .exec = ora},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "ORA", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = ora},
-    {.mnemonic = "ASL", .addr_mode = ZERO_PAGE, .cycles = 5, .exec = asl},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "PHP", .addr_mode = IMPLIED, .cycles = 3, .exec = php},
-    {.mnemonic = "ORA", .addr_mode = IMMEDIATE, .cycles = 2, .exec = ora},
-    {.mnemonic = "ASL", .addr_mode = ACCUMULATOR, .cycles = 2, .exec = asl},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "ORA", .addr_mode = ABSOLUTE, .cycles = 4, .exec = ora},
-    {.mnemonic = "ASL", .addr_mode = ABSOLUTE, .cycles = 6, .exec = asl},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "BPL", .addr_mode = RELATIVE, .cycles = 2, .exec = bpl},
-    {.mnemonic = "ORA", .addr_mode = INDIRECT_Y, .cycles = 5, .exec = ora},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "ORA", .addr_mode = ZERO_PAGE_X, .cycles = 4, .exec = ora},
-    {.mnemonic = "ASL", .addr_mode = ZERO_PAGE_X, .cycles = 6, .exec = asl},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CLC", .addr_mode = IMPLIED, .cycles = 2, .exec = clc},
-    {.mnemonic = "ORA", .addr_mode = ABSOLUTE_Y, .cycles = 4, .exec = ora},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "ORA", .addr_mode = ABSOLUTE_X, .cycles = 4, .exec = ora},
-    {.mnemonic = "ASL", .addr_mode = ABSOLUTE_X, .cycles = 7, .exec = asl},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "JSR", .addr_mode = ABSOLUTE, .cycles = 6, .exec = jsr},
-    {.mnemonic = "AND", .addr_mode = INDIRECT_X, .cycles = 6, .exec = aand},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "BIT", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = bit},
-    {.mnemonic = "AND", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = aand},
-    {.mnemonic = "ROL", .addr_mode = ZERO_PAGE, .cycles = 5, .exec = rol},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "PLP", .addr_mode = IMPLIED, .cycles = 4, .exec = plp},
-    {.mnemonic = "AND", .addr_mode = IMMEDIATE, .cycles = 2, .exec = aand},
-    {.mnemonic = "ROL", .addr_mode = ACCUMULATOR, .cycles = 2, .exec = rol},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "BIT", .addr_mode = ABSOLUTE, .cycles = 4, .exec = bit},
-    {.mnemonic = "AND", .addr_mode = ABSOLUTE, .cycles = 4, .exec = aand},
-    {.mnemonic = "ROL", .addr_mode = ABSOLUTE, .cycles = 6, .exec = rol},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "BMI", .addr_mode = RELATIVE, .cycles = 2, .exec = bmi},
-    {.mnemonic = "AND", .addr_mode = INDIRECT_Y, .cycles = 5, .exec = aand},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "AND", .addr_mode = ZERO_PAGE_X, .cycles = 4, .exec = aand},
-    {.mnemonic = "ROL", .addr_mode = ZERO_PAGE_X, .cycles = 6, .exec = rol},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "SEC", .addr_mode = IMPLIED, .cycles = 2, .exec = sec},
-    {.mnemonic = "AND", .addr_mode = ABSOLUTE_Y, .cycles = 4, .exec = aand},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "AND", .addr_mode = ABSOLUTE_X, .cycles = 4, .exec = aand},
-    {.mnemonic = "ROL", .addr_mode = ABSOLUTE_X, .cycles = 7, .exec = rol},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "RTI", .addr_mode = IMPLIED, .cycles = 6, .exec = rti},
-    {.mnemonic = "EOR", .addr_mode = INDIRECT_X, .cycles = 6, .exec = eor},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "EOR", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = eor},
-    {.mnemonic = "LSR", .addr_mode = ZERO_PAGE, .cycles = 5, .exec = lsr},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "PHA", .addr_mode = IMPLIED, .cycles = 3, .exec = pha},
-    {.mnemonic = "EOR", .addr_mode = IMMEDIATE, .cycles = 2, .exec = eor},
-    {.mnemonic = "LSR", .addr_mode = ACCUMULATOR, .cycles = 2, .exec = lsr},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "JMP", .addr_mode = ABSOLUTE, .cycles = 3, .exec = jmp},
-    {.mnemonic = "EOR", .addr_mode = ABSOLUTE, .cycles = 4, .exec = eor},
-    {.mnemonic = "LSR", .addr_mode = ABSOLUTE, .cycles = 6, .exec = lsr},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "BVC", .addr_mode = RELATIVE, .cycles = 2, .exec = bvc},
-    {.mnemonic = "EOR", .addr_mode = INDIRECT_Y, .cycles = 5, .exec = eor},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "EOR", .addr_mode = ZERO_PAGE_X, .cycles = 4, .exec = eor},
-    {.mnemonic = "LSR", .addr_mode = ZERO_PAGE_X, .cycles = 6, .exec = lsr},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CLI", .addr_mode = IMPLIED, .cycles = 2, .exec = cli},
-    {.mnemonic = "EOR", .addr_mode = ABSOLUTE_Y, .cycles = 4, .exec = eor},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "EOR", .addr_mode = ABSOLUTE_X, .cycles = 4, .exec = eor},
-    {.mnemonic = "LSR", .addr_mode = ABSOLUTE_X, .cycles = 7, .exec = lsr},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "RTS", .addr_mode = IMPLIED, .cycles = 6, .exec = rts},
-    {.mnemonic = "ADC", .addr_mode = INDIRECT_X, .cycles = 6, .exec = adc},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "ADC", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = adc},
-    {.mnemonic = "ROR", .addr_mode = ZERO_PAGE, .cycles = 5, .exec = ror},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "PLA", .addr_mode = IMPLIED, .cycles = 4, .exec = pla},
-    {.mnemonic = "ADC", .addr_mode = IMMEDIATE, .cycles = 2, .exec = adc},
-    {.mnemonic = "ROR", .addr_mode = ACCUMULATOR, .cycles = 2, .exec = ror},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "JMP", .addr_mode = INDIRECT, .cycles = 5, .exec = jmp},
-    {.mnemonic = "ADC", .addr_mode = ABSOLUTE, .cycles = 4, .exec = adc},
-    {.mnemonic = "ROR", .addr_mode = ABSOLUTE, .cycles = 6, .exec = ror},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "BVS", .addr_mode = RELATIVE, .cycles = 2, .exec = bvs},
-    {.mnemonic = "ADC", .addr_mode = INDIRECT_Y, .cycles = 5, .exec = adc},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "ADC", .addr_mode = ZERO_PAGE_X, .cycles = 4, .exec = adc},
-    {.mnemonic = "ROR", .addr_mode = ZERO_PAGE_X, .cycles = 6, .exec = ror},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "SEI", .addr_mode = IMPLIED, .cycles = 2, .exec = sei},
-    {.mnemonic = "ADC", .addr_mode = ABSOLUTE_Y, .cycles = 4, .exec = adc},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "ADC", .addr_mode = ABSOLUTE_X, .cycles = 4, .exec = adc},
-    {.mnemonic = "ROR", .addr_mode = ABSOLUTE_X, .cycles = 7, .exec = ror},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "STA", .addr_mode = INDIRECT_X, .cycles = 6, .exec = sta},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "STY", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = sty},
-    {.mnemonic = "STA", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = sta},
-    {.mnemonic = "STX", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = stx},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "DEY", .addr_mode = IMPLIED, .cycles = 2, .exec = dey},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "TXA", .addr_mode = IMPLIED, .cycles = 2, .exec = txa},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "STY", .addr_mode = ABSOLUTE, .cycles = 4, .exec = sty},
-    {.mnemonic = "STA", .addr_mode = ABSOLUTE, .cycles = 4, .exec = sta},
-    {.mnemonic = "STX", .addr_mode = ABSOLUTE, .cycles = 4, .exec = stx},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "BCC", .addr_mode = RELATIVE, .cycles = 2, .exec = bcc},
-    {.mnemonic = "STA", .addr_mode = INDIRECT_Y, .cycles = 6, .exec = sta},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "STY", .addr_mode = ZERO_PAGE_X, .cycles = 4, .exec = sty},
-    {.mnemonic = "STA", .addr_mode = ZERO_PAGE_X, .cycles = 4, .exec = sta},
-    {.mnemonic = "STX", .addr_mode = ZERO_PAGE_Y, .cycles = 4, .exec = stx},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "TYA", .addr_mode = IMPLIED, .cycles = 2, .exec = tya},
-    {.mnemonic = "STA", .addr_mode = ABSOLUTE_Y, .cycles = 5, .exec = sta},
-    {.mnemonic = "TXS", .addr_mode = IMPLIED, .cycles = 2, .exec = txs},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "STA", .addr_mode = ABSOLUTE_X, .cycles = 5, .exec = sta},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "LDY", .addr_mode = IMMEDIATE, .cycles = 2, .exec = ldy},
-    {.mnemonic = "LDA", .addr_mode = INDIRECT_X, .cycles = 6, .exec = lda},
-    {.mnemonic = "LDX", .addr_mode = IMMEDIATE, .cycles = 2, .exec = ldx},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "LDY", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = ldy},
-    {.mnemonic = "LDA", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = lda},
-    {.mnemonic = "LDX", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = ldx},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "TAY", .addr_mode = IMPLIED, .cycles = 2, .exec = tay},
-    {.mnemonic = "LDA", .addr_mode = IMMEDIATE, .cycles = 2, .exec = lda},
-    {.mnemonic = "TAX", .addr_mode = IMPLIED, .cycles = 2, .exec = tax},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "LDY", .addr_mode = ABSOLUTE, .cycles = 4, .exec = ldy},
-    {.mnemonic = "LDA", .addr_mode = ABSOLUTE, .cycles = 4, .exec = lda},
-    {.mnemonic = "LDX", .addr_mode = ABSOLUTE, .cycles = 4, .exec = ldx},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "BCS", .addr_mode = RELATIVE, .cycles = 2, .exec = bcs},
-    {.mnemonic = "LDA", .addr_mode = INDIRECT_Y, .cycles = 5, .exec = lda},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "LDY", .addr_mode = ZERO_PAGE_X, .cycles = 4, .exec = ldy},
-    {.mnemonic = "LDA", .addr_mode = ZERO_PAGE_X, .cycles = 4, .exec = lda},
-    {.mnemonic = "LDX", .addr_mode = ZERO_PAGE_Y, .cycles = 4, .exec = ldx},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CLV", .addr_mode = IMPLIED, .cycles = 2, .exec = clv},
-    {.mnemonic = "LDA", .addr_mode = ABSOLUTE_Y, .cycles = 4, .exec = lda},
-    {.mnemonic = "TSX", .addr_mode = IMPLIED, .cycles = 2, .exec = tsx},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "LDY", .addr_mode = ABSOLUTE_X, .cycles = 4, .exec = ldy},
-    {.mnemonic = "LDA", .addr_mode = ABSOLUTE_X, .cycles = 4, .exec = lda},
-    {.mnemonic = "LDX", .addr_mode = ABSOLUTE_Y, .cycles = 4, .exec = ldx},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CPY", .addr_mode = IMMEDIATE, .cycles = 2, .exec = cpy},
-    {.mnemonic = "CMP", .addr_mode = INDIRECT_X, .cycles = 6, .exec = cmp},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CPY", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = cpy},
-    {.mnemonic = "CMP", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = cmp},
-    {.mnemonic = "DEC", .addr_mode = ZERO_PAGE, .cycles = 5, .exec = dec},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "INY", .addr_mode = IMPLIED, .cycles = 2, .exec = iny},
-    {.mnemonic = "CMP", .addr_mode = IMMEDIATE, .cycles = 2, .exec = cmp},
-    {.mnemonic = "DEX", .addr_mode = IMPLIED, .cycles = 2, .exec = dex},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CPY", .addr_mode = ABSOLUTE, .cycles = 4, .exec = cpy},
-    {.mnemonic = "CMP", .addr_mode = ABSOLUTE, .cycles = 4, .exec = cmp},
-    {.mnemonic = "DEC", .addr_mode = ABSOLUTE, .cycles = 6, .exec = dec},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "BNE", .addr_mode = RELATIVE, .cycles = 2, .exec = bne},
-    {.mnemonic = "CMP", .addr_mode = INDIRECT_Y, .cycles = 5, .exec = cmp},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CMP", .addr_mode = ZERO_PAGE_X, .cycles = 4, .exec = cmp},
-    {.mnemonic = "DEC", .addr_mode = ZERO_PAGE_X, .cycles = 6, .exec = dec},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CLD", .addr_mode = IMPLIED, .cycles = 2, .exec = cld},
-    {.mnemonic = "CMP", .addr_mode = ABSOLUTE_Y, .cycles = 4, .exec = cmp},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CMP", .addr_mode = ABSOLUTE_X, .cycles = 4, .exec = cmp},
-    {.mnemonic = "DEC", .addr_mode = ABSOLUTE_X, .cycles = 7, .exec = dec},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CPX", .addr_mode = IMMEDIATE, .cycles = 2, .exec = cpx},
-    {.mnemonic = "SBC", .addr_mode = INDIRECT_X, .cycles = 6, .exec = sbc},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CPX", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = cpx},
-    {.mnemonic = "SBC", .addr_mode = ZERO_PAGE, .cycles = 3, .exec = sbc},
-    {.mnemonic = "INC", .addr_mode = ZERO_PAGE, .cycles = 5, .exec = inc},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "INX", .addr_mode = IMPLIED, .cycles = 2, .exec = inx},
-    {.mnemonic = "SBC", .addr_mode = IMMEDIATE, .cycles = 2, .exec = sbc},
-    {.mnemonic = "NOP", .addr_mode = IMPLIED, .cycles = 2, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "CPX", .addr_mode = ABSOLUTE, .cycles = 4, .exec = cpx},
-    {.mnemonic = "SBC", .addr_mode = ABSOLUTE, .cycles = 4, .exec = sbc},
-    {.mnemonic = "INC", .addr_mode = ABSOLUTE, .cycles = 6, .exec = inc},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "BEQ", .addr_mode = RELATIVE, .cycles = 2, .exec = beq},
-    {.mnemonic = "SBC", .addr_mode = INDIRECT_Y, .cycles = 5, .exec = sbc},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "SBC", .addr_mode = ZERO_PAGE_X, .cycles = 4, .exec = sbc},
-    {.mnemonic = "INC", .addr_mode = ZERO_PAGE_X, .cycles = 6, .exec = inc},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "SED", .addr_mode = IMPLIED, .cycles = 2, .exec = sed},
-    {.mnemonic = "SBC", .addr_mode = ABSOLUTE_Y, .cycles = 4, .exec = sbc},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
-    {.mnemonic = "SBC", .addr_mode = ABSOLUTE_X, .cycles = 4, .exec = sbc},
-    {.mnemonic = "INC", .addr_mode = ABSOLUTE_X, .cycles = 7, .exec = inc},
-    {.mnemonic = "???", .addr_mode = IMPLIED, .cycles = 0, .exec = nop},
+static const Instruction MOS_6502_INSTRUCTION_SET[] = {
+    {.mnemonic = "BRK", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 7, .exec = brk},
+    {.mnemonic = "ORA", .addr_mode = INDIRECT_X, .access = OPERAND_VALUE, .cycles = 6, .exec = ora},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "ORA", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = ora},
+    {.mnemonic = "ASL", .addr_mode = ZERO_PAGE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 5, .exec = asl},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "PHP", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 3, .exec = php},
+    {.mnemonic = "ORA", .addr_mode = IMMEDIATE, .access = OPERAND_VALUE, .cycles = 2, .exec = ora},
+    {.mnemonic = "ASL", .addr_mode = ACCUMULATOR, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 2, .exec = asl},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "ORA", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = ora},
+    {.mnemonic = "ASL", .addr_mode = ABSOLUTE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = asl},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "BPL", .addr_mode = RELATIVE, .access = OPERAND_VALUE, .cycles = 2, .exec = bpl},
+    {.mnemonic = "ORA", .addr_mode = INDIRECT_Y, .access = OPERAND_VALUE, .cycles = 5, .exec = ora},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "ORA", .addr_mode = ZERO_PAGE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = ora},
+    {.mnemonic = "ASL", .addr_mode = ZERO_PAGE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = asl},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CLC", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = clc},
+    {.mnemonic = "ORA", .addr_mode = ABSOLUTE_Y, .access = OPERAND_VALUE, .cycles = 4, .exec = ora},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "ORA", .addr_mode = ABSOLUTE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = ora},
+    {.mnemonic = "ASL", .addr_mode = ABSOLUTE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 7, .exec = asl},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "JSR", .addr_mode = ABSOLUTE, .access = OPERAND_ADDRESS, .cycles = 6, .exec = jsr},
+    {.mnemonic = "AND", .addr_mode = INDIRECT_X, .access = OPERAND_VALUE, .cycles = 6, .exec = aand},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "BIT", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = bit},
+    {.mnemonic = "AND", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = aand},
+    {.mnemonic = "ROL", .addr_mode = ZERO_PAGE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 5, .exec = rol},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "PLP", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 4, .exec = plp},
+    {.mnemonic = "AND", .addr_mode = IMMEDIATE, .access = OPERAND_VALUE, .cycles = 2, .exec = aand},
+    {.mnemonic = "ROL", .addr_mode = ACCUMULATOR, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 2, .exec = rol},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "BIT", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = bit},
+    {.mnemonic = "AND", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = aand},
+    {.mnemonic = "ROL", .addr_mode = ABSOLUTE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = rol},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "BMI", .addr_mode = RELATIVE, .access = OPERAND_VALUE, .cycles = 2, .exec = bmi},
+    {.mnemonic = "AND", .addr_mode = INDIRECT_Y, .access = OPERAND_VALUE, .cycles = 5, .exec = aand},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "AND", .addr_mode = ZERO_PAGE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = aand},
+    {.mnemonic = "ROL", .addr_mode = ZERO_PAGE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = rol},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "SEC", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = sec},
+    {.mnemonic = "AND", .addr_mode = ABSOLUTE_Y, .access = OPERAND_VALUE, .cycles = 4, .exec = aand},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "AND", .addr_mode = ABSOLUTE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = aand},
+    {.mnemonic = "ROL", .addr_mode = ABSOLUTE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 7, .exec = rol},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "RTI", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 6, .exec = rti},
+    {.mnemonic = "EOR", .addr_mode = INDIRECT_X, .access = OPERAND_VALUE, .cycles = 6, .exec = eor},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "EOR", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = eor},
+    {.mnemonic = "LSR", .addr_mode = ZERO_PAGE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 5, .exec = lsr},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "PHA", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 3, .exec = pha},
+    {.mnemonic = "EOR", .addr_mode = IMMEDIATE, .access = OPERAND_VALUE, .cycles = 2, .exec = eor},
+    {.mnemonic = "LSR", .addr_mode = ACCUMULATOR, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 2, .exec = lsr},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "JMP", .addr_mode = ABSOLUTE, .access = OPERAND_ADDRESS, .cycles = 3, .exec = jmp},
+    {.mnemonic = "EOR", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = eor},
+    {.mnemonic = "LSR", .addr_mode = ABSOLUTE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = lsr},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "BVC", .addr_mode = RELATIVE, .access = OPERAND_VALUE, .cycles = 2, .exec = bvc},
+    {.mnemonic = "EOR", .addr_mode = INDIRECT_Y, .access = OPERAND_VALUE, .cycles = 5, .exec = eor},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "EOR", .addr_mode = ZERO_PAGE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = eor},
+    {.mnemonic = "LSR", .addr_mode = ZERO_PAGE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = lsr},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CLI", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = cli},
+    {.mnemonic = "EOR", .addr_mode = ABSOLUTE_Y, .access = OPERAND_VALUE, .cycles = 4, .exec = eor},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "EOR", .addr_mode = ABSOLUTE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = eor},
+    {.mnemonic = "LSR", .addr_mode = ABSOLUTE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 7, .exec = lsr},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "RTS", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 6, .exec = rts},
+    {.mnemonic = "ADC", .addr_mode = INDIRECT_X, .access = OPERAND_VALUE, .cycles = 6, .exec = adc},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "ADC", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = adc},
+    {.mnemonic = "ROR", .addr_mode = ZERO_PAGE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 5, .exec = ror},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "PLA", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 4, .exec = pla},
+    {.mnemonic = "ADC", .addr_mode = IMMEDIATE, .access = OPERAND_VALUE, .cycles = 2, .exec = adc},
+    {.mnemonic = "ROR", .addr_mode = ACCUMULATOR, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 2, .exec = ror},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "JMP", .addr_mode = INDIRECT, .access = OPERAND_ADDRESS, .cycles = 5, .exec = jmp},
+    {.mnemonic = "ADC", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = adc},
+    {.mnemonic = "ROR", .addr_mode = ABSOLUTE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = ror},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "BVS", .addr_mode = RELATIVE, .access = OPERAND_VALUE, .cycles = 2, .exec = bvs},
+    {.mnemonic = "ADC", .addr_mode = INDIRECT_Y, .access = OPERAND_VALUE, .cycles = 5, .exec = adc},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "ADC", .addr_mode = ZERO_PAGE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = adc},
+    {.mnemonic = "ROR", .addr_mode = ZERO_PAGE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = ror},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "SEI", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = sei},
+    {.mnemonic = "ADC", .addr_mode = ABSOLUTE_Y, .access = OPERAND_VALUE, .cycles = 4, .exec = adc},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "ADC", .addr_mode = ABSOLUTE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = adc},
+    {.mnemonic = "ROR", .addr_mode = ABSOLUTE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 7, .exec = ror},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "STA", .addr_mode = INDIRECT_X, .access = OPERAND_ADDRESS, .cycles = 6, .exec = sta},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "STY", .addr_mode = ZERO_PAGE, .access = OPERAND_ADDRESS, .cycles = 3, .exec = sty},
+    {.mnemonic = "STA", .addr_mode = ZERO_PAGE, .access = OPERAND_ADDRESS, .cycles = 3, .exec = sta},
+    {.mnemonic = "STX", .addr_mode = ZERO_PAGE, .access = OPERAND_ADDRESS, .cycles = 3, .exec = stx},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "DEY", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = dey},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "TXA", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = txa},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "STY", .addr_mode = ABSOLUTE, .access = OPERAND_ADDRESS, .cycles = 4, .exec = sty},
+    {.mnemonic = "STA", .addr_mode = ABSOLUTE, .access = OPERAND_ADDRESS, .cycles = 4, .exec = sta},
+    {.mnemonic = "STX", .addr_mode = ABSOLUTE, .access = OPERAND_ADDRESS, .cycles = 4, .exec = stx},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "BCC", .addr_mode = RELATIVE, .access = OPERAND_VALUE, .cycles = 2, .exec = bcc},
+    {.mnemonic = "STA", .addr_mode = INDIRECT_Y, .access = OPERAND_ADDRESS, .cycles = 6, .exec = sta},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "STY", .addr_mode = ZERO_PAGE_X, .access = OPERAND_ADDRESS, .cycles = 4, .exec = sty},
+    {.mnemonic = "STA", .addr_mode = ZERO_PAGE_X, .access = OPERAND_ADDRESS, .cycles = 4, .exec = sta},
+    {.mnemonic = "STX", .addr_mode = ZERO_PAGE_Y, .access = OPERAND_ADDRESS, .cycles = 4, .exec = stx},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "TYA", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = tya},
+    {.mnemonic = "STA", .addr_mode = ABSOLUTE_Y, .access = OPERAND_ADDRESS, .cycles = 5, .exec = sta},
+    {.mnemonic = "TXS", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = txs},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "STA", .addr_mode = ABSOLUTE_X, .access = OPERAND_ADDRESS, .cycles = 5, .exec = sta},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "LDY", .addr_mode = IMMEDIATE, .access = OPERAND_VALUE, .cycles = 2, .exec = ldy},
+    {.mnemonic = "LDA", .addr_mode = INDIRECT_X, .access = OPERAND_VALUE, .cycles = 6, .exec = lda},
+    {.mnemonic = "LDX", .addr_mode = IMMEDIATE, .access = OPERAND_VALUE, .cycles = 2, .exec = ldx},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "LDY", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = ldy},
+    {.mnemonic = "LDA", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = lda},
+    {.mnemonic = "LDX", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = ldx},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "TAY", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = tay},
+    {.mnemonic = "LDA", .addr_mode = IMMEDIATE, .access = OPERAND_VALUE, .cycles = 2, .exec = lda},
+    {.mnemonic = "TAX", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = tax},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "LDY", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = ldy},
+    {.mnemonic = "LDA", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = lda},
+    {.mnemonic = "LDX", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = ldx},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "BCS", .addr_mode = RELATIVE, .access = OPERAND_VALUE, .cycles = 2, .exec = bcs},
+    {.mnemonic = "LDA", .addr_mode = INDIRECT_Y, .access = OPERAND_VALUE, .cycles = 5, .exec = lda},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "LDY", .addr_mode = ZERO_PAGE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = ldy},
+    {.mnemonic = "LDA", .addr_mode = ZERO_PAGE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = lda},
+    {.mnemonic = "LDX", .addr_mode = ZERO_PAGE_Y, .access = OPERAND_VALUE, .cycles = 4, .exec = ldx},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CLV", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = clv},
+    {.mnemonic = "LDA", .addr_mode = ABSOLUTE_Y, .access = OPERAND_VALUE, .cycles = 4, .exec = lda},
+    {.mnemonic = "TSX", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = tsx},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "LDY", .addr_mode = ABSOLUTE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = ldy},
+    {.mnemonic = "LDA", .addr_mode = ABSOLUTE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = lda},
+    {.mnemonic = "LDX", .addr_mode = ABSOLUTE_Y, .access = OPERAND_VALUE, .cycles = 4, .exec = ldx},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CPY", .addr_mode = IMMEDIATE, .access = OPERAND_VALUE, .cycles = 2, .exec = cpy},
+    {.mnemonic = "CMP", .addr_mode = INDIRECT_X, .access = OPERAND_VALUE, .cycles = 6, .exec = cmp},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CPY", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = cpy},
+    {.mnemonic = "CMP", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = cmp},
+    {.mnemonic = "DEC", .addr_mode = ZERO_PAGE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 5, .exec = dec},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "INY", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = iny},
+    {.mnemonic = "CMP", .addr_mode = IMMEDIATE, .access = OPERAND_VALUE, .cycles = 2, .exec = cmp},
+    {.mnemonic = "DEX", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = dex},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CPY", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = cpy},
+    {.mnemonic = "CMP", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = cmp},
+    {.mnemonic = "DEC", .addr_mode = ABSOLUTE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = dec},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "BNE", .addr_mode = RELATIVE, .access = OPERAND_VALUE, .cycles = 2, .exec = bne},
+    {.mnemonic = "CMP", .addr_mode = INDIRECT_Y, .access = OPERAND_VALUE, .cycles = 5, .exec = cmp},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CMP", .addr_mode = ZERO_PAGE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = cmp},
+    {.mnemonic = "DEC", .addr_mode = ZERO_PAGE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = dec},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CLD", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = cld},
+    {.mnemonic = "CMP", .addr_mode = ABSOLUTE_Y, .access = OPERAND_VALUE, .cycles = 4, .exec = cmp},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CMP", .addr_mode = ABSOLUTE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = cmp},
+    {.mnemonic = "DEC", .addr_mode = ABSOLUTE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 7, .exec = dec},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CPX", .addr_mode = IMMEDIATE, .access = OPERAND_VALUE, .cycles = 2, .exec = cpx},
+    {.mnemonic = "SBC", .addr_mode = INDIRECT_X, .access = OPERAND_VALUE, .cycles = 6, .exec = sbc},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CPX", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = cpx},
+    {.mnemonic = "SBC", .addr_mode = ZERO_PAGE, .access = OPERAND_VALUE, .cycles = 3, .exec = sbc},
+    {.mnemonic = "INC", .addr_mode = ZERO_PAGE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 5, .exec = inc},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "INX", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = inx},
+    {.mnemonic = "SBC", .addr_mode = IMMEDIATE, .access = OPERAND_VALUE, .cycles = 2, .exec = sbc},
+    {.mnemonic = "NOP", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "CPX", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = cpx},
+    {.mnemonic = "SBC", .addr_mode = ABSOLUTE, .access = OPERAND_VALUE, .cycles = 4, .exec = sbc},
+    {.mnemonic = "INC", .addr_mode = ABSOLUTE, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = inc},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "BEQ", .addr_mode = RELATIVE, .access = OPERAND_VALUE, .cycles = 2, .exec = beq},
+    {.mnemonic = "SBC", .addr_mode = INDIRECT_Y, .access = OPERAND_VALUE, .cycles = 5, .exec = sbc},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "SBC", .addr_mode = ZERO_PAGE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = sbc},
+    {.mnemonic = "INC", .addr_mode = ZERO_PAGE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 6, .exec = inc},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "SED", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 2, .exec = sed},
+    {.mnemonic = "SBC", .addr_mode = ABSOLUTE_Y, .access = OPERAND_VALUE, .cycles = 4, .exec = sbc},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
+    {.mnemonic = "SBC", .addr_mode = ABSOLUTE_X, .access = OPERAND_VALUE, .cycles = 4, .exec = sbc},
+    {.mnemonic = "INC", .addr_mode = ABSOLUTE_X, .access = OPERAND_READ_MODIFY_WRITE, .cycles = 7, .exec = inc},
+    {.mnemonic = "???", .addr_mode = IMPLIED, .access = OPERAND_NONE, .cycles = 0, .exec = nop},
 };
 
-Cpu* build_cpu_from_mem(u8* cpu_mem) {
+Cpu* build_cpu_from_mem(u8* cpu_mem, size_t mem_size) {
    Cpu* cpu = malloc(sizeof(Cpu));
 
    cpu->cpu_state = CPU_STOPPED;
+   cpu->core = CPU_CORE_THREADED;
+   cpu->cycles = cpu->instructions_performed = 0;
+   cpu->run_end = 0;
+   cpu->irq_lines = 0;
+   cpu->bus_reads = cpu->bus_reads_avoided = 0;
+   cpu->trace = NULL;
+   cpu->decode_cache = calloc(1, sizeof(DecodeCache));
    cpu->r_a  = cpu->r_x = cpu->r_y = 0;
    cpu->r_sp = STACK_SIZE;
    cpu->mem  = cpu_mem;
-   cpu->r_pc = reset_vector(cpu_mem);
+   init_bus(&cpu->bus, cpu_mem, mem_size);
    cpu->r_sr = 0x04;
+   reset_cpu(cpu);
 
    return cpu;
 }
 
+void reset_cpu(Cpu* cpu) {
+   cpu->r_pc = reset_vector(cpu);
+}
+
+void free_cpu(Cpu* cpu) {
+    free(cpu->decode_cache);
+    free(cpu);
+}
+
+void disable_decode_cache(Cpu* cpu) {
+    free(cpu->decode_cache);
+    cpu->decode_cache = NULL;
+}
+
 size_t exec_instruction(Cpu* cpu) {
+#ifdef PYROTOBOX_TRACE
+    if (cpu->trace) {
+        trace_instruction(cpu->trace, cpu);
+    }
+#endif
     const u8 opcode = read_u8(cpu, cpu->r_pc);
     const Instruction inst = MOS_6502_INSTRUCTION_SET[opcode];
-    operand_t operand = get_operand(cpu, inst.addr_mode); 
-    disassemble(cpu, &operand, &inst);
+    operand_t operand = get_operand(cpu, inst.addr_mode, inst.access);
     cpu->r_pc += operand.bytes;
 
     inst.exec(cpu, &operand);
     return inst.cycles + operand.extra_cycles;
 }
 
-static inline u16 reset_vector(u8* cpu_mem) {
-   return read_little_endian_u16(cpu_mem[0xFFFC], cpu_mem[0xFFFD]);
+const Instruction* get_instruction(u8 opcode) {
+    return &MOS_6502_INSTRUCTION_SET[opcode];
 }
 
-static inline u16 irq_interrupt_vector(u8* cpu_mem) {
-   return read_little_endian_u16(cpu_mem[0xFFFE], cpu_mem[0xFFFF]);
+u8 get_instruction_length(u8 opcode) {
+    switch (MOS_6502_INSTRUCTION_SET[opcode].addr_mode) {
+        case IMPLIED:
+        case ACCUMULATOR:
+            return 1;
+        case ABSOLUTE:
+        case ABSOLUTE_X:
+        case ABSOLUTE_Y:
+        case INDIRECT:
+            return 3;
+        default:
+            return 2;
+    }
 }
 
-static u8 read_u8(Cpu* cpu, u16 addr) {
-    if (addr < 0x2000) {
-        // 2KB RAM is mirrored towards 1FFF in memory map.
-        const u16 masked_addr = addr & 0x07FF;
-        return cpu->mem[masked_addr];
+u64 run_cpu(Cpu* cpu, u64 cycle_budget) {
+    if (cpu->core == CPU_CORE_THREADED) {
+        return run_cpu_threaded(cpu, cycle_budget);
     }
-    //PPU Registers
-    else if (addr >= 0x2000 && addr < 0x4000) {
-        //TODO: PPU register IO should be handled as soon as PPU implementation starts
-        const u16 masked_addr = addr & 0x2007;
-        printf("PPU is not implemented yet! CPU PC: $%X\n", cpu->r_pc);
-        return cpu->mem[masked_addr];
+
+    const u64 start_cycles = cpu->cycles;
+    cpu->run_end = start_cycles + cycle_budget;
+
+    while (cpu->cycles < cpu->run_end && cpu->cpu_state == CPU_RUNNING) {
+        const size_t cycles = exec_instruction(cpu);
+
+        if (cycles == 0) {
+            printf("Invalid instruction at address $%X. Increasing pc by 1\n", cpu->r_pc);
+        }
+
+        cpu->cycles += cycles;
+        cpu->instructions_performed++;
     }
-    else return cpu->mem[addr];
+
+    return cpu->cycles - start_cycles;
 }
 
-static void write_u8(Cpu* cpu, u16 addr, u8 val) {
-    if (addr < 0x2000) {
-        // 2KB RAM is mirrored towards 1FFF in memory map.
-        const u16 masked_addr = addr & 0x07FF;
-        cpu->mem[masked_addr] = val;
+void limit_cpu_run(Cpu* cpu, u64 cycle) {
+    if (cycle < cpu->run_end) {
+        cpu->run_end = cycle;
     }
-    //PPU Registers
-    else if (addr >= 0x2000 && addr < 0x4000) {
-        //TODO: PPU register IO should be handled as soon as PPU implementation starts
-        const u16 masked_addr = addr & 0x2007;
-        cpu->mem[masked_addr] = val;
-        printf("PPU is not implemented yet! CPU PC: $%X\n", cpu->r_pc);
+}
+
+static void enter_interrupt(Cpu* cpu, u16 vector) {
+    u8 msb_pc, lsb_pc;
+    write_little_endian_u16(cpu->r_pc, &lsb_pc, &msb_pc);
+
+    // Same stack layout as BRK, without the break flag
+    push_stack(cpu, lsb_pc);
+    push_stack(cpu, msb_pc);
+    push_stack(cpu, cpu->r_sr & ~BREAK_COMMAND);
+
+    set_cpu_flag(cpu, INTERRUPT_DISABLED_FLAG, true);
+    cpu->r_pc = read_little_endian_u16(read_u8(cpu, vector), read_u8(cpu, vector + 1));
+    cpu->cycles += INTERRUPT_CYCLES;
+}
+
+void trigger_nmi(Cpu* cpu) {
+    enter_interrupt(cpu, NMI_VECTOR);
+}
+
+void set_irq_line(Cpu* cpu, IrqSource source, bool asserted) {
+    if (asserted) {
+        cpu->irq_lines |= source;
+    } else {
+        cpu->irq_lines &= ~source;
+    }
+}
+
+bool service_irq(Cpu* cpu) {
+    if (cpu->irq_lines == 0 || get_cpu_flag(cpu, INTERRUPT_DISABLED_FLAG)) {
+        return false;
     }
-    else cpu->mem[addr] = val;
+
+    enter_interrupt(cpu, IRQ_VECTOR);
+    return true;
 }
 
-static operand_t get_operand(Cpu* cpu, AddrMode addr_mode) {
+// Instructions that can clear the interrupt disable flag end the run when an IRQ is
+// pending, so the caller gets to service it.
+static inline void check_irq_window(Cpu* cpu) {
+    if (cpu->irq_lines) {
+        cpu->run_end = cpu->cycles;
+    }
+}
+
+static inline u16 reset_vector(Cpu* cpu) {
+   return read_little_endian_u16(bus_read(&cpu->bus, RESET_VECTOR), bus_read(&cpu->bus, RESET_VECTOR + 1));
+}
+
+static inline u16 irq_interrupt_vector(Cpu* cpu) {
+   return read_little_endian_u16(read_u8(cpu, IRQ_VECTOR), read_u8(cpu, IRQ_VECTOR + 1));
+}
+
+static void init_bus(Bus* bus, u8* cpu_mem, size_t mem_size) {
+    memset(bus, 0, sizeof(Bus));
+
+    // 2KB RAM is mirrored towards 1FFF in memory map, each mirror points at the same pages.
+    for (u8 mirror = 0; mirror < 4; mirror++) {
+        bus_map_memory(bus, mirror * 0x08, 0x08, cpu_mem);
+    }
+
+    // PPU, APU and I/O registers and the expansion area, the chips and the mapper map their
+    // handlers over it. A CPU on its own has nothing there.
+    bus_map_read_handler(bus, 0x20, 0x40, bus_open_read, NULL);
+    bus_map_write_handler(bus, 0x20, 0x40, bus_ignore_write, NULL);
+
+    // Cartridge space defaults to the flat memory map as far as it reaches and open bus
+    // beyond, mappers remap it as needed.
+    const u16 flat_pages = mem_size > 0x6000 ? (u16) ((mem_size - 0x6000) >> 8) : 0;
+    const u16 cartridge_pages = flat_pages < 0xA0 ? flat_pages : 0xA0;
+
+    bus_map_memory(bus, 0x60, cartridge_pages, &cpu_mem[0x6000]);
+    bus_map_read_handler(bus, 0x60 + cartridge_pages, 0xA0 - cartridge_pages, bus_open_read, NULL);
+    bus_map_write_handler(bus, 0x60 + cartridge_pages, 0xA0 - cartridge_pages, bus_ignore_write, NULL);
+}
+
+static operand_t get_operand(Cpu* cpu, AddrMode addr_mode, OperandAccess access) {
     operand_t operand = {.val = 0x00, .extra_cycles = 0x00, .bytes = 0, .addr_mode = addr_mode, .addr = 0x0000};
     
     switch (addr_mode) {
         case IMPLIED:
             operand.bytes = 1;
-            break;
+            return operand;
         case ACCUMULATOR:
             operand.val = cpu->r_a;
             operand.bytes = 1;
-            break;
+            return operand;
         case IMMEDIATE:
             operand.addr = cpu->r_pc + 1;
-            operand.val = read_u8(cpu, cpu->r_pc + 1);
             operand.bytes = 2;
             break; 
         case ZERO_PAGE:
             operand.addr = read_u8(cpu, cpu->r_pc + 1);
-            operand.val = read_u8(cpu, operand.addr);
             operand.bytes = 2;
             break; 
         case ZERO_PAGE_X: {
             const u16 zp_addr = read_u8(cpu, cpu->r_pc + 1);
             operand.addr = (zp_addr + cpu->r_x) & 0x00FF;
-            operand.val = read_u8(cpu, operand.addr);
             operand.bytes = 2;
             break; 
        }
         case ZERO_PAGE_Y: {
             const u16 zp_addr = read_u8(cpu, cpu->r_pc + 1);
             operand.addr = (zp_addr + cpu->r_y) & 0x00FF;
-            operand.val = read_u8(cpu, operand.addr);
             operand.bytes = 2;
             break; 
        }
         case RELATIVE: 
             operand.val = read_u8(cpu, cpu->r_pc + 1);
             // Relative offsetting will be handled inside of branch instructions
-            break;
+            return operand;
         case ABSOLUTE: {
             const u8 msb = read_u8(cpu, cpu->r_pc + 2);
             const u8 lsb = read_u8(cpu, cpu->r_pc + 1);
             const u16 addr = read_little_endian_u16(lsb, msb);
             operand.addr = addr;
-            operand.val = read_u8(cpu, addr);
             operand.bytes = 3;
             break;
         }
@@ -457,7 +560,6 @@ static operand_t get_operand(Cpu* cpu, AddrMode addr_mode) {
             const u8 lsb = read_u8(cpu, cpu->r_pc + 1);
             const u16 addr = read_little_endian_u16(lsb, msb) + cpu->r_x;
             operand.addr = addr & 0xFFFF;
-            operand.val = read_u8(cpu, addr);
             //If the page changes then we should increase the instruction cycle by 1
             operand.extra_cycles = msb != ((addr >> 8) & 0xFF) ? 1 : 0;
             operand.bytes = 3;
@@ -468,7 +570,6 @@ static operand_t get_operand(Cpu* cpu, AddrMode addr_mode) {
             const u8 lsb = read_u8(cpu, cpu->r_pc + 1);
             const u16 addr = read_little_endian_u16(lsb, msb) + cpu->r_y;
             operand.addr = addr & 0xFFFF;
-            operand.val = read_u8(cpu, addr);
 
             //If the page changes then we should increase the instruction cycle by 1
             operand.extra_cycles = msb != ((addr >> 8) & 0xFF) ? 1 : 0;
@@ -481,7 +582,6 @@ static operand_t get_operand(Cpu* cpu, AddrMode addr_mode) {
             const u8 msb = read_u8(cpu, lsb_addr + 1);
             const u16 addr = read_little_endian_u16(lsb, msb);
             operand.addr = addr;
-            operand.val = read_u8(cpu, operand.addr);
             operand.bytes = 3;
             break;
         }
@@ -491,7 +591,6 @@ static operand_t get_operand(Cpu* cpu, AddrMode addr_mode) {
             const u8 msb = read_u8(cpu, lsb_addr + 1);
             const u16 addr = read_little_endian_u16(lsb, msb);
             operand.addr = addr;
-            operand.val = read_u8(cpu, addr);
             operand.bytes = 2;
             break;
         }
@@ -501,60 +600,22 @@ static operand_t get_operand(Cpu* cpu, AddrMode addr_mode) {
             const u8 msb = read_u8(cpu, lsb_addr + 1);
             u16 addr = (read_little_endian_u16(lsb, msb) + cpu->r_y) & 0xFFFF;
             operand.addr = addr;
-            operand.val = read_u8(cpu, addr);
             operand.extra_cycles = msb != ((addr >> 8) & 0xFF) ? 1 : 0;
             operand.bytes = 2;
             break;
         }
 
     }
-    return operand;
-}
 
-static void disassemble(const Cpu* cpu, const operand_t* operand, const Instruction* inst) {
-    printf("$%X:\t%s  ", cpu->r_pc, inst->mnemonic);
-
-    switch (operand->addr_mode) {
-        case IMPLIED:
-            printf("\n");
-            break;
-        case ACCUMULATOR:
-            printf("A\n");
-            break;
-        case IMMEDIATE:
-            printf("#%X\n", operand->val);
-            break;
-        case ZERO_PAGE:
-            printf("$%X\n", operand->addr);
-            break;
-        case ZERO_PAGE_X:
-            printf("$%X, X\n", operand->addr - cpu->r_x);
-            break;
-        case ZERO_PAGE_Y:
-            printf("$%X, Y\n", operand->addr - cpu->r_y);
-            break;
-        case RELATIVE:
-            printf("$%X\n", cpu->r_pc + ((i8)operand->val) + 2);
-            break;
-        case ABSOLUTE:
-            printf("$%X\n", operand->addr);
-            break;
-        case ABSOLUTE_X:
-            printf("$%X, X\n", operand->addr - cpu->r_x);
-            break;
-        case ABSOLUTE_Y:
-            printf("$%X, Y\n", operand->addr - cpu->r_y);
-            break;
-        case INDIRECT:
-            printf("($%X)\n", operand->addr);
-            break;
-        case INDIRECT_X:
-            printf("($%X, X)\n", operand->val);
-            break;
-        case INDIRECT_Y:
-            printf("($%X, Y)\n", operand->val);
-            break;
+    // Stores and jumps only need the effective address. Skipping the value read saves
+    // a bus access and keeps read side effects of I/O registers from being triggered.
+    if (access == OPERAND_ADDRESS) {
+        cpu->bus_reads_avoided++;
+    } else {
+        operand.val = read_u8(cpu, operand.addr);
     }
+
+    return operand;
 }
 
 // 6502 INSTRUCTION IMPLEMENTATIONS
@@ -596,7 +657,7 @@ static void asl(Cpu* cpu, operand_t* operand) {
 
 static void bcc(Cpu* cpu, operand_t* operand) {
     if (get_cpu_flag(cpu, CARRY_FLAG) == 0) {
-        const i8 relative_val = read_u8(cpu, cpu->r_pc + 1);
+        const i8 relative_val = operand->val;
         const u8 msb = (cpu->r_pc >> 8) & 0x00FF;
         cpu->r_pc += relative_val + 2;
         operand->extra_cycles = msb != ((cpu->r_pc >> 8) & 0xFF) ? 2 : 1;
@@ -607,7 +668,7 @@ static void bcc(Cpu* cpu, operand_t* operand) {
 
 static void bcs(Cpu* cpu, operand_t* operand) {
     if (get_cpu_flag(cpu, CARRY_FLAG) == 1) {
-        const i8 relative_val = read_u8(cpu, cpu->r_pc + 1);
+        const i8 relative_val = operand->val;
         const u8 msb = (cpu->r_pc >> 8) & 0x00FF;
         cpu->r_pc += relative_val + 2;
         operand->extra_cycles = msb != ((cpu->r_pc >> 8) & 0xFF) ? 2 : 1;
@@ -619,7 +680,7 @@ static void bcs(Cpu* cpu, operand_t* operand) {
 
 static void beq(Cpu* cpu, operand_t* operand) {
     if (get_cpu_flag(cpu, ZERO_FLAG) == 1) {
-        const i8 relative_val = read_u8(cpu, cpu->r_pc + 1);
+        const i8 relative_val = operand->val;
         const u8 msb = (cpu->r_pc >> 8) & 0x00FF;
         cpu->r_pc += relative_val + 2;
         operand->extra_cycles = msb != ((cpu->r_pc >> 8) & 0xFF) ? 2 : 1;
@@ -639,7 +700,7 @@ static void bit(Cpu* cpu, operand_t* operand) {
 
 static void bmi(Cpu* cpu, operand_t* operand) {
     if (get_cpu_flag(cpu, NEGATIVE_FLAG) == 1) {
-        const i8 relative_val = read_u8(cpu, cpu->r_pc + 1);
+        const i8 relative_val = operand->val;
         const u8 msb = (cpu->r_pc >> 8) & 0x00FF;
         cpu->r_pc += relative_val + 2;
         operand->extra_cycles = msb != ((cpu->r_pc >> 8) & 0xFF) ? 2 : 1;
@@ -651,7 +712,7 @@ static void bmi(Cpu* cpu, operand_t* operand) {
 
 static void bne(Cpu* cpu, operand_t* operand) {
     if (get_cpu_flag(cpu, ZERO_FLAG) == 0) {
-        const i8 relative_val = read_u8(cpu, cpu->r_pc + 1);
+        const i8 relative_val = operand->val;
         const u8 msb = (cpu->r_pc >> 8) & 0x00FF;
         cpu->r_pc += relative_val + 2;
         operand->extra_cycles = msb != ((cpu->r_pc >> 8) & 0xFF) ? 2 : 1;
@@ -663,7 +724,7 @@ static void bne(Cpu* cpu, operand_t* operand) {
 
 static void bpl(Cpu* cpu, operand_t* operand) {
     if (get_cpu_flag(cpu, NEGATIVE_FLAG) == 0) {
-        const i8 relative_val = read_u8(cpu, cpu->r_pc + 1);
+        const i8 relative_val = operand->val;
         const u8 msb = (cpu->r_pc >> 8) & 0x00FF;
         cpu->r_pc += relative_val + 2;
         operand->extra_cycles = msb != ((cpu->r_pc >> 8) & 0xFF) ? 2 : 1;
@@ -683,12 +744,12 @@ static void brk(Cpu* cpu, operand_t __attribute__((__unused__)) *operand) {
     push_stack(cpu, cpu->r_sr);
 
     set_cpu_flag(cpu, BREAK_COMMAND, true);
-    cpu->r_pc = irq_interrupt_vector(cpu->mem);
+    cpu->r_pc = irq_interrupt_vector(cpu);
 }
 
 static void bvc(Cpu* cpu, operand_t* operand) {
     if (get_cpu_flag(cpu, OVERFLOW_FLAG) == 0) {
-        const i8 relative_val = read_u8(cpu, cpu->r_pc + 1);
+        const i8 relative_val = operand->val;
         const u8 msb = (cpu->r_pc >> 8) & 0x00FF;
         cpu->r_pc += relative_val + 2;
         operand->extra_cycles = msb != ((cpu->r_pc >> 8) & 0xFF) ? 2 : 1;
@@ -700,7 +761,7 @@ static void bvc(Cpu* cpu, operand_t* operand) {
 
 static void bvs(Cpu* cpu, operand_t* operand) {
     if (get_cpu_flag(cpu, OVERFLOW_FLAG) == 1) {
-        const i8 relative_val = read_u8(cpu, cpu->r_pc + 1);
+        const i8 relative_val = operand->val;
         const u8 msb = (cpu->r_pc >> 8) & 0x00FF;
         cpu->r_pc += relative_val + 2;
         operand->extra_cycles = msb != ((cpu->r_pc >> 8) & 0xFF) ? 2 : 1;
@@ -720,6 +781,7 @@ static inline void cld(Cpu* cpu, operand_t __attribute__((__unused__)) *operand)
 
 static inline void cli(Cpu* cpu, operand_t __attribute__((__unused__)) *operand) {
     set_cpu_flag(cpu, INTERRUPT_DISABLED_FLAG, false);
+    check_irq_window(cpu);
 }
 
 static inline void clv(Cpu* cpu, operand_t __attribute__((__unused__)) *operand) {
@@ -879,6 +941,7 @@ static void pla(Cpu* cpu, operand_t __attribute__((__unused__)) *operand) {
 
 static inline void plp(Cpu* cpu, operand_t __attribute__((__unused__)) *operand) {
     cpu->r_sr = pop_stack(cpu);
+    check_irq_window(cpu);
 }
 
 static void rol(Cpu* cpu, operand_t* operand) {
@@ -918,10 +981,12 @@ static void ror(Cpu* cpu, operand_t* operand) {
 static void rti(Cpu* cpu, operand_t __attribute__((__unused__)) *operand) {
     u8 msb_pc = 0, lsb_pc = 0;
 
+    cpu->r_sr = pop_stack(cpu);
     msb_pc = pop_stack(cpu);
     lsb_pc = pop_stack(cpu);
 
     cpu->r_pc = read_little_endian_u16(lsb_pc, msb_pc);
+    check_irq_window(cpu);
 }
 
 static void rts(Cpu* cpu, operand_t __attribute__((__unused__)) *operand) {
@@ -2,9 +2,19 @@
 #define CPU_H
 #define STACK_SIZE 0xFF
 #define STACK_ADDR_OFFSET 0x0100
+#define NMI_VECTOR 0xFFFA
+#define RESET_VECTOR 0xFFFC
+#define IRQ_VECTOR 0xFFFE
+#define INTERRUPT_CYCLES 7
+
+// The decode cache covers the PRG-ROM window
+#define DECODE_CACHE_BASE 0x8000
+#define DECODE_CACHE_SIZE 0x8000
 
 #include "types.h"
+#include "bus.h"
 #include <stdlib.h>
+#include <stdbool.h>
 
 typedef enum CpuState {
     CPU_STOPPED,
@@ -12,6 +22,13 @@ typedef enum CpuState {
     CPU_RUNNING
 } CpuState;
 
+typedef enum CpuCore {
+    // Table-driven core kept as the reference implementation
+    CPU_CORE_REFERENCE,
+    // Per-opcode handlers dispatched via threaded code (see cpu_threaded.c)
+    CPU_CORE_THREADED
+} CpuCore;
+
 typedef enum AddrMode {
     IMPLIED,
     ACCUMULATOR,
@@ -28,6 +45,19 @@ typedef enum AddrMode {
     INDIRECT_Y
 } AddrMode;
 
+// Which form of the operand an instruction consumes, so that operand decoding only
+// performs the bus reads the instruction actually needs.
+typedef enum OperandAccess {
+    // Implied instructions, nothing to fetch
+    OPERAND_NONE,
+    // Stores and jumps, only the effective address is needed
+    OPERAND_ADDRESS,
+    // Loads, arithmetic and compares read the value at the effective address
+    OPERAND_VALUE,
+    // Shifts, rotates, INC and DEC read the value and write the result back
+    OPERAND_READ_MODIFY_WRITE
+} OperandAccess;
+
 typedef struct operand_t {
     u8 val;
     u8 extra_cycles;
@@ -47,6 +77,33 @@ typedef enum StatusFlag {
     NEGATIVE_FLAG = (1 << 7),
 } StatusFlag;
 
+// Devices that can hold the (level triggered) IRQ line low
+typedef enum IrqSource {
+    IRQ_APU_FRAME = (1 << 0),
+    IRQ_APU_DMC = (1 << 1),
+    IRQ_MAPPER = (1 << 2)
+} IrqSource;
+
+// An instruction decoded from a ROM page. The opcode selects the handler of the threaded
+// core, the base cycles are part of the handler itself.
+typedef struct DecodedInstruction {
+    // Bus page generation the entry was decoded from, 0 when the entry is empty
+    u32 generation;
+    u8 opcode;
+    u8 operands[2];
+    u8 length;
+} DecodedInstruction;
+
+typedef struct DecodeCache {
+    DecodedInstruction entries[DECODE_CACHE_SIZE];
+    u64 hits;
+    // Decodes from ROM pages that filled an entry
+    u64 misses;
+    // Decodes from RAM, I/O or across a page boundary, which are never cached
+    u64 uncached;
+    u64 bus_reads_saved;
+} DecodeCache;
+
 typedef struct Cpu {
     u8 r_x;
     u8 r_y;
@@ -54,20 +111,67 @@ typedef struct Cpu {
     u8 r_sp;
     u8 r_sr;
     u8* mem;
+    Bus bus;
     CpuState cpu_state;
+    CpuCore core;
     u16 r_pc;
     u64 cycles;
+    // run_cpu returns once cycles reaches this, see limit_cpu_run
+    u64 run_end;
+    // IrqSource bits of the devices currently asserting IRQ
+    u8 irq_lines;
     u64 instructions_performed;
+    u64 bus_reads;
+    // Operand reads skipped because the instruction only needed the effective address
+    u64 bus_reads_avoided;
+    // Execution trace, only consulted when built with PYROTOBOX_TRACE
+    struct TraceBuffer* trace;
+    // Predecoded instructions of the threaded core, NULL when disabled
+    DecodeCache* decode_cache;
 } Cpu;
 
 typedef struct Instruction {
     char mnemonic[3];
     AddrMode addr_mode;
+    OperandAccess access;
     size_t cycles;
     void (*exec)(Cpu* cpu, operand_t* operand);
 } Instruction;
 
-Cpu* build_cpu_from_mem(u8* cpu_mem);
+// cpu_mem backs the address space from $0000 for mem_size bytes, cartridge pages beyond
+// it read as open bus until a mapper maps them
+Cpu* build_cpu_from_mem(u8* cpu_mem, size_t mem_size);
+// Loads the PC from the reset vector, done again once the cartridge is mapped
+void reset_cpu(Cpu* cpu);
+void free_cpu(Cpu* cpu);
+void disable_decode_cache(Cpu* cpu);
 size_t exec_instruction(Cpu* cpu);
 
+// Instruction metadata, used by the tracer and the disassembler
+const Instruction* get_instruction(u8 opcode);
+u8 get_instruction_length(u8 opcode);
+
+// Runs instructions on the selected core until at least cycle_budget cycles have passed
+// or the CPU leaves the running state. Returns the number of cycles executed.
+u64 run_cpu(Cpu* cpu, u64 cycle_budget);
+u64 run_cpu_threaded(Cpu* cpu, u64 cycle_budget);
+// Makes the current run_cpu call return once the CPU reaches the given cycle
+void limit_cpu_run(Cpu* cpu, u64 cycle);
+
+// Interrupts are taken between runs, the caller is expected to stop the CPU (see
+// limit_cpu_run) when one becomes pending.
+void trigger_nmi(Cpu* cpu);
+void set_irq_line(Cpu* cpu, IrqSource source, bool asserted);
+// Enters the IRQ handler if any line is asserted and interrupts are enabled
+bool service_irq(Cpu* cpu);
+
+static inline u8 read_u8(Cpu* cpu, u16 addr) {
+    cpu->bus_reads++;
+    return bus_read(&cpu->bus, addr);
+}
+
+static inline void write_u8(Cpu* cpu, u16 addr, u8 val) {
+    bus_write(&cpu->bus, addr, val);
+}
+
 #endif
@@ -0,0 +1,840 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu_batch.h"
+#include "utils.h"
+
+// The kernels are written against a handful of byte-wise vector operations, one lane per
+// byte. The instruction set is picked at compile time, AVX2 needs a build for a CPU that
+// has it (e.g. -DPYROTOBOX_NATIVE_ARCH=ON).
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+#define LANE_VEC_WIDTH 32
+#define LANE_VEC_ISA "avx2"
+
+typedef __m256i LaneVec;
+
+static inline LaneVec vec_load(const u8* p) { return _mm256_loadu_si256((const __m256i*) p); }
+static inline void vec_store(u8* p, LaneVec v) { _mm256_storeu_si256((__m256i*) p, v); }
+static inline LaneVec vec_set1(u8 v) { return _mm256_set1_epi8((char) v); }
+static inline LaneVec vec_and(LaneVec a, LaneVec b) { return _mm256_and_si256(a, b); }
+static inline LaneVec vec_or(LaneVec a, LaneVec b) { return _mm256_or_si256(a, b); }
+static inline LaneVec vec_xor(LaneVec a, LaneVec b) { return _mm256_xor_si256(a, b); }
+// ~a & b
+static inline LaneVec vec_andnot(LaneVec a, LaneVec b) { return _mm256_andnot_si256(a, b); }
+static inline LaneVec vec_add(LaneVec a, LaneVec b) { return _mm256_add_epi8(a, b); }
+static inline LaneVec vec_sub(LaneVec a, LaneVec b) { return _mm256_sub_epi8(a, b); }
+static inline LaneVec vec_cmpeq(LaneVec a, LaneVec b) { return _mm256_cmpeq_epi8(a, b); }
+static inline LaneVec vec_max(LaneVec a, LaneVec b) { return _mm256_max_epu8(a, b); }
+// 0xFF where bit 7 is set
+static inline LaneVec vec_sign(LaneVec a) { return _mm256_cmpgt_epi8(_mm256_setzero_si256(), a); }
+static inline LaneVec vec_shr1(LaneVec a) { return _mm256_and_si256(_mm256_srli_epi16(a, 1), vec_set1(0x7F)); }
+static inline bool vec_any(LaneVec a) { return _mm256_movemask_epi8(a) != 0; }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+
+#define LANE_VEC_WIDTH 16
+#define LANE_VEC_ISA "sse2"
+
+typedef __m128i LaneVec;
+
+static inline LaneVec vec_load(const u8* p) { return _mm_loadu_si128((const __m128i*) p); }
+static inline void vec_store(u8* p, LaneVec v) { _mm_storeu_si128((__m128i*) p, v); }
+static inline LaneVec vec_set1(u8 v) { return _mm_set1_epi8((char) v); }
+static inline LaneVec vec_and(LaneVec a, LaneVec b) { return _mm_and_si128(a, b); }
+static inline LaneVec vec_or(LaneVec a, LaneVec b) { return _mm_or_si128(a, b); }
+static inline LaneVec vec_xor(LaneVec a, LaneVec b) { return _mm_xor_si128(a, b); }
+// ~a & b
+static inline LaneVec vec_andnot(LaneVec a, LaneVec b) { return _mm_andnot_si128(a, b); }
+static inline LaneVec vec_add(LaneVec a, LaneVec b) { return _mm_add_epi8(a, b); }
+static inline LaneVec vec_sub(LaneVec a, LaneVec b) { return _mm_sub_epi8(a, b); }
+static inline LaneVec vec_cmpeq(LaneVec a, LaneVec b) { return _mm_cmpeq_epi8(a, b); }
+static inline LaneVec vec_max(LaneVec a, LaneVec b) { return _mm_max_epu8(a, b); }
+// 0xFF where bit 7 is set
+static inline LaneVec vec_sign(LaneVec a) { return _mm_cmplt_epi8(a, _mm_setzero_si128()); }
+static inline LaneVec vec_shr1(LaneVec a) { return _mm_and_si128(_mm_srli_epi16(a, 1), vec_set1(0x7F)); }
+static inline bool vec_any(LaneVec a) { return _mm_movemask_epi8(a) != 0; }
+
+#else
+
+#define LANE_VEC_WIDTH 16
+#define LANE_VEC_ISA "scalar"
+
+// Plain loops for targets without SSE2, the compiler may still vectorize them
+typedef struct LaneVec {
+    u8 b[LANE_VEC_WIDTH];
+} LaneVec;
+
+#define LANE_VEC_MAP(expr) \
+    LaneVec r; \
+    for (int i = 0; i < LANE_VEC_WIDTH; i++) { \
+        r.b[i] = (expr); \
+    } \
+    return r
+
+static inline LaneVec vec_load(const u8* p) { LaneVec r; memcpy(r.b, p, LANE_VEC_WIDTH); return r; }
+static inline void vec_store(u8* p, LaneVec v) { memcpy(p, v.b, LANE_VEC_WIDTH); }
+static inline LaneVec vec_set1(u8 v) { LANE_VEC_MAP(v); }
+static inline LaneVec vec_and(LaneVec a, LaneVec b) { LANE_VEC_MAP(a.b[i] & b.b[i]); }
+static inline LaneVec vec_or(LaneVec a, LaneVec b) { LANE_VEC_MAP(a.b[i] | b.b[i]); }
+static inline LaneVec vec_xor(LaneVec a, LaneVec b) { LANE_VEC_MAP(a.b[i] ^ b.b[i]); }
+static inline LaneVec vec_andnot(LaneVec a, LaneVec b) { LANE_VEC_MAP(~a.b[i] & b.b[i]); }
+static inline LaneVec vec_add(LaneVec a, LaneVec b) { LANE_VEC_MAP(a.b[i] + b.b[i]); }
+static inline LaneVec vec_sub(LaneVec a, LaneVec b) { LANE_VEC_MAP(a.b[i] - b.b[i]); }
+static inline LaneVec vec_cmpeq(LaneVec a, LaneVec b) { LANE_VEC_MAP(a.b[i] == b.b[i] ? 0xFF : 0x00); }
+static inline LaneVec vec_max(LaneVec a, LaneVec b) { LANE_VEC_MAP(a.b[i] > b.b[i] ? a.b[i] : b.b[i]); }
+static inline LaneVec vec_sign(LaneVec a) { LANE_VEC_MAP(a.b[i] & 0x80 ? 0xFF : 0x00); }
+static inline LaneVec vec_shr1(LaneVec a) { LANE_VEC_MAP(a.b[i] >> 1); }
+
+static inline bool vec_any(LaneVec a) {
+    for (int i = 0; i < LANE_VEC_WIDTH; i++) {
+        if (a.b[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif
+
+static inline LaneVec vec_blend(LaneVec mask, LaneVec new_val, LaneVec old_val) {
+    return vec_or(vec_and(mask, new_val), vec_andnot(mask, old_val));
+}
+
+// Bit 7 moved to bit 0, i.e. the carry out of a shift left
+static inline LaneVec vec_bit7(LaneVec a) {
+    return vec_and(vec_sign(a), vec_set1(0x01));
+}
+
+typedef enum BatchKernel {
+    KERNEL_NONE,
+    KERNEL_LDA, KERNEL_LDX, KERNEL_LDY,
+    KERNEL_STA, KERNEL_STX, KERNEL_STY,
+    KERNEL_ADC, KERNEL_SBC, KERNEL_AND, KERNEL_ORA, KERNEL_EOR, KERNEL_BIT,
+    KERNEL_CMP, KERNEL_CPX, KERNEL_CPY,
+    KERNEL_TAX, KERNEL_TAY, KERNEL_TXA, KERNEL_TYA, KERNEL_TSX, KERNEL_TXS,
+    KERNEL_INX, KERNEL_INY, KERNEL_DEX, KERNEL_DEY,
+    KERNEL_ASL, KERNEL_LSR, KERNEL_ROL, KERNEL_ROR,
+    KERNEL_CLC, KERNEL_SEC, KERNEL_CLV, KERNEL_CLD, KERNEL_SED, KERNEL_NOP,
+    KERNEL_BPL, KERNEL_BMI, KERNEL_BVC, KERNEL_BVS, KERNEL_BCC, KERNEL_BCS, KERNEL_BNE, KERNEL_BEQ,
+    KERNEL_JMP
+} BatchKernel;
+
+enum {
+    PAGE_SHARING_UNKNOWN,
+    PAGE_SHARING_SHARED,
+    PAGE_SHARING_PRIVATE
+};
+
+typedef struct KernelMnemonic {
+    char mnemonic[3];
+    BatchKernel kernel;
+} KernelMnemonic;
+
+static const KernelMnemonic KERNEL_MNEMONICS[] = {
+    {"LDA", KERNEL_LDA}, {"LDX", KERNEL_LDX}, {"LDY", KERNEL_LDY},
+    {"STA", KERNEL_STA}, {"STX", KERNEL_STX}, {"STY", KERNEL_STY},
+    {"ADC", KERNEL_ADC}, {"SBC", KERNEL_SBC}, {"AND", KERNEL_AND},
+    {"ORA", KERNEL_ORA}, {"EOR", KERNEL_EOR}, {"BIT", KERNEL_BIT},
+    {"CMP", KERNEL_CMP}, {"CPX", KERNEL_CPX}, {"CPY", KERNEL_CPY},
+    {"TAX", KERNEL_TAX}, {"TAY", KERNEL_TAY}, {"TXA", KERNEL_TXA},
+    {"TYA", KERNEL_TYA}, {"TSX", KERNEL_TSX}, {"TXS", KERNEL_TXS},
+    {"INX", KERNEL_INX}, {"INY", KERNEL_INY}, {"DEX", KERNEL_DEX}, {"DEY", KERNEL_DEY},
+    {"ASL", KERNEL_ASL}, {"LSR", KERNEL_LSR}, {"ROL", KERNEL_ROL}, {"ROR", KERNEL_ROR},
+    {"CLC", KERNEL_CLC}, {"SEC", KERNEL_SEC}, {"CLV", KERNEL_CLV},
+    {"CLD", KERNEL_CLD}, {"SED", KERNEL_SED}, {"NOP", KERNEL_NOP},
+    {"BPL", KERNEL_BPL}, {"BMI", KERNEL_BMI}, {"BVC", KERNEL_BVC}, {"BVS", KERNEL_BVS},
+    {"BCC", KERNEL_BCC}, {"BCS", KERNEL_BCS}, {"BNE", KERNEL_BNE}, {"BEQ", KERNEL_BEQ},
+    {"JMP", KERNEL_JMP},
+};
+
+#define KERNEL_MNEMONIC_COUNT (sizeof(KERNEL_MNEMONICS) / sizeof(KERNEL_MNEMONICS[0]))
+
+// Indirect modes and read-modify-write on memory stay scalar
+static bool has_vector_addressing(const Instruction* inst) {
+    switch (inst->addr_mode) {
+        case IMPLIED:
+        case ACCUMULATOR:
+        case RELATIVE:
+        case IMMEDIATE:
+            return true;
+        case ZERO_PAGE:
+        case ZERO_PAGE_X:
+        case ZERO_PAGE_Y:
+        case ABSOLUTE:
+        case ABSOLUTE_X:
+        case ABSOLUTE_Y:
+            return inst->access != OPERAND_READ_MODIFY_WRITE;
+        default:
+            return false;
+    }
+}
+
+static inline bool is_store_kernel(BatchKernel kernel) {
+    return kernel == KERNEL_STA || kernel == KERNEL_STX || kernel == KERNEL_STY;
+}
+
+static inline bool is_branch_kernel(BatchKernel kernel) {
+    return kernel >= KERNEL_BPL && kernel <= KERNEL_BEQ;
+}
+
+CpuBatch* build_cpu_batch(Cpu** cpus, size_t count) {
+    CpuBatch* batch = calloc(1, sizeof(CpuBatch));
+    const size_t lanes = (count + LANE_VEC_WIDTH - 1) / LANE_VEC_WIDTH * LANE_VEC_WIDTH;
+
+    batch->count = count;
+    batch->lanes = lanes;
+    batch->cpus = malloc(count * sizeof(Cpu*));
+    memcpy(batch->cpus, cpus, count * sizeof(Cpu*));
+
+    batch->r_a = calloc(lanes, 1);
+    batch->r_x = calloc(lanes, 1);
+    batch->r_y = calloc(lanes, 1);
+    batch->r_sp = calloc(lanes, 1);
+    batch->r_sr = calloc(lanes, 1);
+    batch->r_pc = calloc(lanes, sizeof(u16));
+    batch->cycles_left = calloc(lanes, sizeof(i32));
+    batch->instructions = calloc(lanes, sizeof(u32));
+    batch->running = calloc(lanes, 1);
+    batch->group = calloc(lanes, 1);
+    batch->operand = calloc(lanes, 1);
+    batch->extra_cycles = calloc(lanes, 1);
+    batch->taken = calloc(lanes, 1);
+    batch->scalar_lanes = calloc(lanes, sizeof(size_t));
+
+    for (u16 opcode = 0; opcode < 0x100; opcode++) {
+        const Instruction* inst = get_instruction(opcode);
+        batch->kernels[opcode] = KERNEL_NONE;
+
+        for (size_t i = 0; i < KERNEL_MNEMONIC_COUNT && has_vector_addressing(inst); i++) {
+            if (memcmp(inst->mnemonic, KERNEL_MNEMONICS[i].mnemonic, 3) == 0) {
+                batch->kernels[opcode] = KERNEL_MNEMONICS[i].kernel;
+                break;
+            }
+        }
+    }
+
+    return batch;
+}
+
+void free_cpu_batch(CpuBatch* batch) {
+    free(batch->cpus);
+    free(batch->r_a);
+    free(batch->r_x);
+    free(batch->r_y);
+    free(batch->r_sp);
+    free(batch->r_sr);
+    free(batch->r_pc);
+    free(batch->cycles_left);
+    free(batch->instructions);
+    free(batch->running);
+    free(batch->group);
+    free(batch->operand);
+    free(batch->extra_cycles);
+    free(batch->taken);
+    free(batch->scalar_lanes);
+    free(batch);
+}
+
+const char* cpu_batch_vector_isa(void) {
+    return LANE_VEC_ISA;
+}
+
+static void load_lane(CpuBatch* batch, size_t lane) {
+    const Cpu* cpu = batch->cpus[lane];
+
+    batch->r_a[lane] = cpu->r_a;
+    batch->r_x[lane] = cpu->r_x;
+    batch->r_y[lane] = cpu->r_y;
+    batch->r_sp[lane] = cpu->r_sp;
+    batch->r_sr[lane] = cpu->r_sr;
+    batch->r_pc[lane] = cpu->r_pc;
+    // run_end can be behind the cycle counter, e.g. after an IRQ window closed the run
+    batch->cycles_left[lane] = (i32) (cpu->run_end - cpu->cycles);
+    batch->running[lane] = batch->cycles_left[lane] > 0 && cpu->cpu_state == CPU_RUNNING ? 0xFF : 0x00;
+}
+
+static void store_lane(CpuBatch* batch, size_t lane) {
+    Cpu* cpu = batch->cpus[lane];
+
+    cpu->r_a = batch->r_a[lane];
+    cpu->r_x = batch->r_x[lane];
+    cpu->r_y = batch->r_y[lane];
+    cpu->r_sp = batch->r_sp[lane];
+    cpu->r_sr = batch->r_sr[lane];
+    cpu->r_pc = batch->r_pc[lane];
+    cpu->cycles = cpu->run_end - batch->cycles_left[lane];
+}
+
+// One instruction of one lane on the reference core, with the same bookkeeping as run_cpu
+static void scalar_step(CpuBatch* batch, size_t lane) {
+    Cpu* cpu = batch->cpus[lane];
+
+    const u32 bus_generation = cpu->bus.generation;
+    store_lane(batch, lane);
+    const size_t cycles = exec_instruction(cpu);
+
+    // A mapper may have switched banks
+    if (cpu->bus.generation != bus_generation) {
+        memset(batch->page_sharing, PAGE_SHARING_UNKNOWN, sizeof(batch->page_sharing));
+    }
+
+    if (cycles == 0) {
+        printf("Invalid instruction at address $%X. Increasing pc by 1\n", cpu->r_pc);
+    }
+
+    cpu->cycles += cycles;
+    cpu->instructions_performed++;
+    load_lane(batch, lane);
+    batch->stats.scalar_instructions++;
+}
+
+// Instruction bytes at pc, only from directly mapped pages
+static bool fetch_code(const Bus* bus, u16 pc, u8 length, u8* code) {
+    for (u8 i = 0; i < length; i++) {
+        const u16 addr = pc + i;
+        const u8* page = bus->read_pages[addr >> 8];
+
+        if (!page) {
+            return false;
+        }
+
+        code[i] = page[addr & 0xFF];
+    }
+
+    return true;
+}
+
+static inline u16 effective_address(AddrMode addr_mode, const u8* code, u8 x, u8 y, u8* extra_cycles) {
+    const u16 absolute = read_little_endian_u16(code[1], code[2]);
+    *extra_cycles = 0;
+
+    switch (addr_mode) {
+        case ZERO_PAGE:
+            return code[1];
+        case ZERO_PAGE_X:
+            return (code[1] + x) & 0xFF;
+        case ZERO_PAGE_Y:
+            return (code[1] + y) & 0xFF;
+        case ABSOLUTE_X: {
+            const u16 addr = absolute + x;
+            *extra_cycles = (addr >> 8) != code[2];
+            return addr;
+        }
+        case ABSOLUTE_Y: {
+            const u16 addr = absolute + y;
+            *extra_cycles = (addr >> 8) != code[2];
+            return addr;
+        }
+        default:
+            return absolute;
+    }
+}
+
+static inline bool is_memory_mode(AddrMode addr_mode) {
+    switch (addr_mode) {
+        case ZERO_PAGE:
+        case ZERO_PAGE_X:
+        case ZERO_PAGE_Y:
+        case ABSOLUTE:
+        case ABSOLUTE_X:
+        case ABSOLUTE_Y:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Resolves the memory operand of a lane in the vector group. Stores are performed right away,
+// they do not depend on anything the kernel computes. Returns false when the access hits
+// an I/O handler, the lane then has to go through the scalar path.
+static bool prepare_lane(CpuBatch* batch, size_t lane, BatchKernel kernel, const Instruction* inst, const u8* code) {
+    const Bus* bus = &batch->cpus[lane]->bus;
+    u8 extra_cycles;
+    const u16 addr = effective_address(inst->addr_mode, code, batch->r_x[lane], batch->r_y[lane], &extra_cycles);
+
+    if (is_store_kernel(kernel)) {
+        u8* page = bus->write_pages[addr >> 8];
+
+        if (!page) {
+            return false;
+        }
+
+        page[addr & 0xFF] = kernel == KERNEL_STA ? batch->r_a[lane]
+            : kernel == KERNEL_STX ? batch->r_x[lane] : batch->r_y[lane];
+    } else {
+        const u8* page = bus->read_pages[addr >> 8];
+
+        if (!page) {
+            return false;
+        }
+
+        batch->operand[lane] = page[addr & 0xFF];
+    }
+
+    batch->extra_cycles[lane] = extra_cycles;
+    return true;
+}
+
+typedef struct GroupRetirement {
+    u16 next_pc;
+    u16 target;
+    u8 cycles;
+    u8 taken_cycles;
+    bool branch;
+    // Whether extra_cycles holds page crossing penalties of the lanes
+    bool extra_cycles;
+} GroupRetirement;
+
+static inline u32 count_bits(u32 bits) {
+    u32 count = 0;
+
+    for (; bits; bits &= bits - 1) {
+        count++;
+    }
+
+    return count;
+}
+
+// The lane bookkeeping around the kernels works on 16 and 32 bit lanes, which the byte
+// vectors above do not cover. It runs on SSE2 in blocks of 16 lanes, AVX2 builds included.
+#if defined(__SSE2__) || defined(_M_X64)
+
+// The lowest PC among the running lanes, above $FFFF when no lane runs
+static u32 lowest_running_pc(const CpuBatch* batch) {
+    // Unsigned 16 bit minimum needs SSE4.1, so the PCs are biased into signed range and
+    // lanes that do not run get the largest key
+    const __m128i bias = _mm_set1_epi16((short) 0x8000);
+    const __m128i idle = _mm_set1_epi16(0x7FFF);
+    __m128i lowest = idle;
+
+    for (size_t lane = 0; lane < batch->lanes; lane += 8) {
+        const __m128i running = _mm_loadl_epi64((const __m128i*) &batch->running[lane]);
+        const __m128i running16 = _mm_unpacklo_epi8(running, running);
+        const __m128i pc = _mm_xor_si128(_mm_loadu_si128((const __m128i*) &batch->r_pc[lane]), bias);
+
+        lowest = _mm_min_epi16(lowest, _mm_or_si128(_mm_and_si128(running16, pc), _mm_andnot_si128(running16, idle)));
+    }
+
+    lowest = _mm_min_epi16(lowest, _mm_shuffle_epi32(lowest, _MM_SHUFFLE(1, 0, 3, 2)));
+    lowest = _mm_min_epi16(lowest, _mm_shuffle_epi32(lowest, _MM_SHUFFLE(2, 3, 0, 1)));
+    lowest = _mm_min_epi16(lowest, _mm_shufflelo_epi16(lowest, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    const u16 key = _mm_extract_epi16(lowest, 0);
+
+    if (key != 0x7FFF) {
+        return key ^ 0x8000;
+    }
+
+    // Either no lane runs or the lowest PC is $FFFF
+    for (size_t lane = 0; lane < batch->count; lane++) {
+        if (batch->running[lane]) {
+            return 0xFFFF;
+        }
+    }
+
+    return 0x10000;
+}
+
+// Marks the running lanes at pc in batch->group, returns how many there are
+static size_t select_group(CpuBatch* batch, u16 pc) {
+    const __m128i group_pc = _mm_set1_epi16((short) pc);
+    size_t size = 0;
+
+    for (size_t lane = 0; lane < batch->lanes; lane += 16) {
+        const __m128i running = _mm_loadu_si128((const __m128i*) &batch->running[lane]);
+        const __m128i low = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) &batch->r_pc[lane]), group_pc);
+        const __m128i high = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) &batch->r_pc[lane + 8]), group_pc);
+        const __m128i group = _mm_and_si128(_mm_packs_epi16(low, high), running);
+
+        _mm_storeu_si128((__m128i*) &batch->group[lane], group);
+        size += count_bits(_mm_movemask_epi8(group));
+    }
+
+    return size;
+}
+
+// Moves the lanes of the group past the instruction: PC, cycles left, instruction count
+// and whether the lane keeps running
+static void retire_group(CpuBatch* batch, const GroupRetirement* retirement) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i base_cycles = _mm_set1_epi8((char) retirement->cycles);
+    const __m128i taken_cycles = _mm_set1_epi8((char) retirement->taken_cycles);
+    const __m128i next_pc = _mm_set1_epi16((short) retirement->next_pc);
+    const __m128i target = _mm_set1_epi16((short) retirement->target);
+
+    for (size_t lane = 0; lane < batch->lanes; lane += 16) {
+        const __m128i group = _mm_loadu_si128((const __m128i*) &batch->group[lane]);
+
+        if (!_mm_movemask_epi8(group)) {
+            continue;
+        }
+
+        __m128i taken = zero, extra = zero;
+
+        if (retirement->branch) {
+            taken = _mm_and_si128(_mm_loadu_si128((const __m128i*) &batch->taken[lane]), group);
+            extra = _mm_and_si128(taken, taken_cycles);
+        } else if (retirement->extra_cycles) {
+            extra = _mm_loadu_si128((const __m128i*) &batch->extra_cycles[lane]);
+        }
+
+        const __m128i cycles = _mm_and_si128(group, _mm_add_epi8(base_cycles, extra));
+        const __m128i group16[2] = {_mm_unpacklo_epi8(group, group), _mm_unpackhi_epi8(group, group)};
+        const __m128i taken16[2] = {_mm_unpacklo_epi8(taken, taken), _mm_unpackhi_epi8(taken, taken)};
+        const __m128i cycles16[2] = {_mm_unpacklo_epi8(cycles, zero), _mm_unpackhi_epi8(cycles, zero)};
+        __m128i still_running[4];
+
+        for (int half = 0; half < 2; half++) {
+            __m128i* r_pc = (__m128i*) &batch->r_pc[lane + 8 * half];
+            const __m128i new_pc = _mm_or_si128(_mm_and_si128(taken16[half], target), _mm_andnot_si128(taken16[half], next_pc));
+
+            _mm_storeu_si128(r_pc, _mm_or_si128(_mm_and_si128(group16[half], new_pc),
+                                                _mm_andnot_si128(group16[half], _mm_loadu_si128(r_pc))));
+        }
+
+        for (int quarter = 0; quarter < 4; quarter++) {
+            const __m128i group32 = quarter & 1 ? _mm_unpackhi_epi16(group16[quarter / 2], group16[quarter / 2])
+                : _mm_unpacklo_epi16(group16[quarter / 2], group16[quarter / 2]);
+            const __m128i cycles32 = quarter & 1 ? _mm_unpackhi_epi16(cycles16[quarter / 2], zero)
+                : _mm_unpacklo_epi16(cycles16[quarter / 2], zero);
+            __m128i* cycles_left = (__m128i*) &batch->cycles_left[lane + 4 * quarter];
+            __m128i* instructions = (__m128i*) &batch->instructions[lane + 4 * quarter];
+            const __m128i left = _mm_sub_epi32(_mm_loadu_si128(cycles_left), cycles32);
+
+            _mm_storeu_si128(cycles_left, left);
+            // The group mask is -1 per lane
+            _mm_storeu_si128(instructions, _mm_sub_epi32(_mm_loadu_si128(instructions), group32));
+            still_running[quarter] = _mm_cmpgt_epi32(left, zero);
+        }
+
+        const __m128i running = _mm_packs_epi16(_mm_packs_epi32(still_running[0], still_running[1]),
+                                                _mm_packs_epi32(still_running[2], still_running[3]));
+        const __m128i old_running = _mm_loadu_si128((const __m128i*) &batch->running[lane]);
+
+        _mm_storeu_si128((__m128i*) &batch->running[lane],
+                         _mm_or_si128(_mm_and_si128(group, running), _mm_andnot_si128(group, old_running)));
+    }
+}
+
+#else
+
+static u32 lowest_running_pc(const CpuBatch* batch) {
+    u32 pc = 0x10000;
+
+    for (size_t lane = 0; lane < batch->count; lane++) {
+        if (batch->running[lane] && batch->r_pc[lane] < pc) {
+            pc = batch->r_pc[lane];
+        }
+    }
+
+    return pc;
+}
+
+static size_t select_group(CpuBatch* batch, u16 pc) {
+    size_t size = 0;
+
+    for (size_t lane = 0; lane < batch->lanes; lane++) {
+        const bool in_group = batch->running[lane] && batch->r_pc[lane] == pc;
+
+        batch->group[lane] = in_group ? 0xFF : 0x00;
+        size += in_group;
+    }
+
+    return size;
+}
+
+static void retire_group(CpuBatch* batch, const GroupRetirement* retirement) {
+    for (size_t lane = 0; lane < batch->count; lane++) {
+        if (!batch->group[lane]) {
+            continue;
+        }
+
+        const bool taken = retirement->branch && batch->taken[lane];
+        const u8 extra = taken ? retirement->taken_cycles
+            : retirement->extra_cycles ? batch->extra_cycles[lane] : 0;
+
+        batch->r_pc[lane] = taken ? retirement->target : retirement->next_pc;
+        batch->cycles_left[lane] -= retirement->cycles + extra;
+        batch->instructions[lane]++;
+        batch->running[lane] = batch->cycles_left[lane] > 0 ? 0xFF : 0x00;
+    }
+}
+
+#endif
+
+static inline LaneVec set_nz(LaneVec sr, LaneVec val) {
+    const LaneVec nz = vec_or(vec_and(val, vec_set1(NEGATIVE_FLAG)),
+                              vec_and(vec_cmpeq(val, vec_set1(0)), vec_set1(ZERO_FLAG)));
+
+    return vec_or(vec_and(sr, vec_set1((u8) ~(NEGATIVE_FLAG | ZERO_FLAG))), nz);
+}
+
+static inline LaneVec set_cnz(LaneVec sr, LaneVec carry, LaneVec val) {
+    return set_nz(vec_or(vec_and(sr, vec_set1((u8) ~CARRY_FLAG)), carry), val);
+}
+
+// ADC, and SBC with the operand inverted. The 2A03 has no decimal mode.
+static inline LaneVec add_with_carry(LaneVec a, LaneVec m, LaneVec sr, LaneVec* new_sr) {
+    const LaneVec sum = vec_add(vec_add(a, m), vec_and(sr, vec_set1(CARRY_FLAG)));
+    const LaneVec carry = vec_bit7(vec_or(vec_and(a, m), vec_andnot(sum, vec_or(a, m))));
+    const LaneVec overflow = vec_shr1(vec_and(vec_and(vec_xor(a, sum), vec_xor(m, sum)), vec_set1(0x80)));
+
+    *new_sr = set_cnz(vec_or(vec_and(sr, vec_set1((u8) ~OVERFLOW_FLAG)), overflow), carry, sum);
+    return sum;
+}
+
+static inline LaneVec compare(LaneVec sr, LaneVec reg, LaneVec m) {
+    const LaneVec carry = vec_and(vec_cmpeq(vec_max(reg, m), reg), vec_set1(CARRY_FLAG));
+    return set_cnz(sr, carry, vec_sub(reg, m));
+}
+
+static inline LaneVec branch_taken(LaneVec sr, u8 flag, bool if_set) {
+    const LaneVec set = vec_cmpeq(vec_and(sr, vec_set1(flag)), vec_set1(flag));
+    return if_set ? set : vec_xor(set, vec_set1(0xFF));
+}
+
+// Executes the instruction for the lanes of the group within one vector starting at lane
+static inline void execute_vector(CpuBatch* batch, BatchKernel kernel, size_t lane, LaneVec mask, LaneVec m) {
+    const LaneVec a = vec_load(&batch->r_a[lane]);
+    const LaneVec x = vec_load(&batch->r_x[lane]);
+    const LaneVec y = vec_load(&batch->r_y[lane]);
+    const LaneVec sp = vec_load(&batch->r_sp[lane]);
+    const LaneVec sr = vec_load(&batch->r_sr[lane]);
+    const LaneVec one = vec_set1(0x01);
+    LaneVec new_a = a, new_x = x, new_y = y, new_sp = sp, new_sr = sr;
+
+    switch (kernel) {
+        case KERNEL_LDA: new_a = m; new_sr = set_nz(sr, m); break;
+        case KERNEL_LDX: new_x = m; new_sr = set_nz(sr, m); break;
+        case KERNEL_LDY: new_y = m; new_sr = set_nz(sr, m); break;
+        case KERNEL_ADC: new_a = add_with_carry(a, m, sr, &new_sr); break;
+        case KERNEL_SBC: new_a = add_with_carry(a, vec_xor(m, vec_set1(0xFF)), sr, &new_sr); break;
+        case KERNEL_AND: new_a = vec_and(a, m); new_sr = set_nz(sr, new_a); break;
+        case KERNEL_ORA: new_a = vec_or(a, m); new_sr = set_nz(sr, new_a); break;
+        case KERNEL_EOR: new_a = vec_xor(a, m); new_sr = set_nz(sr, new_a); break;
+        case KERNEL_BIT: {
+            const LaneVec zero = vec_and(vec_cmpeq(vec_and(a, m), vec_set1(0)), vec_set1(ZERO_FLAG));
+            const LaneVec nv = vec_and(m, vec_set1(NEGATIVE_FLAG | OVERFLOW_FLAG));
+            new_sr = vec_or(vec_and(sr, vec_set1((u8) ~(NEGATIVE_FLAG | OVERFLOW_FLAG | ZERO_FLAG))), vec_or(nv, zero));
+            break;
+        }
+        case KERNEL_CMP: new_sr = compare(sr, a, m); break;
+        case KERNEL_CPX: new_sr = compare(sr, x, m); break;
+        case KERNEL_CPY: new_sr = compare(sr, y, m); break;
+        case KERNEL_TAX: new_x = a; new_sr = set_nz(sr, a); break;
+        case KERNEL_TAY: new_y = a; new_sr = set_nz(sr, a); break;
+        case KERNEL_TXA: new_a = x; new_sr = set_nz(sr, x); break;
+        case KERNEL_TYA: new_a = y; new_sr = set_nz(sr, y); break;
+        case KERNEL_TSX: new_x = sp; new_sr = set_nz(sr, sp); break;
+        case KERNEL_TXS: new_sp = x; break;
+        case KERNEL_INX: new_x = vec_add(x, one); new_sr = set_nz(sr, new_x); break;
+        case KERNEL_INY: new_y = vec_add(y, one); new_sr = set_nz(sr, new_y); break;
+        case KERNEL_DEX: new_x = vec_sub(x, one); new_sr = set_nz(sr, new_x); break;
+        case KERNEL_DEY: new_y = vec_sub(y, one); new_sr = set_nz(sr, new_y); break;
+        case KERNEL_ASL:
+            new_a = vec_add(a, a);
+            new_sr = set_cnz(sr, vec_bit7(a), new_a);
+            break;
+        case KERNEL_LSR:
+            new_a = vec_shr1(a);
+            new_sr = set_cnz(sr, vec_and(a, one), new_a);
+            break;
+        case KERNEL_ROL:
+            new_a = vec_or(vec_add(a, a), vec_and(sr, one));
+            new_sr = set_cnz(sr, vec_bit7(a), new_a);
+            break;
+        case KERNEL_ROR:
+            new_a = vec_or(vec_shr1(a), vec_and(vec_cmpeq(vec_and(sr, one), one), vec_set1(0x80)));
+            new_sr = set_cnz(sr, vec_and(a, one), new_a);
+            break;
+        case KERNEL_CLC: new_sr = vec_and(sr, vec_set1((u8) ~CARRY_FLAG)); break;
+        case KERNEL_SEC: new_sr = vec_or(sr, vec_set1(CARRY_FLAG)); break;
+        case KERNEL_CLV: new_sr = vec_and(sr, vec_set1((u8) ~OVERFLOW_FLAG)); break;
+        case KERNEL_CLD: new_sr = vec_and(sr, vec_set1((u8) ~DECIMAL_FLAG)); break;
+        case KERNEL_SED: new_sr = vec_or(sr, vec_set1(DECIMAL_FLAG)); break;
+        case KERNEL_BPL: vec_store(&batch->taken[lane], vec_and(mask, branch_taken(sr, NEGATIVE_FLAG, false))); return;
+        case KERNEL_BMI: vec_store(&batch->taken[lane], vec_and(mask, branch_taken(sr, NEGATIVE_FLAG, true))); return;
+        case KERNEL_BVC: vec_store(&batch->taken[lane], vec_and(mask, branch_taken(sr, OVERFLOW_FLAG, false))); return;
+        case KERNEL_BVS: vec_store(&batch->taken[lane], vec_and(mask, branch_taken(sr, OVERFLOW_FLAG, true))); return;
+        case KERNEL_BCC: vec_store(&batch->taken[lane], vec_and(mask, branch_taken(sr, CARRY_FLAG, false))); return;
+        case KERNEL_BCS: vec_store(&batch->taken[lane], vec_and(mask, branch_taken(sr, CARRY_FLAG, true))); return;
+        case KERNEL_BNE: vec_store(&batch->taken[lane], vec_and(mask, branch_taken(sr, ZERO_FLAG, false))); return;
+        case KERNEL_BEQ: vec_store(&batch->taken[lane], vec_and(mask, branch_taken(sr, ZERO_FLAG, true))); return;
+        // Stores already happened in prepare_lane, JMP only moves the PC
+        default: return;
+    }
+
+    vec_store(&batch->r_a[lane], vec_blend(mask, new_a, a));
+    vec_store(&batch->r_x[lane], vec_blend(mask, new_x, x));
+    vec_store(&batch->r_y[lane], vec_blend(mask, new_y, y));
+    vec_store(&batch->r_sp[lane], vec_blend(mask, new_sp, sp));
+    vec_store(&batch->r_sr[lane], vec_blend(mask, new_sr, sr));
+}
+
+static void run_vector_group(CpuBatch* batch, BatchKernel kernel, const Instruction* inst, u16 pc, const u8* code) {
+    // Immediate operands are the same for every lane
+    const bool immediate = inst->addr_mode == IMMEDIATE;
+
+    for (size_t lane = 0; lane < batch->lanes; lane += LANE_VEC_WIDTH) {
+        const LaneVec mask = vec_load(&batch->group[lane]);
+
+        if (vec_any(mask)) {
+            execute_vector(batch, kernel, lane, mask, immediate ? vec_set1(code[1]) : vec_load(&batch->operand[lane]));
+        }
+    }
+
+    // Every lane of the group is at the same PC, so the successor and the branch target
+    // are the same for all of them. Page crossing is checked against the address of the
+    // branch itself, like the reference core does.
+    const u16 target = pc + 2 + (i8) code[1];
+    const GroupRetirement retirement = {
+        .next_pc = kernel == KERNEL_JMP ? read_little_endian_u16(code[1], code[2]) : pc + get_instruction_length(code[0]),
+        .target = target,
+        .cycles = inst->cycles,
+        .taken_cycles = (target >> 8) != (pc >> 8) ? 2 : 1,
+        .branch = is_branch_kernel(kernel),
+        .extra_cycles = is_memory_mode(inst->addr_mode)
+    };
+
+    retire_group(batch, &retirement);
+}
+
+// Whether every lane has the same ROM mapped at the page, so that code fetched from one
+// lane is valid for all of them. Cached until a mapper switches banks.
+static bool is_shared_page(CpuBatch* batch, u8 page) {
+    if (batch->page_sharing[page] == PAGE_SHARING_UNKNOWN) {
+        const Bus* first = &batch->cpus[0]->bus;
+        bool shared = first->read_pages[page] && first->page_generation[page];
+
+        for (size_t lane = 1; lane < batch->count && shared; lane++) {
+            const Bus* bus = &batch->cpus[lane]->bus;
+
+            shared = bus->read_pages[page] && bus->page_generation[page]
+                && (bus->read_pages[page] == first->read_pages[page]
+                    || memcmp(bus->read_pages[page], first->read_pages[page], BUS_PAGE_SIZE) == 0);
+        }
+
+        batch->page_sharing[page] = shared ? PAGE_SHARING_SHARED : PAGE_SHARING_PRIVATE;
+    }
+
+    return batch->page_sharing[page] == PAGE_SHARING_SHARED;
+}
+
+static inline void leave_group(CpuBatch* batch, size_t lane, size_t* group_size, size_t* scalar_count) {
+    batch->group[lane] = 0;
+    batch->scalar_lanes[(*scalar_count)++] = lane;
+    (*group_size)--;
+}
+
+// Executes the instruction at the lowest PC of the running lanes for every lane sitting at
+// it. Returns false once no lane is running anymore.
+static bool step_batch(CpuBatch* batch) {
+    const u32 pc = lowest_running_pc(batch);
+
+    if (pc > 0xFFFF) {
+        return false;
+    }
+
+    size_t group_size = select_group(batch, pc), scalar_count = 0, leader = 0;
+
+    while (!batch->group[leader]) {
+        leader++;
+    }
+
+    u8 code[3] = {0};
+    const u8* page = batch->cpus[leader]->bus.read_pages[pc >> 8];
+    BatchKernel kernel = page ? batch->kernels[page[pc & 0xFF]] : KERNEL_NONE;
+    const u8 length = page ? get_instruction_length(page[pc & 0xFF]) : 1;
+
+    if (kernel != KERNEL_NONE && !fetch_code(&batch->cpus[leader]->bus, pc, length, code)) {
+        kernel = KERNEL_NONE;
+    }
+
+    if (kernel == KERNEL_NONE) {
+        for (size_t lane = leader; lane < batch->count; lane++) {
+            if (batch->group[lane]) {
+                scalar_step(batch, lane);
+            }
+        }
+
+        return true;
+    }
+
+    const Instruction* inst = get_instruction(code[0]);
+    const bool shared_code = is_shared_page(batch, pc >> 8) && is_shared_page(batch, (pc + length - 1) >> 8);
+    const bool per_lane_operand = kernel != KERNEL_JMP && is_memory_mode(inst->addr_mode);
+
+    for (size_t lane = leader; lane < batch->count && (!shared_code || per_lane_operand); lane++) {
+        if (!batch->group[lane]) {
+            continue;
+        }
+
+        // Outside of shared ROM lanes only share the instruction if their code matches
+        u8 lane_code[3] = {0};
+        const bool same_code = shared_code || lane == leader
+            || (fetch_code(&batch->cpus[lane]->bus, pc, length, lane_code) && memcmp(lane_code, code, length) == 0);
+
+        if (!same_code || (per_lane_operand && !prepare_lane(batch, lane, kernel, inst, code))) {
+            leave_group(batch, lane, &group_size, &scalar_count);
+        }
+    }
+
+    if (group_size > 0) {
+        run_vector_group(batch, kernel, inst, pc, code);
+        batch->stats.vector_steps++;
+        batch->stats.vector_instructions += group_size;
+        batch->stats.lane_slots += batch->count;
+    }
+
+    for (size_t i = 0; i < scalar_count; i++) {
+        scalar_step(batch, batch->scalar_lanes[i]);
+    }
+
+    return true;
+}
+
+static u64 run_batch_pass(CpuBatch* batch, u64 cycle_budget) {
+    u64 cycles = 0;
+
+    // Banks may have been switched since the last pass
+    memset(batch->page_sharing, PAGE_SHARING_UNKNOWN, sizeof(batch->page_sharing));
+
+    for (size_t lane = 0; lane < batch->count; lane++) {
+        Cpu* cpu = batch->cpus[lane];
+
+        cpu->run_end = cpu->cycles + cycle_budget;
+        load_lane(batch, lane);
+        batch->instructions[lane] = 0;
+        cycles -= cpu->cycles;
+    }
+
+    while (step_batch(batch)) {
+    }
+
+    for (size_t lane = 0; lane < batch->count; lane++) {
+        Cpu* cpu = batch->cpus[lane];
+
+        store_lane(batch, lane);
+        cpu->instructions_performed += batch->instructions[lane];
+        cycles += cpu->cycles;
+    }
+
+    return cycles;
+}
+
+u64 run_cpu_batch(CpuBatch* batch, u64 cycle_budget) {
+    u64 cycles = 0;
+
+    while (cycle_budget > 0) {
+        const u64 pass = cycle_budget < CPU_BATCH_MAX_PASS_CYCLES ? cycle_budget : CPU_BATCH_MAX_PASS_CYCLES;
+
+        cycles += run_batch_pass(batch, pass);
+        cycle_budget -= pass;
+    }
+
+    return cycles;
+}
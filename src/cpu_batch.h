@@ -0,0 +1,72 @@
+#ifndef CPU_BATCH_H
+#define CPU_BATCH_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "types.h"
+#include "cpu.h"
+
+// Longest pass of run_cpu_batch, larger budgets are run in several passes
+#define CPU_BATCH_MAX_PASS_CYCLES 0x40000000
+
+typedef struct CpuBatchStats {
+    // Group steps that went through the vector kernels
+    u64 vector_steps;
+    // Lane instructions executed by those steps
+    u64 vector_instructions;
+    // Lane slots the vector steps could have filled, vector_steps times the lane count
+    u64 lane_slots;
+    // Instructions executed one lane at a time with exec_instruction
+    u64 scalar_instructions;
+} CpuBatchStats;
+
+// Lockstep engine for many CPUs running the same program, e.g. copies of one ROM.
+// The registers of every lane are kept as structure of arrays. Each step picks the lowest
+// PC among the running lanes and executes that instruction for every lane sitting at it
+// at once with SSE2 (AVX2 when the build targets it). Lanes that diverge simply wait until
+// the lowest PC catches up with them, which is also where branches tend to reconverge.
+// Instructions without a vector kernel (stack, indirect and read-modify-write operations,
+// interrupts flag changes), code outside directly mapped pages and accesses to I/O
+// handlers run through exec_instruction for the affected lanes.
+typedef struct CpuBatch {
+    size_t count;
+    // count rounded up to whole vectors, padding lanes never run
+    size_t lanes;
+    Cpu** cpus;
+    u8* r_a;
+    u8* r_x;
+    u8* r_y;
+    u8* r_sp;
+    u8* r_sr;
+    u16* r_pc;
+    // Cycles left until Cpu.run_end, the cycle counter of a lane is derived from it
+    i32* cycles_left;
+    // Instructions executed by the vector kernels, added to the Cpu after each pass
+    u32* instructions;
+    // 0xFF while the lane runs
+    u8* running;
+    // Scratch of the current step, one byte per lane
+    u8* group;
+    u8* operand;
+    u8* extra_cycles;
+    u8* taken;
+    size_t* scalar_lanes;
+    // Vector kernel per opcode, see BatchKernel in cpu_batch.c
+    u8 kernels[0x100];
+    // Per bus page, whether all lanes have the same ROM there
+    u8 page_sharing[BUS_PAGE_COUNT];
+    CpuBatchStats stats;
+} CpuBatch;
+
+// The CPUs stay owned by the caller and keep their state between runs
+CpuBatch* build_cpu_batch(Cpu** cpus, size_t count);
+void free_cpu_batch(CpuBatch* batch);
+
+// Runs every lane until it has executed at least cycle_budget cycles or leaves the running
+// state, like run_cpu does for a single CPU. Returns the cycles executed by all lanes.
+u64 run_cpu_batch(CpuBatch* batch, u64 cycle_budget);
+
+// Name of the instruction set the vector kernels were compiled for
+const char* cpu_batch_vector_isa(void);
+
+#endif
@@ -0,0 +1,603 @@
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "utils.h"
+#ifdef PYROTOBOX_TRACE
+#include "trace.h"
+#endif
+
+/*
+ * Specialized interpreter core.
+ *
+ * Every opcode gets its own handler with the addressing mode baked in, so there is
+ * no Instruction copy, no generic get_operand switch and no call through a function
+ * pointer per instruction. With GCC/Clang the handlers are threaded with computed
+ * gotos (one indirect jump at the end of each handler, which gives the branch
+ * predictor a separate history per opcode). Other compilers get a plain switch.
+ *
+ * Semantics, including cycle counts and stack layout, intentionally match the
+ * table-driven reference core in cpu.c so both cores can be compared instruction by
+ * instruction.
+ *
+ * N, Z, C and V are evaluated lazily. Instructions only store the values the flags
+ * are derived from (see LazyFlags) and r_sr is rebuilt when something actually
+ * reads it: PHP, BRK, the tracer and the end of a run, where the rest of the
+ * emulator and debuggers can see it. Branches test the lazy values directly.
+ * Building with PYROTOBOX_CHECK_FLAGS also keeps an eagerly updated copy of the
+ * status register and stops the CPU on the first instruction where the two differ.
+ */
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define CPU_THREADED_DISPATCH
+    // Labels as values are a GNU extension.
+    #pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+#ifdef PYROTOBOX_TRACE
+    #define TRACE() if (cpu->trace) { SYNC_FLAGS(); trace_instruction(cpu->trace, cpu); }
+#else
+    #define TRACE()
+#endif
+
+#define LAZY_FLAGS (NEGATIVE_FLAG | OVERFLOW_FLAG | ZERO_FLAG | CARRY_FLAG)
+
+// Values the lazily evaluated flags are derived from. Z is set when `z` is zero,
+// N and V are bit 7 of `n` and `v`, C is `c` (0 or 1). The remaining flags (I, D, B)
+// stay in r_sr.
+typedef struct {
+    u8 n;
+    u8 z;
+    u8 c;
+    u8 v;
+} LazyFlags;
+
+static inline LazyFlags load_flags(u8 sr) {
+    LazyFlags flags;
+    flags.n = sr & NEGATIVE_FLAG;
+    flags.z = !(sr & ZERO_FLAG);
+    flags.c = sr & CARRY_FLAG;
+    flags.v = (sr & OVERFLOW_FLAG) << 1;
+    return flags;
+}
+
+static inline u8 build_status_register(u8 sr, LazyFlags flags) {
+    return (sr & ~LAZY_FLAGS)
+        | (flags.n & NEGATIVE_FLAG)
+        | ((flags.v & 0x80) >> 1)
+        | (flags.z == 0 ? ZERO_FLAG : 0)
+        | flags.c;
+}
+
+#define SYNC_FLAGS() cpu->r_sr = build_status_register(cpu->r_sr, flags)
+#define RELOAD_FLAGS() flags = load_flags(cpu->r_sr)
+
+#ifdef PYROTOBOX_CHECK_FLAGS
+    // Shadow status register updated the same way the reference core does it
+    #define EAGER(...) __VA_ARGS__
+    #define EAGER_FLAG(flag, cond) \
+        eager_sr = (cond) ? (eager_sr | (flag)) : (eager_sr & ~(flag))
+    #define EAGER_ZN(v) EAGER_FLAG(ZERO_FLAG, (v) == 0); EAGER_FLAG(NEGATIVE_FLAG, (v) & 0x80)
+    #define EAGER_CARRY() (eager_sr & CARRY_FLAG)
+    #define CHECK_FLAGS() \
+        if (build_status_register(cpu->r_sr, flags) != eager_sr) { \
+            fprintf(stderr, "FATAL: Lazy flags diverged before address $%X: lazy $%02X, eager $%02X\n", \
+                cpu->r_pc, build_status_register(cpu->r_sr, flags), eager_sr); \
+            cpu->cpu_state = CPU_STOPPED; \
+        }
+#else
+    #define EAGER(...)
+    #define CHECK_FLAGS()
+#endif
+
+#define SET_ZN(v) flags.n = flags.z = (v); EAGER(EAGER_ZN(v))
+
+#define CARRY() flags.c
+
+// Operand bytes are fetched together with the opcode, see fetch_instruction
+#define OPERAND8() operands[0]
+#define OPERAND16() read_little_endian_u16(operands[0], operands[1])
+
+// Addressing modes. Each one leaves the effective address in `addr` and, for the
+// indexed modes that can cross a page, the page penalty in `extra`.
+#define ADDR_ZP()  addr = OPERAND8()
+#define ADDR_ZPX() addr = (OPERAND8() + cpu->r_x) & 0x00FF
+#define ADDR_ZPY() addr = (OPERAND8() + cpu->r_y) & 0x00FF
+#define ADDR_ABS() addr = OPERAND16()
+#define ADDR_ABX() addr = OPERAND16() + cpu->r_x; extra = operands[1] != (addr >> 8)
+#define ADDR_ABY() addr = OPERAND16() + cpu->r_y; extra = operands[1] != (addr >> 8)
+#define ADDR_IND() \
+    addr = OPERAND16(); \
+    addr = read_little_endian_u16(read_u8(cpu, addr), read_u8(cpu, addr + 1))
+#define ADDR_IZX() \
+    addr = (OPERAND8() + cpu->r_x) & 0x00FF; \
+    addr = read_little_endian_u16(read_u8(cpu, addr), read_u8(cpu, addr + 1))
+#define ADDR_IZY() \
+    addr = OPERAND8(); \
+    addr = read_little_endian_u16(read_u8(cpu, addr), read_u8(cpu, addr + 1)); \
+    extra = (addr >> 8) != ((u16)(addr + cpu->r_y) >> 8); \
+    addr += cpu->r_y
+
+#define SKIP(bytes) cpu->r_pc += (bytes)
+
+// Ends the run after the current instruction when an IRQ is pending and the instruction
+// may have enabled interrupts, like check_irq_window in the reference core.
+#define IRQ_WINDOW() if (cpu->irq_lines) cpu->run_end = cycles
+
+// Stores and jumps never read the value at the effective address. Count those reads
+// the same way the reference core does so the statistics are comparable.
+#define ADDRESS_ONLY() cpu->bus_reads_avoided++
+
+// Operations. They work on `val` (the fetched operand, or the value to write back
+// for read-modify-write instructions) and the registers.
+#define OP_LDA() cpu->r_a = val; SET_ZN(cpu->r_a)
+#define OP_LDX() cpu->r_x = val; SET_ZN(cpu->r_x)
+#define OP_LDY() cpu->r_y = val; SET_ZN(cpu->r_y)
+#define OP_AND() cpu->r_a &= val; SET_ZN(cpu->r_a)
+#define OP_ORA() cpu->r_a |= val; SET_ZN(cpu->r_a)
+#define OP_EOR() cpu->r_a ^= val; SET_ZN(cpu->r_a)
+
+#define OP_ADC() do { \
+    EAGER( \
+        const u16 eager_sum = ((u16) cpu->r_a) + val + EAGER_CARRY(); \
+        EAGER_FLAG(CARRY_FLAG, eager_sum & 0x100); \
+        EAGER_FLAG(OVERFLOW_FLAG, (cpu->r_a ^ eager_sum) & (val ^ eager_sum) & 0x80); \
+    ) \
+    const u16 sum = ((u16) cpu->r_a) + val + CARRY(); \
+    flags.c = sum >> 8; \
+    flags.v = (cpu->r_a ^ sum) & (val ^ sum); \
+    cpu->r_a = sum & 0x00FF; \
+    SET_ZN(cpu->r_a); \
+} while (0)
+
+#define OP_SBC() do { \
+    EAGER( \
+        const u16 eager_diff = ((u16) cpu->r_a) - val - !EAGER_CARRY(); \
+        EAGER_FLAG(CARRY_FLAG, !(eager_diff & 0x100)); \
+        EAGER_FLAG(OVERFLOW_FLAG, (cpu->r_a ^ eager_diff) & (~val ^ eager_diff) & 0x80); \
+    ) \
+    const u16 diff = ((u16) cpu->r_a) - val - !CARRY(); \
+    flags.c = !(diff & 0x100); \
+    flags.v = (cpu->r_a ^ diff) & (~val ^ diff); \
+    cpu->r_a = diff & 0x00FF; \
+    SET_ZN(cpu->r_a); \
+} while (0)
+
+#define OP_BIT() do { \
+    EAGER( \
+        EAGER_FLAG(ZERO_FLAG, (cpu->r_a & val) == 0); \
+        EAGER_FLAG(OVERFLOW_FLAG, val & 0x40); \
+        EAGER_FLAG(NEGATIVE_FLAG, val & 0x80); \
+    ) \
+    flags.z = cpu->r_a & val; \
+    flags.v = val << 1; \
+    flags.n = val; \
+} while (0)
+
+#define COMPARE(reg) do { \
+    const u16 result = (reg) - val; \
+    EAGER(EAGER_FLAG(CARRY_FLAG, !(result & 0x100))); \
+    flags.c = !(result & 0x100); \
+    SET_ZN((u8) result); \
+} while (0)
+#define OP_CMP() COMPARE(cpu->r_a)
+#define OP_CPX() COMPARE(cpu->r_x)
+#define OP_CPY() COMPARE(cpu->r_y)
+
+#define OP_ASL() EAGER(EAGER_FLAG(CARRY_FLAG, val & 0x80)); flags.c = val >> 7; val <<= 1; SET_ZN(val)
+#define OP_LSR() EAGER(EAGER_FLAG(CARRY_FLAG, val & 0x01)); flags.c = val & 0x01; val >>= 1; SET_ZN(val)
+#define OP_ROL() do { \
+    const u8 old_val = val; \
+    val = (val << 1) | CARRY(); \
+    EAGER(EAGER_FLAG(CARRY_FLAG, old_val & 0x80)); \
+    flags.c = old_val >> 7; \
+    SET_ZN(val); \
+} while (0)
+#define OP_ROR() do { \
+    const u8 old_val = val; \
+    val = (val >> 1) | (CARRY() << 7); \
+    EAGER(EAGER_FLAG(CARRY_FLAG, old_val & 0x01)); \
+    flags.c = old_val & 0x01; \
+    SET_ZN(val); \
+} while (0)
+#define OP_INC() val++; SET_ZN(val)
+#define OP_DEC() val--; SET_ZN(val)
+
+#define OP_STA() ADDRESS_ONLY(); write_u8(cpu, addr, cpu->r_a)
+#define OP_STX() ADDRESS_ONLY(); write_u8(cpu, addr, cpu->r_x)
+#define OP_STY() ADDRESS_ONLY(); write_u8(cpu, addr, cpu->r_y)
+
+#define OP_INX() cpu->r_x++; SET_ZN(cpu->r_x)
+#define OP_INY() cpu->r_y++; SET_ZN(cpu->r_y)
+#define OP_DEX() cpu->r_x--; SET_ZN(cpu->r_x)
+#define OP_DEY() cpu->r_y--; SET_ZN(cpu->r_y)
+#define OP_TAX() cpu->r_x = cpu->r_a; SET_ZN(cpu->r_x)
+#define OP_TAY() cpu->r_y = cpu->r_a; SET_ZN(cpu->r_y)
+#define OP_TXA() cpu->r_a = cpu->r_x; SET_ZN(cpu->r_a)
+#define OP_TYA() cpu->r_a = cpu->r_y; SET_ZN(cpu->r_a)
+#define OP_TSX() cpu->r_x = cpu->r_sp; SET_ZN(cpu->r_x)
+#define OP_TXS() cpu->r_sp = cpu->r_x
+
+#define OP_CLC() flags.c = 0; EAGER(eager_sr &= ~CARRY_FLAG)
+#define OP_CLD() cpu->r_sr &= ~DECIMAL_FLAG; EAGER(eager_sr &= ~DECIMAL_FLAG)
+#define OP_CLI() cpu->r_sr &= ~INTERRUPT_DISABLED_FLAG; EAGER(eager_sr &= ~INTERRUPT_DISABLED_FLAG); IRQ_WINDOW()
+#define OP_CLV() flags.v = 0; EAGER(eager_sr &= ~OVERFLOW_FLAG)
+#define OP_SEC() flags.c = 1; EAGER(eager_sr |= CARRY_FLAG)
+#define OP_SED() cpu->r_sr |= DECIMAL_FLAG; EAGER(eager_sr |= DECIMAL_FLAG)
+#define OP_SEI() cpu->r_sr |= INTERRUPT_DISABLED_FLAG; EAGER(eager_sr |= INTERRUPT_DISABLED_FLAG)
+
+// Branch timing follows the reference core: +1 cycle when taken, +2 when the
+// destination is on a different page than the branch instruction.
+#define BRANCH(cond) \
+    if (cond) { \
+        const u8 msb = cpu->r_pc >> 8; \
+        cpu->r_pc += ((i8) OPERAND8()) + 2; \
+        extra = msb != (cpu->r_pc >> 8) ? 2 : 1; \
+    } else { \
+        cpu->r_pc += 2; \
+        extra = 0; \
+    }
+
+#define PUSH_PC(pc) push_stack(cpu, (pc) & 0x00FF); push_stack(cpu, (pc) >> 8)
+#define POP_PC() \
+    val = pop_stack(cpu); \
+    cpu->r_pc = read_little_endian_u16(pop_stack(cpu), val)
+
+#define OP_JMP() ADDRESS_ONLY(); cpu->r_pc = addr
+#define OP_JSR() ADDRESS_ONLY(); PUSH_PC(cpu->r_pc - 1); cpu->r_pc = addr
+#define OP_RTS() POP_PC(); cpu->r_pc++
+#define OP_RTI() OP_PLP(); POP_PC()
+#define OP_BRK() \
+    PUSH_PC(cpu->r_pc); \
+    SYNC_FLAGS(); \
+    push_stack(cpu, cpu->r_sr); \
+    cpu->r_sr |= BREAK_COMMAND; \
+    EAGER(eager_sr |= BREAK_COMMAND); \
+    cpu->r_pc = read_little_endian_u16(read_u8(cpu, 0xFFFE), read_u8(cpu, 0xFFFF))
+#define OP_PHA() push_stack(cpu, cpu->r_a)
+#define OP_PHP() SYNC_FLAGS(); push_stack(cpu, cpu->r_sr)
+#define OP_PLA() cpu->r_a = pop_stack(cpu); SET_ZN(cpu->r_a)
+#define OP_PLP() cpu->r_sr = pop_stack(cpu); RELOAD_FLAGS(); EAGER(eager_sr = cpu->r_sr); IRQ_WINDOW()
+#define OP_NOP()
+
+// Instruction length in bytes per opcode, invalid opcodes take a single byte
+static const u8 INSTRUCTION_LENGTH[0x100] = {
+    1, 2, 1, 1, 1, 2, 2, 1, 1, 2, 1, 1, 1, 3, 3, 1,
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1,
+    3, 2, 1, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1,
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1,
+    1, 2, 1, 1, 1, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1,
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1,
+    1, 2, 1, 1, 1, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1,
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1,
+    1, 2, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 3, 3, 3, 1,
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 3, 1, 1, 1, 3, 1, 1,
+    2, 2, 2, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1,
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 3, 1, 1, 3, 3, 3, 1,
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1,
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1,
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1,
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1,
+};
+
+static inline u8 decode_instruction(Cpu* cpu, u16 pc, u8* operands, u8* length) {
+    const u8 opcode = read_u8(cpu, pc);
+    *length = INSTRUCTION_LENGTH[opcode];
+
+    operands[0] = *length > 1 ? read_u8(cpu, pc + 1) : 0;
+    operands[1] = *length > 2 ? read_u8(cpu, pc + 2) : 0;
+
+    return opcode;
+}
+
+// Fetches the opcode and operand bytes at PC. Instructions on ROM pages come out of the
+// decode cache, everything else is decoded from the bus every time.
+static inline u8 fetch_instruction(Cpu* cpu, u8* operands) {
+    const u16 pc = cpu->r_pc;
+    DecodeCache* cache = cpu->decode_cache;
+    u8 length;
+
+    if (!cache) {
+        return decode_instruction(cpu, pc, operands, &length);
+    }
+
+    const u32 generation = cpu->bus.page_generation[pc >> 8];
+
+    if (generation == 0 || pc < DECODE_CACHE_BASE) {
+        cache->uncached++;
+        return decode_instruction(cpu, pc, operands, &length);
+    }
+
+    DecodedInstruction* entry = &cache->entries[pc - DECODE_CACHE_BASE];
+
+    if (entry->generation == generation) {
+        cache->hits++;
+        cache->bus_reads_saved += entry->length;
+        operands[0] = entry->operands[0];
+        operands[1] = entry->operands[1];
+        return entry->opcode;
+    }
+
+    const u8 opcode = decode_instruction(cpu, pc, operands, &length);
+
+    // The rest of an instruction that crosses into the next page may be remapped
+    // independently, so those are never cached.
+    if ((pc & 0xFF) + length > BUS_PAGE_SIZE) {
+        cache->uncached++;
+        return opcode;
+    }
+
+    cache->misses++;
+    entry->generation = generation;
+    entry->opcode = opcode;
+    entry->operands[0] = operands[0];
+    entry->operands[1] = operands[1];
+    entry->length = length;
+
+    return opcode;
+}
+
+static inline void push_stack(Cpu* cpu, u8 val) {
+    if (cpu->r_sp == 0) {
+        fprintf(stderr, "FATAL: Stack overflow occured at address $%X Exiting...\n", cpu->r_pc);
+        cpu->cpu_state = CPU_STOPPED;
+    }
+
+    cpu->mem[STACK_ADDR_OFFSET | cpu->r_sp] = val;
+    cpu->r_sp--;
+}
+
+static inline u8 pop_stack(Cpu* cpu) {
+    if (cpu->r_sp == STACK_SIZE) {
+        fprintf(stderr, "FATAL: Stack underflow occured at address $%X Exiting...\n", cpu->r_pc);
+        cpu->cpu_state = CPU_STOPPED;
+    }
+
+    cpu->r_sp++;
+    return cpu->mem[STACK_ADDR_OFFSET | cpu->r_sp];
+}
+
+u64 run_cpu_threaded(Cpu* cpu, u64 cycle_budget) {
+    const u64 start_cycles = cpu->cycles;
+    u64 cycles = start_cycles;
+    u64 instructions = cpu->instructions_performed;
+
+    u16 addr = 0;
+    u8 val = 0;
+    u8 extra = 0;
+    u8 operands[2];
+    LazyFlags flags = load_flags(cpu->r_sr);
+
+    cpu->run_end = start_cycles + cycle_budget;
+#ifdef PYROTOBOX_CHECK_FLAGS
+    u8 eager_sr = cpu->r_sr;
+#endif
+
+#ifdef CPU_THREADED_DISPATCH
+    static const void* const dispatch_table[0x100] = {
+        &&op_0x00, &&op_0x01, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0x05, &&op_0x06, &&op_illegal, &&op_0x08, &&op_0x09, &&op_0x0A, &&op_illegal, &&op_illegal, &&op_0x0D, &&op_0x0E, &&op_illegal,
+        &&op_0x10, &&op_0x11, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0x15, &&op_0x16, &&op_illegal, &&op_0x18, &&op_0x19, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0x1D, &&op_0x1E, &&op_illegal,
+        &&op_0x20, &&op_0x21, &&op_illegal, &&op_illegal, &&op_0x24, &&op_0x25, &&op_0x26, &&op_illegal, &&op_0x28, &&op_0x29, &&op_0x2A, &&op_illegal, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_illegal,
+        &&op_0x30, &&op_0x31, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0x35, &&op_0x36, &&op_illegal, &&op_0x38, &&op_0x39, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0x3D, &&op_0x3E, &&op_illegal,
+        &&op_0x40, &&op_0x41, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0x45, &&op_0x46, &&op_illegal, &&op_0x48, &&op_0x49, &&op_0x4A, &&op_illegal, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_illegal,
+        &&op_0x50, &&op_0x51, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0x55, &&op_0x56, &&op_illegal, &&op_0x58, &&op_0x59, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0x5D, &&op_0x5E, &&op_illegal,
+        &&op_0x60, &&op_0x61, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0x65, &&op_0x66, &&op_illegal, &&op_0x68, &&op_0x69, &&op_0x6A, &&op_illegal, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_illegal,
+        &&op_0x70, &&op_0x71, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0x75, &&op_0x76, &&op_illegal, &&op_0x78, &&op_0x79, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0x7D, &&op_0x7E, &&op_illegal,
+        &&op_illegal, &&op_0x81, &&op_illegal, &&op_illegal, &&op_0x84, &&op_0x85, &&op_0x86, &&op_illegal, &&op_0x88, &&op_illegal, &&op_0x8A, &&op_illegal, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_illegal,
+        &&op_0x90, &&op_0x91, &&op_illegal, &&op_illegal, &&op_0x94, &&op_0x95, &&op_0x96, &&op_illegal, &&op_0x98, &&op_0x99, &&op_0x9A, &&op_illegal, &&op_illegal, &&op_0x9D, &&op_illegal, &&op_illegal,
+        &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_illegal, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_illegal, &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_illegal, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_illegal,
+        &&op_0xB0, &&op_0xB1, &&op_illegal, &&op_illegal, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_illegal, &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_illegal, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_illegal,
+        &&op_0xC0, &&op_0xC1, &&op_illegal, &&op_illegal, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_illegal, &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_illegal, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_illegal,
+        &&op_0xD0, &&op_0xD1, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0xD5, &&op_0xD6, &&op_illegal, &&op_0xD8, &&op_0xD9, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0xDD, &&op_0xDE, &&op_illegal,
+        &&op_0xE0, &&op_0xE1, &&op_illegal, &&op_illegal, &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_illegal, &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_illegal, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_illegal,
+        &&op_0xF0, &&op_0xF1, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0xF5, &&op_0xF6, &&op_illegal, &&op_0xF8, &&op_0xF9, &&op_illegal, &&op_illegal, &&op_illegal, &&op_0xFD, &&op_0xFE, &&op_illegal,
+    };
+
+    #define OPCODE(op) op_##op:
+    #define OPCODE_ILLEGAL op_illegal:
+    #define DISPATCH() \
+        CHECK_FLAGS(); \
+        if (cycles >= cpu->run_end || cpu->cpu_state != CPU_RUNNING) goto out; \
+        cpu->cycles = cycles; \
+        TRACE(); \
+        goto *dispatch_table[fetch_instruction(cpu, operands)]
+#else
+    #define OPCODE(op) case op:
+    #define OPCODE_ILLEGAL default:
+    #define DISPATCH() CHECK_FLAGS(); continue
+#endif
+
+    #define NEXT(c) { cycles += (c); instructions++; DISPATCH(); }
+
+#ifdef CPU_THREADED_DISPATCH
+    DISPATCH();
+    {
+#else
+    while (cycles < cpu->run_end && cpu->cpu_state == CPU_RUNNING) {
+        cpu->cycles = cycles;
+        TRACE();
+        switch (fetch_instruction(cpu, operands)) {
+#endif
+        // Loads and stores
+        OPCODE(0xA1) ADDR_IZX(); SKIP(2); val = read_u8(cpu, addr); OP_LDA(); NEXT(6);
+        OPCODE(0xA5) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_LDA(); NEXT(3);
+        OPCODE(0xA9) SKIP(2); val = OPERAND8(); OP_LDA(); NEXT(2);
+        OPCODE(0xAD) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_LDA(); NEXT(4);
+        OPCODE(0xB1) ADDR_IZY(); SKIP(2); val = read_u8(cpu, addr); OP_LDA(); NEXT(5 + extra);
+        OPCODE(0xB5) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_LDA(); NEXT(4);
+        OPCODE(0xB9) ADDR_ABY(); SKIP(3); val = read_u8(cpu, addr); OP_LDA(); NEXT(4 + extra);
+        OPCODE(0xBD) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_LDA(); NEXT(4 + extra);
+        OPCODE(0xA2) SKIP(2); val = OPERAND8(); OP_LDX(); NEXT(2);
+        OPCODE(0xA6) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_LDX(); NEXT(3);
+        OPCODE(0xAE) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_LDX(); NEXT(4);
+        OPCODE(0xB6) ADDR_ZPY(); SKIP(2); val = read_u8(cpu, addr); OP_LDX(); NEXT(4);
+        OPCODE(0xBE) ADDR_ABY(); SKIP(3); val = read_u8(cpu, addr); OP_LDX(); NEXT(4 + extra);
+        OPCODE(0xA0) SKIP(2); val = OPERAND8(); OP_LDY(); NEXT(2);
+        OPCODE(0xA4) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_LDY(); NEXT(3);
+        OPCODE(0xAC) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_LDY(); NEXT(4);
+        OPCODE(0xB4) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_LDY(); NEXT(4);
+        OPCODE(0xBC) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_LDY(); NEXT(4 + extra);
+        OPCODE(0x81) ADDR_IZX(); SKIP(2); OP_STA(); NEXT(6);
+        OPCODE(0x85) ADDR_ZP(); SKIP(2); OP_STA(); NEXT(3);
+        OPCODE(0x8D) ADDR_ABS(); SKIP(3); OP_STA(); NEXT(4);
+        OPCODE(0x91) ADDR_IZY(); SKIP(2); OP_STA(); NEXT(6 + extra);
+        OPCODE(0x95) ADDR_ZPX(); SKIP(2); OP_STA(); NEXT(4);
+        OPCODE(0x99) ADDR_ABY(); SKIP(3); OP_STA(); NEXT(5 + extra);
+        OPCODE(0x9D) ADDR_ABX(); SKIP(3); OP_STA(); NEXT(5 + extra);
+        OPCODE(0x86) ADDR_ZP(); SKIP(2); OP_STX(); NEXT(3);
+        OPCODE(0x8E) ADDR_ABS(); SKIP(3); OP_STX(); NEXT(4);
+        OPCODE(0x96) ADDR_ZPY(); SKIP(2); OP_STX(); NEXT(4);
+        OPCODE(0x84) ADDR_ZP(); SKIP(2); OP_STY(); NEXT(3);
+        OPCODE(0x8C) ADDR_ABS(); SKIP(3); OP_STY(); NEXT(4);
+        OPCODE(0x94) ADDR_ZPX(); SKIP(2); OP_STY(); NEXT(4);
+
+        // Arithmetic, logic and compares
+        OPCODE(0x61) ADDR_IZX(); SKIP(2); val = read_u8(cpu, addr); OP_ADC(); NEXT(6);
+        OPCODE(0x65) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_ADC(); NEXT(3);
+        OPCODE(0x69) SKIP(2); val = OPERAND8(); OP_ADC(); NEXT(2);
+        OPCODE(0x6D) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_ADC(); NEXT(4);
+        OPCODE(0x71) ADDR_IZY(); SKIP(2); val = read_u8(cpu, addr); OP_ADC(); NEXT(5 + extra);
+        OPCODE(0x75) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_ADC(); NEXT(4);
+        OPCODE(0x79) ADDR_ABY(); SKIP(3); val = read_u8(cpu, addr); OP_ADC(); NEXT(4 + extra);
+        OPCODE(0x7D) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_ADC(); NEXT(4 + extra);
+        OPCODE(0xE1) ADDR_IZX(); SKIP(2); val = read_u8(cpu, addr); OP_SBC(); NEXT(6);
+        OPCODE(0xE5) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_SBC(); NEXT(3);
+        OPCODE(0xE9) SKIP(2); val = OPERAND8(); OP_SBC(); NEXT(2);
+        OPCODE(0xED) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_SBC(); NEXT(4);
+        OPCODE(0xF1) ADDR_IZY(); SKIP(2); val = read_u8(cpu, addr); OP_SBC(); NEXT(5 + extra);
+        OPCODE(0xF5) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_SBC(); NEXT(4);
+        OPCODE(0xF9) ADDR_ABY(); SKIP(3); val = read_u8(cpu, addr); OP_SBC(); NEXT(4 + extra);
+        OPCODE(0xFD) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_SBC(); NEXT(4 + extra);
+        OPCODE(0x21) ADDR_IZX(); SKIP(2); val = read_u8(cpu, addr); OP_AND(); NEXT(6);
+        OPCODE(0x25) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_AND(); NEXT(3);
+        OPCODE(0x29) SKIP(2); val = OPERAND8(); OP_AND(); NEXT(2);
+        OPCODE(0x2D) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_AND(); NEXT(4);
+        OPCODE(0x31) ADDR_IZY(); SKIP(2); val = read_u8(cpu, addr); OP_AND(); NEXT(5 + extra);
+        OPCODE(0x35) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_AND(); NEXT(4);
+        OPCODE(0x39) ADDR_ABY(); SKIP(3); val = read_u8(cpu, addr); OP_AND(); NEXT(4 + extra);
+        OPCODE(0x3D) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_AND(); NEXT(4 + extra);
+        OPCODE(0x01) ADDR_IZX(); SKIP(2); val = read_u8(cpu, addr); OP_ORA(); NEXT(6);
+        OPCODE(0x05) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_ORA(); NEXT(3);
+        OPCODE(0x09) SKIP(2); val = OPERAND8(); OP_ORA(); NEXT(2);
+        OPCODE(0x0D) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_ORA(); NEXT(4);
+        OPCODE(0x11) ADDR_IZY(); SKIP(2); val = read_u8(cpu, addr); OP_ORA(); NEXT(5 + extra);
+        OPCODE(0x15) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_ORA(); NEXT(4);
+        OPCODE(0x19) ADDR_ABY(); SKIP(3); val = read_u8(cpu, addr); OP_ORA(); NEXT(4 + extra);
+        OPCODE(0x1D) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_ORA(); NEXT(4 + extra);
+        OPCODE(0x41) ADDR_IZX(); SKIP(2); val = read_u8(cpu, addr); OP_EOR(); NEXT(6);
+        OPCODE(0x45) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_EOR(); NEXT(3);
+        OPCODE(0x49) SKIP(2); val = OPERAND8(); OP_EOR(); NEXT(2);
+        OPCODE(0x4D) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_EOR(); NEXT(4);
+        OPCODE(0x51) ADDR_IZY(); SKIP(2); val = read_u8(cpu, addr); OP_EOR(); NEXT(5 + extra);
+        OPCODE(0x55) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_EOR(); NEXT(4);
+        OPCODE(0x59) ADDR_ABY(); SKIP(3); val = read_u8(cpu, addr); OP_EOR(); NEXT(4 + extra);
+        OPCODE(0x5D) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_EOR(); NEXT(4 + extra);
+        OPCODE(0x24) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_BIT(); NEXT(3);
+        OPCODE(0x2C) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_BIT(); NEXT(4);
+        OPCODE(0xC1) ADDR_IZX(); SKIP(2); val = read_u8(cpu, addr); OP_CMP(); NEXT(6);
+        OPCODE(0xC5) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_CMP(); NEXT(3);
+        OPCODE(0xC9) SKIP(2); val = OPERAND8(); OP_CMP(); NEXT(2);
+        OPCODE(0xCD) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_CMP(); NEXT(4);
+        OPCODE(0xD1) ADDR_IZY(); SKIP(2); val = read_u8(cpu, addr); OP_CMP(); NEXT(5 + extra);
+        OPCODE(0xD5) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_CMP(); NEXT(4);
+        OPCODE(0xD9) ADDR_ABY(); SKIP(3); val = read_u8(cpu, addr); OP_CMP(); NEXT(4 + extra);
+        OPCODE(0xDD) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_CMP(); NEXT(4 + extra);
+        OPCODE(0xE0) SKIP(2); val = OPERAND8(); OP_CPX(); NEXT(2);
+        OPCODE(0xE4) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_CPX(); NEXT(3);
+        OPCODE(0xEC) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_CPX(); NEXT(4);
+        OPCODE(0xC0) SKIP(2); val = OPERAND8(); OP_CPY(); NEXT(2);
+        OPCODE(0xC4) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_CPY(); NEXT(3);
+        OPCODE(0xCC) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_CPY(); NEXT(4);
+
+        // Read-modify-write
+        OPCODE(0x06) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_ASL(); write_u8(cpu, addr, val); NEXT(5);
+        OPCODE(0x0A) SKIP(1); val = cpu->r_a; OP_ASL(); cpu->r_a = val; NEXT(2);
+        OPCODE(0x0E) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_ASL(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0x16) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_ASL(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0x1E) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_ASL(); write_u8(cpu, addr, val); NEXT(7 + extra);
+        OPCODE(0x46) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_LSR(); write_u8(cpu, addr, val); NEXT(5);
+        OPCODE(0x4A) SKIP(1); val = cpu->r_a; OP_LSR(); cpu->r_a = val; NEXT(2);
+        OPCODE(0x4E) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_LSR(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0x56) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_LSR(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0x5E) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_LSR(); write_u8(cpu, addr, val); NEXT(7 + extra);
+        OPCODE(0x26) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_ROL(); write_u8(cpu, addr, val); NEXT(5);
+        OPCODE(0x2A) SKIP(1); val = cpu->r_a; OP_ROL(); cpu->r_a = val; NEXT(2);
+        OPCODE(0x2E) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_ROL(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0x36) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_ROL(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0x3E) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_ROL(); write_u8(cpu, addr, val); NEXT(7 + extra);
+        OPCODE(0x66) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_ROR(); write_u8(cpu, addr, val); NEXT(5);
+        OPCODE(0x6A) SKIP(1); val = cpu->r_a; OP_ROR(); cpu->r_a = val; NEXT(2);
+        OPCODE(0x6E) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_ROR(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0x76) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_ROR(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0x7E) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_ROR(); write_u8(cpu, addr, val); NEXT(7 + extra);
+        OPCODE(0xE6) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_INC(); write_u8(cpu, addr, val); NEXT(5);
+        OPCODE(0xEE) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_INC(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0xF6) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_INC(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0xFE) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_INC(); write_u8(cpu, addr, val); NEXT(7 + extra);
+        OPCODE(0xC6) ADDR_ZP(); SKIP(2); val = read_u8(cpu, addr); OP_DEC(); write_u8(cpu, addr, val); NEXT(5);
+        OPCODE(0xCE) ADDR_ABS(); SKIP(3); val = read_u8(cpu, addr); OP_DEC(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0xD6) ADDR_ZPX(); SKIP(2); val = read_u8(cpu, addr); OP_DEC(); write_u8(cpu, addr, val); NEXT(6);
+        OPCODE(0xDE) ADDR_ABX(); SKIP(3); val = read_u8(cpu, addr); OP_DEC(); write_u8(cpu, addr, val); NEXT(7 + extra);
+
+        // Register increments and transfers
+        OPCODE(0xE8) SKIP(1); OP_INX(); NEXT(2);
+        OPCODE(0xC8) SKIP(1); OP_INY(); NEXT(2);
+        OPCODE(0xCA) SKIP(1); OP_DEX(); NEXT(2);
+        OPCODE(0x88) SKIP(1); OP_DEY(); NEXT(2);
+        OPCODE(0xAA) SKIP(1); OP_TAX(); NEXT(2);
+        OPCODE(0xA8) SKIP(1); OP_TAY(); NEXT(2);
+        OPCODE(0x8A) SKIP(1); OP_TXA(); NEXT(2);
+        OPCODE(0x98) SKIP(1); OP_TYA(); NEXT(2);
+        OPCODE(0xBA) SKIP(1); OP_TSX(); NEXT(2);
+        OPCODE(0x9A) SKIP(1); OP_TXS(); NEXT(2);
+
+        // Status flags
+        OPCODE(0x18) SKIP(1); OP_CLC(); NEXT(2);
+        OPCODE(0xD8) SKIP(1); OP_CLD(); NEXT(2);
+        OPCODE(0x58) SKIP(1); OP_CLI(); NEXT(2);
+        OPCODE(0xB8) SKIP(1); OP_CLV(); NEXT(2);
+        OPCODE(0x38) SKIP(1); OP_SEC(); NEXT(2);
+        OPCODE(0xF8) SKIP(1); OP_SED(); NEXT(2);
+        OPCODE(0x78) SKIP(1); OP_SEI(); NEXT(2);
+
+        // Branches
+        OPCODE(0x90) BRANCH(!flags.c); NEXT(2 + extra);
+        OPCODE(0xB0) BRANCH(flags.c); NEXT(2 + extra);
+        OPCODE(0xF0) BRANCH(flags.z == 0); NEXT(2 + extra);
+        OPCODE(0xD0) BRANCH(flags.z != 0); NEXT(2 + extra);
+        OPCODE(0x30) BRANCH(flags.n & 0x80); NEXT(2 + extra);
+        OPCODE(0x10) BRANCH(!(flags.n & 0x80)); NEXT(2 + extra);
+        OPCODE(0x50) BRANCH(!(flags.v & 0x80)); NEXT(2 + extra);
+        OPCODE(0x70) BRANCH(flags.v & 0x80); NEXT(2 + extra);
+
+        // Jumps, subroutines, interrupts and the stack
+        OPCODE(0x4C) ADDR_ABS(); OP_JMP(); NEXT(3);
+        OPCODE(0x6C) ADDR_IND(); OP_JMP(); NEXT(5);
+        OPCODE(0x20) ADDR_ABS(); SKIP(3); OP_JSR(); NEXT(6);
+        OPCODE(0x60) SKIP(1); OP_RTS(); NEXT(6);
+        OPCODE(0x40) SKIP(1); OP_RTI(); NEXT(6);
+        OPCODE(0x00) SKIP(1); OP_BRK(); NEXT(7);
+        OPCODE(0x48) SKIP(1); OP_PHA(); NEXT(3);
+        OPCODE(0x08) SKIP(1); OP_PHP(); NEXT(3);
+        OPCODE(0x68) SKIP(1); OP_PLA(); NEXT(4);
+        OPCODE(0x28) SKIP(1); OP_PLP(); NEXT(4);
+        OPCODE(0xEA) SKIP(1); OP_NOP(); NEXT(2);
+
+        OPCODE_ILLEGAL
+            SKIP(1);
+            printf("Invalid instruction at address $%X. Increasing pc by 1\n", cpu->r_pc);
+            NEXT(0);
+#ifndef CPU_THREADED_DISPATCH
+        }
+#endif
+    }
+
+#ifdef CPU_THREADED_DISPATCH
+out:
+#endif
+    SYNC_FLAGS();
+    cpu->cycles = cycles;
+    cpu->instructions_performed = instructions;
+
+    return cycles - start_cycles;
+}
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "display.h"
+
+#ifdef PYROTOBOX_HAVE_SDL
+#include <stdatomic.h>
+
+#define SDL_MAIN_HANDLED
+#include <SDL.h>
+
+#include "frame_queue.h"
+#include "ntsc.h"
+#include "thread.h"
+#include "utils.h"
+#include "video.h"
+
+// Pacing of the presentation loop when the renderer cannot wait for the vertical blank
+#define NO_VSYNC_DELAY_MS 16
+
+// Everything SDL is done on the presentation thread: the window, the renderer and the
+// event loop. Uploads and presents block on the GPU driver and vsync there, the emulation
+// thread only ever publishes into the frame queue.
+struct Display {
+    Nes* nes;
+    FrameQueue* queue;
+    int scale;
+    // Frames go through the composite video filter when set, otherwise straight through
+    // the palette
+    NtscFilter* ntsc;
+    Thread thread;
+    _Atomic bool quit;
+    // start_display waits for the window to be open, or to have failed to
+    Mutex mutex;
+    CondVar opened;
+    bool started;
+    bool failed;
+    // Presentation thread only, reported by stop_display
+    u64 presents;
+    u64 conversions;
+    u64 convert_ns;
+};
+
+static void report_opened(Display* display, bool failed) {
+    lock_mutex(&display->mutex);
+    display->started = true;
+    display->failed = failed;
+    signal_cond_var(&display->opened);
+    unlock_mutex(&display->mutex);
+}
+
+static void present_frames(Display* display, SDL_Renderer* renderer, SDL_Texture* texture) {
+    SDL_RendererInfo info;
+    const bool vsync = SDL_GetRendererInfo(renderer, &info) == 0 && info.flags & SDL_RENDERER_PRESENTVSYNC;
+    bool shown = false;
+
+    while (!atomic_load_explicit(&display->quit, memory_order_acquire)) {
+        SDL_Event event;
+
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                stop_nes(display->nes);
+            } else if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && event.key.keysym.sym == SDLK_BACKSPACE) {
+                // Rewinds while held, the emulation thread steps back at its next frame
+                set_nes_rewinding(display->nes, event.type == SDL_KEYDOWN);
+            }
+        }
+
+        bool fresh;
+        const u8* frame = take_frame(display->queue, &fresh);
+        void* pixels;
+        int pitch;
+
+        // A frame that is shown again is already in the texture
+        if (frame && fresh && SDL_LockTexture(texture, NULL, &pixels, &pitch) == 0) {
+            const u64 start_ns = get_time_ns();
+
+            if (display->ntsc) {
+                // Odd frames are a dot short while rendering, which moves the subcarrier to
+                // the other of two phases every frame. The parity comes with the frame,
+                // dropped or repeated frames would put a count of our own out of step.
+                const NtscFrame ntsc_frame = {
+                    .out = pixels,
+                    .pitch = pitch,
+                    .frame = frame,
+                    .emphasis = &frame[NES_DISPLAY_FRAME_EMPHASIS],
+                    .phase = frame[NES_DISPLAY_FRAME_PARITY]
+                };
+
+                filter_ntsc_frame(display->ntsc, &ntsc_frame);
+            } else {
+                convert_frame_to_argb(pixels, pitch, frame, PPU_FRAME_WIDTH, PPU_FRAME_HEIGHT, nes_palette_argb);
+            }
+
+            display->convert_ns += get_time_ns() - start_ns;
+            display->conversions++;
+            SDL_UnlockTexture(texture);
+            shown = true;
+        }
+
+        SDL_RenderClear(renderer);
+        if (shown) {
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+        }
+
+        // Waits for the vertical blank
+        SDL_RenderPresent(renderer);
+        display->presents++;
+
+        if (!vsync) {
+            SDL_Delay(NO_VSYNC_DELAY_MS);
+        }
+    }
+}
+
+static void run_display(void* arg) {
+    Display* display = arg;
+    SDL_Window* window = NULL;
+    SDL_Renderer* renderer = NULL;
+    SDL_Texture* texture = NULL;
+
+    // SIGINT stays with pyrotobox's own handler
+    SDL_SetHint(SDL_HINT_NO_SIGNAL_HANDLERS, "1");
+
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        fprintf(stderr, "Could not initialize SDL: %s\n", SDL_GetError());
+        report_opened(display, true);
+        return;
+    }
+
+    window = SDL_CreateWindow("pyrotobox", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                              PPU_FRAME_WIDTH * display->scale, PPU_FRAME_HEIGHT * display->scale,
+                              SDL_WINDOW_RESIZABLE);
+    if (window) {
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    }
+
+    if (renderer) {
+        const int width = display->ntsc ? NTSC_OUTPUT_WIDTH : PPU_FRAME_WIDTH;
+        const int height = display->ntsc ? NTSC_OUTPUT_HEIGHT : PPU_FRAME_HEIGHT;
+
+        // Scales the frame to the window and keeps its aspect ratio
+        SDL_RenderSetLogicalSize(renderer, width, height);
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    }
+
+    if (!texture) {
+        fprintf(stderr, "Could not open a window: %s\n", SDL_GetError());
+    }
+
+    report_opened(display, !texture);
+
+    if (texture) {
+        present_frames(display, renderer, texture);
+        SDL_DestroyTexture(texture);
+    }
+
+    if (renderer) {
+        SDL_DestroyRenderer(renderer);
+    }
+
+    if (window) {
+        SDL_DestroyWindow(window);
+    }
+
+    SDL_Quit();
+}
+
+Display* start_display(Nes* nes, int scale, bool ntsc) {
+    Display* display = calloc(1, sizeof(Display));
+    const u32 cpus = get_cpu_count();
+
+    display->nes = nes;
+    display->queue = build_frame_queue(NES_DISPLAY_FRAME_SIZE);
+    display->scale = scale;
+    // Every hardware thread but the emulation's
+    display->ntsc = ntsc ? build_ntsc_filter(cpus > 1 ? cpus - 1 : 1) : NULL;
+    atomic_init(&display->quit, false);
+    init_mutex(&display->mutex);
+    init_cond_var(&display->opened);
+
+    if (start_thread(&display->thread, run_display, display)) {
+        lock_mutex(&display->mutex);
+        while (!display->started) {
+            wait_cond_var(&display->opened, &display->mutex);
+        }
+        unlock_mutex(&display->mutex);
+
+        if (!display->failed) {
+            nes->frame_queue = display->queue;
+            return display;
+        }
+
+        join_thread(&display->thread);
+    }
+
+    if (display->ntsc) {
+        free_ntsc_filter(display->ntsc);
+    }
+
+    destroy_cond_var(&display->opened);
+    destroy_mutex(&display->mutex);
+    free_frame_queue(display->queue);
+    free(display);
+
+    return NULL;
+}
+
+void stop_display(Display* display) {
+    atomic_store_explicit(&display->quit, true, memory_order_release);
+    join_thread(&display->thread);
+    display->nes->frame_queue = NULL;
+
+    const FrameQueueStats stats = get_frame_queue_stats(display->queue);
+
+    fprintf(stderr, "[display] vsyncs: %llu, frames shown: %llu of %llu, dropped: %llu, duplicated: %llu\n",
+            (unsigned long long) display->presents,
+            (unsigned long long) stats.taken,
+            (unsigned long long) stats.published,
+            (unsigned long long) stats.dropped,
+            (unsigned long long) stats.duplicated);
+
+    if (display->ntsc) {
+        const NtscFilter* ntsc = display->ntsc;
+
+        fprintf(stderr, "[display] NTSC filter (%s, %u threads): %.1f us/frame at %dx%d\n",
+                ntsc_vector_isa(), ntsc->threads,
+                ntsc->frames > 0 ? ntsc->filter_ns / 1e3 / ntsc->frames : 0.0,
+                NTSC_OUTPUT_WIDTH, NTSC_OUTPUT_HEIGHT);
+        free_ntsc_filter(display->ntsc);
+    } else {
+        fprintf(stderr, "[display] conversion (%s): %.1f us/frame\n", video_vector_isa(),
+                display->conversions > 0 ? display->convert_ns / 1e3 / display->conversions : 0.0);
+    }
+
+    destroy_cond_var(&display->opened);
+    destroy_mutex(&display->mutex);
+    free_frame_queue(display->queue);
+    free(display);
+}
+#else
+Display* start_display(Nes __attribute__((__unused__)) *nes, int __attribute__((__unused__)) scale,
+                       bool __attribute__((__unused__)) ntsc) {
+    return NULL;
+}
+
+void stop_display(Display __attribute__((__unused__)) *display) {
+}
+#endif
@@ -0,0 +1,23 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdbool.h>
+#include "types.h"
+#include "nes.h"
+
+#define DISPLAY_DEFAULT_SCALE 3
+
+// Window that shows the frames of a Nes, see display.c
+typedef struct Display Display;
+
+// Opens a window scale times the size of a frame and starts the presentation thread, which
+// shows the newest frame of nes at every vertical blank until stop_display. Closing the
+// window stops nes, holding Backspace rewinds it when it keeps a history (see
+// enable_rewind). With ntsc the frames go through the composite video filter (see ntsc.h)
+// on every hardware thread but one. Returns NULL when pyrotobox was built without SDL or
+// there is no window to be had, nes then runs as before.
+Display* start_display(Nes* nes, int scale, bool ntsc);
+// Closes the window, waits for the presentation thread and detaches nes
+void stop_display(Display* display);
+
+#endif
@@ -0,0 +1,78 @@
+#include "frame_queue.h"
+
+#define SLOT_MASK 0x03
+
+// Only one thread ever writes each counter, a plain load and store is enough
+static inline void count(_Atomic u64* counter) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+FrameQueue* build_frame_queue(size_t frame_size) {
+    FrameQueue* queue = malloc(sizeof(FrameQueue));
+
+    queue->frame_size = frame_size;
+    for (int slot = 0; slot < FRAME_QUEUE_SLOTS; slot++) {
+        queue->slots[slot] = calloc(frame_size, sizeof(u8));
+    }
+
+    queue->back = 0;
+    queue->front = 1;
+    atomic_init(&queue->shared, 2);
+    atomic_init(&queue->published, 0);
+    atomic_init(&queue->dropped, 0);
+    atomic_init(&queue->taken, 0);
+    atomic_init(&queue->duplicated, 0);
+
+    return queue;
+}
+
+void free_frame_queue(FrameQueue* queue) {
+    for (int slot = 0; slot < FRAME_QUEUE_SLOTS; slot++) {
+        free(queue->slots[slot]);
+    }
+
+    free(queue);
+}
+
+u8* back_frame(FrameQueue* queue) {
+    return queue->slots[queue->back];
+}
+
+void publish_frame(FrameQueue* queue) {
+    // Release hands the frame over, acquire takes back the slot the consumer let go of
+    const u8 previous = atomic_exchange_explicit(&queue->shared, queue->back | FRAME_QUEUE_FRESH, memory_order_acq_rel);
+
+    queue->back = previous & SLOT_MASK;
+    count(&queue->published);
+
+    if (previous & FRAME_QUEUE_FRESH) {
+        count(&queue->dropped);
+    }
+}
+
+const u8* take_frame(FrameQueue* queue, bool* fresh) {
+    *fresh = atomic_load_explicit(&queue->shared, memory_order_relaxed) & FRAME_QUEUE_FRESH;
+
+    if (*fresh) {
+        // The producer only ever sets the flag, it is still there at the exchange
+        const u8 previous = atomic_exchange_explicit(&queue->shared, queue->front, memory_order_acq_rel);
+
+        queue->front = previous & SLOT_MASK;
+        count(&queue->taken);
+    } else if (atomic_load_explicit(&queue->taken, memory_order_relaxed) == 0) {
+        return NULL;
+    } else {
+        count(&queue->duplicated);
+    }
+
+    return queue->slots[queue->front];
+}
+
+FrameQueueStats get_frame_queue_stats(FrameQueue* queue) {
+    return (FrameQueueStats) {
+        .published = atomic_load_explicit(&queue->published, memory_order_relaxed),
+        .dropped = atomic_load_explicit(&queue->dropped, memory_order_relaxed),
+        .taken = atomic_load_explicit(&queue->taken, memory_order_relaxed),
+        .duplicated = atomic_load_explicit(&queue->duplicated, memory_order_relaxed)
+    };
+}
@@ -0,0 +1,57 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "types.h"
+
+// Slot the shared index points at has a frame the consumer has not taken yet
+#define FRAME_QUEUE_FRESH 0x04
+#define FRAME_QUEUE_SLOTS 3
+
+typedef struct FrameQueueStats {
+    u64 published;
+    // Frames overwritten by a newer one before the consumer took them
+    u64 dropped;
+    u64 taken;
+    // Takes that found no new frame and got the last one again
+    u64 duplicated;
+} FrameQueueStats;
+
+// Lock-free triple buffer between the emulation thread, which publishes every frame, and
+// one consumer that takes the newest frame whenever it is ready for one. The producer and
+// the consumer each own a slot and swap it with the shared one with a single atomic
+// exchange, neither of them ever waits for the other.
+typedef struct FrameQueue {
+    u8* slots[FRAME_QUEUE_SLOTS];
+    size_t frame_size;
+    // Index of the slot in the middle, with FRAME_QUEUE_FRESH
+    _Atomic u8 shared;
+    // Only touched by the producer
+    u8 back;
+    // Only touched by the consumer
+    u8 front;
+    // Written by one side each, relaxed so the other can read them for reports
+    _Atomic u64 published;
+    _Atomic u64 dropped;
+    _Atomic u64 taken;
+    _Atomic u64 duplicated;
+} FrameQueue;
+
+FrameQueue* build_frame_queue(size_t frame_size);
+void free_frame_queue(FrameQueue* queue);
+
+// Producer side, the frame_size bytes to put the next frame into. It is handed over to
+// the consumer by publish_frame.
+u8* back_frame(FrameQueue* queue);
+void publish_frame(FrameQueue* queue);
+// Consumer side, the newest published frame or NULL before the first one. *fresh tells
+// whether it differs from what the last call returned. The frame stays valid and
+// unchanged until the next call.
+const u8* take_frame(FrameQueue* queue, bool* fresh);
+
+FrameQueueStats get_frame_queue_stats(FrameQueue* queue);
+
+#endif
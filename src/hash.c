@@ -0,0 +1,235 @@
+#include <string.h>
+
+#include "hash.h"
+#include "thread.h"
+
+#if defined(__SHA__) && defined(__SSE4_1__)
+#include <immintrin.h>
+#define SHA1_NI
+#endif
+
+#define CRC32_POLYNOMIAL 0xEDB88320u
+
+// Slice-by-8: crc32_tables[k][b] is the CRC of byte b followed by k zero bytes, so eight
+// bytes are folded in with eight independent lookups instead of a chain of eight
+static u32 crc32_tables[8][256];
+static Once crc32_tables_once = ONCE_INIT;
+
+static void build_crc32_tables(void) {
+    for (u32 byte = 0; byte < 256; byte++) {
+        u32 crc = byte;
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc >> 1 ^ (crc & 1 ? CRC32_POLYNOMIAL : 0);
+        }
+
+        crc32_tables[0][byte] = crc;
+    }
+
+    for (u32 byte = 0; byte < 256; byte++) {
+        for (int k = 1; k < 8; k++) {
+            const u32 prev = crc32_tables[k - 1][byte];
+            crc32_tables[k][byte] = prev >> 8 ^ crc32_tables[0][prev & 0xFF];
+        }
+    }
+}
+
+static inline u32 load_le32(const u8* p) {
+    return (u32) p[0] | (u32) p[1] << 8 | (u32) p[2] << 16 | (u32) p[3] << 24;
+}
+
+static inline u32 load_be32(const u8* p) {
+    return (u32) p[0] << 24 | (u32) p[1] << 16 | (u32) p[2] << 8 | (u32) p[3];
+}
+
+u32 crc32(u32 crc, const u8* data, size_t size) {
+    run_once(&crc32_tables_once, build_crc32_tables);
+
+    const u32 (*t)[256] = (const u32 (*)[256]) crc32_tables;
+    crc = ~crc;
+
+    for (; size >= 8; size -= 8, data += 8) {
+        const u32 low = load_le32(data) ^ crc;
+        const u32 high = load_le32(data + 4);
+
+        crc = t[7][low & 0xFF] ^ t[6][low >> 8 & 0xFF] ^ t[5][low >> 16 & 0xFF] ^ t[4][low >> 24]
+            ^ t[3][high & 0xFF] ^ t[2][high >> 8 & 0xFF] ^ t[1][high >> 16 & 0xFF] ^ t[0][high >> 24];
+    }
+
+    for (; size > 0; size--, data++) {
+        crc = crc >> 8 ^ t[0][(crc ^ *data) & 0xFF];
+    }
+
+    return ~crc;
+}
+
+static inline u32 rotl32(u32 val, int shift) {
+    return val << shift | val >> (32 - shift);
+}
+
+#ifdef SHA1_NI
+// Four rounds per step g (0-19), the message schedule runs three steps ahead in msg[].
+// e[] alternates between the E of the current and of the next four rounds.
+#define SHA1_NI_STEP(g) do { \
+    if ((g) < 4) { \
+        msg[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) &data[(g) * 16]), byte_swap); \
+    } \
+    e[(g) & 1] = (g) == 0 ? _mm_add_epi32(e[0], msg[0]) : _mm_sha1nexte_epu32(e[(g) & 1], msg[(g) % 4]); \
+    e[((g) + 1) & 1] = abcd; \
+    if ((g) >= 3 && (g) <= 18) { \
+        msg[((g) + 1) % 4] = _mm_sha1msg2_epu32(msg[((g) + 1) % 4], msg[(g) % 4]); \
+    } \
+    abcd = _mm_sha1rnds4_epu32(abcd, e[(g) & 1], (g) / 5); \
+    if ((g) >= 1 && (g) <= 16) { \
+        msg[((g) + 3) % 4] = _mm_sha1msg1_epu32(msg[((g) + 3) % 4], msg[(g) % 4]); \
+    } \
+    if ((g) >= 2 && (g) <= 17) { \
+        msg[((g) + 2) % 4] = _mm_xor_si128(msg[((g) + 2) % 4], msg[(g) % 4]); \
+    } \
+} while (0)
+
+static void sha1_blocks(u32 state[5], const u8* data, size_t blocks) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0001020304050607LL, 0x08090A0B0C0D0E0FLL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state), 0x1B);
+    __m128i e[2] = {_mm_set_epi32(state[4], 0, 0, 0), _mm_setzero_si128()};
+    __m128i msg[4];
+
+    for (; blocks > 0; blocks--, data += SHA1_BLOCK_SIZE) {
+        const __m128i abcd_save = abcd;
+        const __m128i e_save = e[0];
+
+        SHA1_NI_STEP(0);  SHA1_NI_STEP(1);  SHA1_NI_STEP(2);  SHA1_NI_STEP(3);
+        SHA1_NI_STEP(4);  SHA1_NI_STEP(5);  SHA1_NI_STEP(6);  SHA1_NI_STEP(7);
+        SHA1_NI_STEP(8);  SHA1_NI_STEP(9);  SHA1_NI_STEP(10); SHA1_NI_STEP(11);
+        SHA1_NI_STEP(12); SHA1_NI_STEP(13); SHA1_NI_STEP(14); SHA1_NI_STEP(15);
+        SHA1_NI_STEP(16); SHA1_NI_STEP(17); SHA1_NI_STEP(18); SHA1_NI_STEP(19);
+
+        e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i*) state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = _mm_extract_epi32(e[0], 3);
+}
+#else
+// Round functions of the four groups of 20 rounds
+#define SHA1_CHOOSE(b, c, d) (((c ^ d) & b) ^ d)
+#define SHA1_PARITY(b, c, d) (b ^ c ^ d)
+#define SHA1_MAJORITY(b, c, d) ((b & c) | ((b | c) & d))
+
+// One round. The variables rotate instead of being shifted through, and the message
+// schedule is kept as a ring of the last 16 words.
+#define SHA1_ROUND(a, b, c, d, e, i, f, k) do { \
+    if ((i) >= 16) { \
+        w[(i) & 15] = rotl32(w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^ w[((i) + 2) & 15] ^ w[(i) & 15], 1); \
+    } \
+    e += rotl32(a, 5) + f(b, c, d) + (k) + w[(i) & 15]; \
+    b = rotl32(b, 30); \
+} while (0)
+
+// Five rounds bring the variables back to their places
+#define SHA1_FIVE_ROUNDS(i, f, k) do { \
+    SHA1_ROUND(a, b, c, d, e, (i), f, k); \
+    SHA1_ROUND(e, a, b, c, d, (i) + 1, f, k); \
+    SHA1_ROUND(d, e, a, b, c, (i) + 2, f, k); \
+    SHA1_ROUND(c, d, e, a, b, (i) + 3, f, k); \
+    SHA1_ROUND(b, c, d, e, a, (i) + 4, f, k); \
+} while (0)
+
+static void sha1_blocks(u32 state[5], const u8* data, size_t blocks) {
+    for (; blocks > 0; blocks--, data += SHA1_BLOCK_SIZE) {
+        u32 w[16];
+
+        for (int i = 0; i < 16; i++) {
+            w[i] = load_be32(&data[i * 4]);
+        }
+
+        u32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+        for (int i = 0; i < 20; i += 5) {
+            SHA1_FIVE_ROUNDS(i, SHA1_CHOOSE, 0x5A827999);
+        }
+
+        for (int i = 20; i < 40; i += 5) {
+            SHA1_FIVE_ROUNDS(i, SHA1_PARITY, 0x6ED9EBA1);
+        }
+
+        for (int i = 40; i < 60; i += 5) {
+            SHA1_FIVE_ROUNDS(i, SHA1_MAJORITY, 0x8F1BBCDC);
+        }
+
+        for (int i = 60; i < 80; i += 5) {
+            SHA1_FIVE_ROUNDS(i, SHA1_PARITY, 0xCA62C1D6);
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+#endif
+
+const char* sha1_isa(void) {
+#ifdef SHA1_NI
+    return "sha-ni";
+#else
+    return "scalar";
+#endif
+}
+
+void init_sha1(Sha1* sha1) {
+    sha1->state[0] = 0x67452301;
+    sha1->state[1] = 0xEFCDAB89;
+    sha1->state[2] = 0x98BADCFE;
+    sha1->state[3] = 0x10325476;
+    sha1->state[4] = 0xC3D2E1F0;
+    sha1->size = 0;
+}
+
+void update_sha1(Sha1* sha1, const u8* data, size_t size) {
+    const size_t buffered = sha1->size % SHA1_BLOCK_SIZE;
+    sha1->size += size;
+
+    if (buffered > 0) {
+        const size_t fill = SHA1_BLOCK_SIZE - buffered < size ? SHA1_BLOCK_SIZE - buffered : size;
+
+        memcpy(&sha1->block[buffered], data, fill);
+        data += fill;
+        size -= fill;
+
+        if (buffered + fill < SHA1_BLOCK_SIZE) {
+            return;
+        }
+
+        sha1_blocks(sha1->state, sha1->block, 1);
+    }
+
+    // Whole blocks are hashed in place, only the tail is buffered
+    sha1_blocks(sha1->state, data, size / SHA1_BLOCK_SIZE);
+    memcpy(sha1->block, &data[size - size % SHA1_BLOCK_SIZE], size % SHA1_BLOCK_SIZE);
+}
+
+void finish_sha1(Sha1* sha1, u8 digest[SHA1_DIGEST_SIZE]) {
+    const u64 bits = sha1->size * 8;
+    const size_t buffered = sha1->size % SHA1_BLOCK_SIZE;
+    // 0x80, zeros up to 8 bytes before the end of a block, then the size in bits
+    const size_t padding = (buffered < SHA1_BLOCK_SIZE - 8 ? SHA1_BLOCK_SIZE : 2 * SHA1_BLOCK_SIZE) - 8 - buffered;
+    u8 tail[2 * SHA1_BLOCK_SIZE];
+
+    memset(tail, 0, sizeof(tail));
+    tail[0] = 0x80;
+    for (int i = 0; i < 8; i++) {
+        tail[padding + i] = bits >> (56 - 8 * i);
+    }
+
+    update_sha1(sha1, tail, padding + 8);
+
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = sha1->state[i] >> 24;
+        digest[i * 4 + 1] = sha1->state[i] >> 16;
+        digest[i * 4 + 2] = sha1->state[i] >> 8;
+        digest[i * 4 + 3] = sha1->state[i];
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdlib.h>
+#include "types.h"
+
+#define SHA1_DIGEST_SIZE 20
+#define SHA1_BLOCK_SIZE 64
+
+// CRC-32 (IEEE 802.3, the one of zip files and ROM databases). Chains like zlib's crc32:
+// start with 0 and feed the result back in, crc32(crc32(0, a), b) is the CRC of a then b.
+u32 crc32(u32 crc, const u8* data, size_t size);
+
+// Streaming SHA-1
+typedef struct Sha1 {
+    u32 state[5];
+    u64 size;
+    u8 block[SHA1_BLOCK_SIZE];
+} Sha1;
+
+void init_sha1(Sha1* sha1);
+void update_sha1(Sha1* sha1, const u8* data, size_t size);
+void finish_sha1(Sha1* sha1, u8 digest[SHA1_DIGEST_SIZE]);
+
+// Instruction set of the SHA-1 block function, picked at compile time like the batch
+// kernels: "sha-ni" needs a build for a CPU that has it (e.g. -DPYROTOBOX_NATIVE_ARCH=ON)
+const char* sha1_isa(void);
+
+#endif
@@ -1,12 +1,19 @@
+#ifndef WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
 #include <stdio.h>
 
 #include "io_utils.h"
 // If the platform is Windows, then compile the access function accordingly
 #ifdef WIN32
     #include <io.h>
+    #include <windows.h>
     #define F_OK 0
     #define access _access
 #else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
     #include <unistd.h>
 #endif
 
@@ -69,3 +76,110 @@ rom_read_result read_rom_bin(const char* rom_bin_path) {
 
     return result;
 }
+
+// Maps the whole file read-only, NULL if the platform refuses or the size is out of bounds
+static const u8* map_file(const char* path, size_t min_size, size_t max_size, size_t* size) {
+#ifndef WIN32
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < min_size || (size_t) st.st_size > max_size) {
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping keeps the file referenced, the descriptor is not needed anymore
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return data;
+#else
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER file_size;
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+
+    if (!GetFileSizeEx(file, &file_size) || (size_t) file_size.QuadPart < min_size || (size_t) file_size.QuadPart > max_size) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const u8* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+    // The view keeps the mapping and the file alive
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+
+    *size = file_size.QuadPart;
+    return data;
+#endif
+}
+
+rom_map_result map_rom_file(const char* rom_bin_path) {
+    rom_map_result result = (rom_map_result) {.valid = false};
+    size_t size = 0;
+    const u8* data = map_file(rom_bin_path, MIN_ROM_BIN_SIZE, MAX_ROM_BIN_SIZE, &size);
+
+    if (data) {
+        result.image = (RomImage) {.data = data, .size = size, .mapped = true};
+        result.valid = true;
+        return result;
+    }
+
+    // read_rom_bin reports what is wrong with the file
+    const rom_read_result read_result = read_rom_bin(rom_bin_path);
+
+    if (read_result.valid) {
+        result.image = (RomImage) {.data = read_result.rom_bin, .size = read_result.size, .mapped = false};
+        result.valid = true;
+    }
+
+    return result;
+}
+
+rom_map_result map_file_image(const char* path, size_t max_size) {
+    rom_map_result result = (rom_map_result) {.valid = false};
+    size_t size = 0;
+    // Empty files cannot be mapped
+    const u8* data = map_file(path, 1, max_size, &size);
+
+    if (data) {
+        result.image = (RomImage) {.data = data, .size = size, .mapped = true};
+        result.valid = true;
+    }
+
+    return result;
+}
+
+void release_rom_image(RomImage* image) {
+    if (!image->data) {
+        return;
+    }
+
+    if (!image->mapped) {
+        free((u8*) image->data);
+    } else {
+#ifndef WIN32
+        munmap((void*) image->data, image->size);
+#else
+        UnmapViewOfFile(image->data);
+#endif
+    }
+
+    image->data = NULL;
+    image->size = 0;
+}
@@ -13,4 +13,24 @@ typedef struct rom_read_result {
 
 rom_read_result read_rom_bin(const char* rom_bin_path);
 
+// ROM bytes the emulator reads in place. Mapped images are read-only private file
+// mappings, so every instance of the same ROM shares the same physical pages.
+typedef struct RomImage {
+    const u8* data;
+    size_t size;
+    // Whether data is a file mapping, otherwise it is a heap buffer owned by the image
+    bool mapped;
+} RomImage;
+
+typedef struct rom_map_result {
+    bool valid;
+    RomImage image;
+} rom_map_result;
+
+// Maps the ROM file read-only, falls back to reading it where mapping is not possible
+rom_map_result map_rom_file(const char* rom_bin_path);
+// Maps any other file read-only in the same way, without the fallback and quietly
+rom_map_result map_file_image(const char* path, size_t max_size);
+void release_rom_image(RomImage* image);
+
 #endif
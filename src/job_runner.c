@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "job_runner.h"
+#include "io_utils.h"
+#include "nes.h"
+#include "thread.h"
+#include "utils.h"
+
+#define JOB_LIST_MAX_LINE 4096
+#define MOVIE_BYTES_PER_FRAME 2
+#define WORK_RAM_SIZE 0x800
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+// Queued job indices of one worker. The owner takes jobs from the bottom, thieves from
+// the top. Jobs never spawn jobs, so a mutex per queue is all the synchronization needed
+// and it is only ever contended while stealing.
+typedef struct JobQueue {
+    Mutex lock;
+    size_t* jobs;
+    size_t top;
+    size_t bottom;
+} JobQueue;
+
+struct JobRunner;
+
+typedef struct Worker {
+    struct JobRunner* runner;
+    u32 id;
+    JobQueue queue;
+    u64 rng;
+    u64 busy_ns;
+    u64 steals;
+    Thread thread;
+} Worker;
+
+typedef struct JobRunner {
+    const JobList* job_list;
+    const JobRunnerOptions* options;
+    Worker* workers;
+    u32 worker_count;
+    Mutex result_lock;
+    job_result_handler on_result;
+    void* ctx;
+} JobRunner;
+
+typedef struct movie_read_result {
+    bool valid;
+    u8* movie;
+    size_t frames;
+} movie_read_result;
+
+static char* copy_string(const char* str) {
+    const size_t size = strlen(str) + 1;
+    char* copy = malloc(size);
+
+    if (copy) {
+        memcpy(copy, str, size);
+    }
+
+    return copy;
+}
+
+job_list_read_result read_job_list(const char* job_list_path) {
+    job_list_read_result result = (job_list_read_result) {.valid = false, .job_list = NULL};
+    FILE* file = fopen(job_list_path, "r");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Unable to open the job list. Given Path: %s\n", job_list_path);
+        return result;
+    }
+
+    JobList* job_list = calloc(1, sizeof(JobList));
+    size_t capacity = 0;
+    char line[JOB_LIST_MAX_LINE];
+    size_t line_number = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        const char* rom_path = strtok(line, " \t\r\n");
+        const char* frames_str = strtok(NULL, " \t\r\n");
+        const char* movie_path = strtok(NULL, " \t\r\n");
+
+        if (!rom_path) {
+            continue;
+        }
+
+        char* end = NULL;
+        const unsigned long long frames = frames_str ? strtoull(frames_str, &end, 10) : 0;
+
+        if (!frames_str || *end != '\0' || frames == 0 || strtok(NULL, " \t\r\n")) {
+            fprintf(stderr, "ERROR: Invalid job on line %zu of %s, expected ROM_PATH FRAMES [MOVIE_PATH]\n",
+                    line_number, job_list_path);
+            free_job_list(job_list);
+            fclose(file);
+            return result;
+        }
+
+        if (job_list->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            job_list->jobs = realloc(job_list->jobs, capacity * sizeof(Job));
+        }
+
+        job_list->jobs[job_list->count++] = (Job) {
+            .rom_path = copy_string(rom_path),
+            .movie_path = movie_path ? copy_string(movie_path) : NULL,
+            .frames = frames
+        };
+    }
+
+    fclose(file);
+
+    result.job_list = job_list;
+    result.valid = true;
+
+    return result;
+}
+
+void free_job_list(JobList* job_list) {
+    for (size_t i = 0; i < job_list->count; i++) {
+        free(job_list->jobs[i].rom_path);
+        free(job_list->jobs[i].movie_path);
+    }
+
+    free(job_list->jobs);
+    free(job_list);
+}
+
+const char* job_status_name(JobStatus status) {
+    switch (status) {
+        case JOB_OK:
+            return "ok";
+        case JOB_ROM_FAILED:
+            return "rom_failed";
+        case JOB_MOVIE_FAILED:
+            return "movie_failed";
+        case JOB_CPU_STOPPED:
+            return "cpu_stopped";
+    }
+
+    return "unknown";
+}
+
+static movie_read_result read_movie(const char* movie_path) {
+    movie_read_result result = (movie_read_result) {.valid = false, .movie = NULL, .frames = 0};
+    FILE* file = fopen(movie_path, "rb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Unable to open the input movie. Given Path: %s\n", movie_path);
+        return result;
+    }
+
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (size < 0 || size % MOVIE_BYTES_PER_FRAME != 0) {
+        fprintf(stderr, "ERROR: Input movie size must be a multiple of %d bytes. Given Path: %s\n",
+                MOVIE_BYTES_PER_FRAME, movie_path);
+        fclose(file);
+        return result;
+    }
+
+    u8* movie = malloc(size > 0 ? size : 1);
+
+    if (!movie || fread(movie, 1, size, file) != (size_t) size) {
+        fprintf(stderr, "ERROR: Unable to read the input movie. Given Path: %s\n", movie_path);
+        free(movie);
+        fclose(file);
+        return result;
+    }
+
+    fclose(file);
+
+    result.movie = movie;
+    result.frames = size / MOVIE_BYTES_PER_FRAME;
+    result.valid = true;
+
+    return result;
+}
+
+static u64 hash_bytes(u64 hash, const u8* bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static void run_job(const JobRunnerOptions* options, const Job* job, JobResult* result) {
+    movie_read_result movie = (movie_read_result) {.valid = true, .movie = NULL, .frames = 0};
+
+    if (job->movie_path) {
+        movie = read_movie(job->movie_path);
+
+        if (!movie.valid) {
+            result->status = JOB_MOVIE_FAILED;
+            return;
+        }
+    }
+
+    // Jobs of the same ROM share its pages instead of each holding a copy
+    rom_map_result rom = map_rom_file(job->rom_path);
+
+    if (!rom.valid) {
+        free(movie.movie);
+        result->status = JOB_ROM_FAILED;
+        return;
+    }
+
+    const build_nes_result_t build_nes_result = build_nes_from_rom_image(&rom.image);
+
+    if (!build_nes_result.valid) {
+        free(movie.movie);
+        result->status = JOB_ROM_FAILED;
+        return;
+    }
+
+    Nes* nes = build_nes_result.nes;
+    nes->cpu->core = options->core;
+    if (!options->decode_cache) {
+        disable_decode_cache(nes->cpu);
+    }
+    set_pacing_mode(&nes->pacer, PACING_UNCAPPED);
+
+    // Frames are run one at a time so the movie input can change in between
+    const StopCondition one_frame = {.max_frames = 1};
+    result->status = JOB_OK;
+
+    while (result->frames < job->frames) {
+        const size_t frame = result->frames;
+        const bool has_input = frame < movie.frames;
+
+        nes->controllers[0].buttons = has_input ? movie.movie[frame * MOVIE_BYTES_PER_FRAME] : 0;
+        nes->controllers[1].buttons = has_input ? movie.movie[frame * MOVIE_BYTES_PER_FRAME + 1] : 0;
+
+        const RunSummary summary = run_nes_until(nes, &one_frame);
+        result->frames += summary.frames;
+        result->cycles += summary.cycles;
+        result->instructions += summary.instructions;
+
+        if (summary.reason != STOP_FRAME_LIMIT) {
+            result->status = JOB_CPU_STOPPED;
+            break;
+        }
+    }
+
+    u64 hash = hash_bytes(FNV_OFFSET_BASIS, nes->cpu->mem, WORK_RAM_SIZE);
+    result->state_hash = hash_bytes(hash, nes->ppu->framebuffer, sizeof(nes->ppu->framebuffer));
+
+    free_nes(nes);
+    free(movie.movie);
+}
+
+static bool pop_job(JobQueue* queue, size_t* job) {
+    lock_mutex(&queue->lock);
+    const bool found = queue->bottom > queue->top;
+
+    if (found) {
+        *job = queue->jobs[--queue->bottom];
+    }
+
+    unlock_mutex(&queue->lock);
+    return found;
+}
+
+static bool steal_job(JobQueue* queue, size_t* job) {
+    lock_mutex(&queue->lock);
+    const bool found = queue->bottom > queue->top;
+
+    if (found) {
+        *job = queue->jobs[queue->top++];
+    }
+
+    unlock_mutex(&queue->lock);
+    return found;
+}
+
+// xorshift64, only used to spread the thieves over the victims
+static u64 next_random(u64* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static bool take_job(Worker* worker, size_t* job) {
+    if (pop_job(&worker->queue, job)) {
+        return true;
+    }
+
+    JobRunner* runner = worker->runner;
+    const u32 first_victim = next_random(&worker->rng) % runner->worker_count;
+
+    // No job is ever queued again, so once every queue is empty the worker is done
+    for (u32 i = 0; i < runner->worker_count; i++) {
+        Worker* victim = &runner->workers[(first_victim + i) % runner->worker_count];
+
+        if (victim != worker && steal_job(&victim->queue, job)) {
+            worker->steals++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void worker_main(void* arg) {
+    Worker* worker = arg;
+    JobRunner* runner = worker->runner;
+    size_t index;
+
+    while (take_job(worker, &index)) {
+        const Job* job = &runner->job_list->jobs[index];
+        JobResult result;
+
+        memset(&result, 0, sizeof(result));
+        result.job = index;
+        result.worker = worker->id;
+
+        const u64 start_ns = get_time_ns();
+        run_job(runner->options, job, &result);
+        result.wall_ns = get_time_ns() - start_ns;
+        worker->busy_ns += result.wall_ns;
+
+        if (runner->on_result) {
+            lock_mutex(&runner->result_lock);
+            runner->on_result(runner->ctx, job, &result);
+            unlock_mutex(&runner->result_lock);
+        }
+    }
+}
+
+// A job's length carried along with it, qsort has no way to hand the comparator the list
+typedef struct JobOrder {
+    u64 frames;
+    size_t index;
+} JobOrder;
+
+static int compare_job_frames(const void* a, const void* b) {
+    const JobOrder* x = a;
+    const JobOrder* y = b;
+
+    if (x->frames != y->frames) {
+        return (x->frames > y->frames) - (x->frames < y->frames);
+    }
+
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+JobRunnerStats run_jobs(const JobList* job_list, const JobRunnerOptions* options,
+                        job_result_handler on_result, void* ctx) {
+    u32 worker_count = options->threads ? options->threads : get_cpu_count();
+
+    if (job_list->count > 0 && worker_count > job_list->count) {
+        worker_count = job_list->count;
+    }
+
+    JobRunner runner = (JobRunner) {
+        .job_list = job_list,
+        .options = options,
+        .workers = calloc(worker_count, sizeof(Worker)),
+        .worker_count = worker_count,
+        .on_result = on_result,
+        .ctx = ctx
+    };
+    init_mutex(&runner.result_lock);
+
+    // Frame counts are the best estimate of the job lengths there is. Dealing the jobs
+    // out in ascending order leaves the longest ones at the bottom of every queue where
+    // their owners start, the short ones at the top are what gets stolen at the end.
+    JobOrder* order = malloc((job_list->count ? job_list->count : 1) * sizeof(JobOrder));
+    for (size_t i = 0; i < job_list->count; i++) {
+        order[i] = (JobOrder) {.frames = job_list->jobs[i].frames, .index = i};
+    }
+    qsort(order, job_list->count, sizeof(JobOrder), compare_job_frames);
+
+    for (u32 i = 0; i < worker_count; i++) {
+        Worker* worker = &runner.workers[i];
+        const size_t queued = job_list->count / worker_count + (i < job_list->count % worker_count);
+
+        worker->runner = &runner;
+        worker->id = i;
+        worker->rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+        worker->queue.jobs = malloc((queued ? queued : 1) * sizeof(size_t));
+        init_mutex(&worker->queue.lock);
+
+        for (size_t j = i; j < job_list->count; j += worker_count) {
+            worker->queue.jobs[worker->queue.bottom++] = order[j].index;
+        }
+    }
+
+    free(order);
+
+    const u64 start_ns = get_time_ns();
+
+    // The calling thread is worker 0
+    for (u32 i = 1; i < worker_count; i++) {
+        if (!start_thread(&runner.workers[i].thread, worker_main, &runner.workers[i])) {
+            fprintf(stderr, "ERROR: Unable to start worker thread %u, its jobs get stolen by the others\n", i);
+            runner.workers[i].id = UINT32_MAX;
+        }
+    }
+
+    if (worker_count > 0) {
+        worker_main(&runner.workers[0]);
+    }
+
+    JobRunnerStats stats = (JobRunnerStats) {.threads = worker_count, .jobs = job_list->count};
+
+    for (u32 i = 0; i < worker_count; i++) {
+        Worker* worker = &runner.workers[i];
+
+        if (i > 0 && worker->id != UINT32_MAX) {
+            join_thread(&worker->thread);
+        }
+
+        stats.busy_ns += worker->busy_ns;
+        stats.steals += worker->steals;
+        destroy_mutex(&worker->queue.lock);
+        free(worker->queue.jobs);
+    }
+
+    stats.wall_ns = get_time_ns() - start_ns;
+
+    destroy_mutex(&runner.result_lock);
+    free(runner.workers);
+
+    return stats;
+}
@@ -0,0 +1,81 @@
+#ifndef JOB_RUNNER_H
+#define JOB_RUNNER_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "types.h"
+#include "cpu.h"
+
+// One emulation job: run a ROM for a number of frames, optionally replaying an input movie.
+// Movies are raw files with 2 bytes per frame, the buttons of port 1 and port 2
+// (bit 0 A, B, Select, Start, Up, Down, Left, bit 7 Right). Buttons are released once
+// the movie runs out.
+typedef struct Job {
+    char* rom_path;
+    char* movie_path;
+    u64 frames;
+} Job;
+
+typedef struct JobList {
+    Job* jobs;
+    size_t count;
+} JobList;
+
+typedef struct job_list_read_result {
+    bool valid;
+    JobList* job_list;
+} job_list_read_result;
+
+typedef enum JobStatus {
+    JOB_OK,
+    JOB_ROM_FAILED,
+    JOB_MOVIE_FAILED,
+    // The CPU stopped before all frames ran, e.g. on a stack overflow
+    JOB_CPU_STOPPED
+} JobStatus;
+
+typedef struct JobResult {
+    size_t job;
+    JobStatus status;
+    u64 frames;
+    u64 cycles;
+    u64 instructions;
+    // Whole job including loading the ROM and the movie
+    u64 wall_ns;
+    // FNV-1a of the work RAM and the framebuffer after the last frame, for comparing replays
+    u64 state_hash;
+    u32 worker;
+} JobResult;
+
+typedef struct JobRunnerOptions {
+    // 0 picks one worker per hardware thread
+    u32 threads;
+    CpuCore core;
+    bool decode_cache;
+} JobRunnerOptions;
+
+typedef struct JobRunnerStats {
+    u32 threads;
+    size_t jobs;
+    u64 wall_ns;
+    // Sum of the time the workers spent inside jobs
+    u64 busy_ns;
+    u64 steals;
+} JobRunnerStats;
+
+// Called as soon as a job finishes, from the worker that ran it. Calls are serialized.
+typedef void (*job_result_handler)(void* ctx, const Job* job, const JobResult* result);
+
+// Job list file: one job per line, "ROM_PATH FRAMES [MOVIE_PATH]", # starts a comment
+job_list_read_result read_job_list(const char* job_list_path);
+void free_job_list(JobList* job_list);
+
+// Runs every job on a work-stealing pool, one Nes per job. Jobs are dealt out longest
+// first and idle workers steal the shortest queued jobs of others, so the workers stay
+// busy however uneven the job lengths are.
+JobRunnerStats run_jobs(const JobList* job_list, const JobRunnerOptions* options,
+                        job_result_handler on_result, void* ctx);
+
+const char* job_status_name(JobStatus status);
+
+#endif
@@ -1,9 +1,17 @@
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "types.h"
+#include "display.h"
 #include "io_utils.h"
 #include "nes.h"
+#include "job_runner.h"
+#include "rom_index.h"
+#include "save_state.h"
+#include "trace.h"
+#include "utils.h"
 
 //Versioning
 #define PYROTOBOX_MAJOR_VERSION 0
@@ -13,30 +21,205 @@
 #define INVALID_ARGUMENTS_ERROR_RETURN_CODE -1
 #define READ_ROM_BIN_FAILED_ERROR_RETURN_CODE -2
 #define NES_BUILD_FAILED_ERROR_RETURN_CODE -3
+#define STOP_CONDITION_NOT_MET_RETURN_CODE -4
+#define JOB_FAILED_RETURN_CODE -5
+#define SAVE_STATE_FAILED_RETURN_CODE -6
+#define INDEX_FAILED_RETURN_CODE -7
+#define TRACE_FAILED_RETURN_CODE -8
+
+#define DEFAULT_TRACE_RECORDS 0x100000
+// Range of --turbo, an NTSC frame then takes from about 1.7 s down to about 17 us
+#define MIN_TURBO 0.01
+#define MAX_TURBO 1000.0
+#define DEFAULT_ROM_INDEX_PATH "pyrotobox.idx"
 
 void print_help(void);
+static void print_run_summary(const RunSummary* summary);
+static int run_job_list(const char* job_list_path, const JobRunnerOptions* options);
+static Nes* build_shadow_mapping(const char* rom_bin_path, const Nes* nes);
+static bool load_state_file(Nes* nes, const char* path);
+static bool save_state_file(const Nes* nes, const char* path);
+static int run_index_command(int argc, char** argv);
+static void print_rom_info(const char* index_path, const char* rom_path, const RomImage* image);
+
+static Nes* running_nes = NULL;
+
+static void handle_sigint(int __attribute__((__unused__)) sig) {
+    if (running_nes) {
+        stop_nes(running_nes);
+    }
+}
+
+// Parses ADDR=VALUE of --until-mem
+static bool parse_memory_condition(const char* str, StopCondition* condition) {
+    const char* separator = strchr(str, '=');
+    char addr_str[16];
+    u64 addr, val;
+
+    if (!separator || (size_t) (separator - str) >= sizeof(addr_str)) {
+        return false;
+    }
+
+    memcpy(addr_str, str, separator - str);
+    addr_str[separator - str] = '\0';
+
+    if (!parse_number(addr_str, 0xFFFF, &addr) || !parse_number(separator + 1, 0xFF, &val)) {
+        return false;
+    }
+
+    condition->watch_memory = true;
+    condition->memory_addr = addr;
+    condition->memory_val = val;
+    return true;
+}
+
+// Parses the FACTOR of --turbo, the whole string has to be a number in range
+static bool parse_turbo(const char* str, double* out) {
+    char* end;
+    const double val = strtod(str, &end);
+
+    // Also false for NaN
+    if (end == str || *end != '\0' || !(val >= MIN_TURBO && val <= MAX_TURBO)) {
+        return false;
+    }
+
+    *out = val;
+    return true;
+}
 
 int main(int argc, char** argv) {
-    if (argc < 2) { 
+    const char* rom_bin_path = NULL;
+    CpuCore cpu_core = CPU_CORE_THREADED;
+    const char* trace_path = NULL;
+    size_t trace_records = DEFAULT_TRACE_RECORDS;
+    bool decode_cache = true;
+    TvSystem tv_system = TV_NTSC;
+    bool uncapped = false;
+    double turbo = 1.0;
+    bool headless = false;
+    bool ntsc_filter = false;
+    StopCondition stop_condition = {0};
+    const char* job_list_path = NULL;
+    const char* load_state_path = NULL;
+    const char* save_state_path = NULL;
+    u64 rewind_mib = 0;
+    u32 run_ahead_frames = 0;
+    bool run_ahead_instance = false;
+    u32 threads = 0;
+    const char* index_path = NULL;
+    u64 number;
+
+    if (argc > 1 && strcmp(argv[1], "index") == 0) {
+        return run_index_command(argc - 2, argv + 2);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--core=threaded") == 0) {
+            cpu_core = CPU_CORE_THREADED;
+        } else if (strcmp(argv[i], "--core=reference") == 0) {
+            cpu_core = CPU_CORE_REFERENCE;
+        } else if (strcmp(argv[i], "--no-decode-cache") == 0) {
+            decode_cache = false;
+        } else if (strcmp(argv[i], "--region=ntsc") == 0) {
+            tv_system = TV_NTSC;
+        } else if (strcmp(argv[i], "--region=pal") == 0) {
+            tv_system = TV_PAL;
+        } else if (strcmp(argv[i], "--uncapped") == 0) {
+            uncapped = true;
+        } else if (strncmp(argv[i], "--turbo=", 8) == 0 && parse_turbo(argv[i] + 8, &turbo)) {
+            continue;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--ntsc-filter") == 0) {
+            ntsc_filter = true;
+        } else if (strncmp(argv[i], "--frames=", 9) == 0 && parse_number(argv[i] + 9, UINT64_MAX, &number)) {
+            stop_condition.max_frames = number;
+        } else if (strncmp(argv[i], "--cycles=", 9) == 0 && parse_number(argv[i] + 9, UINT64_MAX, &number)) {
+            stop_condition.max_cycles = number;
+        } else if (strncmp(argv[i], "--until-pc=", 11) == 0 && parse_number(argv[i] + 11, 0xFFFF, &number)) {
+            stop_condition.watch_pc = true;
+            stop_condition.pc = number;
+        } else if (strncmp(argv[i], "--until-mem=", 12) == 0 && parse_memory_condition(argv[i] + 12, &stop_condition)) {
+            continue;
+        } else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            job_list_path = argv[i] + 7;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0 && parse_number(argv[i] + 10, UINT32_MAX, &number)) {
+            threads = number;
+        } else if (strncmp(argv[i], "--load-state=", 13) == 0) {
+            load_state_path = argv[i] + 13;
+        } else if (strncmp(argv[i], "--save-state=", 13) == 0) {
+            save_state_path = argv[i] + 13;
+        } else if (strncmp(argv[i], "--rewind=", 9) == 0 && parse_number(argv[i] + 9, 0x10000, &number) && number > 0) {
+            rewind_mib = number;
+        } else if (strncmp(argv[i], "--run-ahead=", 12) == 0 && parse_number(argv[i] + 12, 16, &number)) {
+            run_ahead_frames = number;
+        } else if (strcmp(argv[i], "--run-ahead-instance") == 0) {
+            run_ahead_instance = true;
+        } else if (strncmp(argv[i], "--index=", 8) == 0) {
+            index_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--trace-records=", 16) == 0 && parse_number(argv[i] + 16, TRACE_MAX_RECORDS, &number)) {
+            trace_records = number;
+        } else if (argv[i][0] == '-' || rom_bin_path) {
+            print_help();
+            return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+        } else {
+            rom_bin_path = argv[i];
+        }
+    }
+
+    if (job_list_path) {
+        if (rom_bin_path) {
+            print_help();
+            return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+        }
+
+        const JobRunnerOptions options = {.threads = threads, .core = cpu_core, .decode_cache = decode_cache};
+        return run_job_list(job_list_path, &options);
+    }
+
+    if (!rom_bin_path) { 
         print_help();
         return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
     }
 
-    const char* rom_bin_path = argv[1];
-    const rom_read_result read_rom_bin_result = read_rom_bin(rom_bin_path);
+    const bool has_stop_condition = stop_condition.max_frames || stop_condition.max_cycles
+        || stop_condition.watch_pc || stop_condition.watch_memory;
 
-    if (!read_rom_bin_result.valid) {
+    if (has_stop_condition && !headless) {
+        fprintf(stderr, "--frames, --cycles, --until-pc and --until-mem require --headless.\n");
+        return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+    }
+
+#ifndef PYROTOBOX_TRACE
+    if (trace_path) {
+        fprintf(stderr, "Tracing is not compiled in. Rebuild with -DPYROTOBOX_TRACE=ON to use --trace.\n");
+        return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+    }
+#endif
+
+    rom_map_result rom_map_result = map_rom_file(rom_bin_path);
+
+    if (!rom_map_result.valid) {
         return READ_ROM_BIN_FAILED_ERROR_RETURN_CODE;
     }
 
-    u8* rom_bin = read_rom_bin_result.rom_bin;
-    const build_nes_result_t build_nes_result = build_nes_from_rom_bin(&rom_bin);
+    const build_nes_result_t build_nes_result = build_nes_from_rom_image(&rom_map_result.image);
 
     if (!build_nes_result.valid) {
         return NES_BUILD_FAILED_ERROR_RETURN_CODE;
     }
     
     Nes* nes = build_nes_result.nes;
+    nes->cpu->core = cpu_core;
+    if (!decode_cache) {
+        disable_decode_cache(nes->cpu);
+    }
+    init_frame_pacer(&nes->pacer, tv_system);
+    set_turbo(&nes->pacer, turbo);
+    // Batch runs are throughput runs, nothing to pace against without a display
+    set_pacing_mode(&nes->pacer, uncapped || headless ? PACING_UNCAPPED : PACING_REALTIME);
     printf("\n> pyrotobox v%d.%d.%d, A NES Emulator\n\n", PYROTOBOX_MAJOR_VERSION, PYROTOBOX_MINOR_VERSION, PYROTOBOX_PATCH_VERSION);
     printf("ROM Path: %s\n", rom_bin_path);
 
@@ -49,13 +232,305 @@ int main(int argc, char** argv) {
             nes->nes_header->mirroring == HORIZONTAL ? mirr_horizontal_str : mirr_vertical_str
           );
 
-    run_nes(nes);
+    if (index_path) {
+        print_rom_info(index_path, rom_bin_path, &nes->rom);
+    }
+
+    if (load_state_path && !load_state_file(nes, load_state_path)) {
+        free_nes(nes);
+        return SAVE_STATE_FAILED_RETURN_CODE;
+    }
+
+    if (rewind_mib) {
+        enable_rewind(nes, rewind_mib << 20);
+    }
+
+    if (run_ahead_frames) {
+        enable_run_ahead(nes, run_ahead_frames, run_ahead_instance ? build_shadow_mapping(rom_bin_path, nes) : NULL);
+    }
+
+    TraceBuffer* trace = NULL;
+    if (trace_path) {
+        trace = build_trace_buffer(trace_records);
+
+        if (!trace) {
+            fprintf(stderr, "ERROR: Unable to allocate a trace of %zu records\n", trace_records);
+            free_nes(nes);
+            return TRACE_FAILED_RETURN_CODE;
+        }
+
+        nes->cpu->trace = trace;
+    }
+
+    running_nes = nes;
+    signal(SIGINT, handle_sigint);
+
+    int return_code = 0;
+
+    if (headless) {
+        const RunSummary summary = run_nes_until(nes, &stop_condition);
+        print_run_summary(&summary);
+        print_rewind_report(nes);
+        print_run_ahead_report(nes);
+
+        // A PC or memory condition that never matched is a failed run
+        const bool watched = stop_condition.watch_pc || stop_condition.watch_memory;
+        if (watched && summary.reason != STOP_PC_REACHED && summary.reason != STOP_MEMORY_MATCHED) {
+            return_code = STOP_CONDITION_NOT_MET_RETURN_CODE;
+        }
+    } else {
+        // Frames go to a window when there is one, the emulation thread never waits for it
+        Display* display = start_display(nes, DISPLAY_DEFAULT_SCALE, ntsc_filter);
+
+        run_nes(nes);
+
+        if (display) {
+            stop_display(display);
+        }
+    }
+
+    running_nes = NULL;
+
+    if (save_state_path && !save_state_file(nes, save_state_path)) {
+        return_code = SAVE_STATE_FAILED_RETURN_CODE;
+    }
+
+    if (trace) {
+        dump_trace(trace, trace_path);
+        free_trace_buffer(trace);
+    }
 
     free_nes(nes);
 
-    return 0;
+    return return_code;
+}
+
+static void print_run_summary(const RunSummary* summary) {
+    static const char* const reasons[] = {
+        [STOP_NONE] = "none",
+        [STOP_CPU_STOPPED] = "stopped",
+        [STOP_FRAME_LIMIT] = "frame limit",
+        [STOP_CYCLE_LIMIT] = "cycle limit",
+        [STOP_PC_REACHED] = "pc reached",
+        [STOP_MEMORY_MATCHED] = "memory matched"
+    };
+    const double seconds = summary->wall_ns / 1e9;
+
+    printf("\nStop reason: %s\n", reasons[summary->reason]);
+    printf("Instructions: %llu\n", (unsigned long long) summary->instructions);
+    printf("Cycles: %llu\n", (unsigned long long) summary->cycles);
+    printf("Frames: %llu\n", (unsigned long long) summary->frames);
+    printf("Wall time: %.3f s\n", seconds);
+    printf("Emulated CPU clock: %.2f MHz\n", seconds > 0 ? summary->cycles / seconds / 1e6 : 0.0);
+    printf("Frames/sec: %.2f\n", seconds > 0 ? summary->frames / seconds : 0.0);
+}
+
+// Second instance of the cartridge for run-ahead on a new mapping of the ROM file
+static Nes* build_shadow_mapping(const char* rom_bin_path, const Nes* nes) {
+    // Mapping the file again shares the pages of the ROM with the primary instance
+    rom_map_result map_result = map_rom_file(rom_bin_path);
+
+    return map_result.valid ? build_shadow_nes(nes, &map_result.image) : NULL;
+}
+
+static bool load_state_file(Nes* nes, const char* path) {
+    FILE* file = fopen(path, "rb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Unable to open the save state. Given Path: %s\n", path);
+        return false;
+    }
+
+    // Anything beyond the size of a current state can only be sections of a newer build
+    const size_t capacity = 2 * nes_state_size(nes);
+    u8* state = malloc(capacity);
+    const size_t size = fread(state, 1, capacity, file);
+    fclose(file);
+
+    const SaveStateStatus status = load_nes_state(nes, state, size);
+    free(state);
+
+    if (status != SAVE_STATE_OK) {
+        fprintf(stderr, "ERROR: Unable to load the save state %s: %s\n", path, save_state_status_name(status));
+        return false;
+    }
+
+    return true;
+}
+
+static bool save_state_file(const Nes* nes, const char* path) {
+    const size_t capacity = nes_state_size(nes);
+    u8* state = malloc(capacity);
+    const size_t size = save_nes_state(nes, state, capacity);
+    FILE* file = fopen(path, "wb");
+    bool written = file && fwrite(state, 1, size, file) == size;
+
+    if (file) {
+        written = fclose(file) == 0 && written;
+    }
+
+    if (!written) {
+        fprintf(stderr, "ERROR: Unable to write the save state. Given Path: %s\n", path);
+    }
+
+    free(state);
+    return written;
+}
+
+// Streams one CSV row per job as it finishes
+static void print_job_result(void __attribute__((__unused__)) *ctx, const Job* job, const JobResult* result) {
+    printf("%zu,%s,%llu,%llu,%llu,%.3f,%016llx,%u,%s\n",
+            result->job,
+            job_status_name(result->status),
+            (unsigned long long) result->frames,
+            (unsigned long long) result->cycles,
+            (unsigned long long) result->instructions,
+            result->wall_ns / 1e6,
+            (unsigned long long) result->state_hash,
+            result->worker,
+            job->rom_path);
+    fflush(stdout);
+}
+
+static void count_job_failures(void* ctx, const Job* job, const JobResult* result) {
+    if (result->status != JOB_OK) {
+        (*(size_t*) ctx)++;
+    }
+
+    print_job_result(NULL, job, result);
+}
+
+static int run_job_list(const char* job_list_path, const JobRunnerOptions* options) {
+    const job_list_read_result read_result = read_job_list(job_list_path);
+
+    if (!read_result.valid) {
+        return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+    }
+
+    size_t failures = 0;
+    printf("job,status,frames,cycles,instructions,wall_ms,state_hash,worker,rom\n");
+
+    const JobRunnerStats stats = run_jobs(read_result.job_list, options, count_job_failures, &failures);
+    const double seconds = stats.wall_ns / 1e9;
+
+    fprintf(stderr, "[jobs] %zu jobs (%zu failed) on %u threads in %.3f s, %.2f jobs/sec\n",
+            stats.jobs, failures, stats.threads, seconds, seconds > 0 ? stats.jobs / seconds : 0.0);
+    fprintf(stderr, "[jobs] worker utilization: %.2f%%, steals: %llu\n",
+            stats.wall_ns > 0 ? 100.0 * stats.busy_ns / ((double) stats.wall_ns * stats.threads) : 0.0,
+            (unsigned long long) stats.steals);
+
+    free_job_list(read_result.job_list);
+
+    return failures > 0 ? JOB_FAILED_RETURN_CODE : 0;
+}
+
+// pyrotobox index <DIR> [--index=FILE] [--threads=N] [--hints=FILE]
+static int run_index_command(int argc, char** argv) {
+    const char* dir_path = NULL;
+    const char* index_path = DEFAULT_ROM_INDEX_PATH;
+    RomIndexOptions options = {.threads = 0, .hints_path = NULL};
+    u64 number;
+
+    for (int i = 0; i < argc; i++) {
+        if (strncmp(argv[i], "--index=", 8) == 0) {
+            index_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0 && parse_number(argv[i] + 10, UINT32_MAX, &number)) {
+            options.threads = number;
+        } else if (strncmp(argv[i], "--hints=", 8) == 0) {
+            options.hints_path = argv[i] + 8;
+        } else if (argv[i][0] == '-' || dir_path) {
+            print_help();
+            return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+        } else {
+            dir_path = argv[i];
+        }
+    }
+
+    if (!dir_path) {
+        print_help();
+        return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+    }
+
+    RomIndexStats stats;
+    const bool written = build_rom_index(dir_path, index_path, &options, &stats);
+    const double seconds = stats.wall_ns / 1e9;
+
+    fprintf(stderr, "[index] %zu ROMs in %zu files (%zu skipped, %zu unchanged) on %u threads in %.3f s\n",
+            stats.roms, stats.files, stats.skipped, stats.reused, stats.threads, seconds);
+    fprintf(stderr, "[index] hashed %.2f MiB at %.2f MiB/s, SHA-1: %s\n",
+            stats.bytes_hashed / 1048576.0, seconds > 0 ? stats.bytes_hashed / 1048576.0 / seconds : 0.0, sha1_isa());
+
+    return written ? 0 : INDEX_FAILED_RETURN_CODE;
+}
+
+static void print_rom_info(const char* index_path, const char* rom_path, const RomImage* image) {
+    const rom_index_open_result open_result = open_rom_index(index_path);
+
+    if (!open_result.valid) {
+        return;
+    }
+
+    RomInfo info;
+    bool hashed;
+    const u64 start_ns = get_time_ns();
+    const bool found = resolve_rom(open_result.index, rom_path, image, &info, &hashed);
+    const u64 lookup_ns = get_time_ns() - start_ns;
+
+    if (found) {
+        char sha1[2 * SHA1_DIGEST_SIZE + 1];
+
+        for (int i = 0; i < SHA1_DIGEST_SIZE; i++) {
+            snprintf(&sha1[2 * i], 3, "%02x", info.sha1[i]);
+        }
+
+        printf("Index: CRC32 %08X, SHA-1 %s, mapper %u.%u, found by %s in %.1f us\n",
+                (unsigned) info.crc32, sha1, info.mapper, info.submapper,
+                hashed ? "CRC32" : "path", lookup_ns / 1e3);
+
+        if (info.idle_loop_pc) {
+            printf("Index: idle loop at $%04X\n", info.idle_loop_pc);
+        }
+    } else {
+        printf("Index: ROM not in %s\n", index_path);
+    }
+
+    close_rom_index(open_result.index);
 }
 
 void print_help(void) {
-    printf("USAGE: pyrotobox <NES_ROM_FILE_PATH>\n");
+    printf("USAGE: pyrotobox [OPTIONS] <NES_ROM_FILE_PATH>\n");
+    printf("       pyrotobox [OPTIONS] --jobs=<JOB_LIST_FILE>\n");
+    printf("       pyrotobox index <DIR> [--index=FILE] [--threads=N] [--hints=FILE]\n\n");
+    printf("OPTIONS:\n");
+    printf("  --core=threaded    Run the specialized threaded interpreter core (default)\n");
+    printf("  --core=reference   Run the table-driven reference core\n");
+    printf("  --no-decode-cache  Decode every instruction from the bus, even on ROM pages\n");
+    printf("  --region=ntsc|pal  Pace frames at 60.0988 Hz (NTSC, default) or 50.007 Hz (PAL)\n");
+    printf("  --uncapped         Run as fast as possible instead of pacing to real time\n");
+    printf("  --turbo=<FACTOR>   Run FACTOR times faster than real time, e.g. 2 or 0.5 (%g-%g)\n", MIN_TURBO, MAX_TURBO);
+    printf("  --headless         Run without window and audio, print a summary on exit\n");
+    printf("  --ntsc-filter      Show the frames the way a TV decodes the composite signal\n");
+    printf("  --frames=N         Headless: stop after N frames\n");
+    printf("  --cycles=N         Headless: stop after N CPU cycles\n");
+    printf("  --until-pc=ADDR    Headless: stop when PC reaches ADDR (single steps the CPU)\n");
+    printf("  --until-mem=ADDR=V Headless: stop when the byte at ADDR reads V (RAM or ROM only)\n");
+    printf("                     Numbers can be decimal, 0x or $ prefixed hex\n");
+    printf("  --jobs=<FILE>      Run every job of FILE headless on a thread pool, one CSV row\n");
+    printf("                     per job as it finishes. One job per line:\n");
+    printf("                     ROM_PATH FRAMES [MOVIE_PATH], movies hold 2 bytes per frame\n");
+    printf("  --threads=N        Worker threads for --jobs (default: one per hardware thread)\n");
+    printf("  --load-state=<FILE> Start from the save state in FILE\n");
+    printf("  --save-state=<FILE> Write a save state to FILE when the run ends\n");
+    printf("  --rewind=MIB       Keep up to MIB MiB of compressed per-frame rewind history,\n");
+    printf("                     hold Backspace in the window to rewind\n");
+    printf("  --run-ahead=N      Show the frame N frames ahead to cut input latency (0-16)\n");
+    printf("  --run-ahead-instance Run ahead on a second instance instead of rolling back\n");
+    printf("  --index=<FILE>     Look the ROM up in the ROM index FILE and print what it knows\n");
+    printf("  --trace=<FILE>     Record an execution trace and write it to FILE on exit\n");
+    printf("                     (requires a build with -DPYROTOBOX_TRACE=ON)\n");
+    printf("  --trace-records=N  Keep the last N instructions in the trace (default: %d, at most %zu)\n",
+           DEFAULT_TRACE_RECORDS, TRACE_MAX_RECORDS);
+    printf("\nINDEX: hashes every .nes file under DIR in parallel and writes the ROM index FILE\n");
+    printf("(default: %s). Unchanged files of an existing index are not hashed again.\n", DEFAULT_ROM_INDEX_PATH);
+    printf("  --hints=<FILE>     Per-game hints, one line per game: CRC32 idle_loop=ADDR\n");
 }
@@ -1,47 +1,308 @@
 #include <stdio.h>
-#include <memory.h>
+#include <string.h>
 #include <stdlib.h>
 
 #include "mapper.h"
 #include "nes.h"
 
-#define CPU_MEM_MAP_SIZE 0x10000
-#define PRG_ROM_SIZE_PER_UNIT 0x4000
-#define CHR_ROM_SIZE 0x2000
+// Dot of a rendered scanline at which the scanline hook runs
+#define SCANLINE_HOOK_DOT 260
 
-static MemMap get_nrom_mem_map(const NesHeader* nes_header, const u8* rom_bin);
+// Nametable RAM (1 KiB each) that the four nametables show for each Mirroring. Boards
+// without RAM of their own only have the first two.
+static const u8 NAMETABLE_LAYOUTS[][PPU_NAMETABLE_SLOTS] = {
+    [HORIZONTAL] = {0, 0, 1, 1},
+    [VERTICAL] = {0, 1, 0, 1},
+    [SINGLE_SCREEN_LOWER] = {0, 0, 0, 0},
+    [SINGLE_SCREEN_UPPER] = {1, 1, 1, 1},
+    [FOUR_SCREEN] = {0, 1, 2, 3}
+};
 
-mem_map_result generate_mem_map(const NesHeader* nes_header, const u8* rom_bin) {
-    mem_map_result result = (mem_map_result) { .valid = false };
-    switch (nes_header->mapper) {
-        case NROM: 
-            result.mem_map = get_nrom_mem_map(nes_header, rom_bin);
-            break;
-        default:
-            fprintf(stderr, "Cannot get ROM due to invalid mapper. Mapper code: %d", nes_header->mapper);
-            return result;
+static void nrom_reset(Mapper* mapper) {
+    // A single 16 KiB bank wraps around into $C000
+    map_prg_bank(mapper, 0x8000, 0x4000, 0);
+    map_prg_bank(mapper, 0xC000, 0x4000, 1);
+    map_chr_bank(mapper, 0x0000, 0x2000, 0);
+}
+
+static void bank_register_save(const Mapper* mapper, u8* state) {
+    state[0] = mapper->regs.bank;
+}
+
+// UxROM: 16 KiB PRG bank at $8000, the last bank is fixed at $C000
+static void uxrom_update_banks(Mapper* mapper) {
+    map_prg_bank(mapper, 0x8000, 0x4000, mapper->regs.bank);
+    map_prg_bank(mapper, 0xC000, 0x4000, -1);
+    map_chr_bank(mapper, 0x0000, 0x2000, 0);
+}
+
+static void uxrom_write(Mapper* mapper, u16 __attribute__((__unused__)) addr, u8 val) {
+    mapper->regs.bank = val;
+    uxrom_update_banks(mapper);
+}
+
+static void uxrom_load_state(Mapper* mapper, const u8* state, u16 __attribute__((__unused__)) version) {
+    mapper->regs.bank = state[0];
+    uxrom_update_banks(mapper);
+}
+
+// CNROM: fixed PRG like NROM, 8 KiB CHR bank
+static void cnrom_update_banks(Mapper* mapper) {
+    map_prg_bank(mapper, 0x8000, 0x4000, 0);
+    map_prg_bank(mapper, 0xC000, 0x4000, 1);
+    map_chr_bank(mapper, 0x0000, 0x2000, mapper->regs.bank);
+}
+
+static void cnrom_write(Mapper* mapper, u16 __attribute__((__unused__)) addr, u8 val) {
+    mapper->regs.bank = val;
+    cnrom_update_banks(mapper);
+}
+
+static void cnrom_load_state(Mapper* mapper, const u8* state, u16 __attribute__((__unused__)) version) {
+    mapper->regs.bank = state[0];
+    cnrom_update_banks(mapper);
+}
+
+// AxROM: 32 KiB PRG bank and one-screen mirroring selected by bit 4
+static void axrom_update_banks(Mapper* mapper) {
+    map_prg_bank(mapper, 0x8000, 0x8000, mapper->regs.bank & 0x07);
+    map_chr_bank(mapper, 0x0000, 0x2000, 0);
+    set_mirroring(mapper, mapper->regs.bank & 0x10 ? SINGLE_SCREEN_UPPER : SINGLE_SCREEN_LOWER);
+}
+
+static void axrom_write(Mapper* mapper, u16 __attribute__((__unused__)) addr, u8 val) {
+    mapper->regs.bank = val;
+    axrom_update_banks(mapper);
+}
+
+static void axrom_load_state(Mapper* mapper, const u8* state, u16 __attribute__((__unused__)) version) {
+    mapper->regs.bank = state[0];
+    axrom_update_banks(mapper);
+}
+
+static const MapperOps NROM_OPS = {
+    .name = "NROM",
+    .state_size = 0,
+    .reset = nrom_reset
+};
+
+static const MapperOps UXROM_OPS = {
+    .name = "UxROM",
+    .state_size = 1,
+    .reset = uxrom_update_banks,
+    .write = uxrom_write,
+    .save_state = bank_register_save,
+    .load_state = uxrom_load_state
+};
+
+static const MapperOps CNROM_OPS = {
+    .name = "CNROM",
+    .state_size = 1,
+    .reset = cnrom_update_banks,
+    .write = cnrom_write,
+    .save_state = bank_register_save,
+    .load_state = cnrom_load_state
+};
+
+static const MapperOps AXROM_OPS = {
+    .name = "AxROM",
+    .state_size = 1,
+    .reset = axrom_update_banks,
+    .write = axrom_write,
+    .save_state = bank_register_save,
+    .load_state = axrom_load_state
+};
+
+static const MapperOps* get_mapper_ops(MapperType type) {
+    switch (type) {
+        case NROM:
+            return &NROM_OPS;
+        case MMC1:
+            return &MMC1_OPS;
+        case UXROM:
+            return &UXROM_OPS;
+        case CNROM:
+            return &CNROM_OPS;
+        case MMC3:
+            return &MMC3_OPS;
+        case AXROM:
+            return &AXROM_OPS;
+    }
+
+    return NULL;
+}
+
+bool is_mapper_supported(MapperType type) {
+    return get_mapper_ops(type) != NULL;
+}
+
+static void mapper_register_write(void* ctx, u16 addr, u8 val) {
+    Mapper* mapper = ctx;
+
+    // The scanlines the beam passed are drawn with the banks they had
+    sync_component(&mapper->ppu->component, mapper->cpu->cycles);
+    mapper->ops->write(mapper, addr, val);
+}
+
+static u8 mapper_register_read(void* ctx, u16 addr) {
+    Mapper* mapper = ctx;
+    return mapper->ops->read(mapper, addr);
+}
+
+static void mapper_scanline_event(void* ctx, u64 timestamp) {
+    Mapper* mapper = ctx;
+
+    // PPUMASK writes sync the PPU, so its registers are current
+    if (ppu_rendering_enabled(mapper->ppu)) {
+        mapper->ops->scanline(mapper);
     }
 
-    result.valid = true;
-    return result;
+    schedule_event(mapper->scheduler, EVENT_MAPPER_SCANLINE, ppu_next_rendered_dot_cycle(timestamp, SCANLINE_HOOK_DOT));
+}
+
+static void mapper_timer_event(void* ctx, u64 timestamp) {
+    Mapper* mapper = ctx;
+    mapper->ops->timer(mapper, timestamp);
 }
 
-static MemMap get_nrom_mem_map(const NesHeader* nes_header, const u8* rom_bin) {
-    MemMap mem_map = (MemMap) {.cpu_mem_map = NULL, .ppu_mem_map = NULL};
-    u8* cpu_mem_map = calloc(CPU_MEM_MAP_SIZE, sizeof(u8));
+Mapper* build_mapper(const NesHeader* nes_header, const u8* rom_bin, Cpu* cpu, Ppu* ppu, Scheduler* scheduler) {
+    const MapperOps* ops = get_mapper_ops(nes_header->mapper);
+
+    if (!ops) {
+        fprintf(stderr, "Cannot get ROM due to invalid mapper. Mapper code: %d", nes_header->mapper);
+        return NULL;
+    }
+
+    Mapper* mapper = calloc(1, sizeof(Mapper));
+
+    mapper->ops = ops;
+    mapper->cpu = cpu;
+    mapper->ppu = ppu;
+    mapper->scheduler = scheduler;
+    mapper->prg_rom = &rom_bin[nes_prg_rom_offset(nes_header)];
+    mapper->prg_size = nes_header->prg_rom_count * PRG_ROM_SIZE_PER_UNIT;
 
     //TODO: Support battery-packed PRG RAMs?
+    if (nes_header->chr_rom_count > 0) {
+        mapper->chr = &mapper->prg_rom[mapper->prg_size];
+        mapper->chr_size = nes_header->chr_rom_count * CHR_ROM_SIZE_PER_UNIT;
+    } else {
+        mapper->chr_ram = calloc(CHR_RAM_SIZE, sizeof(u8));
+        mapper->chr = mapper->chr_ram;
+        mapper->chr_size = CHR_RAM_SIZE;
+    }
+
+    Bus* bus = &cpu->bus;
+
+    // PRG RAM
+    bus_map_memory(bus, 0x60, 0x20, &cpu->mem[0x6000]);
 
-    //There will always be at most 2 banks for PRG in NROM typed cartridges
-    if (nes_header->prg_rom_count > 1) {
-        memcpy(&cpu_mem_map[0x8000], &rom_bin[0x10], PRG_ROM_SIZE_PER_UNIT);
-        memcpy(&cpu_mem_map[0xC000], &rom_bin[0x4010], PRG_ROM_SIZE_PER_UNIT);
+    if (ops->read) {
+        bus_map_read_handler(bus, 0x41, 0x1F, mapper_register_read, mapper);
+    }
+
+    // PRG ROM is read-only, writes go to the registers of the board
+    if (ops->write) {
+        bus_map_write_handler(bus, 0x80, 0x80, mapper_register_write, mapper);
     } else {
-        memcpy(&cpu_mem_map[0x8000], &rom_bin[0x10], PRG_ROM_SIZE_PER_UNIT);
-        //Mirror the single PRG ROM
-        memcpy(&cpu_mem_map[0xC000], &rom_bin[0x10], PRG_ROM_SIZE_PER_UNIT);
+        bus_map_write_handler(bus, 0x80, 0x80, bus_ignore_write, NULL);
+    }
+
+    if (ops->scanline) {
+        set_event_handler(scheduler, EVENT_MAPPER_SCANLINE, mapper_scanline_event, mapper);
+        schedule_event(scheduler, EVENT_MAPPER_SCANLINE, ppu_next_rendered_dot_cycle(cpu->cycles, SCANLINE_HOOK_DOT));
+    }
+
+    if (ops->timer) {
+        set_event_handler(scheduler, EVENT_MAPPER_IRQ, mapper_timer_event, mapper);
     }
 
-    mem_map.cpu_mem_map = cpu_mem_map;
-    return mem_map;
+    set_mirroring(mapper, nes_header->mirroring);
+    ops->reset(mapper);
+    // The power-on banks are not switches
+    mapper->bank_switches = 0;
+
+    return mapper;
+}
+
+void free_mapper(Mapper* mapper) {
+    free(mapper->chr_ram);
+    free(mapper);
+}
+
+static inline size_t bank_offset(int bank, size_t bank_size, size_t rom_size) {
+    const int bank_count = rom_size / bank_size;
+    const int wrapped = bank % bank_count;
+
+    return (size_t) (wrapped < 0 ? wrapped + bank_count : wrapped) * bank_size;
+}
+
+void map_prg_bank(Mapper* mapper, u16 addr, size_t bank_size, int bank) {
+    // A bank smaller than the window (16 KiB of PRG-ROM for a 32 KiB window) is mirrored
+    const size_t size = bank_size < mapper->prg_size ? bank_size : mapper->prg_size;
+    const size_t offset = bank_offset(bank, size, mapper->prg_size);
+
+    for (size_t mirror = 0; mirror < bank_size; mirror += size) {
+        const u8 first_page = (addr + mirror) >> 8;
+
+        if (bus_map_rom_bank(&mapper->cpu->bus, first_page, size / BUS_PAGE_SIZE, &mapper->prg_rom[offset], offset / BUS_PAGE_SIZE)) {
+            mapper->bank_switches++;
+        }
+    }
+}
+
+void map_chr_bank(Mapper* mapper, u16 addr, size_t bank_size, int bank) {
+    const size_t offset = bank_offset(bank, bank_size, mapper->chr_size);
+    const u8 first_slot = addr / PPU_BUS_SLOT_SIZE;
+    bool changed = false;
+
+    for (size_t slot = 0; slot < bank_size / PPU_BUS_SLOT_SIZE; slot++) {
+        const size_t slot_offset = offset + slot * PPU_BUS_SLOT_SIZE;
+
+        changed |= mapper->ppu->bus.read[first_slot + slot] != &mapper->chr[slot_offset];
+        // CHR-RAM is written through whatever slot it is mapped in
+        map_pattern_slot(mapper->ppu, first_slot + slot, &mapper->chr[slot_offset],
+                         mapper->chr_ram ? &mapper->chr_ram[slot_offset] : NULL);
+    }
+
+    if (changed) {
+        mapper->bank_switches++;
+    }
+}
+
+void set_mirroring(Mapper* mapper, Mirroring mirroring) {
+    mapper->mirroring = mirroring;
+    map_nametables(mapper->ppu, NAMETABLE_LAYOUTS[mirroring]);
+}
+
+void set_mapper_irq(Mapper* mapper, bool asserted) {
+    if (asserted && !(mapper->cpu->irq_lines & IRQ_MAPPER)) {
+        mapper->irqs++;
+    }
+
+    set_irq_line(mapper->cpu, IRQ_MAPPER, asserted);
+}
+
+size_t mapper_state_size(const Mapper* mapper) {
+    return mapper->ops->state_size + (mapper->chr_ram ? CHR_RAM_SIZE : 0);
+}
+
+void save_mapper_state(const Mapper* mapper, u8* state) {
+    if (mapper->ops->save_state) {
+        mapper->ops->save_state(mapper, state);
+    }
+
+    if (mapper->chr_ram) {
+        memcpy(&state[mapper->ops->state_size], mapper->chr_ram, CHR_RAM_SIZE);
+    }
+}
+
+void load_mapper_state(Mapper* mapper, const u8* state, u16 version) {
+    if (mapper->ops->load_state) {
+        mapper->ops->load_state(mapper, state, version);
+    }
+
+    if (mapper->chr_ram) {
+        memcpy(mapper->chr_ram, &state[mapper->ops->state_size], CHR_RAM_SIZE);
+    }
 }
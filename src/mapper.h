@@ -4,16 +4,108 @@
 #include "nes.h"
 #include <stdbool.h>
 
-typedef struct MemMap {
-    u8* cpu_mem_map;
-    u8* ppu_mem_map;
-} MemMap;
+// Size of the CPU memory the Nes allocates, work RAM and the PRG-RAM window ($0000-$7FFF).
+// The cartridge space above it is mapped from the ROM image.
+#define CPU_MEM_MAP_SIZE 0x8000
 
-typedef struct mem_map_result { 
-    bool valid;
-    MemMap mem_map;
-} mem_map_result;
+#define PRG_ROM_SIZE_PER_UNIT 0x4000
+#define CHR_ROM_SIZE_PER_UNIT 0x2000
+#define CHR_RAM_SIZE 0x2000
 
-mem_map_result generate_mem_map(const NesHeader* nes_header, const u8* rom_bin);
+struct Mapper;
+
+// Behaviour of a board. Only reset is mandatory, unset hooks cost nothing: they are
+// neither mapped on the bus nor scheduled.
+typedef struct MapperOps {
+    const char* name;
+    // Bytes save_state writes, CHR-RAM is saved by the framework
+    size_t state_size;
+    // Maps the power-on banks, called once the Mapper is set up
+    void (*reset)(struct Mapper* mapper);
+    // Writes to $8000-$FFFF, ignored when not set
+    void (*write)(struct Mapper* mapper, u16 addr, u8 val);
+    // Reads of the expansion area ($4100-$5FFF), open bus when not set
+    u8 (*read)(struct Mapper* mapper, u16 addr);
+    // Called at dot 260 of every rendered scanline while rendering is enabled, which is
+    // where the PPU fetches sprite patterns from $1000 and the MMC3 sees A12 rise
+    void (*scanline)(struct Mapper* mapper);
+    // CPU cycle counters: called when EVENT_MAPPER_IRQ, which the mapper schedules
+    // itself, is due
+    void (*timer)(struct Mapper* mapper, u64 timestamp);
+    // Board registers as state_size bytes, load_state remaps the banks they select. version
+    // is the save state version (see save_state.h) the registers were saved by.
+    void (*save_state)(const struct Mapper* mapper, u8* state);
+    void (*load_state)(struct Mapper* mapper, const u8* state, u16 version);
+} MapperOps;
+
+typedef struct Mmc1 {
+    u8 shift;
+    u8 shift_count;
+    u8 control;
+    u8 chr_banks[2];
+    u8 prg_bank;
+    // Writes on the cycle after a write are ignored, which is what happens to the second
+    // write of a read-modify-write instruction
+    u64 last_write_cycle;
+} Mmc1;
+
+typedef struct Mmc3 {
+    u8 bank_select;
+    u8 banks[8];
+    u8 mirroring;
+    u8 prg_ram_protect;
+    u8 irq_latch;
+    u8 irq_counter;
+    bool irq_reload;
+    bool irq_enabled;
+} Mmc3;
+
+// The cartridge board: owns the banking of PRG-ROM on the CPU bus, and of CHR and the
+// nametables on the PPU bus. Switching a bank only swaps pointers (CPU bus pages of 256
+// bytes, PPU bus slots of 1 KiB) into the ROM image, nothing is ever copied.
+typedef struct Mapper {
+    const MapperOps* ops;
+    const u8* prg_rom;
+    size_t prg_size;
+    // CHR-ROM in the image, or chr_ram for boards without CHR-ROM
+    const u8* chr;
+    size_t chr_size;
+    u8* chr_ram;
+    Mirroring mirroring;
+    // Board registers, the member of the board in use
+    union {
+        u8 bank;
+        Mmc1 mmc1;
+        Mmc3 mmc3;
+    } regs;
+    u64 bank_switches;
+    u64 irqs;
+    Cpu* cpu;
+    Ppu* ppu;
+    Scheduler* scheduler;
+} Mapper;
+
+extern const MapperOps MMC1_OPS;
+extern const MapperOps MMC3_OPS;
+
+// Builds the board of the cartridge and maps it on the CPU bus ($4100-$FFFF), NULL for
+// unsupported mappers. rom_bin is the whole iNES image, it has to outlive the Mapper.
+Mapper* build_mapper(const NesHeader* nes_header, const u8* rom_bin, Cpu* cpu, Ppu* ppu, Scheduler* scheduler);
+void free_mapper(Mapper* mapper);
+// Whether build_mapper supports the mapper
+bool is_mapper_supported(MapperType type);
+
+// Banking for the boards. Banks are numbered in units of bank_size from the start of the
+// ROM, negative numbers count from its end (-1 is the last bank), and wrap around the ROM
+// like the unconnected address lines of a real board.
+void map_prg_bank(Mapper* mapper, u16 addr, size_t bank_size, int bank);
+void map_chr_bank(Mapper* mapper, u16 addr, size_t bank_size, int bank);
+void set_mirroring(Mapper* mapper, Mirroring mirroring);
+void set_mapper_irq(Mapper* mapper, bool asserted);
+
+// Board registers followed by CHR-RAM, if the board has any
+size_t mapper_state_size(const Mapper* mapper);
+void save_mapper_state(const Mapper* mapper, u8* state);
+void load_mapper_state(Mapper* mapper, const u8* state, u16 version);
 
 #endif
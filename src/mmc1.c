@@ -0,0 +1,133 @@
+#include "mapper.h"
+
+// MMC1 (SxROM): registers are loaded serially, five writes of bit 0 to $8000-$FFFF. The
+// fifth write picks the register by its address:
+//   $8000 control: mirroring (bits 0-1), PRG mode (2-3), CHR mode (4)
+//   $A000 CHR bank 0, $C000 CHR bank 1, $E000 PRG bank
+#define MMC1_SHIFT_RESET 0x80
+#define MMC1_CONTROL_POWER_ON 0x0C
+#define MMC1_STATE_SIZE 6
+// 512 KiB boards (SUROM) select the 256 KiB half of PRG-ROM with bit 4 of the CHR bank
+#define MMC1_PRG_OUTER_BANK_SIZE 0x40000
+
+static const Mirroring MMC1_MIRRORING[4] = {SINGLE_SCREEN_LOWER, SINGLE_SCREEN_UPPER, VERTICAL, HORIZONTAL};
+
+static void mmc1_update_banks(Mapper* mapper) {
+    const Mmc1* mmc1 = &mapper->regs.mmc1;
+    const int prg_bank = mmc1->prg_bank & 0x0F;
+    // Bank numbers in 16 KiB within the outer 256 KiB half
+    const int outer_bank = mapper->prg_size > MMC1_PRG_OUTER_BANK_SIZE && (mmc1->chr_banks[0] & 0x10) ? 16 : 0;
+
+    switch (mmc1->control >> 2 & 0x03) {
+        case 0:
+        case 1:
+            // 32 KiB, the low bit of the bank number is ignored
+            map_prg_bank(mapper, 0x8000, 0x4000, outer_bank + (prg_bank & ~1));
+            map_prg_bank(mapper, 0xC000, 0x4000, outer_bank + (prg_bank | 1));
+            break;
+        case 2:
+            // First bank fixed at $8000
+            map_prg_bank(mapper, 0x8000, 0x4000, outer_bank);
+            map_prg_bank(mapper, 0xC000, 0x4000, outer_bank + prg_bank);
+            break;
+        case 3:
+            // Last bank fixed at $C000
+            map_prg_bank(mapper, 0x8000, 0x4000, outer_bank + prg_bank);
+            map_prg_bank(mapper, 0xC000, 0x4000, outer_bank + (mapper->prg_size > MMC1_PRG_OUTER_BANK_SIZE ? 15 : -1));
+            break;
+    }
+
+    if (mmc1->control & 0x10) {
+        map_chr_bank(mapper, 0x0000, 0x1000, mmc1->chr_banks[0]);
+        map_chr_bank(mapper, 0x1000, 0x1000, mmc1->chr_banks[1]);
+    } else {
+        map_chr_bank(mapper, 0x0000, 0x2000, mmc1->chr_banks[0] >> 1);
+    }
+
+    set_mirroring(mapper, MMC1_MIRRORING[mmc1->control & 0x03]);
+}
+
+static void mmc1_reset(Mapper* mapper) {
+    mapper->regs.mmc1 = (Mmc1) {.control = MMC1_CONTROL_POWER_ON, .last_write_cycle = EVENT_NEVER};
+    mmc1_update_banks(mapper);
+}
+
+static void mmc1_write(Mapper* mapper, u16 addr, u8 val) {
+    Mmc1* mmc1 = &mapper->regs.mmc1;
+    const u64 cycle = mapper->cpu->cycles;
+
+    // Both writes of a read-modify-write instruction happen while the CPU clock still
+    // reads the start of the instruction, only the first one counts
+    if (cycle == mmc1->last_write_cycle) {
+        return;
+    }
+
+    mmc1->last_write_cycle = cycle;
+
+    if (val & MMC1_SHIFT_RESET) {
+        mmc1->shift = 0;
+        mmc1->shift_count = 0;
+        mmc1->control |= MMC1_CONTROL_POWER_ON;
+        mmc1_update_banks(mapper);
+        return;
+    }
+
+    mmc1->shift |= (val & 0x01) << mmc1->shift_count;
+
+    if (++mmc1->shift_count < 5) {
+        return;
+    }
+
+    switch (addr >> 13 & 0x03) {
+        case 0:
+            mmc1->control = mmc1->shift;
+            break;
+        case 1:
+            mmc1->chr_banks[0] = mmc1->shift;
+            break;
+        case 2:
+            mmc1->chr_banks[1] = mmc1->shift;
+            break;
+        case 3:
+            mmc1->prg_bank = mmc1->shift;
+            break;
+    }
+
+    mmc1->shift = 0;
+    mmc1->shift_count = 0;
+    mmc1_update_banks(mapper);
+}
+
+static void mmc1_save_state(const Mapper* mapper, u8* state) {
+    const Mmc1* mmc1 = &mapper->regs.mmc1;
+
+    state[0] = mmc1->shift;
+    state[1] = mmc1->shift_count;
+    state[2] = mmc1->control;
+    state[3] = mmc1->chr_banks[0];
+    state[4] = mmc1->chr_banks[1];
+    state[5] = mmc1->prg_bank;
+}
+
+static void mmc1_load_state(Mapper* mapper, const u8* state, u16 __attribute__((__unused__)) version) {
+    Mmc1* mmc1 = &mapper->regs.mmc1;
+
+    // States are only taken between instructions, so no write is pending
+    mmc1->shift = state[0] & 0x1F;
+    mmc1->shift_count = state[1] < 5 ? state[1] : 0;
+    mmc1->control = state[2];
+    mmc1->chr_banks[0] = state[3];
+    mmc1->chr_banks[1] = state[4];
+    mmc1->prg_bank = state[5];
+    mmc1->last_write_cycle = EVENT_NEVER;
+    mmc1_update_banks(mapper);
+}
+
+const MapperOps MMC1_OPS = {
+    .name = "MMC1",
+    .state_size = MMC1_STATE_SIZE,
+    .reset = mmc1_reset,
+    .write = mmc1_write,
+    .save_state = mmc1_save_state,
+    .load_state = mmc1_load_state
+};
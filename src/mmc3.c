@@ -0,0 +1,207 @@
+#include "mapper.h"
+
+// MMC3 (TxROM): register pairs at even/odd addresses of every 8 KiB of $8000-$FFFF
+//   $8000 bank select, $8001 bank data
+//   $A000 mirroring, $A001 PRG-RAM protect
+//   $C000 IRQ latch, $C001 IRQ reload
+//   $E000 IRQ disable, $E001 IRQ enable
+// and a scanline counter that raises IRQ when it is clocked down to zero.
+#define MMC3_PRG_MODE 0x40
+#define MMC3_CHR_INVERSION 0x80
+// $A001
+#define MMC3_PRG_RAM_WRITE_PROTECT 0x40
+#define MMC3_PRG_RAM_ENABLE 0x80
+#define MMC3_STATE_SIZE 15
+
+// Power-on values of the bank registers R0-R7
+static const u8 MMC3_POWER_ON_BANKS[8] = {0, 2, 4, 5, 6, 7, 0, 1};
+
+// Maps what R0-R7 select, bank_select decides where
+static void mmc3_map_register(Mapper* mapper, int reg) {
+    const Mmc3* mmc3 = &mapper->regs.mmc3;
+    // Bit 7 swaps the 2 KiB and 1 KiB halves of the pattern tables
+    const u16 chr_flip = mmc3->bank_select & MMC3_CHR_INVERSION ? 0x1000 : 0x0000;
+
+    switch (reg) {
+        case 0:
+        case 1:
+            // 2 KiB banks, the low bit is ignored
+            map_chr_bank(mapper, (reg * 0x0800) ^ chr_flip, 0x0800, mmc3->banks[reg] >> 1);
+            break;
+        case 6:
+            // R6 and the second to last bank trade places in PRG mode 1
+            map_prg_bank(mapper, mmc3->bank_select & MMC3_PRG_MODE ? 0xC000 : 0x8000, 0x2000, mmc3->banks[6]);
+            break;
+        case 7:
+            map_prg_bank(mapper, 0xA000, 0x2000, mmc3->banks[7]);
+            break;
+        default:
+            map_chr_bank(mapper, (0x1000 + (reg - 2) * 0x0400) ^ chr_flip, 0x0400, mmc3->banks[reg]);
+            break;
+    }
+}
+
+static void mmc3_map_prg(Mapper* mapper) {
+    map_prg_bank(mapper, mapper->regs.mmc3.bank_select & MMC3_PRG_MODE ? 0x8000 : 0xC000, 0x2000, -2);
+    map_prg_bank(mapper, 0xE000, 0x2000, -1);
+    mmc3_map_register(mapper, 6);
+    mmc3_map_register(mapper, 7);
+}
+
+static void mmc3_map_chr(Mapper* mapper) {
+    for (int reg = 0; reg < 6; reg++) {
+        mmc3_map_register(mapper, reg);
+    }
+}
+
+static void mmc3_map_prg_ram(Mapper* mapper) {
+    Bus* bus = &mapper->cpu->bus;
+    u8* ram = &mapper->cpu->mem[0x6000];
+    const u8 protect = mapper->regs.mmc3.prg_ram_protect;
+
+    if (!(protect & MMC3_PRG_RAM_ENABLE)) {
+        // The disabled chip leaves the data bus alone
+        bus_map_read_handler(bus, 0x60, 0x20, bus_open_read, NULL);
+        bus_map_write_handler(bus, 0x60, 0x20, bus_ignore_write, NULL);
+    } else if (protect & MMC3_PRG_RAM_WRITE_PROTECT) {
+        bus_map_rom(bus, 0x60, 0x20, ram);
+        bus_map_write_handler(bus, 0x60, 0x20, bus_ignore_write, NULL);
+    } else {
+        bus_map_memory(bus, 0x60, 0x20, ram);
+    }
+}
+
+static void mmc3_update_mirroring(Mapper* mapper) {
+    // Four-screen boards wire the nametables themselves
+    if (mapper->mirroring != FOUR_SCREEN) {
+        set_mirroring(mapper, mapper->regs.mmc3.mirroring & 0x01 ? HORIZONTAL : VERTICAL);
+    }
+}
+
+static void mmc3_reset(Mapper* mapper) {
+    Mmc3* mmc3 = &mapper->regs.mmc3;
+
+    // The protection register powers up in no particular state, plenty of games use the
+    // RAM without ever enabling it
+    *mmc3 = (Mmc3) {.mirroring = mapper->mirroring == HORIZONTAL, .prg_ram_protect = MMC3_PRG_RAM_ENABLE};
+    for (int bank = 0; bank < 8; bank++) {
+        mmc3->banks[bank] = MMC3_POWER_ON_BANKS[bank];
+    }
+
+    mmc3_map_prg(mapper);
+    mmc3_map_chr(mapper);
+    mmc3_map_prg_ram(mapper);
+}
+
+static void mmc3_write(Mapper* mapper, u16 addr, u8 val) {
+    Mmc3* mmc3 = &mapper->regs.mmc3;
+    const bool odd = addr & 0x01;
+
+    switch (addr & 0xE000) {
+        case 0x8000:
+            // Games switch banks all the time, only what changed is remapped
+            if (odd) {
+                mmc3->banks[mmc3->bank_select & 0x07] = val;
+                mmc3_map_register(mapper, mmc3->bank_select & 0x07);
+                break;
+            }
+
+            const u8 changed = mmc3->bank_select ^ val;
+            mmc3->bank_select = val;
+
+            if (changed & MMC3_PRG_MODE) {
+                mmc3_map_prg(mapper);
+            }
+
+            if (changed & MMC3_CHR_INVERSION) {
+                mmc3_map_chr(mapper);
+            }
+            break;
+        case 0xA000:
+            if (odd) {
+                mmc3->prg_ram_protect = val;
+                mmc3_map_prg_ram(mapper);
+            } else {
+                mmc3->mirroring = val;
+                mmc3_update_mirroring(mapper);
+            }
+            break;
+        case 0xC000:
+            if (odd) {
+                mmc3->irq_counter = 0;
+                mmc3->irq_reload = true;
+            } else {
+                mmc3->irq_latch = val;
+            }
+            break;
+        case 0xE000:
+            mmc3->irq_enabled = odd;
+
+            // Disabling also acknowledges a pending IRQ
+            if (!odd) {
+                set_mapper_irq(mapper, false);
+            }
+            break;
+    }
+}
+
+static void mmc3_scanline(Mapper* mapper) {
+    Mmc3* mmc3 = &mapper->regs.mmc3;
+
+    if (mmc3->irq_counter == 0 || mmc3->irq_reload) {
+        mmc3->irq_counter = mmc3->irq_latch;
+        mmc3->irq_reload = false;
+    } else {
+        mmc3->irq_counter--;
+    }
+
+    if (mmc3->irq_counter == 0 && mmc3->irq_enabled) {
+        set_mapper_irq(mapper, true);
+    }
+}
+
+static void mmc3_save_state(const Mapper* mapper, u8* state) {
+    const Mmc3* mmc3 = &mapper->regs.mmc3;
+
+    state[0] = mmc3->bank_select;
+    for (int bank = 0; bank < 8; bank++) {
+        state[1 + bank] = mmc3->banks[bank];
+    }
+    state[9] = mmc3->mirroring;
+    state[10] = mmc3->prg_ram_protect;
+    state[11] = mmc3->irq_latch;
+    state[12] = mmc3->irq_counter;
+    state[13] = mmc3->irq_reload;
+    state[14] = mmc3->irq_enabled;
+}
+
+static void mmc3_load_state(Mapper* mapper, const u8* state, u16 version) {
+    Mmc3* mmc3 = &mapper->regs.mmc3;
+
+    mmc3->bank_select = state[0];
+    for (int bank = 0; bank < 8; bank++) {
+        mmc3->banks[bank] = state[1 + bank];
+    }
+    mmc3->mirroring = state[9];
+    // Builds before version 4 ignored the protection, the RAM was always enabled
+    mmc3->prg_ram_protect = version < 4 ? MMC3_PRG_RAM_ENABLE : state[10];
+    mmc3->irq_latch = state[11];
+    mmc3->irq_counter = state[12];
+    mmc3->irq_reload = state[13];
+    mmc3->irq_enabled = state[14];
+
+    mmc3_map_prg(mapper);
+    mmc3_map_chr(mapper);
+    mmc3_map_prg_ram(mapper);
+    mmc3_update_mirroring(mapper);
+}
+
+const MapperOps MMC3_OPS = {
+    .name = "MMC3",
+    .state_size = MMC3_STATE_SIZE,
+    .reset = mmc3_reset,
+    .write = mmc3_write,
+    .scanline = mmc3_scanline,
+    .save_state = mmc3_save_state,
+    .load_state = mmc3_load_state
+};
@@ -10,45 +10,182 @@
 
 #include "cpu.h"
 #include "nes.h"
+#include "frame_queue.h"
 #include "mapper.h"
+#include "rewind.h"
+#include "save_state.h"
 #include "utils.h"
 
 #define INES_HEADER_SIGNATURE 0x1A53454E
+#define PRG_ROM_UNIT_SIZE 0x4000
+#define CHR_ROM_UNIT_SIZE 0x2000
+#define PERF_REPORT_INTERVAL_NS 1000000000ULL
 
-static build_nes_header_result_t build_nes_header_from_rom_bin(const u8* rom_bin) {
-    build_nes_header_result_t result = (build_nes_header_result_t) {
-        .nes_header = NULL,
-        .valid = false
-    };
-    const size_t sign_size_in_bytes = 0x04;
-    u8 sign_arr[sign_size_in_bytes];
-    memcpy(sign_arr, rom_bin, sign_size_in_bytes);
+static void print_perf_report(const Cpu* cpu, u64 instructions, u64 elapsed_ns) {
+    const double seconds = elapsed_ns / 1e9;
+    fprintf(stderr, "[perf] core: %s, %.2f M instructions/sec, total instructions: %llu, total cycles: %llu\n",
+            cpu->core == CPU_CORE_THREADED ? "threaded" : "reference",
+            seconds > 0 ? instructions / seconds / 1e6 : 0.0,
+            (unsigned long long) cpu->instructions_performed,
+            (unsigned long long) cpu->cycles);
+
+    if (cpu->instructions_performed > 0) {
+        fprintf(stderr, "[perf] bus reads/instruction: %.3f, operand reads avoided/instruction: %.3f\n",
+                (double) cpu->bus_reads / cpu->instructions_performed,
+                (double) cpu->bus_reads_avoided / cpu->instructions_performed);
+    }
+
+    const DecodeCache* cache = cpu->decode_cache;
+    const u64 decodes = cache ? cache->hits + cache->misses + cache->uncached : 0;
+
+    if (cpu->core == CPU_CORE_THREADED && decodes > 0) {
+        fprintf(stderr, "[perf] decode cache hit rate: %.2f%%, uncached (RAM) decodes: %.2f%%, bus reads saved/instruction: %.3f\n",
+                100.0 * cache->hits / decodes,
+                100.0 * cache->uncached / decodes,
+                (double) cache->bus_reads_saved / decodes);
+    }
+}
+
+static void print_scheduler_report(const Nes* nes) {
+    const Ppu* ppu = nes->ppu;
+    const u64 batched = ppu->scanlines_drawn - ppu->scanlines_redrawn;
+
+    fprintf(stderr, "[sched] frames: %llu, events dispatched: %llu, PPU syncs: %llu, APU syncs: %llu, DMC fetches: %llu\n",
+            (unsigned long long) nes->frames,
+            (unsigned long long) nes->scheduler.events_dispatched,
+            (unsigned long long) ppu->component.syncs,
+            (unsigned long long) nes->apu->component.syncs,
+            (unsigned long long) nes->apu->dmc_fetches);
+    fprintf(stderr, "[ppu] scanlines: %llu, one pass: %.2f%%, per dot after mid-scanline writes: %.2f%%\n",
+            (unsigned long long) ppu->scanlines_drawn,
+            ppu->scanlines_drawn > 0 ? 100.0 * batched / ppu->scanlines_drawn : 0.0,
+            ppu->scanlines_drawn > 0 ? 100.0 * ppu->scanlines_redrawn / ppu->scanlines_drawn : 0.0);
+    fprintf(stderr, "[mapper] %s, bank switches: %llu, IRQs: %llu\n",
+            nes->mapper->ops->name,
+            (unsigned long long) nes->mapper->bank_switches,
+            (unsigned long long) nes->mapper->irqs);
+}
+
+static void print_pacing_report(Nes* nes) {
+    const FrameStats stats = collect_frame_stats(&nes->pacer);
+
+    fprintf(stderr, "[pace] %.2f fps, frame time min/avg/p99: %.2f/%.2f/%.2f ms, jitter avg/p99: %.3f/%.3f ms\n",
+            stats.fps, stats.min_ns / 1e6, stats.avg_ns / 1e6, stats.p99_ns / 1e6,
+            stats.avg_jitter_ns / 1e6, stats.p99_jitter_ns / 1e6);
+}
+
+static void print_display_report(const Nes* nes) {
+    if (!nes->frame_queue) {
+        return;
+    }
+
+    const FrameQueueStats stats = get_frame_queue_stats(nes->frame_queue);
+
+    fprintf(stderr, "[display] frames published: %llu, shown: %llu, dropped: %llu, duplicated: %llu\n",
+            (unsigned long long) stats.published,
+            (unsigned long long) stats.taken,
+            (unsigned long long) stats.dropped,
+            (unsigned long long) stats.duplicated);
+}
+
+static void end_of_frame_event(void* ctx, u64 __attribute__((__unused__)) timestamp) {
+    Nes* nes = ctx;
+    const u64 now = nes->cpu->cycles;
+
+    // Bring every chip up to the frame boundary
+    sync_component(&nes->ppu->component, now);
+    sync_component(&nes->apu->component, now);
+    nes->frames++;
+
+    schedule_event(&nes->scheduler, EVENT_END_OF_FRAME, ppu_frame_end_cycle(nes->ppu));
+}
+
+static void stop_cpu_at_deadline(void* ctx, u64 deadline) {
+    limit_cpu_run(ctx, deadline);
+}
+
+static void init_nes_scheduler(Nes* nes) {
+    Scheduler* scheduler = &nes->scheduler;
+
+    init_scheduler(scheduler);
+    scheduler->deadline_changed = stop_cpu_at_deadline;
+    scheduler->deadline_ctx = nes->cpu;
+
+    nes->frames = 0;
+    init_frame_pacer(&nes->pacer, TV_NTSC);
+    nes->ppu = build_ppu(nes->cpu, scheduler);
+    nes->apu = build_apu(nes->cpu, scheduler);
+    memset(nes->controllers, 0, sizeof(nes->controllers));
+    nes->apu->controllers = nes->controllers;
+    nes->apu->ppu = nes->ppu;
+
+    set_event_handler(scheduler, EVENT_END_OF_FRAME, end_of_frame_event, nes);
+    schedule_event(scheduler, EVENT_END_OF_FRAME, ppu_frame_end_cycle(nes->ppu));
+}
+
+size_t nes_prg_rom_offset(const NesHeader* nes_header) {
+    return INES_HEADER_SIZE + (nes_header->trainer ? INES_TRAINER_SIZE : 0);
+}
+
+bool read_nes_header(const u8* rom_bin, size_t rom_size, NesHeader* nes_header) {
+    if (rom_size < INES_HEADER_SIZE) {
+        fprintf(stderr, "ROM is smaller than the iNES header. Given size in bytes: %zu\n", rom_size);
+        return false;
+    }
 
     const u32 sign = read_little_endian_u32(rom_bin[0], rom_bin[1], rom_bin[2], rom_bin[3]);
 
     if (sign != INES_HEADER_SIGNATURE) {
         fprintf(stderr, "Invalid iNES Header signature! Given Signature: 0x%x\n", sign);
-        return result;
+        return false;
     }
 
-    NesHeader* nes_header = malloc(sizeof(NesHeader));
-
     nes_header->prg_rom_count = rom_bin[4];
     nes_header->chr_rom_count = rom_bin[5];
     nes_header->mirroring = (rom_bin[6] & 0x1) == 1 ? VERTICAL : HORIZONTAL;
     nes_header->prg_ram_available = (rom_bin[6] & 0x10) > 0;
+    nes_header->trainer = (rom_bin[6] & 0x04) > 0;
+    nes_header->nes2 = (rom_bin[7] & 0x0C) == 0x08;
+
+    if (rom_bin[6] & 0x08) {
+        nes_header->mirroring = FOUR_SCREEN;
+    }
 
-    const u8 mapper_code = rom_bin[6] >> 4;
+    // The upper nibble of the mapper is in byte 7. Old dumps have garbage (like a ripper's
+    // name) in bytes 7-15, it is only trusted for NES 2.0 headers or when the padding is clean.
+    const bool clean_padding = rom_bin[12] == 0 && rom_bin[13] == 0 && rom_bin[14] == 0 && rom_bin[15] == 0;
+    nes_header->mapper = (rom_bin[6] >> 4) | (nes_header->nes2 || clean_padding ? rom_bin[7] & 0xF0 : 0);
+    nes_header->submapper = nes_header->nes2 ? rom_bin[8] >> 4 : 0;
 
-    switch (mapper_code) {
-         case 0:
-                nes_header->mapper = NROM;
-                break;
-        default: 
-                 fprintf(stderr, "Invalid iNES Mapper code: %d", mapper_code);
-                 // Free NES Header as the header is invalid.
-                 free(nes_header);
-                 return result;
+    const size_t expected_size = nes_prg_rom_offset(nes_header)
+        + nes_header->prg_rom_count * PRG_ROM_UNIT_SIZE + nes_header->chr_rom_count * CHR_ROM_UNIT_SIZE;
+
+    if (rom_size < expected_size) {
+        fprintf(stderr, "ROM is truncated, expected %zu bytes but got %zu\n", expected_size, rom_size);
+        return false;
+    }
+
+    return true;
+}
+
+static build_nes_header_result_t build_nes_header_from_rom_bin(const u8* rom_bin, size_t rom_size) {
+    build_nes_header_result_t result = (build_nes_header_result_t) {
+        .nes_header = NULL,
+        .valid = false
+    };
+
+    NesHeader* nes_header = malloc(sizeof(NesHeader));
+
+    if (!read_nes_header(rom_bin, rom_size, nes_header)) {
+        free(nes_header);
+        return result;
+    }
+
+    if (!is_mapper_supported(nes_header->mapper) || nes_header->prg_rom_count == 0) {
+        fprintf(stderr, "Invalid iNES Mapper code: %d\n", nes_header->mapper);
+        // Free NES Header as the header is invalid.
+        free(nes_header);
+        return result;
     }
 
     result.nes_header = nes_header;
@@ -57,68 +194,364 @@ static build_nes_header_result_t build_nes_header_from_rom_bin(const u8* rom_bin
     return result;
 }
 
-build_nes_result_t build_nes_from_rom_bin(u8** p_rom_bin) {
-    u8* rom_bin = *p_rom_bin;
+build_nes_result_t build_nes_from_rom_image(RomImage* image) {
+    RomImage rom = *image;
     build_nes_result_t result = (build_nes_result_t) {.nes = NULL, .valid = false};
-    const build_nes_header_result_t nes_header_result = build_nes_header_from_rom_bin(rom_bin);
+    const build_nes_header_result_t nes_header_result = build_nes_header_from_rom_bin(rom.data, rom.size);
+
+    // The Nes owns the image from here on, clear the caller's copy
+    *image = (RomImage) {.data = NULL, .size = 0, .mapped = false};
 
     if(!nes_header_result.valid) {
-        free(rom_bin);
-        //Update the pointer address to NULL after cleaning up.
-        *p_rom_bin = NULL;
+        release_rom_image(&rom);
         return result;
     }
 
     Nes* nes = malloc(sizeof(Nes));
 
     nes->nes_header = nes_header_result.nes_header;
-    mem_map_result mem_map_result = generate_mem_map(nes->nes_header, rom_bin);
-
-    if (!mem_map_result.valid) {
-        // Free NES if we can't create mem map
-        free(nes);
-        free(rom_bin);
-        *p_rom_bin = NULL;
+    nes->rom = rom;
+    nes->cpu = build_cpu_from_mem(calloc(CPU_MEM_MAP_SIZE, sizeof(u8)), CPU_MEM_MAP_SIZE);
+    nes->rewind = NULL;
+    atomic_init(&nes->rewinding, false);
+    atomic_init(&nes->stop_requested, false);
+    nes->frame_queue = NULL;
+    memset(&nes->run_ahead, 0, sizeof(RunAhead));
+    init_nes_scheduler(nes);
+    nes->mapper = build_mapper(nes->nes_header, rom.data, nes->cpu, nes->ppu, &nes->scheduler);
 
+    if (!nes->mapper) {
+        free_nes(nes);
         return result;
     }
 
-    u8* cpu_mem = mem_map_result.mem_map.cpu_mem_map;
-    Cpu* cpu = build_cpu_from_mem(cpu_mem);
-    nes->cpu = cpu;
+    // The reset vector is in the banks the mapper just mapped
+    reset_cpu(nes->cpu);
 
     result.nes = nes;
     result.valid = true;
 
-    free(rom_bin);
+    return result;
+}
+
+build_nes_result_t build_nes_from_rom_bin(u8** p_rom_bin, size_t rom_size) {
+    // A heap buffer is read in place just like a mapped file
+    RomImage image = (RomImage) {.data = *p_rom_bin, .size = rom_size, .mapped = false};
+
     *p_rom_bin = NULL;
+    return build_nes_from_rom_image(&image);
+}
 
+Nes* build_shadow_nes(const Nes* nes, RomImage* image) {
+    const build_nes_result_t result = build_nes_from_rom_image(image);
 
-    return result;
+    if (!result.valid) {
+        return NULL;
+    }
+
+    result.nes->cpu->core = nes->cpu->core;
+    if (!nes->cpu->decode_cache) {
+        disable_decode_cache(result.nes->cpu);
+    }
+
+    return result.nes;
+}
+
+// Runs the CPU up to the next event (or cycle_limit, whichever comes first) and handles
+// everything that is due by then. Register accesses in between catch the other chips up.
+static void advance_nes(Nes* nes, u64 cycle_limit) {
+    Cpu* cpu = nes->cpu;
+    u64 deadline = next_event_timestamp(&nes->scheduler);
+
+    if (cycle_limit < deadline) {
+        deadline = cycle_limit;
+    }
+
+    if (deadline > cpu->cycles) {
+        run_cpu(cpu, deadline - cpu->cycles);
+    }
+
+    dispatch_events(&nes->scheduler, cpu->cycles);
+    service_irq(cpu);
+}
+
+static inline bool nes_stop_requested(const Nes* nes) {
+    return atomic_load_explicit(&nes->stop_requested, memory_order_relaxed);
+}
+
+// Runs until the end of the frame in progress without any of the per-frame work
+static void run_hidden_frame(Nes* nes) {
+    const u64 frames = nes->frames;
+
+    while (nes->frames == frames && nes->cpu->cpu_state == CPU_RUNNING) {
+        advance_nes(nes, EVENT_NEVER);
+    }
+}
+
+static void run_ahead(Nes* nes) {
+    RunAhead* run_ahead = &nes->run_ahead;
+    Nes* ahead = run_ahead->shadow ? run_ahead->shadow : nes;
+    const CpuState cpu_state = nes->cpu->cpu_state;
+    const u64 start_ns = get_time_ns();
+
+    save_nes_state(nes, run_ahead->state, run_ahead->state_size);
+    u64 load_start_ns = get_time_ns();
+    run_ahead->save_ns += load_start_ns - start_ns;
+
+    if (run_ahead->shadow) {
+        // The primary never rolls back, so whatever it produced stays untouched
+        load_nes_state(ahead, run_ahead->state, run_ahead->state_size);
+        run_ahead->load_ns += get_time_ns() - load_start_ns;
+    }
+
+    ahead->cpu->cpu_state = CPU_RUNNING;
+
+    // A stop cuts the frames ahead short, the rollback below leaves the request alone
+    for (u32 frame = 0; frame < run_ahead->frames && !nes_stop_requested(nes); frame++) {
+        run_hidden_frame(ahead);
+    }
+
+    if (!run_ahead->shadow) {
+        // The framebuffer is not part of the state and keeps the frame furthest ahead
+        load_start_ns = get_time_ns();
+        load_nes_state(nes, run_ahead->state, run_ahead->state_size);
+        run_ahead->load_ns += get_time_ns() - load_start_ns;
+        // Only the CPU's own state, a halt in the frames ahead has not happened yet
+        nes->cpu->cpu_state = cpu_state;
+    }
+
+    run_ahead->frames_run++;
+    run_ahead->ahead_ns += get_time_ns() - start_ns;
+}
+
+static void step_nes(Nes* nes, u64 cycle_limit) {
+    const u64 frames = nes->frames;
+
+    advance_nes(nes, cycle_limit);
+
+    if (nes->frames != frames) {
+        if (nes->rewind) {
+            push_rewind_frame(nes->rewind, nes);
+        }
+
+        // The frame just run is still shown, the state goes back to before the one before it
+        const bool rewound = atomic_load_explicit(&nes->rewinding, memory_order_relaxed) && rewind_nes(nes);
+
+        if (!rewound && nes->run_ahead.frames && nes->cpu->cpu_state == CPU_RUNNING && !nes_stop_requested(nes)) {
+            run_ahead(nes);
+        }
+
+        // A copy and an atomic exchange, the consumer never holds up emulation
+        if (nes->frame_queue) {
+            const Ppu* ppu = nes_display_ppu(nes);
+            u8* frame = back_frame(nes->frame_queue);
+
+            memcpy(frame, ppu->framebuffer, sizeof(ppu->framebuffer));
+            memcpy(&frame[NES_DISPLAY_FRAME_EMPHASIS], ppu->emphasis, sizeof(ppu->emphasis));
+            frame[NES_DISPLAY_FRAME_PARITY] = ppu->frames & 1;
+            publish_frame(nes->frame_queue);
+        }
+
+        pace_frame(&nes->pacer);
+    }
 }
 
 void run_nes(Nes* nes) {
     Cpu* cpu = nes->cpu;
     cpu->cpu_state = CPU_RUNNING;
 
-    //FIXME: Implement the infinite loop speed according to 2A03 CPU clock cycle.
-    while (cpu->cpu_state == CPU_RUNNING) {
-       const size_t cycles = exec_instruction(cpu);
+    u64 report_start_ns = get_time_ns();
+    u64 report_start_instructions = cpu->instructions_performed;
+
+    bool running = !nes_stop_requested(nes);
+
+    while (running) {
+       step_nes(nes, EVENT_NEVER);
+       running = cpu->cpu_state == CPU_RUNNING && !nes_stop_requested(nes);
 
-       if (cycles == 0) {
-            printf("Invalid instruction at address $%X. Increasing pc by 1\n", cpu->r_pc);
+       const u64 now_ns = get_time_ns();
+       if (now_ns - report_start_ns >= PERF_REPORT_INTERVAL_NS || !running) {
+            print_perf_report(cpu, cpu->instructions_performed - report_start_instructions, now_ns - report_start_ns);
+            print_scheduler_report(nes);
+            print_pacing_report(nes);
+            print_display_report(nes);
+            print_rewind_report(nes);
+            print_run_ahead_report(nes);
+            report_start_ns = now_ns;
+            report_start_instructions = cpu->instructions_performed;
        }
+    }
+}
+
+static StopReason check_stop_condition(const Nes* nes, const StopCondition* condition, u64 start_cycles, u64 start_frames) {
+    const Cpu* cpu = nes->cpu;
+
+    if (cpu->cpu_state != CPU_RUNNING || nes_stop_requested(nes)) {
+        return STOP_CPU_STOPPED;
+    }
+
+    if (condition->watch_pc && cpu->r_pc == condition->pc) {
+        return STOP_PC_REACHED;
+    }
+
+    u8 val;
+
+    // Peeked rather than read, reading $2002, $2007 or $4016 would change what the game sees
+    if (condition->watch_memory && bus_peek(&cpu->bus, condition->memory_addr, &val) && val == condition->memory_val) {
+        return STOP_MEMORY_MATCHED;
+    }
+
+    if (condition->max_cycles > 0 && cpu->cycles - start_cycles >= condition->max_cycles) {
+        return STOP_CYCLE_LIMIT;
+    }
+
+    if (condition->max_frames > 0 && nes->frames - start_frames >= condition->max_frames) {
+        return STOP_FRAME_LIMIT;
+    }
+
+    return STOP_NONE;
+}
+
+RunSummary run_nes_until(Nes* nes, const StopCondition* condition) {
+    Cpu* cpu = nes->cpu;
+    cpu->cpu_state = CPU_RUNNING;
+
+    const u64 start_ns = get_time_ns();
+    const u64 start_cycles = cpu->cycles;
+    const u64 start_instructions = cpu->instructions_performed;
+    const u64 start_frames = nes->frames;
+    const u64 cycle_limit = condition->max_cycles > 0 ? start_cycles + condition->max_cycles : EVENT_NEVER;
+
+    StopReason reason;
 
-       cpu->cycles += cycles;
-       cpu->instructions_performed++;
+    while ((reason = check_stop_condition(nes, condition, start_cycles, start_frames)) == STOP_NONE) {
+        // A PC condition has to be checked before every instruction, so the CPU is single
+        // stepped. Memory is checked between scheduler steps.
+        step_nes(nes, condition->watch_pc ? cpu->cycles + 1 : cycle_limit);
+    }
+
+    cpu->cpu_state = CPU_STOPPED;
+
+    return (RunSummary) {
+        .reason = reason,
+        .instructions = cpu->instructions_performed - start_instructions,
+        .cycles = cpu->cycles - start_cycles,
+        .frames = nes->frames - start_frames,
+        .wall_ns = get_time_ns() - start_ns
+    };
+}
+
+void stop_nes(Nes* nes) {
+    // A lock-free atomic, unlike the CPU's state, which the emulation thread writes all along
+    atomic_store_explicit(&nes->stop_requested, true, memory_order_relaxed);
+}
+
+void enable_rewind(Nes* nes, size_t memory_budget) {
+    if (nes->rewind) {
+        free_rewind_buffer(nes->rewind);
+    }
+
+    nes->rewind = memory_budget ? build_rewind_buffer(nes, memory_budget, REWIND_DEFAULT_KEYFRAME_INTERVAL) : NULL;
+}
+
+bool rewind_nes(Nes* nes) {
+    return nes->rewind && rewind_frames(nes->rewind, nes, 2);
+}
+
+void set_nes_rewinding(Nes* nes, bool rewinding) {
+    atomic_store_explicit(&nes->rewinding, rewinding, memory_order_relaxed);
+}
+
+void print_rewind_report(Nes* nes) {
+    if (!nes->rewind) {
+        return;
+    }
+
+    const RewindStats stats = get_rewind_stats(nes->rewind);
+    // The frames the history spans, dropped frames leave gaps in it
+    const double seconds = stats.entries > 0 ? (stats.newest_frame - stats.oldest_frame + 1) / nes->pacer.frame_rate : 0.0;
+
+    fprintf(stderr, "[rewind] history: %.1f s in %.1f/%.1f KiB (%.1f KiB per second), keyframes: %zu, "
+            "compression: %.1fx at %.1f us/frame, dropped: %llu\n",
+            seconds, stats.bytes / 1024.0, stats.memory_budget / 1024.0,
+            seconds > 0 ? stats.bytes / 1024.0 / seconds : 0.0,
+            stats.keyframes,
+            stats.compressed_bytes > 0 ? (double) stats.raw_bytes / stats.compressed_bytes : 0.0,
+            stats.pushed > stats.dropped ? stats.compress_ns / 1e3 / (stats.pushed - stats.dropped) : 0.0,
+            (unsigned long long) stats.dropped);
+}
+
+void enable_run_ahead(Nes* nes, u32 frames, Nes* shadow) {
+    RunAhead* run_ahead = &nes->run_ahead;
 
-       //sleep(1);
+    if (run_ahead->shadow) {
+        free_nes(run_ahead->shadow);
+    }
+
+    free(run_ahead->state);
+    memset(run_ahead, 0, sizeof(RunAhead));
+
+    if (frames == 0) {
+        if (shadow) {
+            free_nes(shadow);
+        }
+        return;
+    }
+
+    run_ahead->frames = frames;
+    run_ahead->shadow = shadow;
+    run_ahead->state_size = nes_state_size(nes);
+    run_ahead->state = malloc(run_ahead->state_size);
+
+    if (shadow) {
+        // The shadow is only ever driven through run_ahead
+        set_pacing_mode(&shadow->pacer, PACING_UNCAPPED);
     }
 }
 
+void print_run_ahead_report(Nes* nes) {
+    const RunAhead* run_ahead = &nes->run_ahead;
+
+    if (!run_ahead->frames || !run_ahead->frames_run) {
+        return;
+    }
+
+    const double frames_run = run_ahead->frames_run;
+
+    fprintf(stderr, "[runahead] %u frames ahead%s: %.1f ms less latency, overhead %.3f ms/frame "
+            "(%.3f ms per frame ahead), snapshot %.2f us, restore %.2f us\n",
+            run_ahead->frames, run_ahead->shadow ? " on a second instance" : "",
+            1e3 * run_ahead->frames / nes->pacer.frame_rate,
+            run_ahead->ahead_ns / 1e6 / frames_run,
+            run_ahead->ahead_ns / 1e6 / frames_run / run_ahead->frames,
+            run_ahead->save_ns / 1e3 / frames_run,
+            run_ahead->load_ns / 1e3 / frames_run);
+}
+
+const Ppu* nes_display_ppu(const Nes* nes) {
+    return nes->run_ahead.shadow ? nes->run_ahead.shadow->ppu : nes->ppu;
+}
+
+const u8* nes_display_framebuffer(const Nes* nes) {
+    return nes_display_ppu(nes)->framebuffer;
+}
+
 void free_nes(Nes* nes) {
+    if (nes->rewind) {
+        free_rewind_buffer(nes->rewind);
+    }
+
+    enable_run_ahead(nes, 0, NULL);
+
+    if (nes->mapper) {
+        free_mapper(nes->mapper);
+    }
+
     free(nes->nes_header);
+    free_ppu(nes->ppu);
+    free_apu(nes->apu);
     free(nes->cpu->mem);
-    free(nes->cpu);
+    free_cpu(nes->cpu);
+    release_rom_image(&nes->rom);
     free(nes);
 }
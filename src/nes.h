@@ -3,29 +3,99 @@
 
 #include "types.h"
 #include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "scheduler.h"
+#include "pacer.h"
+#include "controller.h"
+#include "io_utils.h"
+#include <stdatomic.h>
 #include <stdbool.h>
 
-typedef enum Mapper {
-    NROM = 0
-} Mapper;
-
+// iNES mapper numbers of the supported boards
+typedef enum MapperType {
+    NROM = 0,
+    MMC1 = 1,
+    UXROM = 2,
+    CNROM = 3,
+    MMC3 = 4,
+    AXROM = 7
+} MapperType;
 
+// Nametable arrangement, mappers with mirroring control switch it at run time
 typedef enum Mirroring {
     HORIZONTAL,
-    VERTICAL
+    VERTICAL,
+    SINGLE_SCREEN_LOWER,
+    SINGLE_SCREEN_UPPER,
+    FOUR_SCREEN
 } Mirroring;
 
+// Size of the iNES header and of the trainer that may follow it
+#define INES_HEADER_SIZE 0x10
+#define INES_TRAINER_SIZE 0x200
+
 typedef struct NesHeader {
     bool prg_ram_available;
+    // 512 bytes between the header and PRG-ROM
+    bool trainer;
+    bool nes2;
     u8 prg_rom_count;
     u8 chr_rom_count;
-    Mapper mapper;
+    // The iNES number, which may be a board build_nes does not support
+    MapperType mapper;
+    // NES 2.0 only, 0 otherwise
+    u8 submapper;
     Mirroring mirroring;
 } NesHeader;
 
+// Emulates frames ahead of the real one at the end of every frame and shows the last of
+// them, so input shows up frames earlier. The frames ahead run on a second instance when
+// there is one, otherwise the Nes snapshots itself and rolls back afterwards.
+typedef struct RunAhead {
+    u32 frames;
+    struct Nes* shadow;
+    u8* state;
+    size_t state_size;
+    // Real frames that were followed by frames ahead
+    u64 frames_run;
+    // Time spent on the frames ahead, snapshot and restore included
+    u64 ahead_ns;
+    u64 save_ns;
+    u64 load_ns;
+} RunAhead;
+
+// Layout of a frame handed to the display: the framebuffer, the emphasis of every pixel
+// and the parity of the PPU's frame number, which decides the phase of the color subcarrier
+#define NES_DISPLAY_FRAME_EMPHASIS (PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT)
+#define NES_DISPLAY_FRAME_PARITY (2 * PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT)
+#define NES_DISPLAY_FRAME_SIZE (NES_DISPLAY_FRAME_PARITY + 1)
+
 typedef struct Nes {
     NesHeader* nes_header;
+    // The cartridge banks point into it, owned by the Nes
+    RomImage rom;
+    // Board of the cartridge (see mapper.h)
+    struct Mapper* mapper;
     Cpu* cpu;
+    Ppu* ppu;
+    Apu* apu;
+    // Drives every chip off the CPU clock, the CPU runs until the next event is due
+    Scheduler scheduler;
+    u64 frames;
+    FramePacer pacer;
+    Controller controllers[2];
+    // Records every frame when set, owned by the Nes (see rewind.h)
+    struct RewindBuffer* rewind;
+    // Plays the history backwards while set, see set_nes_rewinding
+    _Atomic bool rewinding;
+    // Set by stop_nes. Kept apart from the CPU's state, which snapshots and rollbacks
+    // restore, so no restore can take back a stop.
+    _Atomic bool stop_requested;
+    RunAhead run_ahead;
+    // Gets every frame shown when set, not owned by the Nes (see frame_queue.h), laid out
+    // as NES_DISPLAY_FRAME_*
+    struct FrameQueue* frame_queue;
 } Nes;
 
 typedef struct build_nes_result_t {
@@ -38,8 +108,74 @@ typedef struct build_nes_header_result_t {
     NesHeader* nes_header;
 } build_nes_header_result_t;
 
-build_nes_result_t build_nes_from_rom_bin(u8** p_rom_bin);
+typedef enum StopReason {
+    STOP_NONE,
+    STOP_CPU_STOPPED,
+    STOP_FRAME_LIMIT,
+    STOP_CYCLE_LIMIT,
+    STOP_PC_REACHED,
+    STOP_MEMORY_MATCHED
+} StopReason;
+
+// When run_nes_until returns. Limits of 0 are ignored, the first condition met wins.
+typedef struct StopCondition {
+    u64 max_frames;
+    u64 max_cycles;
+    // Stops before the instruction at pc executes. Single steps the CPU, which is slower.
+    bool watch_pc;
+    u16 pc;
+    // Stops once the byte at memory_addr reads memory_val, checked between scheduler steps.
+    // Only RAM, PRG-RAM and PRG-ROM are watched, registers never match (see bus_peek).
+    bool watch_memory;
+    u16 memory_addr;
+    u8 memory_val;
+} StopCondition;
+
+typedef struct RunSummary {
+    StopReason reason;
+    u64 instructions;
+    u64 cycles;
+    u64 frames;
+    u64 wall_ns;
+} RunSummary;
+
+// Parses and validates the iNES/NES 2.0 header against the size of the ROM, whether or not
+// the mapper is supported. Reports what is wrong on stderr.
+bool read_nes_header(const u8* rom_bin, size_t rom_size, NesHeader* nes_header);
+// Offset of PRG-ROM in the ROM, CHR-ROM follows it
+size_t nes_prg_rom_offset(const NesHeader* nes_header);
+// Takes ownership of the ROM image and reads the cartridge in place, the image is
+// released when building fails. *image is cleared either way.
+build_nes_result_t build_nes_from_rom_image(RomImage* image);
+// Takes ownership of the ROM buffer, *p_rom_bin is set to NULL
+build_nes_result_t build_nes_from_rom_bin(u8** p_rom_bin, size_t rom_size);
+// Second instance of the cartridge in image for run-ahead (see enable_run_ahead),
+// configured like nes. Takes ownership of the image like build_nes_from_rom_image,
+// returns NULL when building fails.
+Nes* build_shadow_nes(const Nes* nes, RomImage* image);
 void free_nes(Nes* nes);
 void run_nes(Nes* nes);
+// Runs without periodic reports until the condition is met or the NES is stopped
+RunSummary run_nes_until(Nes* nes, const StopCondition* condition);
+// Makes run_nes and run_nes_until return at the end of the current scheduler step, and
+// right away from then on. Safe to call from a signal handler and from any thread.
+void stop_nes(Nes* nes);
+// Keeps memory_budget bytes of rewind history from now on, 0 turns it off
+void enable_rewind(Nes* nes, size_t memory_budget);
+void print_rewind_report(Nes* nes);
+// Steps back over the last frame run and the one before it, so the frame run next is the
+// one before the last frame shown. Returns false, leaving the Nes untouched, when there is
+// no rewind history or it does not reach back that far.
+bool rewind_nes(Nes* nes);
+// While set every frame run is followed by rewind_nes, which plays the history backwards
+// at the speed it was recorded. Safe to call from any thread.
+void set_nes_rewinding(Nes* nes, bool rewinding);
+// Runs frames ahead of every frame, 0 turns run-ahead off. The Nes takes ownership of
+// shadow, a second instance of the same cartridge or NULL to roll back the Nes itself.
+void enable_run_ahead(Nes* nes, u32 frames, Nes* shadow);
+void print_run_ahead_report(Nes* nes);
+// PPU whose framebuffer shows the last frame, the one furthest ahead with run-ahead
+const Ppu* nes_display_ppu(const Nes* nes);
+const u8* nes_display_framebuffer(const Nes* nes);
 
 #endif
@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ntsc.h"
+#include "utils.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define NTSC_VECTOR_ISA "avx2"
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define NTSC_VECTOR_ISA "sse2"
+#endif
+
+#define SAMPLES_PER_PIXEL 8
+#define SUBCARRIER_SAMPLES 12
+#define LUMA_WINDOW 12
+#define CHROMA_WINDOW 24
+// Fits the decoded colors to nes_palette_argb (video.c)
+#define CHROMA_SATURATION 0.8
+// Fixed point of the kernels, the output is shifted down by this
+#define KERNEL_FRACTION_BITS 3
+#define KERNEL_ONE (255 << KERNEL_FRACTION_BITS)
+// Kernel values of an output pixel
+#define PIXEL_CHANNELS 4
+
+// Voltages of the signal: low and high level of each luma. Emphasis attenuates them.
+static const double signal_levels[2][4] = {
+    {0.350, 0.518, 0.962, 1.550},
+    {1.094, 1.506, 1.962, 1.962}
+};
+#define BLACK_LEVEL 0.518
+#define WHITE_LEVEL 1.962
+#define ATTENUATION 0.746
+
+#define SQRT3_2 0.8660254037844386
+// Subcarrier at every sample phase, shifted so that the hues line up with the palette
+static const double subcarrier_cos[SUBCARRIER_SAMPLES] = {
+    -0.5, -SQRT3_2, -1.0, -SQRT3_2, -0.5, 0.0, 0.5, SQRT3_2, 1.0, SQRT3_2, 0.5, 0.0
+};
+static const double subcarrier_sin[SUBCARRIER_SAMPLES] = {
+    SQRT3_2, 0.5, 0.0, -0.5, -SQRT3_2, -1.0, -SQRT3_2, -0.5, 0.0, 0.5, SQRT3_2, 1.0
+};
+
+// Kernel of the pixels left and right of the frame, black is no signal
+static const i16 black_kernel[NTSC_KERNEL_SIZE];
+
+// Hue 1-12 is high for the half of the subcarrier cycle that starts at its phase
+static inline bool in_color_phase(int hue, int phase) {
+    return (hue + phase) % SUBCARRIER_SAMPLES < 6;
+}
+
+// Sample of the square wave of a 9-bit color at a phase of the subcarrier, 0 at black and
+// 1 at white
+static double color_signal(int color, int phase) {
+    const int hue = color & 0x0F;
+    const int emphasis = color >> 6;
+    // Hues 14 and 15 are black, whatever the luma
+    const int luma = hue > 13 ? 1 : color >> 4 & 0x03;
+    double low = signal_levels[0][luma];
+    double high = signal_levels[1][luma];
+
+    // Hue 0 is gray at the high level, 13-15 at the low one
+    if (hue == 0) {
+        low = high;
+    } else if (hue > 12) {
+        high = low;
+    }
+
+    double signal = in_color_phase(hue, phase) ? high : low;
+
+    // Red, green and blue emphasis each dim a different part of the cycle
+    if (hue < 14 && ((emphasis & 1 && in_color_phase(0x0C, phase))
+                     || (emphasis & 2 && in_color_phase(0x04, phase))
+                     || (emphasis & 4 && in_color_phase(0x08, phase)))) {
+        signal *= ATTENUATION;
+    }
+
+    return (signal - BLACK_LEVEL) / (WHITE_LEVEL - BLACK_LEVEL);
+}
+
+static inline i16 to_fixed(double val) {
+    return (i16) (val * KERNEL_ONE + (val < 0 ? -0.5 : 0.5));
+}
+
+static void build_kernel(i16 kernel[NTSC_KERNEL_SIZE], int color, int phase) {
+    double samples[SAMPLES_PER_PIXEL];
+
+    for (int t = 0; t < SAMPLES_PER_PIXEL; t++) {
+        samples[t] = color_signal(color, (phase * 4 + t) % SUBCARRIER_SAMPLES);
+    }
+
+    for (int x = 0; x < NTSC_KERNEL_PIXELS; x++) {
+        for (int m = 0; m < NTSC_SCALE; m++) {
+            // The output pixel's NES pixel is x - NTSC_KERNEL_RADIUS pixels right of this
+            // one, its center is in the middle of its two samples
+            const int center = (x - NTSC_KERNEL_RADIUS) * SAMPLES_PER_PIXEL + 2 * m + 1;
+            double y = 0, i = 0, q = 0;
+
+            for (int t = 0; t < SAMPLES_PER_PIXEL; t++) {
+                const int phase_t = (phase * 4 + t) % SUBCARRIER_SAMPLES;
+
+                if (t >= center - LUMA_WINDOW / 2 && t < center + LUMA_WINDOW / 2) {
+                    y += samples[t] / LUMA_WINDOW;
+                }
+
+                // Demodulating takes twice the average
+                if (t >= center - CHROMA_WINDOW / 2 && t < center + CHROMA_WINDOW / 2) {
+                    i += 2 * CHROMA_SATURATION * samples[t] * subcarrier_cos[phase_t] / CHROMA_WINDOW;
+                    q += 2 * CHROMA_SATURATION * samples[t] * subcarrier_sin[phase_t] / CHROMA_WINDOW;
+                }
+            }
+
+            i16* pixel = &kernel[(x * NTSC_SCALE + m) * PIXEL_CHANNELS];
+
+            // YIQ to RGB, as bytes of an ARGB8888 pixel
+            pixel[0] = to_fixed(y - 1.108545 * i + 1.709007 * q);
+            pixel[1] = to_fixed(y - 0.274788 * i - 0.635691 * q);
+            pixel[2] = to_fixed(y + 0.946882 * i + 0.623557 * q);
+            pixel[3] = 0;
+        }
+    }
+}
+
+// Kernels of the pixels of a row and of NTSC_KERNEL_RADIUS black pixels on either side
+static void gather_kernels(const NtscFilter* filter, const NtscFrame* frame, int row,
+                           const i16* kernels[PPU_FRAME_WIDTH + 2 * NTSC_KERNEL_RADIUS]) {
+    const u8* colors = &frame->frame[row * PPU_FRAME_WIDTH];
+    const u8* emphasis = &frame->emphasis[row * PPU_FRAME_WIDTH];
+    // Every row starts a third of a cycle later, every pixel two thirds after the one before
+    int phase = (frame->phase + row) % NTSC_PHASES;
+
+    for (int x = 0; x < NTSC_KERNEL_RADIUS; x++) {
+        kernels[x] = black_kernel;
+        kernels[NTSC_KERNEL_RADIUS + PPU_FRAME_WIDTH + x] = black_kernel;
+    }
+
+    for (int x = 0; x < PPU_FRAME_WIDTH; x++) {
+        const int color = (emphasis[x] & 0x07) << 6 | (colors[x] & 0x3F);
+
+        kernels[NTSC_KERNEL_RADIUS + x] = filter->kernels[color * NTSC_PHASES + phase];
+        phase = phase == 0 ? NTSC_PHASES - 1 : phase - 1;
+    }
+}
+
+// Output pixels the kernel of each pixel adds to, those of the pixel itself in the middle
+#define KERNEL_PART(x) ((x) * NTSC_SCALE * PIXEL_CHANNELS)
+
+void filter_ntsc_rows_scalar(const NtscFilter* filter, const NtscFrame* frame, int first, int count) {
+    for (int row = first; row < first + count; row++) {
+        const i16* kernels[PPU_FRAME_WIDTH + 2 * NTSC_KERNEL_RADIUS];
+        u8* out = &frame->out[row * NTSC_SCALE * frame->pitch];
+
+        gather_kernels(filter, frame, row, kernels);
+
+        for (int x = 0; x < PPU_FRAME_WIDTH; x++) {
+            u8 pixels[NTSC_SCALE * PIXEL_CHANNELS];
+
+            for (int i = 0; i < NTSC_SCALE * PIXEL_CHANNELS; i++) {
+                int sum = 0;
+
+                // kernels[x + 2 * NTSC_KERNEL_RADIUS] is the pixel NTSC_KERNEL_RADIUS to the right
+                for (int k = 0; k < NTSC_KERNEL_PIXELS; k++) {
+                    sum += kernels[x + 2 * NTSC_KERNEL_RADIUS - k][KERNEL_PART(k) + i];
+                }
+
+                sum = sum < 0 ? 0 : sum >> KERNEL_FRACTION_BITS;
+                pixels[i] = i % PIXEL_CHANNELS == 3 ? 0xFF : sum > 0xFF ? 0xFF : sum;
+            }
+
+            for (int line = 0; line < NTSC_SCALE; line++) {
+                memcpy(&out[line * frame->pitch + x * sizeof(pixels)], pixels, sizeof(pixels));
+            }
+        }
+    }
+}
+
+#if defined(__AVX2__)
+// Sum of the kernels of one output vector, the 4 output pixels of pixel x
+static inline __m256i sum_kernels(const i16* const* kernels, int x) {
+    __m256i sum = _mm256_loadu_si256((const __m256i*) &kernels[x + 2 * NTSC_KERNEL_RADIUS][KERNEL_PART(0)]);
+
+    for (int k = 1; k < NTSC_KERNEL_PIXELS; k++) {
+        sum = _mm256_add_epi16(sum, _mm256_loadu_si256((const __m256i*) &kernels[x + 2 * NTSC_KERNEL_RADIUS - k][KERNEL_PART(k)]));
+    }
+
+    return _mm256_srai_epi16(sum, KERNEL_FRACTION_BITS);
+}
+
+void filter_ntsc_rows(const NtscFilter* filter, const NtscFrame* frame, int first, int count) {
+    const __m256i alpha = _mm256_set1_epi32((int) 0xFF000000);
+
+    for (int row = first; row < first + count; row++) {
+        const i16* kernels[PPU_FRAME_WIDTH + 2 * NTSC_KERNEL_RADIUS];
+        u8* out = &frame->out[row * NTSC_SCALE * frame->pitch];
+
+        gather_kernels(filter, frame, row, kernels);
+
+        for (int x = 0; x < PPU_FRAME_WIDTH; x += 2) {
+            // Packing clamps to bytes, within 128-bit lanes: the quadwords are put back in order
+            const __m256i packed = _mm256_packus_epi16(sum_kernels(kernels, x), sum_kernels(kernels, x + 1));
+            const __m256i pixels = _mm256_or_si256(_mm256_permute4x64_epi64(packed, 0xD8), alpha);
+
+            for (int line = 0; line < NTSC_SCALE; line++) {
+                _mm256_storeu_si256((__m256i*) &out[line * frame->pitch + x * NTSC_SCALE * sizeof(u32)], pixels);
+            }
+        }
+    }
+}
+#elif defined(NTSC_VECTOR_ISA)
+// Sum of the kernels of one output vector, output pixels half * 2 and half * 2 + 1 of pixel x
+static inline __m128i sum_kernels(const i16* const* kernels, int x, int half) {
+    const int offset = half * 2 * PIXEL_CHANNELS;
+    __m128i sum = _mm_loadu_si128((const __m128i*) &kernels[x + 2 * NTSC_KERNEL_RADIUS][KERNEL_PART(0) + offset]);
+
+    for (int k = 1; k < NTSC_KERNEL_PIXELS; k++) {
+        sum = _mm_add_epi16(sum, _mm_loadu_si128((const __m128i*) &kernels[x + 2 * NTSC_KERNEL_RADIUS - k][KERNEL_PART(k) + offset]));
+    }
+
+    return _mm_srai_epi16(sum, KERNEL_FRACTION_BITS);
+}
+
+void filter_ntsc_rows(const NtscFilter* filter, const NtscFrame* frame, int first, int count) {
+    const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+
+    for (int row = first; row < first + count; row++) {
+        const i16* kernels[PPU_FRAME_WIDTH + 2 * NTSC_KERNEL_RADIUS];
+        u8* out = &frame->out[row * NTSC_SCALE * frame->pitch];
+
+        gather_kernels(filter, frame, row, kernels);
+
+        for (int x = 0; x < PPU_FRAME_WIDTH; x++) {
+            // Packing clamps to bytes
+            const __m128i pixels = _mm_or_si128(_mm_packus_epi16(sum_kernels(kernels, x, 0), sum_kernels(kernels, x, 1)), alpha);
+
+            for (int line = 0; line < NTSC_SCALE; line++) {
+                _mm_storeu_si128((__m128i*) &out[line * frame->pitch + x * NTSC_SCALE * sizeof(u32)], pixels);
+            }
+        }
+    }
+}
+#else
+void filter_ntsc_rows(const NtscFilter* filter, const NtscFrame* frame, int first, int count) {
+    filter_ntsc_rows_scalar(filter, frame, first, count);
+}
+#endif
+
+const char* ntsc_vector_isa(void) {
+#ifdef NTSC_VECTOR_ISA
+    return NTSC_VECTOR_ISA;
+#else
+    return "scalar";
+#endif
+}
+
+// Rows of the frame that are the share of a thread
+static void filter_share(const NtscFilter* filter, const NtscFrame* frame, u32 id) {
+    const int first = PPU_FRAME_HEIGHT * id / filter->threads;
+    const int last = PPU_FRAME_HEIGHT * (id + 1) / filter->threads;
+
+    filter_ntsc_rows(filter, frame, first, last - first);
+}
+
+static void run_ntsc_worker(void* arg) {
+    NtscWorker* worker = arg;
+    NtscFilter* filter = worker->filter;
+    u64 generation = 0;
+
+    lock_mutex(&filter->mutex);
+
+    for (;;) {
+        while (filter->generation == generation && !filter->quit) {
+            wait_cond_var(&filter->work_ready, &filter->mutex);
+        }
+
+        if (filter->quit) {
+            break;
+        }
+
+        const NtscFrame frame = filter->job;
+        generation = filter->generation;
+        unlock_mutex(&filter->mutex);
+
+        filter_share(filter, &frame, worker->id);
+
+        lock_mutex(&filter->mutex);
+        if (--filter->busy == 0) {
+            signal_cond_var(&filter->done);
+        }
+    }
+
+    unlock_mutex(&filter->mutex);
+}
+
+NtscFilter* build_ntsc_filter(u32 threads) {
+    NtscFilter* filter = calloc(1, sizeof(NtscFilter));
+
+    filter->kernels = malloc(NTSC_COLORS * NTSC_PHASES * sizeof(*filter->kernels));
+    for (int color = 0; color < NTSC_COLORS; color++) {
+        for (int phase = 0; phase < NTSC_PHASES; phase++) {
+            build_kernel(filter->kernels[color * NTSC_PHASES + phase], color, phase);
+        }
+    }
+
+    filter->threads = threads > 0 ? threads : get_cpu_count();
+    if (filter->threads > PPU_FRAME_HEIGHT) {
+        filter->threads = PPU_FRAME_HEIGHT;
+    }
+
+    filter->workers = calloc(filter->threads, sizeof(NtscWorker));
+    init_mutex(&filter->mutex);
+    init_cond_var(&filter->work_ready);
+    init_cond_var(&filter->done);
+
+    // The calling thread is worker 0, the rows of those that do not start go to the others
+    for (u32 i = 1; i < filter->threads; i++) {
+        filter->workers[i].filter = filter;
+        filter->workers[i].id = i;
+
+        if (!start_thread(&filter->workers[i].thread, run_ntsc_worker, &filter->workers[i])) {
+            fprintf(stderr, "Unable to start NTSC filter thread %u, going on with %u\n", i, i);
+            filter->threads = i;
+        }
+    }
+
+    return filter;
+}
+
+void free_ntsc_filter(NtscFilter* filter) {
+    lock_mutex(&filter->mutex);
+    filter->quit = true;
+    broadcast_cond_var(&filter->work_ready);
+    unlock_mutex(&filter->mutex);
+
+    for (u32 i = 1; i < filter->threads; i++) {
+        join_thread(&filter->workers[i].thread);
+    }
+
+    destroy_cond_var(&filter->done);
+    destroy_cond_var(&filter->work_ready);
+    destroy_mutex(&filter->mutex);
+    free(filter->workers);
+    free(filter->kernels);
+    free(filter);
+}
+
+void filter_ntsc_frame(NtscFilter* filter, const NtscFrame* frame) {
+    const u64 start_ns = get_time_ns();
+
+    lock_mutex(&filter->mutex);
+    filter->job = *frame;
+    filter->generation++;
+    filter->busy = filter->threads - 1;
+    broadcast_cond_var(&filter->work_ready);
+    unlock_mutex(&filter->mutex);
+
+    filter_share(filter, frame, 0);
+
+    lock_mutex(&filter->mutex);
+    while (filter->busy > 0) {
+        wait_cond_var(&filter->done, &filter->mutex);
+    }
+    unlock_mutex(&filter->mutex);
+
+    filter->frames++;
+    filter->filter_ns += get_time_ns() - start_ns;
+}
@@ -0,0 +1,86 @@
+#ifndef NTSC_H
+#define NTSC_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "types.h"
+#include "ppu.h"
+#include "thread.h"
+
+// Output pixels per NES pixel, across and down
+#define NTSC_SCALE 4
+#define NTSC_OUTPUT_WIDTH (PPU_FRAME_WIDTH * NTSC_SCALE)
+#define NTSC_OUTPUT_HEIGHT (PPU_FRAME_HEIGHT * NTSC_SCALE)
+
+// 9-bit colors, the emphasis bits above the palette index
+#define NTSC_COLORS 512
+// A pixel is 8 samples of the signal, two thirds of a cycle of the color subcarrier, so
+// it starts at one of three phases
+#define NTSC_PHASES 3
+// The signal of a pixel shows in the output pixels of the NTSC_KERNEL_RADIUS pixels on
+// either side of it
+#define NTSC_KERNEL_RADIUS 2
+#define NTSC_KERNEL_PIXELS (2 * NTSC_KERNEL_RADIUS + 1)
+// Blue, green, red and a zero of each output pixel a kernel adds to
+#define NTSC_KERNEL_SIZE (NTSC_KERNEL_PIXELS * NTSC_SCALE * 4)
+
+// One frame to filter. frame and emphasis are PPU_FRAME_WIDTH x PPU_FRAME_HEIGHT like the
+// planes of the PPU, out NTSC_OUTPUT_WIDTH x NTSC_OUTPUT_HEIGHT pixels of 32 bits laid out
+// like convert_frame_to_argb's with rows pitch bytes apart. phase (0-2) is where the color
+// subcarrier starts on the first row, in thirds of a cycle; every row starts a third later.
+typedef struct NtscFrame {
+    u8* out;
+    size_t pitch;
+    const u8* frame;
+    const u8* emphasis;
+    int phase;
+} NtscFrame;
+
+typedef struct NtscWorker {
+    struct NtscFilter* filter;
+    u32 id;
+    Thread thread;
+} NtscWorker;
+
+// Composite video filter. The 9-bit colors are turned into the square waves the PPU puts
+// out, 8 samples per pixel, and decoded again like a TV does: luma averaged over a cycle
+// of the subcarrier, chroma demodulated and averaged over two, so colors bleed into their
+// neighbors and sharp edges leave color fringes. Decoding is linear, what every color at
+// every phase adds to the output pixels around it is worked out up front; filtering a row
+// then sums NTSC_KERNEL_PIXELS kernels per pixel and clamps.
+typedef struct NtscFilter {
+    // kernels[color * NTSC_PHASES + phase], in 1/8 of a step of the 8-bit channels. The
+    // output pixels of the pixel NTSC_KERNEL_RADIUS to the left come first.
+    i16 (*kernels)[NTSC_KERNEL_SIZE];
+    // The calling thread is one of them
+    u32 threads;
+    NtscWorker* workers;
+    Mutex mutex;
+    CondVar work_ready;
+    CondVar done;
+    // Frame the workers are on, a new generation starts with every frame
+    NtscFrame job;
+    u64 generation;
+    u32 busy;
+    bool quit;
+    // Totals of filter_ntsc_frame
+    u64 frames;
+    u64 filter_ns;
+} NtscFilter;
+
+// threads 0 is one per hardware thread
+NtscFilter* build_ntsc_filter(u32 threads);
+void free_ntsc_filter(NtscFilter* filter);
+
+// Filters the whole frame, its rows split between the threads
+void filter_ntsc_frame(NtscFilter* filter, const NtscFrame* frame);
+// Filters count rows of the frame from first on the calling thread. The vector version
+// picks the instruction set at compile time like the PPU kernels, the scalar one is its
+// reference.
+void filter_ntsc_rows(const NtscFilter* filter, const NtscFrame* frame, int first, int count);
+void filter_ntsc_rows_scalar(const NtscFilter* filter, const NtscFrame* frame, int first, int count);
+
+// "avx2", "sse2" or "scalar"
+const char* ntsc_vector_isa(void);
+
+#endif
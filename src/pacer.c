@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pacer.h"
+#include "utils.h"
+
+// Initial and bounds of the spin window before each deadline
+#define DEFAULT_SPIN_NS 1500000ULL
+#define MIN_SPIN_NS 200000ULL
+#define MAX_SPIN_NS 4000000ULL
+#define SPIN_MARGIN_NS 250000ULL
+
+// When emulation falls further behind than this, the deadline is reset instead of
+// running the missed frames back to back
+#define MAX_LAG_FRAMES 4
+
+// Largest relative change of the frame period while locked to audio
+#define AUDIO_RATE_CONTROL 0.005
+
+static void update_frame_period(FramePacer* pacer) {
+    pacer->frame_period_ns = (u64) (1e9 / (pacer->frame_rate * pacer->turbo));
+}
+
+void init_frame_pacer(FramePacer* pacer, TvSystem tv_system) {
+    memset(pacer, 0, sizeof(FramePacer));
+
+    pacer->mode = PACING_REALTIME;
+    pacer->frame_rate = tv_system == TV_PAL ? PAL_FRAME_RATE : NTSC_FRAME_RATE;
+    pacer->turbo = 1.0;
+    pacer->spin_ns = DEFAULT_SPIN_NS;
+    update_frame_period(pacer);
+}
+
+void set_pacing_mode(FramePacer* pacer, PacingMode mode) {
+    pacer->mode = mode;
+    pacer->deadline_ns = 0;
+}
+
+void set_turbo(FramePacer* pacer, double turbo) {
+    pacer->turbo = turbo > 0 ? turbo : 1.0;
+    update_frame_period(pacer);
+}
+
+void lock_pacer_to_audio(FramePacer* pacer, audio_queue_ns audio_queue, void* ctx, u64 target_ns) {
+    pacer->audio_queue = audio_queue;
+    pacer->audio_ctx = ctx;
+    pacer->audio_target_ns = target_ns;
+}
+
+static u64 next_frame_period(const FramePacer* pacer) {
+    if (!pacer->audio_queue || pacer->audio_target_ns == 0) {
+        return pacer->frame_period_ns;
+    }
+
+    // More audio queued than wanted means emulation is running ahead of the device
+    double error = ((double) pacer->audio_queue(pacer->audio_ctx) - pacer->audio_target_ns) / pacer->audio_target_ns;
+    error = error > 1.0 ? 1.0 : (error < -1.0 ? -1.0 : error);
+
+    return (u64) (pacer->frame_period_ns * (1.0 + AUDIO_RATE_CONTROL * error));
+}
+
+static void wait_until(FramePacer* pacer, u64 deadline_ns) {
+    const u64 now = get_time_ns();
+
+    if (deadline_ns > now + pacer->spin_ns) {
+        const u64 wake_ns = deadline_ns - pacer->spin_ns;
+        sleep_ns(wake_ns - now);
+
+        // Widen the spin window right away when the OS overslept, narrow it slowly otherwise
+        const u64 woke_ns = get_time_ns();
+        const u64 oversleep = woke_ns > wake_ns ? woke_ns - wake_ns : 0;
+
+        if (oversleep + SPIN_MARGIN_NS > pacer->spin_ns) {
+            pacer->spin_ns = oversleep + SPIN_MARGIN_NS;
+        } else {
+            pacer->spin_ns -= (pacer->spin_ns - oversleep - SPIN_MARGIN_NS) / 16;
+        }
+
+        pacer->spin_ns = pacer->spin_ns < MIN_SPIN_NS ? MIN_SPIN_NS : pacer->spin_ns;
+        pacer->spin_ns = pacer->spin_ns > MAX_SPIN_NS ? MAX_SPIN_NS : pacer->spin_ns;
+    }
+
+    while (get_time_ns() < deadline_ns) {
+    }
+}
+
+static void record_frame(FramePacer* pacer, u64 now) {
+    if (pacer->last_frame_ns == 0) {
+        pacer->window_start_ns = now;
+    } else {
+        pacer->frame_times[pacer->frame_count % FRAME_STATS_WINDOW] = now - pacer->last_frame_ns;
+        pacer->frame_count++;
+    }
+
+    pacer->last_frame_ns = now;
+}
+
+void pace_frame(FramePacer* pacer) {
+    if (pacer->mode == PACING_REALTIME) {
+        const u64 now = get_time_ns();
+
+        if (pacer->deadline_ns == 0) {
+            pacer->deadline_ns = now;
+        }
+
+        pacer->deadline_ns += next_frame_period(pacer);
+
+        if (now > pacer->deadline_ns + MAX_LAG_FRAMES * pacer->frame_period_ns) {
+            pacer->deadline_ns = now;
+        }
+
+        wait_until(pacer, pacer->deadline_ns);
+    }
+
+    record_frame(pacer, get_time_ns());
+}
+
+static int compare_u64(const void* a, const void* b) {
+    const u64 x = *(const u64*) a;
+    const u64 y = *(const u64*) b;
+    return (x > y) - (x < y);
+}
+
+static inline u64 percentile_99(const u64* sorted, size_t count) {
+    const size_t index = count * 99 / 100;
+    return sorted[index < count ? index : count - 1];
+}
+
+FrameStats collect_frame_stats(FramePacer* pacer) {
+    FrameStats stats;
+    memset(&stats, 0, sizeof(FrameStats));
+
+    const u64 now = get_time_ns();
+    const size_t count = pacer->frame_count < FRAME_STATS_WINDOW ? pacer->frame_count : FRAME_STATS_WINDOW;
+
+    if (count > 0) {
+        u64 times[FRAME_STATS_WINDOW];
+        u64 jitter[FRAME_STATS_WINDOW];
+        u64 total = 0, total_jitter = 0;
+
+        memcpy(times, pacer->frame_times, count * sizeof(u64));
+        qsort(times, count, sizeof(u64), compare_u64);
+
+        for (size_t i = 0; i < count; i++) {
+            total += times[i];
+        }
+
+        // Uncapped frames have no period to aim for, their jitter is relative to the average
+        const u64 expected = pacer->mode == PACING_REALTIME ? pacer->frame_period_ns : total / count;
+
+        for (size_t i = 0; i < count; i++) {
+            jitter[i] = times[i] > expected ? times[i] - expected : expected - times[i];
+            total_jitter += jitter[i];
+        }
+
+        qsort(jitter, count, sizeof(u64), compare_u64);
+
+        stats.frames = pacer->frame_count;
+        stats.fps = now > pacer->window_start_ns ? pacer->frame_count / ((now - pacer->window_start_ns) / 1e9) : 0.0;
+        stats.min_ns = times[0];
+        stats.avg_ns = total / count;
+        stats.p99_ns = percentile_99(times, count);
+        stats.avg_jitter_ns = total_jitter / count;
+        stats.p99_jitter_ns = percentile_99(jitter, count);
+    }
+
+    pacer->frame_count = 0;
+    pacer->window_start_ns = now;
+
+    return stats;
+}
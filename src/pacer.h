@@ -0,0 +1,71 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdbool.h>
+#include "types.h"
+
+#define NTSC_FRAME_RATE 60.0988
+#define PAL_FRAME_RATE 50.007
+
+// Frame times kept for the statistics, enough for several seconds of turbo
+#define FRAME_STATS_WINDOW 1024
+
+typedef enum TvSystem {
+    TV_NTSC,
+    TV_PAL
+} TvSystem;
+
+typedef enum PacingMode {
+    // One emulated frame per frame period of the TV system, scaled by the turbo factor
+    PACING_REALTIME,
+    // As fast as the host allows, frames are only measured
+    PACING_UNCAPPED
+} PacingMode;
+
+// Returns how much audio is queued for playback, in nanoseconds
+typedef u64 (*audio_queue_ns)(void* ctx);
+
+typedef struct FrameStats {
+    u64 frames;
+    double fps;
+    u64 min_ns;
+    u64 avg_ns;
+    u64 p99_ns;
+    // Deviation of the frame time from the frame period
+    u64 avg_jitter_ns;
+    u64 p99_jitter_ns;
+} FrameStats;
+
+// Paces emulated frames to wall clock time. Waiting is done by sleeping until shortly
+// before the deadline and spinning for the rest, the spin window adapts to how much
+// the OS oversleeps.
+typedef struct FramePacer {
+    PacingMode mode;
+    double frame_rate;
+    double turbo;
+    u64 frame_period_ns;
+    u64 deadline_ns;
+    u64 spin_ns;
+    u64 last_frame_ns;
+    // When set, the frame period is stretched or shrunk slightly to keep the audio
+    // queue at audio_target_ns, so the audio device clock ends up driving emulation.
+    audio_queue_ns audio_queue;
+    void* audio_ctx;
+    u64 audio_target_ns;
+    u64 frame_times[FRAME_STATS_WINDOW];
+    size_t frame_count;
+    u64 window_start_ns;
+} FramePacer;
+
+void init_frame_pacer(FramePacer* pacer, TvSystem tv_system);
+void set_pacing_mode(FramePacer* pacer, PacingMode mode);
+// Runs turbo times faster than real time while pacing is enabled
+void set_turbo(FramePacer* pacer, double turbo);
+// Locks the frame rate to the audio device, pass NULL to unlock
+void lock_pacer_to_audio(FramePacer* pacer, audio_queue_ns audio_queue, void* ctx, u64 target_ns);
+// Called once per emulated frame, blocks until the frame is due
+void pace_frame(FramePacer* pacer);
+// Statistics of the frames since the last call, resets the window
+FrameStats collect_frame_stats(FramePacer* pacer);
+
+#endif
@@ -0,0 +1,619 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ppu.h"
+#include "ppu_kernels.h"
+#include "thread.h"
+
+#define PPUCTRL 0
+#define PPUMASK 1
+#define PPUSTATUS 2
+#define OAMADDR 3
+#define OAMDATA 4
+#define PPUSCROLL 5
+#define PPUADDR 6
+#define PPUDATA 7
+
+// Position of the vblank flag changes within a frame, in dots
+#define VBLANK_SET_DOT (PPU_VBLANK_SCANLINE * PPU_DOTS_PER_SCANLINE + 1)
+
+// Dots of a scanline at which the PPU does something, a visible scanline is rendered as
+// a whole at its first dot
+#define RENDER_DOT 1
+// Tile k >= 2 of a visible scanline is fetched from dot 8 * (k - 2) + 1 on, the first two
+// at the end of the scanline before
+#define PREFETCHED_TILES 2
+#define VBLANK_DOT 1
+#define HORIZONTAL_COPY_DOT 257
+#define VERTICAL_COPY_DOT 280
+
+// The VRAM address v (and t) is 0yyy NNYY YYYX XXXX: fine Y, nametable, coarse Y and X
+#define COARSE_X 0x001F
+#define COARSE_Y 0x03E0
+#define NAMETABLE_X 0x0400
+#define NAMETABLE_Y 0x0800
+#define FINE_Y 0x7000
+#define HORIZONTAL_BITS (COARSE_X | NAMETABLE_X)
+#define VERTICAL_BITS (COARSE_Y | NAMETABLE_Y | FINE_Y)
+
+#define PALETTE_ADDR 0x3F00
+#define ATTRIBUTE_TABLE 0x03C0
+
+
+// Every byte set to 1, multiplying a byte value by it replicates it into all 8 pixels
+#define BYTES_ONES 0x0101010101010101ULL
+
+// Both bitplane bytes of a tile row spread out to one byte per pixel, leftmost pixel first,
+// and mirrored for horizontally flipped sprites. A row of 8 pixels is then two lookups, a
+// shift and an OR instead of 16 bit extractions.
+static u64 tile_spread[2][256];
+static Once tile_spread_once = ONCE_INIT;
+
+static void build_tile_spread(void) {
+    for (int bits = 0; bits < 256; bits++) {
+        u8 pixels[8];
+        u8 flipped[8];
+
+        for (int x = 0; x < 8; x++) {
+            pixels[x] = bits >> (7 - x) & 0x01;
+            flipped[x] = bits >> x & 0x01;
+        }
+
+        // Through memory, so byte x is pixel x whatever the byte order of the host
+        memcpy(&tile_spread[0][bits], pixels, 8);
+        memcpy(&tile_spread[1][bits], flipped, 8);
+    }
+}
+
+// 8 pixels of 2 bits each, the high plane can only carry into its own byte
+static inline u64 decode_tile_row(u8 low, u8 high, bool flip) {
+    return tile_spread[flip][low] | tile_spread[flip][high] << 1;
+}
+
+static inline u64 dot_to_cycle(u64 dot) {
+    return (dot + PPU_DOTS_PER_CPU_CYCLE - 1) / PPU_DOTS_PER_CPU_CYCLE;
+}
+
+static inline u64 next_vblank_cycle(const Ppu* ppu) {
+    u64 dot = ppu->dots - ppu->dots % PPU_DOTS_PER_FRAME + VBLANK_SET_DOT;
+
+    if (dot <= ppu->dots) {
+        dot += PPU_DOTS_PER_FRAME;
+    }
+
+    return dot_to_cycle(dot);
+}
+
+// $3F10, $3F14, $3F18 and $3F1C are the same entries as $3F00, $3F04, $3F08 and $3F0C
+static inline u8 palette_address(u16 addr) {
+    const u8 entry = addr & 0x1F;
+    return (entry & 0x13) == 0x10 ? entry & 0x0F : entry;
+}
+
+static void write_vram(Ppu* ppu, u16 addr, u8 val) {
+    if (addr >= PALETTE_ADDR) {
+        ppu->palette[palette_address(addr)] = val & 0x3F;
+        return;
+    }
+
+    u8* slot = ppu->bus.write[addr / PPU_BUS_SLOT_SIZE];
+
+    if (slot) {
+        slot[addr % PPU_BUS_SLOT_SIZE] = val;
+    }
+}
+
+// Dot of the visible scanline the beam is on, 0 when it is on another scanline
+static inline u16 visible_dot(const Ppu* ppu) {
+    const u64 frame_dot = ppu->dots % PPU_DOTS_PER_FRAME;
+    return frame_dot < PPU_FRAME_HEIGHT * PPU_DOTS_PER_SCANLINE ? frame_dot % PPU_DOTS_PER_SCANLINE : 0;
+}
+
+static inline void increment_v(Ppu* ppu) {
+    ppu->v = (ppu->v + (ppu->registers[PPUCTRL] & PPUCTRL_INCREMENT_32 ? 32 : 1)) & 0x7FFF;
+}
+
+// Moves v down one pixel, coarse Y wraps into the vertically adjacent nametable after row 29
+static inline void increment_y(Ppu* ppu) {
+    if ((ppu->v & FINE_Y) != FINE_Y) {
+        ppu->v += 0x1000;
+        return;
+    }
+
+    u16 coarse_y = (ppu->v & COARSE_Y) >> 5;
+
+    if (coarse_y == 29) {
+        coarse_y = 0;
+        ppu->v ^= NAMETABLE_Y;
+    } else {
+        // Rows 30 and 31 are the attribute table, they wrap without switching nametables
+        coarse_y = (coarse_y + 1) & 0x1F;
+    }
+
+    ppu->v = (ppu->v & ~(FINE_Y | COARSE_Y)) | coarse_y << 5;
+}
+
+// Coarse X wraps into the horizontally adjacent nametable
+static inline u16 increment_coarse_x(u16 v) {
+    return (v & COARSE_X) == COARSE_X ? (v & ~COARSE_X) ^ NAMETABLE_X : v + 1;
+}
+
+// Background palette addresses ($00-$0F) of tiles first-32 of the scanline, fetched from v on
+static void fetch_tiles(Ppu* ppu, int first, u16 v) {
+    u8* tiles = ppu->line.tiles;
+    const u16 pattern_table = ppu->registers[PPUCTRL] & PPUCTRL_BACKGROUND_TABLE ? 0x1000 : 0x0000;
+    const u16 fine_y = v >> 12;
+    const PpuBus* bus = &ppu->bus;
+
+    for (int tile = first; tile < PPU_TILES_PER_SCANLINE; tile++) {
+        const u8* nametable = bus->read[PPU_PATTERN_SLOTS + (v >> 10 & 0x03)];
+        const u8 name = nametable[v & 0x03FF];
+        const u8 attribute = nametable[ATTRIBUTE_TABLE | (v >> 4 & 0x38) | (v >> 2 & 0x07)];
+        // An attribute byte covers 4x4 tiles with 2 bits per quadrant of 2x2 tiles
+        const u8 palette = attribute >> ((v >> 4 & 0x04) | (v & 0x02)) & 0x03;
+        const u16 pattern = pattern_table + name * 16 + fine_y;
+        const u64 row = decode_tile_row(ppu_bus_read(bus, pattern), ppu_bus_read(bus, pattern + 8), false)
+            | palette * 4 * BYTES_ONES;
+
+        memcpy(&tiles[tile * 8], &row, 8);
+        v = increment_coarse_x(v);
+    }
+}
+
+// Sprite line of a scanline: the first 8 sprites in OAM order that cover it. Sprites are
+// drawn back to front so the one first in OAM ends up on top, whatever its priority.
+// Returns the number of sprites on the scanline.
+static int render_sprites(Ppu* ppu, u16 scanline, u8 ctrl, u8* line) {
+    const int height = ctrl & PPUCTRL_SPRITE_SIZE ? 16 : 8;
+    const u16 pattern_table = ctrl & PPUCTRL_SPRITE_TABLE ? 0x1000 : 0x0000;
+    u8 sprites[PPU_SPRITES_PER_SCANLINE];
+    bool overflow;
+    const int count = evaluate_sprites(ppu->oam, scanline, height, sprites, &overflow);
+
+    if (overflow) {
+        ppu->status |= PPUSTATUS_SPRITE_OVERFLOW;
+    }
+
+    if (count > 0) {
+        memset(line, 0, SPRITE_LINE_SIZE);
+    }
+
+    for (int i = count - 1; i >= 0; i--) {
+        const u8* entry = &ppu->oam[sprites[i] * 4];
+        const u8 tile = entry[1];
+        const u8 attributes = entry[2];
+        const u8 x = entry[3];
+        int row = scanline - 1 - entry[0];
+        u16 pattern;
+
+        if (attributes & 0x80) {
+            row = height - 1 - row;
+        }
+
+        if (height == 16) {
+            // Bit 0 of the tile number picks the pattern table of 8x16 sprites
+            pattern = (tile & 0x01) * 0x1000 + (tile & 0xFE) * 16 + (row & 0x08) * 2 + (row & 0x07);
+        } else {
+            pattern = pattern_table + tile * 16 + row;
+        }
+
+        const u64 row_pixels = decode_tile_row(ppu_bus_read(&ppu->bus, pattern), ppu_bus_read(&ppu->bus, pattern + 8),
+                                               attributes & 0x40);
+        const u8 flags = 0x10 | (attributes & 0x03) << 2
+            | (attributes & 0x20 ? SPRITE_BEHIND_BACKGROUND : 0)
+            | (sprites[i] == 0 ? SPRITE_ZERO : 0);
+        // Adding 0x7F sets bit 7 of the opaque pixels (1-3) without carrying into the next
+        // one, which then becomes a mask of whole bytes
+        const u64 opaque = (((row_pixels + 0x7F * BYTES_ONES) & 0x80 * BYTES_ONES) >> 7) * 0xFF;
+        u64 dest;
+
+        memcpy(&dest, &line[x], 8);
+        dest = (dest & ~opaque) | ((row_pixels | flags * BYTES_ONES) & opaque);
+        memcpy(&line[x], &dest, 8);
+    }
+
+    return count;
+}
+
+// Draws pixels first-255 of the scanline from what was fetched for it, with PPUMASK and
+// fine X as they are now. The sprites are looked up in OAM again, which is what they were
+// fetched from as long as OAM is not written in the middle of the frame.
+static inline void draw_pixels(Ppu* ppu, u16 scanline, u64 line_start, int first) {
+    const PpuLine* line = &ppu->line;
+    u8* pixels = &ppu->framebuffer[scanline * PPU_FRAME_WIDTH];
+    const u8 mask = ppu->registers[PPUMASK];
+    const u8 color_mask = mask & PPUMASK_GRAYSCALE ? 0x30 : 0x3F;
+
+    memset(&ppu->emphasis[scanline * PPU_FRAME_WIDTH + first], mask >> PPUMASK_EMPHASIS_SHIFT, PPU_FRAME_WIDTH - first);
+
+    if (!ppu_rendering_enabled(ppu)) {
+        memset(&pixels[first], ppu->palette[0] & color_mask, PPU_FRAME_WIDTH - first);
+        return;
+    }
+
+    u8 background[PPU_FRAME_WIDTH];
+    u8 sprites[SPRITE_LINE_SIZE];
+    u8 colors[PPU_PALETTE_SIZE];
+    int sprite_count = 0;
+
+    if (mask & PPUMASK_SHOW_BACKGROUND) {
+        memcpy(&background[first], &line->tiles[first + ppu->fine_x], PPU_FRAME_WIDTH - first);
+    } else {
+        memset(&background[first], 0, PPU_FRAME_WIDTH - first);
+    }
+
+    if (line->sprites && (mask & PPUMASK_SHOW_SPRITES)) {
+        sprite_count = render_sprites(ppu, scanline, line->ctrl, sprites);
+    }
+
+    // Either layer can be hidden in the leftmost 8 pixels
+    if (!(mask & PPUMASK_BACKGROUND_LEFT) && first < 8) {
+        memset(&background[first], 0, 8 - first);
+    }
+
+    if (sprite_count > 0 && !(mask & PPUMASK_SPRITES_LEFT) && first < 8) {
+        memset(&sprites[first], 0, 8 - first);
+    }
+
+    for (int entry = 0; entry < PPU_PALETTE_SIZE; entry++) {
+        colors[entry] = ppu->palette[entry] & color_mask;
+    }
+
+    // Pixel 0 of every background palette shows the backdrop
+    colors[0x04] = colors[0x08] = colors[0x0C] = colors[0x00];
+
+    const int hit = composite_pixels(pixels, background, sprite_count > 0 ? sprites : NULL, colors, first);
+
+    // The flag goes up when the beam gets to the pixel, not when the scanline is rendered
+    if (hit >= 0 && !(ppu->status & PPUSTATUS_SPRITE_ZERO_HIT)) {
+        ppu->sprite_zero_hit_dot = line_start + RENDER_DOT + hit;
+    }
+}
+
+// The batched pass: everything the scanline shows is fetched and drawn when the beam
+// enters it
+static void render_scanline(Ppu* ppu, u16 scanline, u64 line_start) {
+    PpuLine* line = &ppu->line;
+
+    line->start = line_start;
+    line->ctrl = ppu->registers[PPUCTRL];
+    line->sprites = ppu_rendering_enabled(ppu) && (ppu->registers[PPUMASK] & PPUMASK_SHOW_SPRITES);
+    line->redrawn = false;
+
+    if (ppu_rendering_enabled(ppu)) {
+        fetch_tiles(ppu, 0, ppu->v);
+    } else {
+        // Nothing was fetched in case rendering gets turned on in the middle of it
+        memset(line->tiles, 0, sizeof(line->tiles));
+    }
+
+    draw_pixels(ppu, scanline, line_start, 0);
+    ppu->scanlines_drawn++;
+}
+
+// The per-dot path, after a write that changes how the rest of the scanline looks. The
+// pixels the beam has not drawn yet are drawn again, from the tiles that were fetched
+// before the write and those fetched at their dots after it. The sprites of the scanline
+// were fetched on the scanline before, writes do not change them.
+static void redraw_scanline(Ppu* ppu) {
+    PpuLine* line = &ppu->line;
+    const u16 dot = visible_dot(ppu);
+    const u64 line_start = ppu->dots - dot;
+
+    // Pixel x is drawn at dot x + 1
+    if (dot < RENDER_DOT || dot >= PPU_FRAME_WIDTH || line->start != line_start) {
+        return;
+    }
+
+    if (!line->redrawn) {
+        line->redrawn = true;
+        ppu->scanlines_redrawn++;
+    }
+
+    // A pending sprite 0 hit is looked for again in what is left of the scanline
+    ppu->sprite_zero_hit_dot = EVENT_NEVER;
+
+    if (ppu_rendering_enabled(ppu)) {
+        const int first_tile = (dot - 1) / 8 + PREFETCHED_TILES + 1;
+        u16 v = ppu->v;
+
+        for (int tile = line->fetch_tile; tile < first_tile; tile++) {
+            v = increment_coarse_x(v);
+        }
+
+        fetch_tiles(ppu, first_tile, v);
+    }
+
+    draw_pixels(ppu, line_start % PPU_DOTS_PER_FRAME / PPU_DOTS_PER_SCANLINE, line_start, dot);
+}
+
+static inline bool passes_dot(u16 from, u16 to, u16 dot) {
+    return from < dot && dot <= to;
+}
+
+// Moves the beam from dot `from` of a scanline to dot `to` (0-341) and does what happens
+// at the dots in between
+static void run_scanline(Ppu* ppu, u64 line_start, u16 from, u16 to) {
+    const u16 scanline = line_start % PPU_DOTS_PER_FRAME / PPU_DOTS_PER_SCANLINE;
+    const bool rendering = ppu_rendering_enabled(ppu);
+
+    if (scanline < PPU_FRAME_HEIGHT) {
+        if (passes_dot(from, to, RENDER_DOT)) {
+            render_scanline(ppu, scanline, line_start);
+        }
+
+        if (passes_dot(from, to, HORIZONTAL_COPY_DOT)) {
+            ppu->line.fetch_tile = 0;
+
+            if (rendering) {
+                increment_y(ppu);
+                ppu->v = (ppu->v & ~HORIZONTAL_BITS) | (ppu->t & HORIZONTAL_BITS);
+            }
+        }
+    } else if (scanline == PPU_VBLANK_SCANLINE) {
+        if (passes_dot(from, to, VBLANK_DOT)) {
+            ppu->status |= PPUSTATUS_VBLANK;
+        }
+    } else if (scanline == PPU_PRE_RENDER_SCANLINE) {
+        if (passes_dot(from, to, VBLANK_DOT)) {
+            ppu->status &= ~(PPUSTATUS_VBLANK | PPUSTATUS_SPRITE_ZERO_HIT | PPUSTATUS_SPRITE_OVERFLOW);
+        }
+
+        if (rendering && passes_dot(from, to, HORIZONTAL_COPY_DOT)) {
+            ppu->v = (ppu->v & ~HORIZONTAL_BITS) | (ppu->t & HORIZONTAL_BITS);
+        }
+
+        if (rendering && passes_dot(from, to, VERTICAL_COPY_DOT)) {
+            ppu->v = (ppu->v & ~VERTICAL_BITS) | (ppu->t & VERTICAL_BITS);
+        }
+    }
+
+    if (ppu->sprite_zero_hit_dot <= line_start + to) {
+        ppu->status |= PPUSTATUS_SPRITE_ZERO_HIT;
+        ppu->sprite_zero_hit_dot = EVENT_NEVER;
+    }
+}
+
+static void ppu_catch_up(void* ctx, u64 __attribute__((__unused__)) from, u64 to) {
+    Ppu* ppu = ctx;
+    const u64 new_dots = to * PPU_DOTS_PER_CPU_CYCLE;
+
+    while (ppu->dots < new_dots) {
+        const u64 line_start = ppu->dots - ppu->dots % PPU_DOTS_PER_SCANLINE;
+        const u64 line_end = line_start + PPU_DOTS_PER_SCANLINE;
+        const u64 until = new_dots < line_end ? new_dots : line_end;
+
+        run_scanline(ppu, line_start, ppu->dots - line_start, until - line_start);
+        ppu->dots = until;
+    }
+
+    ppu->frames = new_dots / PPU_DOTS_PER_FRAME;
+}
+
+static void ppu_nmi_event(void* ctx, u64 __attribute__((__unused__)) timestamp) {
+    Ppu* ppu = ctx;
+    sync_component(&ppu->component, ppu->cpu->cycles);
+
+    if ((ppu->registers[PPUCTRL] & PPUCTRL_NMI_ENABLE) && (ppu->status & PPUSTATUS_VBLANK)) {
+        trigger_nmi(ppu->cpu);
+    }
+
+    schedule_event(ppu->scheduler, EVENT_NMI, next_vblank_cycle(ppu));
+}
+
+static void oam_dma_event(void* ctx, u64 __attribute__((__unused__)) timestamp) {
+    Ppu* ppu = ctx;
+    Cpu* cpu = ppu->cpu;
+    sync_component(&ppu->component, cpu->cycles);
+
+    for (int i = 0; i < PPU_OAM_SIZE; i++) {
+        ppu->oam[(u8) (ppu->oam_addr + i)] = bus_read(&cpu->bus, ppu->oam_dma_page << 8 | i);
+    }
+
+    // The DMA waits for an even cycle before it starts
+    cpu->cycles += PPU_OAM_DMA_CYCLES + (cpu->cycles & 1);
+}
+
+static u8 ppu_register_read(void* ctx, u16 addr) {
+    Ppu* ppu = ctx;
+    const u8 reg = addr & 0x07;
+
+    sync_component(&ppu->component, ppu->cpu->cycles);
+
+    switch (reg) {
+        case PPUSTATUS: {
+            const u8 val = (ppu->status & 0xE0) | (ppu->registers[PPUSTATUS] & 0x1F);
+            ppu->status &= ~PPUSTATUS_VBLANK;
+            ppu->write_toggle = false;
+            return val;
+        }
+        case OAMDATA:
+            return ppu->oam[ppu->oam_addr];
+        case PPUDATA: {
+            const u16 vram_addr = ppu->v & 0x3FFF;
+            // Palette reads are not buffered, the buffer still gets the nametable byte
+            // underneath
+            const u8 val = vram_addr >= PALETTE_ADDR ? ppu->palette[palette_address(vram_addr)] : ppu->read_buffer;
+
+            ppu->read_buffer = ppu_bus_read(&ppu->bus, vram_addr);
+            increment_v(ppu);
+            return val;
+        }
+        default:
+            return ppu->registers[reg];
+    }
+}
+
+static void ppu_register_write(void* ctx, u16 addr, u8 val) {
+    Ppu* ppu = ctx;
+    const u8 reg = addr & 0x07;
+
+    sync_component(&ppu->component, ppu->cpu->cycles);
+
+    switch (reg) {
+        case PPUCTRL:
+            // Enabling NMI during vblank raises it right away
+            if (!(ppu->registers[PPUCTRL] & PPUCTRL_NMI_ENABLE)
+                    && (val & PPUCTRL_NMI_ENABLE) && (ppu->status & PPUSTATUS_VBLANK)) {
+                schedule_event(ppu->scheduler, EVENT_NMI, ppu->cpu->cycles);
+            }
+
+            ppu->t = (ppu->t & ~(NAMETABLE_X | NAMETABLE_Y)) | (val & 0x03) << 10;
+            break;
+        case OAMADDR:
+            ppu->oam_addr = val;
+            break;
+        case OAMDATA:
+            ppu->oam[ppu->oam_addr++] = val;
+            break;
+        case PPUSCROLL:
+            if (!ppu->write_toggle) {
+                ppu->t = (ppu->t & ~COARSE_X) | val >> 3;
+                ppu->fine_x = val & 0x07;
+            } else {
+                ppu->t = (ppu->t & ~(COARSE_Y | FINE_Y)) | (val & 0xF8) << 2 | (val & 0x07) << 12;
+            }
+
+            ppu->write_toggle = !ppu->write_toggle;
+            break;
+        case PPUADDR:
+            if (!ppu->write_toggle) {
+                ppu->t = (ppu->t & 0x00FF) | (val & 0x3F) << 8;
+            } else {
+                const u16 dot = visible_dot(ppu);
+
+                ppu->t = (ppu->t & 0xFF00) | val;
+                ppu->v = ppu->t;
+
+                // Coarse X goes up at every 8th dot, so the next tile fetched sees v
+                // incremented if the increment of the tile being fetched is still ahead
+                if (ppu_rendering_enabled(ppu) && dot >= RENDER_DOT && dot <= PPU_FRAME_WIDTH) {
+                    ppu->line.fetch_tile = PREFETCHED_TILES + dot / 8;
+                }
+            }
+
+            ppu->write_toggle = !ppu->write_toggle;
+            break;
+        case PPUDATA:
+            write_vram(ppu, ppu->v & 0x3FFF, val);
+            increment_v(ppu);
+            break;
+        default:
+            break;
+    }
+
+    ppu->registers[reg] = val;
+    // Low bits of PPUSTATUS read back whatever was last written to the PPU
+    ppu->registers[PPUSTATUS] = (ppu->registers[PPUSTATUS] & 0xE0) | (val & 0x1F);
+
+    if (reg == PPUCTRL || reg == PPUMASK || reg == PPUSCROLL || reg == PPUADDR) {
+        redraw_scanline(ppu);
+    }
+}
+
+Ppu* build_ppu(Cpu* cpu, Scheduler* scheduler) {
+    Ppu* ppu = malloc(sizeof(Ppu));
+
+    run_once(&tile_spread_once, build_tile_spread);
+
+    memset(ppu, 0, sizeof(Ppu));
+    reset_ppu_memory(ppu);
+    // Until the board says otherwise every nametable has RAM of its own
+    map_nametables(ppu, (const u8[PPU_NAMETABLE_SLOTS]) {0, 1, 2, 3});
+    ppu->cpu = cpu;
+    ppu->scheduler = scheduler;
+    ppu->dots = cpu->cycles * PPU_DOTS_PER_CPU_CYCLE;
+    ppu->component = (Component) {
+        .cycles = cpu->cycles,
+        .catch_up = ppu_catch_up,
+        .ctx = ppu,
+        .syncs = 0
+    };
+
+    // $2000-$3FFF mirrors the 8 registers
+    bus_map_read_handler(&cpu->bus, 0x20, 0x20, ppu_register_read, ppu);
+    bus_map_write_handler(&cpu->bus, 0x20, 0x20, ppu_register_write, ppu);
+
+    set_event_handler(scheduler, EVENT_NMI, ppu_nmi_event, ppu);
+    set_event_handler(scheduler, EVENT_OAM_DMA, oam_dma_event, ppu);
+    schedule_event(scheduler, EVENT_NMI, next_vblank_cycle(ppu));
+
+    return ppu;
+}
+
+void free_ppu(Ppu* ppu) {
+    free(ppu);
+}
+
+void reset_ppu_memory(Ppu* ppu) {
+    ppu->v = 0;
+    ppu->t = 0;
+    ppu->fine_x = 0;
+    ppu->write_toggle = false;
+    ppu->read_buffer = 0;
+    ppu->oam_addr = 0;
+    ppu->oam_dma_page = 0;
+    ppu->sprite_zero_hit_dot = EVENT_NEVER;
+    ppu->line.start = EVENT_NEVER;
+    ppu->line.fetch_tile = 0;
+    memset(ppu->oam, 0, sizeof(ppu->oam));
+    memset(ppu->palette, 0, sizeof(ppu->palette));
+    memset(ppu->nametables, 0, sizeof(ppu->nametables));
+}
+
+void map_nametables(Ppu* ppu, const u8 tables[PPU_NAMETABLE_SLOTS]) {
+    bool changed = false;
+
+    for (int slot = 0; slot < PPU_NAMETABLE_SLOTS; slot++) {
+        u8* table = &ppu->nametables[tables[slot] * PPU_BUS_SLOT_SIZE];
+
+        changed |= ppu->bus.read[PPU_PATTERN_SLOTS + slot] != table;
+
+        // $3000-$3EFF mirrors the nametables
+        for (int mirror = 0; mirror < 2; mirror++) {
+            ppu->bus.read[PPU_PATTERN_SLOTS + mirror * PPU_NAMETABLE_SLOTS + slot] = table;
+            ppu->bus.write[PPU_PATTERN_SLOTS + mirror * PPU_NAMETABLE_SLOTS + slot] = table;
+        }
+    }
+
+    if (changed) {
+        redraw_scanline(ppu);
+    }
+}
+
+void map_pattern_slot(Ppu* ppu, u8 slot, const u8* mem, u8* writable) {
+    if (ppu->bus.read[slot] == mem && ppu->bus.write[slot] == writable) {
+        return;
+    }
+
+    ppu->bus.read[slot] = mem;
+    ppu->bus.write[slot] = writable;
+    redraw_scanline(ppu);
+}
+
+void start_oam_dma(Ppu* ppu, u8 page) {
+    ppu->oam_dma_page = page;
+    // The CPU finishes the instruction that wrote $4014, the event then halts it
+    schedule_event(ppu->scheduler, EVENT_OAM_DMA, ppu->cpu->cycles);
+}
+
+u64 ppu_frame_end_cycle(const Ppu* ppu) {
+    return dot_to_cycle((ppu->dots / PPU_DOTS_PER_FRAME + 1) * PPU_DOTS_PER_FRAME);
+}
+
+u64 ppu_next_rendered_dot_cycle(u64 timestamp, u16 dot) {
+    const u64 now = timestamp * PPU_DOTS_PER_CPU_CYCLE;
+    const u64 frame_start = now - now % PPU_DOTS_PER_FRAME;
+    u64 scanline = now % PPU_DOTS_PER_FRAME / PPU_DOTS_PER_SCANLINE;
+
+    if (frame_start + scanline * PPU_DOTS_PER_SCANLINE + dot <= now) {
+        scanline++;
+    }
+
+    // Post-render and vblank scanlines are skipped
+    if (scanline >= PPU_FRAME_HEIGHT && scanline < PPU_PRE_RENDER_SCANLINE) {
+        scanline = PPU_PRE_RENDER_SCANLINE;
+    }
+
+    return dot_to_cycle(frame_start + scanline * PPU_DOTS_PER_SCANLINE + dot);
+}
@@ -0,0 +1,154 @@
+#ifndef PPU_H
+#define PPU_H
+
+#include "types.h"
+#include "cpu.h"
+#include "scheduler.h"
+
+#define PPU_FRAME_WIDTH 256
+#define PPU_FRAME_HEIGHT 240
+
+#define PPU_DOTS_PER_CPU_CYCLE 3
+#define PPU_DOTS_PER_SCANLINE 341
+#define PPU_SCANLINES_PER_FRAME 262
+#define PPU_DOTS_PER_FRAME (PPU_DOTS_PER_SCANLINE * PPU_SCANLINES_PER_FRAME)
+#define PPU_VBLANK_SCANLINE 241
+#define PPU_PRE_RENDER_SCANLINE 261
+
+#define PPU_OAM_SIZE 0x100
+#define PPU_PALETTE_SIZE 0x20
+// Enough for four-screen boards, the others use the first two tables
+#define PPU_NAMETABLES_SIZE 0x1000
+// Sprites the PPU draws on one scanline
+#define PPU_SPRITES_PER_SCANLINE 8
+// Tiles fetched per scanline, the 33rd covers fine X scrolling
+#define PPU_TILES_PER_SCANLINE (PPU_FRAME_WIDTH / 8 + 1)
+
+// The PPU address space in slots of 1 KiB: the pattern tables, the four nametables and
+// their mirror at $3000-$3EFF
+#define PPU_BUS_SLOT_SIZE 0x400
+#define PPU_BUS_SLOT_COUNT 16
+#define PPU_PATTERN_SLOTS 8
+#define PPU_NAMETABLE_SLOTS 4
+
+// CPU cycles the CPU is halted for an OAM DMA, one more when it starts on an odd cycle
+#define PPU_OAM_DMA_CYCLES 513
+
+#define PPUCTRL_NMI_ENABLE 0x80
+#define PPUCTRL_SPRITE_SIZE 0x20
+#define PPUCTRL_BACKGROUND_TABLE 0x10
+#define PPUCTRL_SPRITE_TABLE 0x08
+#define PPUCTRL_INCREMENT_32 0x04
+#define PPUMASK_GRAYSCALE 0x01
+#define PPUMASK_BACKGROUND_LEFT 0x02
+#define PPUMASK_SPRITES_LEFT 0x04
+#define PPUMASK_SHOW_BACKGROUND 0x08
+#define PPUMASK_SHOW_SPRITES 0x10
+// Red, green and blue emphasis, bits 0-2 of a pixel's emphasis once shifted down
+#define PPUMASK_EMPHASIS_SHIFT 5
+#define PPUSTATUS_SPRITE_OVERFLOW 0x20
+#define PPUSTATUS_SPRITE_ZERO_HIT 0x40
+#define PPUSTATUS_VBLANK 0x80
+
+// What the PPU sees at $0000-$3EFF. The board points the pattern table slots into CHR
+// and picks which 1 KiB of nametable RAM each nametable slot shows, so bank switching
+// and mirroring only rewrite pointers and a fetch never looks at the board.
+typedef struct PpuBus {
+    const u8* read[PPU_BUS_SLOT_COUNT];
+    // NULL for ROM
+    u8* write[PPU_BUS_SLOT_COUNT];
+} PpuBus;
+
+// What was fetched for the scanline the beam is on, kept so that a write in the middle of
+// the scanline can draw the rest of it again. Background pixels are palette addresses
+// ($00-$0F).
+typedef struct PpuLine {
+    // Dot 0 of the scanline, EVENT_NEVER before the first one is drawn
+    u64 start;
+    u8 tiles[PPU_TILES_PER_SCANLINE * 8];
+    // PPUCTRL when the beam entered the scanline, the sprites were fetched with it if they
+    // were fetched at all
+    u8 ctrl;
+    bool sprites;
+    // The tile v was loaded for, 0 unless $2006 was written in the middle of the scanline.
+    // Coarse X counts on from there.
+    u8 fetch_tile;
+    // Drawn again after a mid-scanline write
+    bool redrawn;
+} PpuLine;
+
+// The 2C02. It runs as a Component: its dot counter is only advanced when the CPU accesses
+// $2000-$3FFF or when one of its events is due, and catching up renders every scanline
+// the beam passed. A scanline is drawn in one pass when the beam enters it. Writes that
+// change how it looks ($2000, $2001, $2005, $2006 and CHR bank switches) sync the PPU
+// first, and when they land in the middle of a scanline the rest of it is fetched and
+// drawn again from the dot of the write.
+typedef struct Ppu {
+    u8 registers[8];
+    u8 status;
+    // VRAM address, the temporary address $2005/$2006 write to, fine X scroll and the
+    // toggle between first and second writes
+    u16 v;
+    u16 t;
+    u8 fine_x;
+    bool write_toggle;
+    // $2007 reads return what the previous read fetched
+    u8 read_buffer;
+    u8 oam_addr;
+    // Page of the OAM DMA in progress
+    u8 oam_dma_page;
+    u8 oam[PPU_OAM_SIZE];
+    u8 palette[PPU_PALETTE_SIZE];
+    u8 nametables[PPU_NAMETABLES_SIZE];
+    PpuBus bus;
+    PpuLine line;
+    // Visible scanlines drawn, and how many of them were drawn again after a mid-scanline
+    // write
+    u64 scanlines_drawn;
+    u64 scanlines_redrawn;
+    // Dot at which the sprite 0 hit flag of the scanline rendered last gets set,
+    // EVENT_NEVER when there is no hit pending
+    u64 sprite_zero_hit_dot;
+    // Palette index (0-63) per pixel
+    u8 framebuffer[PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT];
+    // Emphasis bits of PPUMASK (0-7) per pixel, with the palette index the 9-bit color the
+    // video signal is generated from
+    u8 emphasis[PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT];
+    // Dots since power-on, the beam position is derived from this
+    u64 dots;
+    u64 frames;
+    Component component;
+    Scheduler* scheduler;
+    Cpu* cpu;
+} Ppu;
+
+// Maps the PPU registers on the CPU bus and schedules the first vblank
+Ppu* build_ppu(Cpu* cpu, Scheduler* scheduler);
+void free_ppu(Ppu* ppu);
+// Clears OAM, palette, nametables and the scroll registers to their power-on state
+void reset_ppu_memory(Ppu* ppu);
+// Copies page to OAM on behalf of the CPU ($4014), which is halted meanwhile
+void start_oam_dma(Ppu* ppu, u8 page);
+// The board switches CHR and mirroring with these. Whoever calls them in the middle of a
+// frame syncs the PPU first, the scanlines the beam passed were drawn with the old banks.
+
+// Shows tables[i] (0-3), 1 KiB each of the nametable RAM, as nametable i
+void map_nametables(Ppu* ppu, const u8 tables[PPU_NAMETABLE_SLOTS]);
+// Points the pattern table slot at mem, writes go to writable (NULL for ROM)
+void map_pattern_slot(Ppu* ppu, u8 slot, const u8* mem, u8* writable);
+
+static inline u8 ppu_bus_read(const PpuBus* bus, u16 addr) {
+    return bus->read[addr / PPU_BUS_SLOT_SIZE % PPU_BUS_SLOT_COUNT][addr % PPU_BUS_SLOT_SIZE];
+}
+
+// Master clock timestamp at which the frame in progress ends
+u64 ppu_frame_end_cycle(const Ppu* ppu);
+// Master clock timestamp at which the beam next reaches dot of a rendered scanline (the
+// visible ones and the pre-render one), strictly after the given timestamp
+u64 ppu_next_rendered_dot_cycle(u64 timestamp, u16 dot);
+
+static inline bool ppu_rendering_enabled(const Ppu* ppu) {
+    return ppu->registers[1] & (PPUMASK_SHOW_BACKGROUND | PPUMASK_SHOW_SPRITES);
+}
+
+#endif
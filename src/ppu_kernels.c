@@ -0,0 +1,260 @@
+#include <string.h>
+
+#include "ppu_kernels.h"
+
+// The compositing kernel is written against a handful of byte-wise vector operations, one
+// pixel per byte. AVX2 needs a build for a CPU that has it (e.g. -DPYROTOBOX_NATIVE_ARCH=ON),
+// it also looks the colors up with byte shuffles where SSE2 goes through memory.
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+#define PIXEL_VEC_WIDTH 32
+#define PIXEL_VEC_ISA "avx2"
+
+typedef __m256i PixelVec;
+
+static inline PixelVec vec_load(const u8* p) { return _mm256_loadu_si256((const __m256i*) p); }
+static inline void vec_store(u8* p, PixelVec v) { _mm256_storeu_si256((__m256i*) p, v); }
+static inline PixelVec vec_set1(u8 v) { return _mm256_set1_epi8((char) v); }
+static inline PixelVec vec_and(PixelVec a, PixelVec b) { return _mm256_and_si256(a, b); }
+static inline PixelVec vec_or(PixelVec a, PixelVec b) { return _mm256_or_si256(a, b); }
+// ~a & b
+static inline PixelVec vec_andnot(PixelVec a, PixelVec b) { return _mm256_andnot_si256(a, b); }
+static inline PixelVec vec_cmpeq(PixelVec a, PixelVec b) { return _mm256_cmpeq_epi8(a, b); }
+static inline u32 vec_movemask(PixelVec a) { return (u32) _mm256_movemask_epi8(a); }
+
+// colors[index] of 32 palette addresses, each half of the table is shuffled in and the
+// half that index is in picked
+static inline void store_colors(u8* pixels, PixelVec index, const u8 colors[PPU_PALETTE_SIZE]) {
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) colors));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) &colors[16]));
+    const __m256i from_high = _mm256_cmpgt_epi8(index, _mm256_set1_epi8(0x0F));
+
+    vec_store(pixels, _mm256_blendv_epi8(_mm256_shuffle_epi8(low, index), _mm256_shuffle_epi8(high, index), from_high));
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+
+#define PIXEL_VEC_WIDTH 16
+#define PIXEL_VEC_ISA "sse2"
+
+typedef __m128i PixelVec;
+
+static inline PixelVec vec_load(const u8* p) { return _mm_loadu_si128((const __m128i*) p); }
+static inline void vec_store(u8* p, PixelVec v) { _mm_storeu_si128((__m128i*) p, v); }
+static inline PixelVec vec_set1(u8 v) { return _mm_set1_epi8((char) v); }
+static inline PixelVec vec_and(PixelVec a, PixelVec b) { return _mm_and_si128(a, b); }
+static inline PixelVec vec_or(PixelVec a, PixelVec b) { return _mm_or_si128(a, b); }
+// ~a & b
+static inline PixelVec vec_andnot(PixelVec a, PixelVec b) { return _mm_andnot_si128(a, b); }
+static inline PixelVec vec_cmpeq(PixelVec a, PixelVec b) { return _mm_cmpeq_epi8(a, b); }
+static inline u32 vec_movemask(PixelVec a) { return (u32) _mm_movemask_epi8(a); }
+
+// SSE2 has no byte shuffle, the palette addresses are looked up one at a time
+static inline void store_colors(u8* pixels, PixelVec index, const u8 colors[PPU_PALETTE_SIZE]) {
+    u8 addresses[PIXEL_VEC_WIDTH];
+
+    vec_store(addresses, index);
+    for (int i = 0; i < PIXEL_VEC_WIDTH; i++) {
+        pixels[i] = colors[addresses[i]];
+    }
+}
+
+#else
+
+#define PIXEL_VEC_ISA "scalar"
+
+#endif
+
+// Index of the lowest set bit, found with a de Bruijn sequence so that no compiler
+// builtin is needed
+static inline int lowest_bit(u64 bits) {
+    static const u8 DE_BRUIJN_INDEX[64] = {
+        0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6
+    };
+
+    return DE_BRUIJN_INDEX[((bits & (~bits + 1)) * 0x03F79D71B4CB0A89ULL) >> 58];
+}
+
+int evaluate_sprites_scalar(const u8 oam[PPU_OAM_SIZE], u16 scanline, int height,
+                            u8 sprites[PPU_SPRITES_PER_SCANLINE], bool* overflow) {
+    int count = 0;
+
+    *overflow = false;
+
+    // The hardware's buggy search for a ninth sprite is not reproduced
+    for (int sprite = 0; sprite < PPU_OAM_SIZE / 4; sprite++) {
+        const int row = scanline - 1 - oam[sprite * 4];
+
+        if (row >= 0 && row < height) {
+            if (count == PPU_SPRITES_PER_SCANLINE) {
+                *overflow = true;
+                break;
+            }
+
+            sprites[count++] = sprite;
+        }
+    }
+
+    return count;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+// Bit i set for each of 16 sprites, Y coordinates in y, that covers the scanline below
+// last_row: Y <= last_row and last_row - Y <= max_row, compared unsigned
+static inline u32 covering_sprites(__m128i y, __m128i last_row, __m128i max_row) {
+    const __m128i row = _mm_sub_epi8(last_row, y);
+    const __m128i above = _mm_cmpeq_epi8(_mm_max_epu8(y, last_row), last_row);
+    const __m128i inside = _mm_cmpeq_epi8(_mm_min_epu8(row, max_row), row);
+
+    return (u32) _mm_movemask_epi8(_mm_and_si128(above, inside));
+}
+#endif
+
+#if defined(__AVX2__)
+// Y coordinates of 32 sprites. The packs work within 128 bit halves, which leaves groups
+// of 4 sprites in the order 0 2 4 6 1 3 5 7.
+static inline __m256i load_sprite_y(const u8* oam) {
+    const __m256i y_bytes = _mm256_set1_epi32(0xFF);
+    const __m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i*) oam), y_bytes);
+    const __m256i b = _mm256_and_si256(_mm256_loadu_si256((const __m256i*) &oam[32]), y_bytes);
+    const __m256i c = _mm256_and_si256(_mm256_loadu_si256((const __m256i*) &oam[64]), y_bytes);
+    const __m256i d = _mm256_and_si256(_mm256_loadu_si256((const __m256i*) &oam[96]), y_bytes);
+    const __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+
+    return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+// Y coordinates of 16 sprites
+static inline __m128i load_sprite_y(const u8* oam) {
+    const __m128i y_bytes = _mm_set1_epi32(0xFF);
+    const __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*) oam), y_bytes);
+    const __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*) &oam[16]), y_bytes);
+    const __m128i c = _mm_and_si128(_mm_loadu_si128((const __m128i*) &oam[32]), y_bytes);
+    const __m128i d = _mm_and_si128(_mm_loadu_si128((const __m128i*) &oam[48]), y_bytes);
+
+    return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+#endif
+
+int evaluate_sprites(const u8 oam[PPU_OAM_SIZE], u16 scanline, int height,
+                     u8 sprites[PPU_SPRITES_PER_SCANLINE], bool* overflow) {
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+    // No sprite covers scanline 0, and the row above it does not fit in a byte
+    if (scanline == 0) {
+        *overflow = false;
+        return 0;
+    }
+
+    const __m128i last_row = _mm_set1_epi8((char) (scanline - 1));
+    const __m128i max_row = _mm_set1_epi8((char) (height - 1));
+    u64 covering = 0;
+
+#if defined(__AVX2__)
+    for (int group = 0; group < 2; group++) {
+        const __m256i y = load_sprite_y(&oam[group * 128]);
+
+        covering |= (u64) covering_sprites(_mm256_castsi256_si128(y), last_row, max_row) << group * 32;
+        covering |= (u64) covering_sprites(_mm256_extracti128_si256(y, 1), last_row, max_row) << (group * 32 + 16);
+    }
+#else
+    for (int group = 0; group < 4; group++) {
+        covering |= (u64) covering_sprites(load_sprite_y(&oam[group * 64]), last_row, max_row) << group * 16;
+    }
+#endif
+
+    int count = 0;
+
+    for (; covering && count < PPU_SPRITES_PER_SCANLINE; covering &= covering - 1) {
+        sprites[count++] = lowest_bit(covering);
+    }
+
+    *overflow = covering != 0;
+    return count;
+#else
+    return evaluate_sprites_scalar(oam, scanline, height, sprites, overflow);
+#endif
+}
+
+int composite_pixels_scalar(u8* pixels, const u8* background, const u8* sprites, const u8 colors[PPU_PALETTE_SIZE],
+                            int first) {
+    int hit = -1;
+
+    if (!sprites) {
+        for (int x = first; x < PPU_FRAME_WIDTH; x++) {
+            pixels[x] = colors[background[x]];
+        }
+        return hit;
+    }
+
+    for (int x = first; x < PPU_FRAME_WIDTH; x++) {
+        const u8 bg = background[x];
+        const u8 sprite = sprites[x];
+        const bool sprite_wins = sprite && (!(sprite & SPRITE_BEHIND_BACKGROUND) || !(bg & 0x03));
+
+        if (hit < 0 && (sprite & SPRITE_ZERO) && (bg & 0x03) && x < PPU_FRAME_WIDTH - 1) {
+            hit = x;
+        }
+
+        pixels[x] = colors[sprite_wins ? sprite & 0x1F : bg];
+    }
+
+    return hit;
+}
+
+int composite_pixels(u8* pixels, const u8* background, const u8* sprites, const u8 colors[PPU_PALETTE_SIZE], int first) {
+#ifdef PIXEL_VEC_WIDTH
+    const PixelVec zero = vec_set1(0);
+    const PixelVec opaque_bits = vec_set1(0x03);
+    const PixelVec behind_bit = vec_set1(SPRITE_BEHIND_BACKGROUND);
+    const PixelVec zero_bit = vec_set1(SPRITE_ZERO);
+    const PixelVec address_bits = vec_set1(0x1F);
+    int x = first;
+    int hit = -1;
+
+    for (; x + PIXEL_VEC_WIDTH <= PPU_FRAME_WIDTH; x += PIXEL_VEC_WIDTH) {
+        const PixelVec bg = vec_load(&background[x]);
+
+        if (!sprites) {
+            store_colors(&pixels[x], bg, colors);
+            continue;
+        }
+
+        // The sprite pixel shows where there is one, unless it is behind opaque background
+        const PixelVec sprite = vec_load(&sprites[x]);
+        const PixelVec transparent = vec_cmpeq(vec_and(bg, opaque_bits), zero);
+        const PixelVec in_front = vec_cmpeq(vec_and(sprite, behind_bit), zero);
+        const PixelVec sprite_wins = vec_andnot(vec_cmpeq(sprite, zero), vec_or(in_front, transparent));
+        const PixelVec address = vec_or(vec_and(sprite_wins, vec_and(sprite, address_bits)), vec_andnot(sprite_wins, bg));
+
+        if (hit < 0) {
+            u32 hits = vec_movemask(vec_andnot(transparent, vec_cmpeq(vec_and(sprite, zero_bit), zero_bit)));
+
+            if (x + PIXEL_VEC_WIDTH == PPU_FRAME_WIDTH) {
+                hits &= ~(1u << (PIXEL_VEC_WIDTH - 1));
+            }
+
+            if (hits) {
+                hit = x + lowest_bit(hits);
+            }
+        }
+
+        store_colors(&pixels[x], address, colors);
+    }
+
+    // Whatever is left when first is not a multiple of the vector width
+    const int tail_hit = composite_pixels_scalar(pixels, background, sprites, colors, x);
+
+    return hit >= 0 ? hit : tail_hit;
+#else
+    return composite_pixels_scalar(pixels, background, sprites, colors, first);
+#endif
+}
+
+const char* ppu_vector_isa(void) {
+    return PIXEL_VEC_ISA;
+}
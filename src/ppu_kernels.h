@@ -0,0 +1,39 @@
+#ifndef PPU_KERNELS_H
+#define PPU_KERNELS_H
+
+#include <stdbool.h>
+#include "types.h"
+#include "ppu.h"
+
+// A sprite line pixel is the palette address of the sprite ($10-$1F) and these flags, 0
+// where no sprite is
+#define SPRITE_BEHIND_BACKGROUND 0x20
+#define SPRITE_ZERO 0x40
+
+// Sprites at X 249-255 are drawn whole into the padding past the visible pixels
+#define SPRITE_LINE_SIZE (PPU_FRAME_WIDTH + 8)
+
+// The per-scanline work of the renderer that does not depend on the beam. Each kernel has
+// a vector version, with the instruction set picked at compile time like the batch
+// kernels, and a scalar reference that gives the same output.
+
+// OAM numbers of the first 8 sprites in OAM order that cover the scanline, sprites show up
+// one scanline below their Y coordinate. Returns how many there are, *overflow tells
+// whether a ninth one was found.
+int evaluate_sprites(const u8 oam[PPU_OAM_SIZE], u16 scanline, int height,
+                     u8 sprites[PPU_SPRITES_PER_SCANLINE], bool* overflow);
+int evaluate_sprites_scalar(const u8 oam[PPU_OAM_SIZE], u16 scanline, int height,
+                            u8 sprites[PPU_SPRITES_PER_SCANLINE], bool* overflow);
+
+// Draws pixels first-255 from the background palette addresses ($00-$0F) and the sprite
+// line (NULL when no sprite is on the scanline) through colors, one per palette address.
+// Returns the first of those pixels where sprite 0 hits opaque background, -1 if there is
+// none. Sprite 0 never hits on the last pixel.
+int composite_pixels(u8* pixels, const u8* background, const u8* sprites, const u8 colors[PPU_PALETTE_SIZE], int first);
+int composite_pixels_scalar(u8* pixels, const u8* background, const u8* sprites, const u8 colors[PPU_PALETTE_SIZE],
+                            int first);
+
+// "avx2", "sse2" or "scalar"
+const char* ppu_vector_isa(void);
+
+#endif
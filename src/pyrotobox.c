@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pyrotobox.h"
+#include "nes.h"
+#include "save_state.h"
+
+struct Pyrotobox {
+    Nes* nes;
+};
+
+Pyrotobox* pyrotobox_create(const uint8_t* rom, size_t rom_size) {
+    if (!rom) {
+        return NULL;
+    }
+
+    // build_nes_from_rom_bin takes ownership of the image it is given
+    u8* rom_bin = malloc(rom_size);
+
+    if (!rom_bin) {
+        return NULL;
+    }
+
+    memcpy(rom_bin, rom, rom_size);
+    const build_nes_result_t result = build_nes_from_rom_bin(&rom_bin, rom_size);
+
+    if (!result.valid) {
+        return NULL;
+    }
+
+    Pyrotobox* pyrotobox = malloc(sizeof(Pyrotobox));
+
+    if (!pyrotobox) {
+        free_nes(result.nes);
+        return NULL;
+    }
+
+    pyrotobox->nes = result.nes;
+    set_pacing_mode(&pyrotobox->nes->pacer, PACING_UNCAPPED);
+    pyrotobox->nes->cpu->cpu_state = CPU_PAUSED;
+
+    return pyrotobox;
+}
+
+void pyrotobox_destroy(Pyrotobox* pyrotobox) {
+    if (!pyrotobox) {
+        return;
+    }
+
+    free_nes(pyrotobox->nes);
+    free(pyrotobox);
+}
+
+static RunSummary run(Pyrotobox* pyrotobox, const StopCondition* condition) {
+    Cpu* cpu = pyrotobox->nes->cpu;
+    RunSummary summary = {.reason = STOP_CPU_STOPPED};
+
+    if (cpu->cpu_state == CPU_STOPPED) {
+        return summary;
+    }
+
+    summary = run_nes_until(pyrotobox->nes, condition);
+
+    // run_nes_until leaves the CPU stopped, only keep it that way if it stopped by itself
+    if (summary.reason != STOP_CPU_STOPPED) {
+        cpu->cpu_state = CPU_PAUSED;
+    }
+
+    return summary;
+}
+
+bool pyrotobox_step_frame(Pyrotobox* pyrotobox) {
+    const StopCondition condition = {.max_frames = 1};
+    return run(pyrotobox, &condition).reason == STOP_FRAME_LIMIT;
+}
+
+uint64_t pyrotobox_step_cycles(Pyrotobox* pyrotobox, uint64_t cycles) {
+    const StopCondition condition = {.max_cycles = cycles};
+
+    if (cycles == 0) {
+        return 0;
+    }
+
+    return run(pyrotobox, &condition).cycles;
+}
+
+const uint8_t* pyrotobox_framebuffer(const Pyrotobox* pyrotobox) {
+    return nes_display_framebuffer(pyrotobox->nes);
+}
+
+void pyrotobox_set_buttons(Pyrotobox* pyrotobox, unsigned port, uint8_t buttons) {
+    if (port < sizeof(pyrotobox->nes->controllers) / sizeof(pyrotobox->nes->controllers[0])) {
+        pyrotobox->nes->controllers[port].buttons = buttons;
+    }
+}
+
+// Second instance of the cartridge for run-ahead, on a copy of the ROM of the first
+static Nes* build_shadow_copy(const Nes* nes) {
+    u8* rom_bin = malloc(nes->rom.size);
+
+    if (!rom_bin) {
+        return NULL;
+    }
+
+    memcpy(rom_bin, nes->rom.data, nes->rom.size);
+
+    RomImage image = (RomImage) {.data = rom_bin, .size = nes->rom.size, .mapped = false};
+    return build_shadow_nes(nes, &image);
+}
+
+bool pyrotobox_set_run_ahead(Pyrotobox* pyrotobox, unsigned frames, bool second_instance) {
+    Nes* shadow = NULL;
+
+    if (frames > 0 && second_instance) {
+        shadow = build_shadow_copy(pyrotobox->nes);
+
+        if (!shadow) {
+            enable_run_ahead(pyrotobox->nes, 0, NULL);
+            return false;
+        }
+    }
+
+    enable_run_ahead(pyrotobox->nes, frames, shadow);
+    return true;
+}
+
+void pyrotobox_enable_rewind(Pyrotobox* pyrotobox, size_t memory_budget) {
+    enable_rewind(pyrotobox->nes, memory_budget);
+}
+
+bool pyrotobox_rewind_frame(Pyrotobox* pyrotobox) {
+    // A stopped instance would not step forward again after rewinding
+    if (pyrotobox->nes->cpu->cpu_state == CPU_STOPPED) {
+        return false;
+    }
+
+    // Two frames back and one forward again, which renders the framebuffer and records
+    // the frame anew
+    return rewind_nes(pyrotobox->nes) && pyrotobox_step_frame(pyrotobox);
+}
+
+size_t pyrotobox_state_size(const Pyrotobox* pyrotobox) {
+    return nes_state_size(pyrotobox->nes);
+}
+
+size_t pyrotobox_save_state(const Pyrotobox* pyrotobox, uint8_t* state, size_t size) {
+    return save_nes_state(pyrotobox->nes, state, size);
+}
+
+bool pyrotobox_load_state(Pyrotobox* pyrotobox, const uint8_t* state, size_t size) {
+    if (load_nes_state(pyrotobox->nes, state, size) != SAVE_STATE_OK) {
+        return false;
+    }
+
+    pyrotobox->nes->cpu->cpu_state = CPU_PAUSED;
+    return true;
+}
+
+uint64_t pyrotobox_frame_count(const Pyrotobox* pyrotobox) {
+    return pyrotobox->nes->frames;
+}
+
+uint64_t pyrotobox_cycle_count(const Pyrotobox* pyrotobox) {
+    return pyrotobox->nes->cpu->cycles;
+}
@@ -0,0 +1,87 @@
+#ifndef PYROTOBOX_H
+#define PYROTOBOX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * libpyrotobox, the emulator core as a C library.
+ *
+ * Every instance owns all of its state and the library has no mutable globals, so any
+ * number of instances can run in one process. An instance must only be used by one
+ * thread at a time, different instances can run on different threads concurrently.
+ *
+ *     Pyrotobox* nes = pyrotobox_create(rom, rom_size);
+ *     while (pyrotobox_step_frame(nes)) {
+ *         present(pyrotobox_framebuffer(nes));
+ *     }
+ *     pyrotobox_destroy(nes);
+ *
+ * Emulation is not paced, callers step frames or cycles as fast as they need them. The APU
+ * does not synthesize sound, there is no audio output.
+ */
+
+#define PYROTOBOX_FRAME_WIDTH 256
+#define PYROTOBOX_FRAME_HEIGHT 240
+
+// Buttons of a standard controller, see pyrotobox_set_buttons
+#define PYROTOBOX_BUTTON_A (1 << 0)
+#define PYROTOBOX_BUTTON_B (1 << 1)
+#define PYROTOBOX_BUTTON_SELECT (1 << 2)
+#define PYROTOBOX_BUTTON_START (1 << 3)
+#define PYROTOBOX_BUTTON_UP (1 << 4)
+#define PYROTOBOX_BUTTON_DOWN (1 << 5)
+#define PYROTOBOX_BUTTON_LEFT (1 << 6)
+#define PYROTOBOX_BUTTON_RIGHT (1 << 7)
+
+typedef struct Pyrotobox Pyrotobox;
+
+// Creates an instance from an iNES image. The bytes are copied, the caller keeps
+// ownership of rom. Returns NULL if the image is invalid or uses an unsupported mapper.
+Pyrotobox* pyrotobox_create(const uint8_t* rom, size_t rom_size);
+void pyrotobox_destroy(Pyrotobox* pyrotobox);
+
+// Runs until the end of the current frame. Returns false once the CPU has stopped (e.g.
+// on a stack overflow), the instance can only be destroyed after that.
+bool pyrotobox_step_frame(Pyrotobox* pyrotobox);
+// Runs at least cycles CPU cycles (the last instruction may overshoot a little).
+// Returns the number of cycles actually run, 0 once the CPU has stopped.
+uint64_t pyrotobox_step_cycles(Pyrotobox* pyrotobox, uint64_t cycles);
+
+// Current frame as PYROTOBOX_FRAME_WIDTH x PYROTOBOX_FRAME_HEIGHT NES palette indices
+// (0-63), row major. Valid until the next step or destroy call.
+const uint8_t* pyrotobox_framebuffer(const Pyrotobox* pyrotobox);
+
+// Holds buttons, PYROTOBOX_BUTTON_* bits, on the controller in port 0 or 1 from the next
+// step on until they are set again. Other ports are ignored.
+void pyrotobox_set_buttons(Pyrotobox* pyrotobox, unsigned port, uint8_t buttons);
+
+// Emulates frames frames ahead at the end of every frame and rolls back afterwards, so
+// pyrotobox_framebuffer shows the effect of input frames earlier. 0 turns it off. With
+// second_instance the frames ahead run on a second instance of the cartridge, which costs
+// its memory but saves restoring the state after every frame. Returns false, with
+// run-ahead off, when the second instance cannot be created.
+bool pyrotobox_set_run_ahead(Pyrotobox* pyrotobox, unsigned frames, bool second_instance);
+
+// Records every frame from now on into up to memory_budget bytes of compressed history,
+// the oldest frames are forgotten first. 0 turns it off and drops the history.
+void pyrotobox_enable_rewind(Pyrotobox* pyrotobox, size_t memory_budget);
+// Steps back one frame of the history, state and framebuffer both, and forgets the frame
+// stepped back from. Returns false, leaving the instance untouched, when rewind is off,
+// the history is exhausted or the CPU has stopped.
+bool pyrotobox_rewind_frame(Pyrotobox* pyrotobox);
+
+// Save states are versioned little-endian images, portable between hosts and loadable
+// by later builds. Every state of a build is pyrotobox_state_size bytes.
+size_t pyrotobox_state_size(const Pyrotobox* pyrotobox);
+// Returns the number of bytes written, 0 if size is too small
+size_t pyrotobox_save_state(const Pyrotobox* pyrotobox, uint8_t* state, size_t size);
+// Returns false if the state is invalid, from a newer build or from another cartridge, in
+// which case the instance is left untouched. Loading a state resumes a stopped instance.
+bool pyrotobox_load_state(Pyrotobox* pyrotobox, const uint8_t* state, size_t size);
+
+uint64_t pyrotobox_frame_count(const Pyrotobox* pyrotobox);
+uint64_t pyrotobox_cycle_count(const Pyrotobox* pyrotobox);
+
+#endif
@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "rewind.h"
+#include "nes.h"
+#include "save_state.h"
+#include "utils.h"
+
+// Zero bytes that end a literal run. Shorter gaps cost more to encode than to copy.
+#define MIN_ZERO_RUN 8
+// Smallest compressed entry to expect, used to size the entry ring. Even a frame where the
+// game changes nothing moves the counters of every chip, the deltas of the bench programs
+// are around 90 bytes. Smaller entries only mean the ring fills before the arena does.
+#define MIN_ENTRY_SIZE 64
+
+static inline size_t write_varint(u8* out, size_t val) {
+    size_t size = 0;
+
+    while (val >= 0x80) {
+        out[size++] = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+
+    out[size++] = val;
+    return size;
+}
+
+static inline size_t read_varint(const u8* in, size_t* pos) {
+    size_t val = 0;
+
+    for (int shift = 0;; shift += 7) {
+        const u8 byte = in[(*pos)++];
+        val |= (size_t) (byte & 0x7F) << shift;
+
+        if (!(byte & 0x80)) {
+            return val;
+        }
+    }
+}
+
+static inline u64 load_u64(const u8* bytes) {
+    u64 val;
+    memcpy(&val, bytes, sizeof(val));
+    return val;
+}
+
+// Length of the run of equal bytes of a and b starting at pos
+static size_t equal_run(const u8* a, const u8* b, size_t pos, size_t size) {
+    const size_t start = pos;
+
+    while (pos + 8 <= size && load_u64(&a[pos]) == load_u64(&b[pos])) {
+        pos += 8;
+    }
+
+    while (pos < size && a[pos] == b[pos]) {
+        pos++;
+    }
+
+    return pos - start;
+}
+
+// Encodes state XOR base as (zero run, literal count, literal bytes) triples of varints
+// and XORed bytes. A keyframe is the same encoding against an all-zero base.
+static size_t encode_delta(const u8* state, const u8* base, size_t size, u8* out) {
+    size_t pos = 0, out_size = 0;
+
+    while (pos < size) {
+        const size_t zeros = equal_run(state, base, pos, size);
+        size_t literal_end = pos + zeros;
+
+        // Extend the literals until a zero run long enough to be worth a new triple
+        while (literal_end < size) {
+            const size_t run = equal_run(state, base, literal_end, size);
+
+            if (run >= MIN_ZERO_RUN || literal_end + run == size) {
+                break;
+            }
+
+            literal_end += run + 1;
+        }
+
+        const size_t literal_start = pos + zeros;
+
+        out_size += write_varint(&out[out_size], zeros);
+        out_size += write_varint(&out[out_size], literal_end - literal_start);
+
+        for (size_t i = literal_start; i < literal_end; i++) {
+            out[out_size++] = state[i] ^ base[i];
+        }
+
+        pos = literal_end;
+    }
+
+    return out_size;
+}
+
+// XORs an encoded delta into state, which turns the state of one end of the delta into
+// the state of the other end
+static void apply_delta(const u8* delta, size_t delta_size, u8* state) {
+    size_t in = 0, pos = 0;
+
+    while (in < delta_size) {
+        pos += read_varint(delta, &in);
+        const size_t literals = read_varint(delta, &in);
+
+        for (size_t i = 0; i < literals; i++) {
+            state[pos++] ^= delta[in++];
+        }
+    }
+}
+
+static inline RewindEntry* entry_at(RewindBuffer* rewind, size_t index) {
+    return &rewind->entries[(rewind->first_entry + index) % rewind->entry_capacity];
+}
+
+static void decode_entry(RewindBuffer* rewind, const RewindEntry* entry, u8* state) {
+    if (entry->keyframe) {
+        memset(state, 0, rewind->state_size);
+    }
+
+    apply_delta(&rewind->arena[entry->offset], entry->size, state);
+}
+
+static void evict_oldest_entry(RewindBuffer* rewind) {
+    const RewindEntry* entry = entry_at(rewind, 0);
+
+    rewind->stats.bytes -= entry->size;
+    rewind->stats.keyframes -= entry->keyframe;
+    rewind->stats.evicted++;
+    rewind->first_entry = (rewind->first_entry + 1) % rewind->entry_capacity;
+    rewind->entry_count--;
+}
+
+// Drops the oldest keyframe and its deltas, unless that would drop the newest entry
+static bool evict_oldest_group(RewindBuffer* rewind) {
+    size_t group_size = 1;
+
+    while (group_size < rewind->entry_count && !entry_at(rewind, group_size)->keyframe) {
+        group_size++;
+    }
+
+    if (group_size == rewind->entry_count) {
+        return false;
+    }
+
+    for (size_t i = 0; i < group_size; i++) {
+        evict_oldest_entry(rewind);
+    }
+
+    return true;
+}
+
+// Finds room for size bytes behind the newest entry, wrapping to the start of the arena
+// when the end is too short. Evicts old groups as needed, false if there is no room.
+static bool reserve_arena(RewindBuffer* rewind, size_t size, size_t* offset) {
+    if (size > rewind->arena_size) {
+        return false;
+    }
+
+    for (;;) {
+        if (rewind->entry_count == 0) {
+            *offset = 0;
+            return true;
+        }
+
+        const RewindEntry* oldest = entry_at(rewind, 0);
+        const RewindEntry* newest = entry_at(rewind, rewind->entry_count - 1);
+        const size_t head = newest->offset + newest->size;
+
+        if (rewind->entry_count < rewind->entry_capacity) {
+            if (newest->offset >= oldest->offset) {
+                if (head + size <= rewind->arena_size) {
+                    *offset = head;
+                    return true;
+                }
+
+                if (size <= oldest->offset) {
+                    *offset = 0;
+                    return true;
+                }
+            } else if (head + size <= oldest->offset) {
+                *offset = head;
+                return true;
+            }
+        }
+
+        if (!evict_oldest_group(rewind)) {
+            return false;
+        }
+    }
+}
+
+static void append_entry(RewindBuffer* rewind, const u8* data, size_t size, bool keyframe, u64 frame, size_t offset) {
+    memcpy(&rewind->arena[offset], data, size);
+    *entry_at(rewind, rewind->entry_count++) = (RewindEntry) {
+        .offset = offset,
+        .size = size,
+        .keyframe = keyframe,
+        .frame = frame
+    };
+
+    rewind->since_keyframe = keyframe ? 0 : rewind->since_keyframe + 1;
+    rewind->stats.bytes += size;
+    rewind->stats.keyframes += keyframe;
+    rewind->stats.compressed_bytes += size;
+    rewind->stats.raw_bytes += rewind->state_size;
+}
+
+// Compression thread
+static void compress_pending_states(void* arg) {
+    RewindBuffer* rewind = arg;
+
+    lock_mutex(&rewind->mutex);
+
+    for (;;) {
+        while (rewind->pending_count == 0 && !rewind->quit) {
+            wait_cond_var(&rewind->work_ready, &rewind->mutex);
+        }
+
+        if (rewind->pending_count == 0) {
+            break;
+        }
+
+        const u8* state = rewind->pending[rewind->first_pending];
+        const u64 frame = rewind->pending_frames[rewind->first_pending];
+        const bool keyframe = rewind->entry_count == 0 || rewind->since_keyframe + 1 >= rewind->keyframe_interval;
+        rewind->compressing = true;
+        unlock_mutex(&rewind->mutex);
+
+        // latest is only touched by rewind_frame while nothing is compressing
+        const u64 start_ns = get_time_ns();
+        size_t size = encode_delta(state, keyframe ? rewind->zeros : rewind->latest, rewind->state_size, rewind->scratch);
+        memcpy(rewind->latest, state, rewind->state_size);
+        const u64 compress_ns = get_time_ns() - start_ns;
+
+        lock_mutex(&rewind->mutex);
+        size_t offset;
+
+        if (reserve_arena(rewind, size, &offset)) {
+            append_entry(rewind, rewind->scratch, size, keyframe, frame, offset);
+        } else {
+            // Not even the group of the newest keyframe fits, start over from this state
+            while (rewind->entry_count > 0) {
+                evict_oldest_entry(rewind);
+            }
+
+            size = encode_delta(state, rewind->zeros, rewind->state_size, rewind->scratch);
+
+            if (reserve_arena(rewind, size, &offset)) {
+                append_entry(rewind, rewind->scratch, size, true, frame, offset);
+            } else {
+                rewind->stats.dropped++;
+            }
+        }
+
+        rewind->stats.compress_ns += compress_ns;
+        rewind->first_pending = (rewind->first_pending + 1) % REWIND_PENDING_STATES;
+        rewind->pending_count--;
+        rewind->compressing = false;
+        broadcast_cond_var(&rewind->idle);
+    }
+
+    unlock_mutex(&rewind->mutex);
+}
+
+RewindBuffer* build_rewind_buffer(const Nes* nes, size_t memory_budget, u32 keyframe_interval) {
+    RewindBuffer* rewind = calloc(1, sizeof(RewindBuffer));
+
+    rewind->state_size = nes_state_size(nes);
+    rewind->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+    // The entry ring comes out of the budget as well, both share one allocation
+    rewind->entry_capacity = memory_budget / (sizeof(RewindEntry) + MIN_ENTRY_SIZE) + 1;
+    const size_t ring_size = rewind->entry_capacity * sizeof(RewindEntry);
+    rewind->arena_size = memory_budget > ring_size ? memory_budget - ring_size : 0;
+    rewind->entries = malloc(ring_size + rewind->arena_size);
+    rewind->arena = (u8*) &rewind->entries[rewind->entry_capacity];
+    rewind->latest = malloc(rewind->state_size);
+    // Keyframes are encoded against all zeros
+    rewind->zeros = calloc(rewind->state_size, 1);
+    // Every triple covers at least MIN_ZERO_RUN bytes besides its literals
+    rewind->scratch = malloc(4 * rewind->state_size + 64);
+    rewind->stats.memory_budget = memory_budget;
+
+    for (int i = 0; i < REWIND_PENDING_STATES; i++) {
+        rewind->pending[i] = malloc(rewind->state_size);
+    }
+
+    init_mutex(&rewind->mutex);
+    init_cond_var(&rewind->work_ready);
+    init_cond_var(&rewind->idle);
+
+    if (!start_thread(&rewind->worker, compress_pending_states, rewind)) {
+        fprintf(stderr, "Unable to start the rewind compression thread\n");
+        rewind->quit = true;
+    }
+
+    return rewind;
+}
+
+void free_rewind_buffer(RewindBuffer* rewind) {
+    lock_mutex(&rewind->mutex);
+    const bool running = !rewind->quit;
+    rewind->quit = true;
+    signal_cond_var(&rewind->work_ready);
+    unlock_mutex(&rewind->mutex);
+
+    if (running) {
+        join_thread(&rewind->worker);
+    }
+
+    destroy_cond_var(&rewind->work_ready);
+    destroy_cond_var(&rewind->idle);
+    destroy_mutex(&rewind->mutex);
+
+    for (int i = 0; i < REWIND_PENDING_STATES; i++) {
+        free(rewind->pending[i]);
+    }
+
+    free(rewind->scratch);
+    free(rewind->zeros);
+    free(rewind->latest);
+    free(rewind->entries);
+    free(rewind);
+}
+
+bool push_rewind_frame(RewindBuffer* rewind, const Nes* nes) {
+    lock_mutex(&rewind->mutex);
+    rewind->stats.pushed++;
+
+    if (rewind->pending_count == REWIND_PENDING_STATES || rewind->quit) {
+        rewind->stats.dropped++;
+        unlock_mutex(&rewind->mutex);
+        return false;
+    }
+
+    // Slots past the pending ones belong to this thread, the copy happens unlocked
+    const size_t slot = (rewind->first_pending + rewind->pending_count) % REWIND_PENDING_STATES;
+    unlock_mutex(&rewind->mutex);
+
+    save_nes_state(nes, rewind->pending[slot], rewind->state_size);
+    rewind->pending_frames[slot] = nes->frames;
+
+    lock_mutex(&rewind->mutex);
+    rewind->pending_count++;
+    signal_cond_var(&rewind->work_ready);
+    unlock_mutex(&rewind->mutex);
+
+    return true;
+}
+
+// Turns latest into the state of the entry before the newest one and forgets the newest
+static void drop_newest_entry(RewindBuffer* rewind) {
+    const size_t newest = rewind->entry_count - 1;
+    const RewindEntry* entry = entry_at(rewind, newest);
+
+    if (!entry->keyframe) {
+        // latest XOR (latest XOR previous) is the previous state
+        apply_delta(&rewind->arena[entry->offset], entry->size, rewind->latest);
+    } else {
+        size_t keyframe = newest - 1;
+
+        while (!entry_at(rewind, keyframe)->keyframe) {
+            keyframe--;
+        }
+
+        for (size_t i = keyframe; i < newest; i++) {
+            decode_entry(rewind, entry_at(rewind, i), rewind->latest);
+        }
+    }
+
+    rewind->stats.bytes -= entry->size;
+    rewind->stats.keyframes -= entry->keyframe;
+    rewind->entry_count--;
+
+    rewind->since_keyframe = 0;
+    while (!entry_at(rewind, newest - 1 - rewind->since_keyframe)->keyframe) {
+        rewind->since_keyframe++;
+    }
+}
+
+// Called with the mutex held
+static void wait_until_idle(RewindBuffer* rewind) {
+    while ((rewind->pending_count > 0 || rewind->compressing) && !rewind->quit) {
+        wait_cond_var(&rewind->idle, &rewind->mutex);
+    }
+}
+
+void wait_rewind_idle(RewindBuffer* rewind) {
+    lock_mutex(&rewind->mutex);
+    wait_until_idle(rewind);
+    unlock_mutex(&rewind->mutex);
+}
+
+bool rewind_frames(RewindBuffer* rewind, Nes* nes, u32 frames) {
+    lock_mutex(&rewind->mutex);
+
+    // Everything pushed so far has to be in the history before stepping back
+    wait_until_idle(rewind);
+
+    if (frames == 0 || rewind->entry_count <= frames) {
+        unlock_mutex(&rewind->mutex);
+        return false;
+    }
+
+    for (u32 i = 0; i < frames; i++) {
+        drop_newest_entry(rewind);
+    }
+
+    const SaveStateStatus status = load_nes_state(nes, rewind->latest, rewind->state_size);
+    unlock_mutex(&rewind->mutex);
+
+    return status == SAVE_STATE_OK;
+}
+
+bool rewind_frame(RewindBuffer* rewind, Nes* nes) {
+    return rewind_frames(rewind, nes, 1);
+}
+
+RewindStats get_rewind_stats(RewindBuffer* rewind) {
+    lock_mutex(&rewind->mutex);
+
+    RewindStats stats = rewind->stats;
+    stats.entries = rewind->entry_count;
+
+    if (rewind->entry_count > 0) {
+        stats.oldest_frame = entry_at(rewind, 0)->frame;
+        stats.newest_frame = entry_at(rewind, rewind->entry_count - 1)->frame;
+    }
+
+    unlock_mutex(&rewind->mutex);
+
+    return stats;
+}
@@ -0,0 +1,97 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "types.h"
+#include "thread.h"
+
+struct Nes;
+
+#define REWIND_DEFAULT_KEYFRAME_INTERVAL 60
+// Snapshots waiting for the compression thread, pushes beyond that are dropped
+#define REWIND_PENDING_STATES 8
+
+typedef struct RewindEntry {
+    // Position of the compressed state in the arena
+    size_t offset;
+    u32 size;
+    bool keyframe;
+    u64 frame;
+} RewindEntry;
+
+typedef struct RewindStats {
+    size_t entries;
+    size_t keyframes;
+    // Compressed bytes of the history currently held
+    size_t bytes;
+    size_t memory_budget;
+    u64 oldest_frame;
+    u64 newest_frame;
+    u64 pushed;
+    // Pushes that found every pending slot taken
+    u64 dropped;
+    u64 evicted;
+    // Totals over every compressed state, for the compression ratio
+    u64 raw_bytes;
+    u64 compressed_bytes;
+    u64 compress_ns;
+} RewindStats;
+
+// Per-frame history of save states within a fixed memory budget. Every keyframe_interval
+// frames a full state is stored, the frames in between as the XOR of the state with the
+// previous one, both run-length compressed. XOR deltas work in both directions, so
+// stepping back one frame is a single delta applied to the newest state; only stepping
+// back over a keyframe replays the deltas from the keyframe before it.
+//
+// The emulation thread only copies the state into a pending slot, compression runs on
+// a thread of its own. Entries are kept in a ring over one arena, when either is full the
+// oldest keyframe is evicted together with its deltas. The ring and the arena together
+// take memory_budget bytes.
+typedef struct RewindBuffer {
+    size_t state_size;
+    u32 keyframe_interval;
+    // Behind the entries in the same allocation
+    u8* arena;
+    size_t arena_size;
+    RewindEntry* entries;
+    size_t entry_capacity;
+    size_t first_entry;
+    size_t entry_count;
+    // State of the newest entry, the base of the next delta
+    u8* latest;
+    u32 since_keyframe;
+    // Encoder output, large enough for the worst case
+    u8* scratch;
+    u8* zeros;
+    u8* pending[REWIND_PENDING_STATES];
+    u64 pending_frames[REWIND_PENDING_STATES];
+    size_t first_pending;
+    size_t pending_count;
+    bool compressing;
+    bool quit;
+    Mutex mutex;
+    CondVar work_ready;
+    CondVar idle;
+    Thread worker;
+    RewindStats stats;
+} RewindBuffer;
+
+RewindBuffer* build_rewind_buffer(const struct Nes* nes, size_t memory_budget, u32 keyframe_interval);
+void free_rewind_buffer(RewindBuffer* rewind);
+
+// Queues the current state of the NES, called once per frame. Returns false when the
+// compression thread is behind and the frame was dropped.
+bool push_rewind_frame(RewindBuffer* rewind, const struct Nes* nes);
+// Waits until the compression thread has taken every frame pushed so far into the history
+void wait_rewind_idle(RewindBuffer* rewind);
+// Steps the NES back to the previous frame in the history and forgets the current one.
+// Returns false once the history is exhausted.
+bool rewind_frame(RewindBuffer* rewind, struct Nes* nes);
+// Steps back frames frames at once, false and the NES untouched when the history does not
+// reach back that far
+bool rewind_frames(RewindBuffer* rewind, struct Nes* nes, u32 frames);
+
+RewindStats get_rewind_stats(RewindBuffer* rewind);
+
+#endif
@@ -0,0 +1,749 @@
+#ifndef WIN32
+#define _XOPEN_SOURCE 700
+#endif
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <dirent.h>
+#else
+#include <windows.h>
+#endif
+
+#include "rom_index.h"
+#include "mapper.h"
+#include "nes.h"
+#include "thread.h"
+#include "utils.h"
+
+#define ROM_INDEX_HEADER_SIZE 16
+#define ROM_RECORD_SIZE 68
+#define PATH_LOOKUP_ENTRY_SIZE 12
+// Far beyond any real library, anything larger is not an index
+#define MAX_ROM_INDEX_SIZE 0x40000000
+// Files a worker takes from the shared list at a time
+#define INDEX_BATCH_SIZE 8
+#define HINTS_MAX_LINE 1024
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+// Field offsets of a ROM record
+#define RECORD_CRC32 0
+#define RECORD_PRG_CRC32 4
+#define RECORD_CHR_CRC32 8
+#define RECORD_SHA1 12
+#define RECORD_PRG_SIZE 32
+#define RECORD_CHR_SIZE 36
+#define RECORD_MAPPER 40
+#define RECORD_SUBMAPPER 42
+#define RECORD_MIRRORING 43
+#define RECORD_FLAGS 44
+#define RECORD_IDLE_LOOP_PC 46
+#define RECORD_FILE_SIZE 48
+#define RECORD_MTIME 56
+#define RECORD_PATH 64
+
+typedef struct PathList {
+    char** paths;
+    size_t count;
+    size_t capacity;
+} PathList;
+
+struct IndexWorker;
+
+// Files are handed out in small batches off a shared counter, hashing a file takes far
+// longer than taking the lock
+typedef struct IndexBuild {
+    const PathList* files;
+    RomInfo* roms;
+    bool* indexed;
+    const RomIndex* previous;
+    Mutex lock;
+    size_t next;
+} IndexBuild;
+
+typedef struct IndexWorker {
+    IndexBuild* build;
+    u64 bytes_hashed;
+    size_t reused;
+    Thread thread;
+} IndexWorker;
+
+static inline void store_u16(u8* p, u16 val) {
+    p[0] = val;
+    p[1] = val >> 8;
+}
+
+static inline void store_u32(u8* p, u32 val) {
+    store_u16(p, val);
+    store_u16(&p[2], val >> 16);
+}
+
+static inline void store_u64(u8* p, u64 val) {
+    store_u32(p, val);
+    store_u32(&p[4], val >> 32);
+}
+
+static inline u16 load_u16(const u8* p) {
+    return p[0] | p[1] << 8;
+}
+
+static inline u32 load_u32(const u8* p) {
+    return load_u16(p) | (u32) load_u16(&p[2]) << 16;
+}
+
+static inline u64 load_u64(const u8* p) {
+    return load_u32(p) | (u64) load_u32(&p[4]) << 32;
+}
+
+static u64 hash_path(const char* path) {
+    u64 hash = FNV_OFFSET_BASIS;
+
+    for (; *path; path++) {
+        hash = (hash ^ (u8) *path) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+// Absolute path with links and . or .. resolved, so every spelling of a file is the same
+// key. malloc'ed, NULL if the file does not exist.
+static char* canonical_path(const char* path) {
+#ifndef WIN32
+    return realpath(path, NULL);
+#else
+    return _fullpath(NULL, path, 0);
+#endif
+}
+
+static bool stat_file(const char* path, u64* size, u64* mtime) {
+#ifndef WIN32
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+#else
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0) {
+        return false;
+    }
+#endif
+
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return true;
+}
+
+rom_index_open_result open_rom_index(const char* index_path) {
+    rom_index_open_result result = (rom_index_open_result) {.valid = false, .index = NULL};
+    rom_map_result map_result = map_file_image(index_path, MAX_ROM_INDEX_SIZE);
+
+    if (!map_result.valid) {
+        fprintf(stderr, "ERROR: Unable to open the ROM index. Given Path: %s\n", index_path);
+        return result;
+    }
+
+    const u8* data = map_result.image.data;
+    const size_t size = map_result.image.size;
+
+    if (size < ROM_INDEX_HEADER_SIZE || memcmp(data, ROM_INDEX_MAGIC, 4) != 0 || load_u16(&data[4]) != ROM_INDEX_VERSION) {
+        fprintf(stderr, "ERROR: Not a ROM index of this version. Given Path: %s\n", index_path);
+        release_rom_image(&map_result.image);
+        return result;
+    }
+
+    const u32 rom_count = load_u32(&data[8]);
+    const u32 paths_size = load_u32(&data[12]);
+    const u64 tables_size = (u64) rom_count * (ROM_RECORD_SIZE + PATH_LOOKUP_ENTRY_SIZE);
+
+    // Paths are NUL-terminated, so every offset into the table ends inside it
+    if (ROM_INDEX_HEADER_SIZE + tables_size + paths_size != size || (paths_size > 0 && data[size - 1] != '\0')) {
+        fprintf(stderr, "ERROR: The ROM index is corrupt. Given Path: %s\n", index_path);
+        release_rom_image(&map_result.image);
+        return result;
+    }
+
+    RomIndex* index = malloc(sizeof(RomIndex));
+
+    index->image = map_result.image;
+    index->rom_count = rom_count;
+    index->roms = &data[ROM_INDEX_HEADER_SIZE];
+    index->path_lookup = &index->roms[(size_t) rom_count * ROM_RECORD_SIZE];
+    index->paths = (const char*) &index->path_lookup[(size_t) rom_count * PATH_LOOKUP_ENTRY_SIZE];
+    index->paths_size = paths_size;
+
+    result.index = index;
+    result.valid = true;
+
+    return result;
+}
+
+void close_rom_index(RomIndex* index) {
+    release_rom_image(&index->image);
+    free(index);
+}
+
+static void read_rom_record(const RomIndex* index, u32 rom, RomInfo* info) {
+    const u8* record = &index->roms[(size_t) rom * ROM_RECORD_SIZE];
+    const u32 path_offset = load_u32(&record[RECORD_PATH]);
+
+    info->crc32 = load_u32(&record[RECORD_CRC32]);
+    info->prg_crc32 = load_u32(&record[RECORD_PRG_CRC32]);
+    info->chr_crc32 = load_u32(&record[RECORD_CHR_CRC32]);
+    memcpy(info->sha1, &record[RECORD_SHA1], SHA1_DIGEST_SIZE);
+    info->prg_size = load_u32(&record[RECORD_PRG_SIZE]);
+    info->chr_size = load_u32(&record[RECORD_CHR_SIZE]);
+    info->mapper = load_u16(&record[RECORD_MAPPER]);
+    info->submapper = record[RECORD_SUBMAPPER];
+    info->mirroring = record[RECORD_MIRRORING];
+    info->flags = record[RECORD_FLAGS];
+    info->idle_loop_pc = load_u16(&record[RECORD_IDLE_LOOP_PC]);
+    info->file_size = load_u64(&record[RECORD_FILE_SIZE]);
+    info->mtime = load_u64(&record[RECORD_MTIME]);
+    info->path = path_offset < index->paths_size ? &index->paths[path_offset] : "";
+}
+
+static void write_rom_record(u8* record, const RomInfo* info, u32 path_offset) {
+    memset(record, 0, ROM_RECORD_SIZE);
+    store_u32(&record[RECORD_CRC32], info->crc32);
+    store_u32(&record[RECORD_PRG_CRC32], info->prg_crc32);
+    store_u32(&record[RECORD_CHR_CRC32], info->chr_crc32);
+    memcpy(&record[RECORD_SHA1], info->sha1, SHA1_DIGEST_SIZE);
+    store_u32(&record[RECORD_PRG_SIZE], info->prg_size);
+    store_u32(&record[RECORD_CHR_SIZE], info->chr_size);
+    store_u16(&record[RECORD_MAPPER], info->mapper);
+    record[RECORD_SUBMAPPER] = info->submapper;
+    record[RECORD_MIRRORING] = info->mirroring;
+    record[RECORD_FLAGS] = info->flags;
+    store_u16(&record[RECORD_IDLE_LOOP_PC], info->idle_loop_pc);
+    store_u64(&record[RECORD_FILE_SIZE], info->file_size);
+    store_u64(&record[RECORD_MTIME], info->mtime);
+    store_u32(&record[RECORD_PATH], path_offset);
+}
+
+bool find_rom_by_crc32(const RomIndex* index, u32 crc32, RomInfo* info) {
+    u32 low = 0, high = index->rom_count;
+
+    // First record whose CRC is not below crc32
+    while (low < high) {
+        const u32 mid = low + (high - low) / 2;
+
+        if (load_u32(&index->roms[(size_t) mid * ROM_RECORD_SIZE + RECORD_CRC32]) < crc32) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == index->rom_count || load_u32(&index->roms[(size_t) low * ROM_RECORD_SIZE + RECORD_CRC32]) != crc32) {
+        return false;
+    }
+
+    read_rom_record(index, low, info);
+    return true;
+}
+
+// path has to be canonical
+static bool find_rom_file(const RomIndex* index, const char* path, u64 size, u64 mtime, RomInfo* info) {
+    const u64 hash = hash_path(path);
+    u32 low = 0, high = index->rom_count;
+
+    while (low < high) {
+        const u32 mid = low + (high - low) / 2;
+
+        if (load_u64(&index->path_lookup[(size_t) mid * PATH_LOOKUP_ENTRY_SIZE]) < hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    // Paths that collide on the hash are next to each other
+    for (; low < index->rom_count; low++) {
+        const u8* entry = &index->path_lookup[(size_t) low * PATH_LOOKUP_ENTRY_SIZE];
+        const u32 rom = load_u32(&entry[8]);
+
+        if (load_u64(entry) != hash) {
+            break;
+        }
+
+        if (rom >= index->rom_count) {
+            continue;
+        }
+
+        read_rom_record(index, rom, info);
+
+        if (strcmp(info->path, path) == 0) {
+            return info->file_size == size && info->mtime == mtime;
+        }
+    }
+
+    return false;
+}
+
+bool find_rom_by_path(const RomIndex* index, const char* rom_path, RomInfo* info) {
+    char* path = canonical_path(rom_path);
+    u64 size, mtime;
+    const bool found = path && stat_file(path, &size, &mtime) && find_rom_file(index, path, size, mtime, info);
+
+    free(path);
+    return found;
+}
+
+// PRG-ROM and CHR-ROM of a valid image
+static const u8* rom_body(const RomImage* image, const NesHeader* nes_header, u32* prg_size, u32* chr_size) {
+    *prg_size = nes_header->prg_rom_count * PRG_ROM_SIZE_PER_UNIT;
+    *chr_size = nes_header->chr_rom_count * CHR_ROM_SIZE_PER_UNIT;
+    return &image->data[nes_prg_rom_offset(nes_header)];
+}
+
+bool read_rom_info(const RomImage* image, RomInfo* info) {
+    NesHeader nes_header;
+
+    if (!read_nes_header(image->data, image->size, &nes_header)) {
+        return false;
+    }
+
+    u32 prg_size, chr_size;
+    const u8* prg = rom_body(image, &nes_header, &prg_size, &chr_size);
+    Sha1 sha1;
+
+    memset(info, 0, sizeof(RomInfo));
+    info->prg_crc32 = crc32(0, prg, prg_size);
+    info->chr_crc32 = crc32(0, &prg[prg_size], chr_size);
+    // CRCs chain, the CRC of the whole ROM continues the one of PRG-ROM
+    info->crc32 = crc32(info->prg_crc32, &prg[prg_size], chr_size);
+
+    init_sha1(&sha1);
+    update_sha1(&sha1, prg, prg_size + chr_size);
+    finish_sha1(&sha1, info->sha1);
+
+    info->prg_size = prg_size;
+    info->chr_size = chr_size;
+    info->mapper = nes_header.mapper;
+    info->submapper = nes_header.submapper;
+    info->mirroring = nes_header.mirroring;
+    info->flags = (nes_header.nes2 ? ROM_INFO_NES2 : 0)
+        | (nes_header.trainer ? ROM_INFO_TRAINER : 0)
+        | (image->data[6] & 0x02 ? ROM_INFO_BATTERY : 0)
+        | (is_mapper_supported(nes_header.mapper) && prg_size > 0 ? ROM_INFO_SUPPORTED : 0);
+    info->file_size = image->size;
+
+    return true;
+}
+
+bool resolve_rom(const RomIndex* index, const char* rom_path, const RomImage* image, RomInfo* info, bool* hashed) {
+    *hashed = false;
+
+    if (find_rom_by_path(index, rom_path, info)) {
+        return true;
+    }
+
+    NesHeader nes_header;
+
+    if (!read_nes_header(image->data, image->size, &nes_header)) {
+        return false;
+    }
+
+    // The CRC is all a lookup needs, hashing a ROM this way takes well under a millisecond
+    u32 prg_size, chr_size;
+    const u8* body = rom_body(image, &nes_header, &prg_size, &chr_size);
+    *hashed = true;
+
+    return find_rom_by_crc32(index, crc32(0, body, prg_size + chr_size), info)
+        && info->prg_size == prg_size && info->chr_size == chr_size;
+}
+
+static void add_path(PathList* list, char* path) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->paths = realloc(list->paths, list->capacity * sizeof(char*));
+    }
+
+    list->paths[list->count++] = path;
+}
+
+static bool has_nes_extension(const char* name) {
+    const size_t length = strlen(name);
+
+    return length > 4 && name[length - 4] == '.' && tolower((u8) name[length - 3]) == 'n'
+        && tolower((u8) name[length - 2]) == 'e' && tolower((u8) name[length - 1]) == 's';
+}
+
+static char* join_path(const char* dir_path, const char* name) {
+    const size_t dir_length = strlen(dir_path);
+    const size_t name_length = strlen(name);
+    char* path = malloc(dir_length + name_length + 2);
+
+    memcpy(path, dir_path, dir_length);
+    path[dir_length] = '/';
+    memcpy(&path[dir_length + 1], name, name_length + 1);
+
+    return path;
+}
+
+// Collects the .nes files of the tree. Links to directories are not followed, which keeps
+// loops out and every ROM to one path.
+static void scan_dir(const char* dir_path, PathList* files) {
+#ifndef WIN32
+    DIR* dir = opendir(dir_path);
+
+    if (!dir) {
+        fprintf(stderr, "WARNING: Unable to open the directory %s\n", dir_path);
+        return;
+    }
+
+    const struct dirent* entry;
+
+    while ((entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        char* path = join_path(dir_path, entry->d_name);
+        struct stat st;
+
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            scan_dir(path, files);
+        } else if (has_nes_extension(entry->d_name) && stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+            add_path(files, path);
+            continue;
+        }
+
+        free(path);
+    }
+
+    closedir(dir);
+#else
+    char* pattern = join_path(dir_path, "*");
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA(pattern, &entry);
+
+    free(pattern);
+
+    if (find == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "WARNING: Unable to open the directory %s\n", dir_path);
+        return;
+    }
+
+    do {
+        if (strcmp(entry.cFileName, ".") == 0 || strcmp(entry.cFileName, "..") == 0) {
+            continue;
+        }
+
+        char* path = join_path(dir_path, entry.cFileName);
+
+        if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                scan_dir(path, files);
+            }
+        } else if (has_nes_extension(entry.cFileName)) {
+            add_path(files, path);
+            continue;
+        }
+
+        free(path);
+    } while (FindNextFileA(find, &entry));
+
+    FindClose(find);
+#endif
+}
+
+static bool index_file(IndexWorker* worker, size_t file) {
+    IndexBuild* build = worker->build;
+    RomInfo* info = &build->roms[file];
+    char* path = canonical_path(build->files->paths[file]);
+    u64 size, mtime;
+
+    if (!path || !stat_file(path, &size, &mtime)) {
+        free(path);
+        return false;
+    }
+
+    if (build->previous && find_rom_file(build->previous, path, size, mtime, info)) {
+        worker->reused++;
+    } else {
+        rom_map_result rom = map_rom_file(path);
+
+        if (!rom.valid || !read_rom_info(&rom.image, info)) {
+            release_rom_image(&rom.image);
+            free(path);
+            return false;
+        }
+
+        release_rom_image(&rom.image);
+        worker->bytes_hashed += info->prg_size + info->chr_size;
+
+        // A changed or moved file of a known game keeps its hints
+        RomInfo known;
+        if (build->previous && find_rom_by_crc32(build->previous, info->crc32, &known)) {
+            info->idle_loop_pc = known.idle_loop_pc;
+        }
+    }
+
+    info->file_size = size;
+    info->mtime = mtime;
+    info->path = path;
+
+    return true;
+}
+
+static void index_worker_main(void* arg) {
+    IndexWorker* worker = arg;
+    IndexBuild* build = worker->build;
+
+    for (;;) {
+        lock_mutex(&build->lock);
+        const size_t first = build->next;
+        build->next += INDEX_BATCH_SIZE;
+        unlock_mutex(&build->lock);
+
+        if (first >= build->files->count) {
+            return;
+        }
+
+        for (size_t file = first; file < first + INDEX_BATCH_SIZE && file < build->files->count; file++) {
+            build->indexed[file] = index_file(worker, file);
+
+            if (!build->indexed[file]) {
+                fprintf(stderr, "WARNING: Skipped %s, not a valid iNES image\n", build->files->paths[file]);
+            }
+        }
+    }
+}
+
+static int compare_roms(const void* a, const void* b) {
+    const RomInfo* rom_a = a;
+    const RomInfo* rom_b = b;
+
+    if (rom_a->crc32 != rom_b->crc32) {
+        return rom_a->crc32 < rom_b->crc32 ? -1 : 1;
+    }
+
+    return strcmp(rom_a->path, rom_b->path);
+}
+
+typedef struct PathLookupEntry {
+    u64 hash;
+    u32 rom;
+} PathLookupEntry;
+
+static int compare_path_lookup_entries(const void* a, const void* b) {
+    const PathLookupEntry* entry_a = a;
+    const PathLookupEntry* entry_b = b;
+
+    if (entry_a->hash != entry_b->hash) {
+        return entry_a->hash < entry_b->hash ? -1 : 1;
+    }
+
+    return (entry_a->rom > entry_b->rom) - (entry_a->rom < entry_b->rom);
+}
+
+// Hint lines are "CRC32 idle_loop=ADDR", they apply to every file of the game
+static bool apply_hints(const char* hints_path, RomInfo* roms, size_t count) {
+    FILE* file = fopen(hints_path, "r");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Unable to open the hint file. Given Path: %s\n", hints_path);
+        return false;
+    }
+
+    char line[HINTS_MAX_LINE];
+    size_t line_number = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        const char* crc_str = strtok(line, " \t\r\n");
+
+        if (!crc_str) {
+            continue;
+        }
+
+        char* end = NULL;
+        const unsigned long crc = strtoul(crc_str, &end, 16);
+        bool valid = *end == '\0' && strlen(crc_str) <= 8;
+        u64 idle_loop_pc = 0;
+        const char* hint;
+
+        while (valid && (hint = strtok(NULL, " \t\r\n"))) {
+            valid = strncmp(hint, "idle_loop=", 10) == 0 && parse_number(hint + 10, 0xFFFF, &idle_loop_pc);
+        }
+
+        if (!valid) {
+            fprintf(stderr, "ERROR: Invalid hint on line %zu of %s, expected CRC32 idle_loop=ADDR\n", line_number, hints_path);
+            fclose(file);
+            return false;
+        }
+
+        // roms are sorted by CRC
+        size_t low = 0, high = count;
+        while (low < high) {
+            const size_t mid = low + (high - low) / 2;
+
+            if (roms[mid].crc32 < crc) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+
+        for (; low < count && roms[low].crc32 == crc; low++) {
+            roms[low].idle_loop_pc = idle_loop_pc;
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool write_rom_index(const char* index_path, const RomInfo* roms, u32 count) {
+    size_t paths_size = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        paths_size += strlen(roms[i].path) + 1;
+    }
+
+    const size_t lookup_offset = ROM_INDEX_HEADER_SIZE + (size_t) count * ROM_RECORD_SIZE;
+    const size_t paths_offset = lookup_offset + (size_t) count * PATH_LOOKUP_ENTRY_SIZE;
+    const size_t size = paths_offset + paths_size;
+    u8* data = calloc(size, 1);
+    PathLookupEntry* lookup = malloc((count ? count : 1) * sizeof(PathLookupEntry));
+    size_t path_offset = 0;
+
+    memcpy(data, ROM_INDEX_MAGIC, 4);
+    store_u16(&data[4], ROM_INDEX_VERSION);
+    store_u32(&data[8], count);
+    store_u32(&data[12], paths_size);
+
+    for (u32 i = 0; i < count; i++) {
+        const size_t path_size = strlen(roms[i].path) + 1;
+
+        write_rom_record(&data[ROM_INDEX_HEADER_SIZE + (size_t) i * ROM_RECORD_SIZE], &roms[i], path_offset);
+        memcpy(&data[paths_offset + path_offset], roms[i].path, path_size);
+        path_offset += path_size;
+        lookup[i] = (PathLookupEntry) {.hash = hash_path(roms[i].path), .rom = i};
+    }
+
+    qsort(lookup, count, sizeof(PathLookupEntry), compare_path_lookup_entries);
+
+    for (u32 i = 0; i < count; i++) {
+        store_u64(&data[lookup_offset + (size_t) i * PATH_LOOKUP_ENTRY_SIZE], lookup[i].hash);
+        store_u32(&data[lookup_offset + (size_t) i * PATH_LOOKUP_ENTRY_SIZE + 8], lookup[i].rom);
+    }
+
+    FILE* file = fopen(index_path, "wb");
+    bool written = file && fwrite(data, 1, size, file) == size;
+
+    if (file) {
+        written = fclose(file) == 0 && written;
+    }
+
+    if (!written) {
+        fprintf(stderr, "ERROR: Unable to write the ROM index. Given Path: %s\n", index_path);
+    }
+
+    free(lookup);
+    free(data);
+    return written;
+}
+
+bool build_rom_index(const char* dir_path, const char* index_path, const RomIndexOptions* options, RomIndexStats* stats) {
+    const u64 start_ns = get_time_ns();
+    PathList files = {0};
+    u64 index_size, index_mtime;
+
+    memset(stats, 0, sizeof(RomIndexStats));
+    scan_dir(dir_path, &files);
+
+    // Writing replaces the previous index, so it is only read until the workers are done
+    RomIndex* previous = NULL;
+    if (stat_file(index_path, &index_size, &index_mtime)) {
+        const rom_index_open_result previous_result = open_rom_index(index_path);
+        previous = previous_result.index;
+    }
+
+    IndexBuild build = (IndexBuild) {
+        .files = &files,
+        .roms = calloc(files.count ? files.count : 1, sizeof(RomInfo)),
+        .indexed = calloc(files.count ? files.count : 1, sizeof(bool)),
+        .previous = previous,
+        .next = 0
+    };
+    init_mutex(&build.lock);
+
+    u32 worker_count = options->threads ? options->threads : get_cpu_count();
+    if (worker_count > files.count / INDEX_BATCH_SIZE + 1) {
+        worker_count = files.count / INDEX_BATCH_SIZE + 1;
+    }
+
+    IndexWorker* workers = calloc(worker_count, sizeof(IndexWorker));
+
+    // The calling thread is worker 0
+    for (u32 i = 0; i < worker_count; i++) {
+        workers[i].build = &build;
+    }
+
+    u32 started = 1;
+    for (; started < worker_count; started++) {
+        if (!start_thread(&workers[started].thread, index_worker_main, &workers[started])) {
+            fprintf(stderr, "ERROR: Unable to start indexer thread %u, the others take its files\n", started);
+            break;
+        }
+    }
+
+    index_worker_main(&workers[0]);
+
+    for (u32 i = 0; i < worker_count; i++) {
+        if (i > 0 && i < started) {
+            join_thread(&workers[i].thread);
+        }
+
+        stats->bytes_hashed += workers[i].bytes_hashed;
+        stats->reused += workers[i].reused;
+    }
+
+    if (previous) {
+        close_rom_index(previous);
+    }
+
+    // Compact the ROMs that were indexed
+    size_t count = 0;
+    for (size_t i = 0; i < files.count; i++) {
+        if (build.indexed[i]) {
+            build.roms[count++] = build.roms[i];
+        }
+
+        free(files.paths[i]);
+    }
+
+    qsort(build.roms, count, sizeof(RomInfo), compare_roms);
+
+    bool written = count <= UINT32_MAX && (!options->hints_path || apply_hints(options->hints_path, build.roms, count));
+    written = written && write_rom_index(index_path, build.roms, count);
+
+    stats->threads = started;
+    stats->files = files.count;
+    stats->roms = count;
+    stats->skipped = files.count - count;
+    stats->wall_ns = get_time_ns() - start_ns;
+
+    for (size_t i = 0; i < count; i++) {
+        free((char*) build.roms[i].path);
+    }
+
+    destroy_mutex(&build.lock);
+    free(workers);
+    free(build.indexed);
+    free(build.roms);
+    free(files.paths);
+
+    return written;
+}
@@ -0,0 +1,104 @@
+#ifndef ROM_INDEX_H
+#define ROM_INDEX_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "types.h"
+#include "hash.h"
+#include "io_utils.h"
+
+#define ROM_INDEX_VERSION 1
+#define ROM_INDEX_MAGIC "PBIX"
+
+// RomInfo flags
+#define ROM_INFO_NES2 (1 << 0)
+#define ROM_INFO_TRAINER (1 << 1)
+#define ROM_INFO_BATTERY (1 << 2)
+// The mapper is one this build can run
+#define ROM_INFO_SUPPORTED (1 << 3)
+
+// Metadata of one ROM file. The hashes cover PRG-ROM and CHR-ROM without the header (and
+// trainer), which is what ROM databases list.
+typedef struct RomInfo {
+    u32 crc32;
+    u32 prg_crc32;
+    u32 chr_crc32;
+    u8 sha1[SHA1_DIGEST_SIZE];
+    u32 prg_size;
+    u32 chr_size;
+    u16 mapper;
+    u8 submapper;
+    // A Mirroring
+    u8 mirroring;
+    u8 flags;
+    // Per-game hints, 0 when unknown. Hints belong to the game, so they are matched by CRC.
+    u16 idle_loop_pc;
+    // The file as it was indexed, for finding it again without reading it
+    u64 file_size;
+    u64 mtime;
+    // Absolute path, points into the index or is owned by whoever built the RomInfo
+    const char* path;
+} RomInfo;
+
+// An index file, mapped read-only. The layout is little-endian:
+//
+//   header       "PBIX", u16 version, u16 reserved, u32 ROM count, u32 path table size
+//   ROMs         one record per ROM file sorted by CRC32
+//   path lookup  u64 FNV-1a of the path and u32 ROM number, sorted by the hash
+//   path table   NUL-terminated paths, records refer to them by offset
+//
+// Both tables are searched in place, so a lookup only touches O(log n) records however
+// large the library is.
+typedef struct RomIndex {
+    RomImage image;
+    u32 rom_count;
+    const u8* roms;
+    const u8* path_lookup;
+    const char* paths;
+    u32 paths_size;
+} RomIndex;
+
+typedef struct rom_index_open_result {
+    bool valid;
+    RomIndex* index;
+} rom_index_open_result;
+
+typedef struct RomIndexOptions {
+    // 0 picks one worker per hardware thread
+    u32 threads;
+    // Hint file: one game per line, "CRC32 idle_loop=ADDR", # starts a comment
+    const char* hints_path;
+} RomIndexOptions;
+
+typedef struct RomIndexStats {
+    u32 threads;
+    size_t files;
+    size_t roms;
+    // Files that are not valid iNES images
+    size_t skipped;
+    // Unchanged files whose metadata came from the previous index
+    size_t reused;
+    u64 bytes_hashed;
+    u64 wall_ns;
+} RomIndexStats;
+
+rom_index_open_result open_rom_index(const char* index_path);
+void close_rom_index(RomIndex* index);
+
+// Looks a ROM up by its CRC32, returns false if it is not in the index
+bool find_rom_by_crc32(const RomIndex* index, u32 crc32, RomInfo* info);
+// Looks a ROM file up by path, size and modification time, nothing is read from the file.
+// Returns false if the file is not in the index or has changed since.
+bool find_rom_by_path(const RomIndex* index, const char* rom_path, RomInfo* info);
+// Path first, then the CRC32 of the ROM image. hashed tells which one found it.
+bool resolve_rom(const RomIndex* index, const char* rom_path, const RomImage* image, RomInfo* info, bool* hashed);
+
+// Indexes every .nes file under dir_path on a pool of threads and writes the index to
+// index_path. Files unchanged since an existing index at index_path are not hashed again,
+// and the hints of the existing index are kept.
+bool build_rom_index(const char* dir_path, const char* index_path, const RomIndexOptions* options, RomIndexStats* stats);
+
+// Hashes and parses a ROM image, false if it is not a valid iNES image
+bool read_rom_info(const RomImage* image, RomInfo* info);
+
+#endif
@@ -0,0 +1,471 @@
+#include <string.h>
+
+#include "save_state.h"
+#include "mapper.h"
+
+#define SAVE_STATE_HEADER_SIZE 12
+#define SECTION_HEADER_SIZE 8
+
+#define WORK_RAM_SIZE 0x800
+#define PRG_RAM_ADDR 0x6000
+#define PRG_RAM_SIZE 0x2000
+
+#define SECTION_TAG(a, b, c, d) ((u32) (a) | (u32) (b) << 8 | (u32) (c) << 16 | (u32) (d) << 24)
+
+// Payload sizes of the fixed-layout sections, the scheduler section holds one entry per
+// event type
+#define NES_SECTION_SIZE 12
+#define CPU_SECTION_SIZE 24
+#define SCHEDULER_ENTRY_SIZE 9
+#define PPU_SECTION_SIZE 25
+#define APU_SECTION_SIZE 40
+#define CONTROLLERS_SECTION_SIZE 6
+#define PPU_MEMORY_SECTION_SIZE (17 + PPU_OAM_SIZE + PPU_PALETTE_SIZE + PPU_NAMETABLES_SIZE)
+
+typedef enum Section {
+    SECTION_NES,
+    SECTION_CPU,
+    SECTION_WORK_RAM,
+    SECTION_PRG_RAM,
+    SECTION_SCHEDULER,
+    SECTION_PPU,
+    SECTION_APU,
+    SECTION_CONTROLLERS,
+    SECTION_MAPPER,
+    SECTION_PPU_MEMORY,
+    SECTION_COUNT
+} Section;
+
+typedef struct SectionLayout {
+    u32 tag;
+    // 0 for sections whose size depends on their contents
+    u32 size;
+    // First version that has the section, it is mandatory from there on
+    u16 since_version;
+} SectionLayout;
+
+static const SectionLayout SECTIONS[SECTION_COUNT] = {
+    [SECTION_NES] = {SECTION_TAG('N', 'E', 'S', ' '), NES_SECTION_SIZE, 1},
+    [SECTION_CPU] = {SECTION_TAG('C', 'P', 'U', ' '), CPU_SECTION_SIZE, 1},
+    [SECTION_WORK_RAM] = {SECTION_TAG('W', 'R', 'A', 'M'), WORK_RAM_SIZE, 1},
+    [SECTION_PRG_RAM] = {SECTION_TAG('P', 'R', 'A', 'M'), PRG_RAM_SIZE, 1},
+    [SECTION_SCHEDULER] = {SECTION_TAG('S', 'C', 'H', 'D'), 0, 1},
+    [SECTION_PPU] = {SECTION_TAG('P', 'P', 'U', ' '), PPU_SECTION_SIZE, 1},
+    [SECTION_APU] = {SECTION_TAG('A', 'P', 'U', ' '), APU_SECTION_SIZE, 1},
+    [SECTION_CONTROLLERS] = {SECTION_TAG('C', 'T', 'R', 'L'), CONTROLLERS_SECTION_SIZE, 1},
+    // Board registers and CHR-RAM, the size depends on the mapper
+    [SECTION_MAPPER] = {SECTION_TAG('M', 'A', 'P', 'R'), 0, 2},
+    // Scroll registers, OAM, palette and nametables
+    [SECTION_PPU_MEMORY] = {SECTION_TAG('V', 'R', 'A', 'M'), PPU_MEMORY_SECTION_SIZE, 3}
+};
+
+// APU flag bits of the APU section
+#define APU_FIVE_STEP_MODE (1 << 0)
+#define APU_FRAME_IRQ_INHIBIT (1 << 1)
+#define APU_FRAME_IRQ (1 << 2)
+#define APU_DMC_IRQ_ENABLE (1 << 3)
+#define APU_DMC_LOOP (1 << 4)
+#define APU_DMC_IRQ (1 << 5)
+
+// Cursor over a buffer that is known to be large enough, the bounds are checked up front
+typedef struct StateCursor {
+    u8* data;
+    size_t pos;
+} StateCursor;
+
+typedef struct StateReader {
+    const u8* data;
+    size_t pos;
+} StateReader;
+
+static inline void put_u8(StateCursor* cursor, u8 val) {
+    cursor->data[cursor->pos++] = val;
+}
+
+static inline void put_u16(StateCursor* cursor, u16 val) {
+    put_u8(cursor, val);
+    put_u8(cursor, val >> 8);
+}
+
+static inline void put_u32(StateCursor* cursor, u32 val) {
+    put_u16(cursor, val);
+    put_u16(cursor, val >> 16);
+}
+
+static inline void put_u64(StateCursor* cursor, u64 val) {
+    put_u32(cursor, val);
+    put_u32(cursor, val >> 32);
+}
+
+static inline void put_bytes(StateCursor* cursor, const void* bytes, size_t size) {
+    memcpy(&cursor->data[cursor->pos], bytes, size);
+    cursor->pos += size;
+}
+
+static inline u8 get_u8(StateReader* reader) {
+    return reader->data[reader->pos++];
+}
+
+static inline u16 get_u16(StateReader* reader) {
+    const u16 lsb = get_u8(reader);
+    return lsb | (u16) get_u8(reader) << 8;
+}
+
+static inline u32 get_u32(StateReader* reader) {
+    const u32 low = get_u16(reader);
+    return low | (u32) get_u16(reader) << 16;
+}
+
+static inline u64 get_u64(StateReader* reader) {
+    const u64 low = get_u32(reader);
+    return low | (u64) get_u32(reader) << 32;
+}
+
+static inline void get_bytes(StateReader* reader, void* bytes, size_t size) {
+    memcpy(bytes, &reader->data[reader->pos], size);
+    reader->pos += size;
+}
+
+static inline u32 section_size(const Nes* nes, Section section) {
+    switch (section) {
+        case SECTION_SCHEDULER:
+            return 1 + EVENT_TYPE_COUNT * SCHEDULER_ENTRY_SIZE;
+        case SECTION_MAPPER:
+            return mapper_state_size(nes->mapper);
+        default:
+            return SECTIONS[section].size;
+    }
+}
+
+size_t nes_state_size(const Nes* nes) {
+    size_t size = SAVE_STATE_HEADER_SIZE;
+
+    for (Section section = 0; section < SECTION_COUNT; section++) {
+        size += SECTION_HEADER_SIZE + section_size(nes, section);
+    }
+
+    return size;
+}
+
+static void begin_section(StateCursor* cursor, const Nes* nes, Section section) {
+    put_u32(cursor, SECTIONS[section].tag);
+    put_u32(cursor, section_size(nes, section));
+}
+
+size_t save_nes_state(const Nes* nes, u8* state, size_t size) {
+    if (size < nes_state_size(nes)) {
+        return 0;
+    }
+
+    const Cpu* cpu = nes->cpu;
+    const Ppu* ppu = nes->ppu;
+    const Apu* apu = nes->apu;
+    StateCursor cursor = {.data = state, .pos = SAVE_STATE_HEADER_SIZE};
+
+    begin_section(&cursor, nes, SECTION_NES);
+    put_u8(&cursor, nes->nes_header->mapper);
+    put_u8(&cursor, nes->nes_header->prg_rom_count);
+    put_u8(&cursor, nes->nes_header->chr_rom_count);
+    put_u8(&cursor, nes->nes_header->mirroring);
+    put_u64(&cursor, nes->frames);
+
+    begin_section(&cursor, nes, SECTION_CPU);
+    put_u8(&cursor, cpu->r_a);
+    put_u8(&cursor, cpu->r_x);
+    put_u8(&cursor, cpu->r_y);
+    put_u8(&cursor, cpu->r_sp);
+    put_u8(&cursor, cpu->r_sr);
+    put_u8(&cursor, cpu->irq_lines);
+    put_u16(&cursor, cpu->r_pc);
+    put_u64(&cursor, cpu->cycles);
+    put_u64(&cursor, cpu->instructions_performed);
+
+    begin_section(&cursor, nes, SECTION_WORK_RAM);
+    put_bytes(&cursor, cpu->mem, WORK_RAM_SIZE);
+
+    begin_section(&cursor, nes, SECTION_PRG_RAM);
+    put_bytes(&cursor, &cpu->mem[PRG_RAM_ADDR], PRG_RAM_SIZE);
+
+    // Every event type gets an entry, EVENT_NEVER when it is not pending, so states of one
+    // build all have the same size and layout. Types are stored by their EventType value,
+    // which makes the enum order part of the format.
+    begin_section(&cursor, nes, SECTION_SCHEDULER);
+    put_u8(&cursor, EVENT_TYPE_COUNT);
+    for (EventType type = 0; type < EVENT_TYPE_COUNT; type++) {
+        const int index = nes->scheduler.heap_index[type];
+
+        put_u8(&cursor, type);
+        put_u64(&cursor, index >= 0 ? nes->scheduler.heap[index].timestamp : EVENT_NEVER);
+    }
+
+    begin_section(&cursor, nes, SECTION_PPU);
+    put_bytes(&cursor, ppu->registers, sizeof(ppu->registers));
+    put_u8(&cursor, ppu->status);
+    put_u64(&cursor, ppu->dots);
+    put_u64(&cursor, ppu->component.cycles);
+
+    begin_section(&cursor, nes, SECTION_APU);
+    put_bytes(&cursor, apu->registers, sizeof(apu->registers));
+    put_u8(&cursor, (apu->five_step_mode ? APU_FIVE_STEP_MODE : 0)
+        | (apu->frame_irq_inhibit ? APU_FRAME_IRQ_INHIBIT : 0)
+        | (apu->frame_irq ? APU_FRAME_IRQ : 0)
+        | (apu->dmc_irq_enable ? APU_DMC_IRQ_ENABLE : 0)
+        | (apu->dmc_loop ? APU_DMC_LOOP : 0)
+        | (apu->dmc_irq ? APU_DMC_IRQ : 0));
+    put_u16(&cursor, apu->dmc_period);
+    put_u16(&cursor, apu->dmc_address);
+    put_u16(&cursor, apu->dmc_bytes_remaining);
+    put_u8(&cursor, apu->dmc_sample_buffer);
+    put_u64(&cursor, apu->component.cycles);
+
+    begin_section(&cursor, nes, SECTION_CONTROLLERS);
+    for (int port = 0; port < 2; port++) {
+        put_u8(&cursor, nes->controllers[port].buttons);
+        put_u8(&cursor, nes->controllers[port].shift);
+        put_u8(&cursor, nes->controllers[port].strobe);
+    }
+
+    begin_section(&cursor, nes, SECTION_MAPPER);
+    save_mapper_state(nes->mapper, &cursor.data[cursor.pos]);
+    cursor.pos += mapper_state_size(nes->mapper);
+
+    begin_section(&cursor, nes, SECTION_PPU_MEMORY);
+    put_u16(&cursor, ppu->v);
+    put_u16(&cursor, ppu->t);
+    put_u8(&cursor, ppu->fine_x);
+    put_u8(&cursor, ppu->write_toggle);
+    put_u8(&cursor, ppu->read_buffer);
+    put_u8(&cursor, ppu->oam_addr);
+    put_u8(&cursor, ppu->oam_dma_page);
+    put_u64(&cursor, ppu->sprite_zero_hit_dot);
+    put_bytes(&cursor, ppu->oam, PPU_OAM_SIZE);
+    put_bytes(&cursor, ppu->palette, PPU_PALETTE_SIZE);
+    put_bytes(&cursor, ppu->nametables, PPU_NAMETABLES_SIZE);
+
+    const size_t written = cursor.pos;
+
+    cursor.pos = 0;
+    put_bytes(&cursor, SAVE_STATE_MAGIC, 4);
+    put_u16(&cursor, SAVE_STATE_VERSION);
+    put_u16(&cursor, SECTION_COUNT);
+    put_u32(&cursor, written);
+
+    return written;
+}
+
+static bool valid_section(const Nes* nes, Section section, const u8* payload, u32 size) {
+    if (section == SECTION_MAPPER) {
+        return size == mapper_state_size(nes->mapper);
+    }
+
+    if (section == SECTION_SCHEDULER) {
+        if (size < 1 || payload[0] > EVENT_TYPE_COUNT || size != 1 + payload[0] * (u32) SCHEDULER_ENTRY_SIZE) {
+            return false;
+        }
+
+        u32 seen = 0;
+
+        for (u8 i = 0; i < payload[0]; i++) {
+            const u8 type = payload[1 + i * SCHEDULER_ENTRY_SIZE];
+
+            if (type >= EVENT_TYPE_COUNT || (seen & (1u << type))) {
+                return false;
+            }
+
+            seen |= 1u << type;
+        }
+
+        return true;
+    }
+
+    return size == SECTIONS[section].size;
+}
+
+static bool same_cartridge(const Nes* nes, const u8* payload) {
+    return payload[0] == nes->nes_header->mapper
+        && payload[1] == nes->nes_header->prg_rom_count
+        && payload[2] == nes->nes_header->chr_rom_count;
+}
+
+// Finds the payload of every known section, NULL for the ones that are not there
+static SaveStateStatus find_sections(const Nes* nes, const u8* state, size_t size, const u8** payloads) {
+    if (size < SAVE_STATE_HEADER_SIZE) {
+        return SAVE_STATE_CORRUPT;
+    }
+
+    if (memcmp(state, SAVE_STATE_MAGIC, 4) != 0) {
+        return SAVE_STATE_BAD_MAGIC;
+    }
+
+    StateReader reader = {.data = state, .pos = 4};
+    const u16 version = get_u16(&reader);
+    const u16 section_count = get_u16(&reader);
+    const u32 total_size = get_u32(&reader);
+
+    if (version == 0 || version > SAVE_STATE_VERSION) {
+        return SAVE_STATE_UNSUPPORTED_VERSION;
+    }
+
+    if (total_size > size || total_size < SAVE_STATE_HEADER_SIZE) {
+        return SAVE_STATE_CORRUPT;
+    }
+
+    memset(payloads, 0, SECTION_COUNT * sizeof(const u8*));
+
+    for (u16 i = 0; i < section_count; i++) {
+        if (total_size - reader.pos < SECTION_HEADER_SIZE) {
+            return SAVE_STATE_CORRUPT;
+        }
+
+        const u32 tag = get_u32(&reader);
+        const u32 section_size = get_u32(&reader);
+
+        if (total_size - reader.pos < section_size) {
+            return SAVE_STATE_CORRUPT;
+        }
+
+        const u8* payload = &state[reader.pos];
+        reader.pos += section_size;
+
+        for (Section section = 0; section < SECTION_COUNT; section++) {
+            if (SECTIONS[section].tag != tag) {
+                continue;
+            }
+
+            if (payloads[section] || !valid_section(nes, section, payload, section_size)) {
+                return SAVE_STATE_CORRUPT;
+            }
+
+            payloads[section] = payload;
+        }
+    }
+
+    for (Section section = 0; section < SECTION_COUNT; section++) {
+        if (!payloads[section] && SECTIONS[section].since_version <= version) {
+            return SAVE_STATE_CORRUPT;
+        }
+    }
+
+    return same_cartridge(nes, payloads[SECTION_NES]) ? SAVE_STATE_OK : SAVE_STATE_WRONG_CARTRIDGE;
+}
+
+SaveStateStatus load_nes_state(Nes* nes, const u8* state, size_t size) {
+    const u8* payloads[SECTION_COUNT];
+    const SaveStateStatus status = find_sections(nes, state, size, payloads);
+
+    if (status != SAVE_STATE_OK) {
+        return status;
+    }
+
+    Cpu* cpu = nes->cpu;
+    Ppu* ppu = nes->ppu;
+    Apu* apu = nes->apu;
+    // find_sections checked the header
+    StateReader reader = {.data = state, .pos = 4};
+    const u16 version = get_u16(&reader);
+
+    reader = (StateReader) {.data = payloads[SECTION_NES], .pos = 4};
+
+    nes->frames = get_u64(&reader);
+
+    reader = (StateReader) {.data = payloads[SECTION_CPU], .pos = 0};
+    cpu->r_a = get_u8(&reader);
+    cpu->r_x = get_u8(&reader);
+    cpu->r_y = get_u8(&reader);
+    cpu->r_sp = get_u8(&reader);
+    cpu->r_sr = get_u8(&reader);
+    cpu->irq_lines = get_u8(&reader);
+    cpu->r_pc = get_u16(&reader);
+    cpu->cycles = get_u64(&reader);
+    cpu->instructions_performed = get_u64(&reader);
+
+    memcpy(cpu->mem, payloads[SECTION_WORK_RAM], WORK_RAM_SIZE);
+    memcpy(&cpu->mem[PRG_RAM_ADDR], payloads[SECTION_PRG_RAM], PRG_RAM_SIZE);
+
+    reader = (StateReader) {.data = payloads[SECTION_PPU], .pos = 0};
+    get_bytes(&reader, ppu->registers, sizeof(ppu->registers));
+    ppu->status = get_u8(&reader);
+    ppu->dots = get_u64(&reader);
+    ppu->frames = ppu->dots / PPU_DOTS_PER_FRAME;
+    ppu->component.cycles = get_u64(&reader);
+
+    reader = (StateReader) {.data = payloads[SECTION_APU], .pos = 0};
+    get_bytes(&reader, apu->registers, sizeof(apu->registers));
+    const u8 flags = get_u8(&reader);
+    apu->five_step_mode = flags & APU_FIVE_STEP_MODE;
+    apu->frame_irq_inhibit = flags & APU_FRAME_IRQ_INHIBIT;
+    apu->frame_irq = flags & APU_FRAME_IRQ;
+    apu->dmc_irq_enable = flags & APU_DMC_IRQ_ENABLE;
+    apu->dmc_loop = flags & APU_DMC_LOOP;
+    apu->dmc_irq = flags & APU_DMC_IRQ;
+    apu->dmc_period = get_u16(&reader);
+    apu->dmc_address = get_u16(&reader);
+    apu->dmc_bytes_remaining = get_u16(&reader);
+    apu->dmc_sample_buffer = get_u8(&reader);
+    apu->component.cycles = get_u64(&reader);
+
+    reader = (StateReader) {.data = payloads[SECTION_CONTROLLERS], .pos = 0};
+    for (int port = 0; port < 2; port++) {
+        nes->controllers[port].buttons = get_u8(&reader);
+        nes->controllers[port].shift = get_u8(&reader);
+        nes->controllers[port].strobe = get_u8(&reader);
+    }
+
+    // Version 1 states only exist for NROM boards, which have nothing to restore
+    if (payloads[SECTION_MAPPER]) {
+        load_mapper_state(nes->mapper, payloads[SECTION_MAPPER], version);
+    }
+
+    // States from before the PPU rendered leave its memory at power-on
+    if (payloads[SECTION_PPU_MEMORY]) {
+        reader = (StateReader) {.data = payloads[SECTION_PPU_MEMORY], .pos = 0};
+        ppu->v = get_u16(&reader);
+        ppu->t = get_u16(&reader);
+        ppu->fine_x = get_u8(&reader);
+        ppu->write_toggle = get_u8(&reader);
+        ppu->read_buffer = get_u8(&reader);
+        ppu->oam_addr = get_u8(&reader);
+        ppu->oam_dma_page = get_u8(&reader);
+        ppu->sprite_zero_hit_dot = get_u64(&reader);
+        get_bytes(&reader, ppu->oam, PPU_OAM_SIZE);
+        get_bytes(&reader, ppu->palette, PPU_PALETTE_SIZE);
+        get_bytes(&reader, ppu->nametables, PPU_NAMETABLES_SIZE);
+    } else {
+        reset_ppu_memory(ppu);
+    }
+
+    // Events are rescheduled last, the CPU clock they are relative to is restored by now
+    for (EventType type = 0; type < EVENT_TYPE_COUNT; type++) {
+        cancel_event(&nes->scheduler, type);
+    }
+
+    reader = (StateReader) {.data = payloads[SECTION_SCHEDULER], .pos = 0};
+    const u8 events = get_u8(&reader);
+    for (u8 i = 0; i < events; i++) {
+        const EventType type = get_u8(&reader);
+        const u64 timestamp = get_u64(&reader);
+
+        if (timestamp != EVENT_NEVER) {
+            schedule_event(&nes->scheduler, type, timestamp);
+        }
+    }
+
+    return SAVE_STATE_OK;
+}
+
+const char* save_state_status_name(SaveStateStatus status) {
+    switch (status) {
+        case SAVE_STATE_OK:
+            return "ok";
+        case SAVE_STATE_BAD_MAGIC:
+            return "not a save state";
+        case SAVE_STATE_UNSUPPORTED_VERSION:
+            return "unsupported version";
+        case SAVE_STATE_CORRUPT:
+            return "corrupt";
+        case SAVE_STATE_WRONG_CARTRIDGE:
+            return "saved from a different cartridge";
+    }
+
+    return "unknown";
+}
@@ -0,0 +1,45 @@
+#ifndef SAVE_STATE_H
+#define SAVE_STATE_H
+
+#include <stdlib.h>
+#include "types.h"
+#include "nes.h"
+
+// Bumped whenever a section changes layout or meaning, or a new section becomes mandatory.
+// States of older versions keep loading, states of newer builds are rejected.
+//   4: the MMC3 PRG-RAM protection register takes effect
+#define SAVE_STATE_VERSION 4
+#define SAVE_STATE_MAGIC "PBST"
+
+typedef enum SaveStateStatus {
+    SAVE_STATE_OK,
+    SAVE_STATE_BAD_MAGIC,
+    SAVE_STATE_UNSUPPORTED_VERSION,
+    // Truncated, a section has an unexpected size or a mandatory section is missing
+    SAVE_STATE_CORRUPT,
+    // Saved from a different cartridge layout (mapper or ROM sizes)
+    SAVE_STATE_WRONG_CARTRIDGE
+} SaveStateStatus;
+
+// A save state is a little-endian binary image:
+//
+//   header   "PBST", u16 version, u16 section count, u32 total size
+//   sections u32 tag, u32 size, size bytes of payload
+//
+// Sections are found by tag, so newer versions can append sections older loaders skip.
+// Memory is stored as is (work RAM, PRG-RAM, CHR-RAM, nametables) and the chip registers as
+// fixed-layout blocks, which keeps saving and loading down to a handful of copies.
+// Host-side state (pacing, bus and sync statistics, the framebuffer of the frame in
+// progress) is not saved.
+
+// Size of a state of the current version, every state of a cartridge has exactly this size
+size_t nes_state_size(const Nes* nes);
+// Returns the number of bytes written, 0 if size is smaller than nes_state_size
+size_t save_nes_state(const Nes* nes, u8* state, size_t size);
+// The state is validated completely before anything is applied, on failure the Nes is
+// left untouched. Must not be called while the CPU is running.
+SaveStateStatus load_nes_state(Nes* nes, const u8* state, size_t size);
+
+const char* save_state_status_name(SaveStateStatus status);
+
+#endif
@@ -0,0 +1,119 @@
+#include <string.h>
+
+#include "scheduler.h"
+
+static inline bool event_before(const Event* a, const Event* b) {
+    return a->timestamp < b->timestamp || (a->timestamp == b->timestamp && a->type < b->type);
+}
+
+static void swap_events(Scheduler* scheduler, size_t i, size_t j) {
+    const Event tmp = scheduler->heap[i];
+    scheduler->heap[i] = scheduler->heap[j];
+    scheduler->heap[j] = tmp;
+
+    scheduler->heap_index[scheduler->heap[i].type] = i;
+    scheduler->heap_index[scheduler->heap[j].type] = j;
+}
+
+static void sift_up(Scheduler* scheduler, size_t i) {
+    while (i > 0) {
+        const size_t parent = (i - 1) / 2;
+
+        if (!event_before(&scheduler->heap[i], &scheduler->heap[parent])) {
+            break;
+        }
+
+        swap_events(scheduler, i, parent);
+        i = parent;
+    }
+}
+
+static void sift_down(Scheduler* scheduler, size_t i) {
+    for (;;) {
+        const size_t left = 2 * i + 1;
+        const size_t right = left + 1;
+        size_t smallest = i;
+
+        if (left < scheduler->size && event_before(&scheduler->heap[left], &scheduler->heap[smallest])) {
+            smallest = left;
+        }
+
+        if (right < scheduler->size && event_before(&scheduler->heap[right], &scheduler->heap[smallest])) {
+            smallest = right;
+        }
+
+        if (smallest == i) {
+            break;
+        }
+
+        swap_events(scheduler, i, smallest);
+        i = smallest;
+    }
+}
+
+static void remove_at(Scheduler* scheduler, size_t i) {
+    const EventType type = scheduler->heap[i].type;
+    const size_t last = --scheduler->size;
+
+    if (i != last) {
+        swap_events(scheduler, i, last);
+        sift_up(scheduler, i);
+        sift_down(scheduler, i);
+    }
+
+    scheduler->heap_index[type] = -1;
+}
+
+void init_scheduler(Scheduler* scheduler) {
+    memset(scheduler, 0, sizeof(Scheduler));
+
+    for (int type = 0; type < EVENT_TYPE_COUNT; type++) {
+        scheduler->heap_index[type] = -1;
+    }
+}
+
+void set_event_handler(Scheduler* scheduler, EventType type, event_handler handler, void* ctx) {
+    scheduler->handlers[type] = handler;
+    scheduler->handler_ctx[type] = ctx;
+}
+
+void schedule_event(Scheduler* scheduler, EventType type, u64 timestamp) {
+    const u64 deadline = next_event_timestamp(scheduler);
+    const int index = scheduler->heap_index[type];
+
+    if (index >= 0) {
+        scheduler->heap[index].timestamp = timestamp;
+        sift_up(scheduler, index);
+        sift_down(scheduler, scheduler->heap_index[type]);
+    } else {
+        const size_t i = scheduler->size++;
+        scheduler->heap[i] = (Event) {.timestamp = timestamp, .type = type};
+        scheduler->heap_index[type] = i;
+        sift_up(scheduler, i);
+    }
+
+    if (timestamp < deadline && scheduler->deadline_changed) {
+        scheduler->deadline_changed(scheduler->deadline_ctx, timestamp);
+    }
+}
+
+void cancel_event(Scheduler* scheduler, EventType type) {
+    const int index = scheduler->heap_index[type];
+
+    if (index >= 0) {
+        remove_at(scheduler, index);
+    }
+}
+
+void dispatch_events(Scheduler* scheduler, u64 now) {
+    while (scheduler->size > 0 && scheduler->heap[0].timestamp <= now) {
+        const Event event = scheduler->heap[0];
+        remove_at(scheduler, 0);
+
+        scheduler->events_dispatched++;
+
+        if (scheduler->handlers[event.type]) {
+            scheduler->handlers[event.type](scheduler->handler_ctx[event.type], event.timestamp);
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include "types.h"
+
+// Timestamps are on the master clock, which counts CPU cycles (3 PPU dots each).
+#define EVENT_NEVER UINT64_MAX
+
+// Every event type is scheduled at most once, rescheduling moves the pending event.
+// Events with the same timestamp fire in the order of this enum.
+typedef enum EventType {
+    EVENT_NMI,
+    EVENT_FRAME_IRQ,
+    EVENT_DMC_FETCH,
+    EVENT_MAPPER_IRQ,
+    EVENT_END_OF_FRAME,
+    // Save states store events by value, new types go last
+    EVENT_MAPPER_SCANLINE,
+    EVENT_OAM_DMA,
+    EVENT_TYPE_COUNT
+} EventType;
+
+// Called with the timestamp the event was scheduled for, which can be a few cycles
+// behind the master clock as the CPU only stops between instructions.
+typedef void (*event_handler)(void* ctx, u64 timestamp);
+
+typedef struct Event {
+    u64 timestamp;
+    EventType type;
+} Event;
+
+// Min-heap of pending events ordered by timestamp. heap_index maps an event type to its
+// position in the heap (-1 when not scheduled) so rescheduling is O(log n).
+typedef struct Scheduler {
+    Event heap[EVENT_TYPE_COUNT];
+    int heap_index[EVENT_TYPE_COUNT];
+    size_t size;
+    event_handler handlers[EVENT_TYPE_COUNT];
+    void* handler_ctx[EVENT_TYPE_COUNT];
+    // Called when an event is scheduled before the earliest pending deadline, so whoever
+    // runs the CPU can stop it in time.
+    void (*deadline_changed)(void* ctx, u64 deadline);
+    void* deadline_ctx;
+    u64 events_dispatched;
+} Scheduler;
+
+// A chip that is only brought up to date when somebody needs its state, either because
+// the CPU touches one of its registers or because one of its events is due.
+typedef struct Component {
+    // Master clock the component has been caught up to
+    u64 cycles;
+    void (*catch_up)(void* ctx, u64 from, u64 to);
+    void* ctx;
+    u64 syncs;
+} Component;
+
+void init_scheduler(Scheduler* scheduler);
+void set_event_handler(Scheduler* scheduler, EventType type, event_handler handler, void* ctx);
+void schedule_event(Scheduler* scheduler, EventType type, u64 timestamp);
+void cancel_event(Scheduler* scheduler, EventType type);
+// Pops and handles every event due at or before now, in timestamp order
+void dispatch_events(Scheduler* scheduler, u64 now);
+
+static inline bool is_event_scheduled(const Scheduler* scheduler, EventType type) {
+    return scheduler->heap_index[type] >= 0;
+}
+
+static inline u64 next_event_timestamp(const Scheduler* scheduler) {
+    return scheduler->size > 0 ? scheduler->heap[0].timestamp : EVENT_NEVER;
+}
+
+static inline void sync_component(Component* component, u64 now) {
+    if (now > component->cycles) {
+        component->catch_up(component->ctx, component->cycles, now);
+        component->cycles = now;
+        component->syncs++;
+    }
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef WIN32
+#define _POSIX_C_SOURCE 200809L
+#include <unistd.h>
+#endif
+
+#include "thread.h"
+
+#ifndef WIN32
+static void* thread_entry(void* ctx) {
+    Thread* thread = ctx;
+    thread->main(thread->arg);
+    return NULL;
+}
+#else
+static DWORD WINAPI thread_entry(LPVOID ctx) {
+    Thread* thread = ctx;
+    thread->main(thread->arg);
+    return 0;
+}
+#endif
+
+bool start_thread(Thread* thread, thread_main main, void* arg) {
+    thread->main = main;
+    thread->arg = arg;
+
+#ifndef WIN32
+    return pthread_create(&thread->handle, NULL, thread_entry, thread) == 0;
+#else
+    thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+    return thread->handle != NULL;
+#endif
+}
+
+void join_thread(Thread* thread) {
+#ifndef WIN32
+    pthread_join(thread->handle, NULL);
+#else
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#endif
+}
+
+void init_mutex(Mutex* mutex) {
+#ifndef WIN32
+    pthread_mutex_init(&mutex->handle, NULL);
+#else
+    InitializeCriticalSection(&mutex->handle);
+#endif
+}
+
+void destroy_mutex(Mutex* mutex) {
+#ifndef WIN32
+    pthread_mutex_destroy(&mutex->handle);
+#else
+    DeleteCriticalSection(&mutex->handle);
+#endif
+}
+
+void lock_mutex(Mutex* mutex) {
+#ifndef WIN32
+    pthread_mutex_lock(&mutex->handle);
+#else
+    EnterCriticalSection(&mutex->handle);
+#endif
+}
+
+void unlock_mutex(Mutex* mutex) {
+#ifndef WIN32
+    pthread_mutex_unlock(&mutex->handle);
+#else
+    LeaveCriticalSection(&mutex->handle);
+#endif
+}
+
+void init_cond_var(CondVar* cond_var) {
+#ifndef WIN32
+    pthread_cond_init(&cond_var->handle, NULL);
+#else
+    InitializeConditionVariable(&cond_var->handle);
+#endif
+}
+
+void destroy_cond_var(CondVar __attribute__((__unused__)) *cond_var) {
+#ifndef WIN32
+    pthread_cond_destroy(&cond_var->handle);
+#endif
+}
+
+void wait_cond_var(CondVar* cond_var, Mutex* mutex) {
+#ifndef WIN32
+    pthread_cond_wait(&cond_var->handle, &mutex->handle);
+#else
+    SleepConditionVariableCS(&cond_var->handle, &mutex->handle, INFINITE);
+#endif
+}
+
+void signal_cond_var(CondVar* cond_var) {
+#ifndef WIN32
+    pthread_cond_signal(&cond_var->handle);
+#else
+    WakeConditionVariable(&cond_var->handle);
+#endif
+}
+
+void broadcast_cond_var(CondVar* cond_var) {
+#ifndef WIN32
+    pthread_cond_broadcast(&cond_var->handle);
+#else
+    WakeAllConditionVariable(&cond_var->handle);
+#endif
+}
+
+#ifdef WIN32
+typedef struct OnceCall {
+    void (*init)(void);
+} OnceCall;
+
+static BOOL CALLBACK once_entry(PINIT_ONCE __attribute__((__unused__)) once, PVOID ctx, PVOID __attribute__((__unused__)) *result) {
+    ((OnceCall*) ctx)->init();
+    return TRUE;
+}
+#endif
+
+void run_once(Once* once, void (*init)(void)) {
+#ifndef WIN32
+    pthread_once(&once->handle, init);
+#else
+    OnceCall call = {init};
+    InitOnceExecuteOnce(&once->handle, once_entry, &call, NULL);
+#endif
+}
+
+u32 get_cpu_count(void) {
+#ifndef WIN32
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const long count = info.dwNumberOfProcessors;
+#endif
+    return count > 0 ? (u32) count : 1;
+}
@@ -0,0 +1,78 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stdbool.h>
+#include "types.h"
+
+#ifndef WIN32
+#include <pthread.h>
+#else
+#include <windows.h>
+#endif
+
+typedef void (*thread_main)(void* arg);
+
+// Minimal threading layer over pthreads and the Win32 API
+typedef struct Thread {
+#ifndef WIN32
+    pthread_t handle;
+#else
+    HANDLE handle;
+#endif
+    thread_main main;
+    void* arg;
+} Thread;
+
+typedef struct Mutex {
+#ifndef WIN32
+    pthread_mutex_t handle;
+#else
+    CRITICAL_SECTION handle;
+#endif
+} Mutex;
+
+typedef struct CondVar {
+#ifndef WIN32
+    pthread_cond_t handle;
+#else
+    CONDITION_VARIABLE handle;
+#endif
+} CondVar;
+
+typedef struct Once {
+#ifndef WIN32
+    pthread_once_t handle;
+#else
+    INIT_ONCE handle;
+#endif
+} Once;
+
+#ifndef WIN32
+#define ONCE_INIT {PTHREAD_ONCE_INIT}
+#else
+#define ONCE_INIT {INIT_ONCE_STATIC_INIT}
+#endif
+
+// The Thread has to stay valid until join_thread returns
+bool start_thread(Thread* thread, thread_main main, void* arg);
+void join_thread(Thread* thread);
+
+void init_mutex(Mutex* mutex);
+void destroy_mutex(Mutex* mutex);
+void lock_mutex(Mutex* mutex);
+void unlock_mutex(Mutex* mutex);
+
+void init_cond_var(CondVar* cond_var);
+void destroy_cond_var(CondVar* cond_var);
+// Releases the mutex while waiting, wakeups can be spurious so callers wait in a loop
+void wait_cond_var(CondVar* cond_var, Mutex* mutex);
+void signal_cond_var(CondVar* cond_var);
+void broadcast_cond_var(CondVar* cond_var);
+
+// Runs init exactly once per Once, callers racing for it wait until it has returned
+void run_once(Once* once, void (*init)(void));
+
+// Number of hardware threads available to the process, at least 1
+u32 get_cpu_count(void);
+
+#endif
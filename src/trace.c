@@ -0,0 +1,202 @@
+#include <string.h>
+
+#include "trace.h"
+#include "utils.h"
+
+#define TRACE_HEADER_SIZE 24
+
+// 0 when val is above the largest power of two a size_t holds
+static size_t round_up_pow2(size_t val) {
+    if (val > SIZE_MAX / 2 + 1) {
+        return 0;
+    }
+
+    size_t pow2 = 1;
+    while (pow2 < val) {
+        pow2 <<= 1;
+    }
+    return pow2;
+}
+
+TraceBuffer* build_trace_buffer(size_t capacity) {
+    if (capacity > TRACE_MAX_RECORDS) {
+        return NULL;
+    }
+
+    TraceBuffer* trace = malloc(sizeof(TraceBuffer));
+
+    if (!trace) {
+        return NULL;
+    }
+
+    trace->capacity = round_up_pow2(capacity > 0 ? capacity : 1);
+    trace->records = malloc(sizeof(TraceRecord) * trace->capacity);
+
+    if (!trace->records) {
+        free(trace);
+        return NULL;
+    }
+
+    atomic_init(&trace->head, 0);
+    return trace;
+}
+
+void free_trace_buffer(TraceBuffer* trace) {
+    free(trace->records);
+    free(trace);
+}
+
+void trace_instruction(TraceBuffer* trace, const Cpu* cpu) {
+    const u64 head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    TraceRecord* record = &trace->records[head & (trace->capacity - 1)];
+
+    // Operand bytes are fetched without going through read_u8 so tracing does not show up
+    // in the bus statistics.
+    const u8 opcode = bus_read(&cpu->bus, cpu->r_pc);
+    const u8 length = get_instruction_length(opcode);
+
+    record->cycles = cpu->cycles;
+    record->pc = cpu->r_pc;
+    record->opcode = opcode;
+    record->operands[0] = length > 1 ? bus_read(&cpu->bus, cpu->r_pc + 1) : 0;
+    record->operands[1] = length > 2 ? bus_read(&cpu->bus, cpu->r_pc + 2) : 0;
+    record->r_a = cpu->r_a;
+    record->r_x = cpu->r_x;
+    record->r_y = cpu->r_y;
+    record->r_sp = cpu->r_sp;
+    record->r_sr = cpu->r_sr;
+
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+size_t trace_snapshot(TraceBuffer* trace, TraceRecord* out, size_t max) {
+    const u64 head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    u64 count = head < trace->capacity ? head : trace->capacity;
+    count = count < max ? count : max;
+
+    const u64 first = head - count;
+    for (u64 i = 0; i < count; i++) {
+        out[i] = trace->records[(first + i) & (trace->capacity - 1)];
+    }
+
+    // Anything the producer reached while we were copying may be torn, drop it.
+    const u64 head_after = atomic_load_explicit(&trace->head, memory_order_acquire);
+    const u64 overwritten = head_after - head;
+
+    if (overwritten >= count) {
+        return 0;
+    }
+
+    memmove(out, &out[overwritten], sizeof(TraceRecord) * (count - overwritten));
+    return count - overwritten;
+}
+
+static void serialize_record(const TraceRecord* record, u8* buf) {
+    for (int i = 0; i < 8; i++) {
+        buf[i] = (record->cycles >> (i * 8)) & 0xFF;
+    }
+    write_little_endian_u16(record->pc, &buf[8], &buf[9]);
+    buf[10] = record->opcode;
+    buf[11] = record->operands[0];
+    buf[12] = record->operands[1];
+    buf[13] = record->r_a;
+    buf[14] = record->r_x;
+    buf[15] = record->r_y;
+    buf[16] = record->r_sp;
+    buf[17] = record->r_sr;
+}
+
+static void deserialize_record(const u8* buf, TraceRecord* record) {
+    record->cycles = 0;
+    for (int i = 0; i < 8; i++) {
+        record->cycles |= ((u64) buf[i]) << (i * 8);
+    }
+    record->pc = read_little_endian_u16(buf[8], buf[9]);
+    record->opcode = buf[10];
+    record->operands[0] = buf[11];
+    record->operands[1] = buf[12];
+    record->r_a = buf[13];
+    record->r_x = buf[14];
+    record->r_y = buf[15];
+    record->r_sp = buf[16];
+    record->r_sr = buf[17];
+}
+
+bool dump_trace(TraceBuffer* trace, const char* path) {
+    TraceRecord* records = malloc(sizeof(TraceRecord) * trace->capacity);
+
+    if (!records) {
+        fprintf(stderr, "Unable to allocate memory for the trace dump.\n");
+        return false;
+    }
+
+    const size_t count = trace_snapshot(trace, records, trace->capacity);
+    FILE* file = fopen(path, "wb");
+
+    if (!file) {
+        fprintf(stderr, "Unable to open the trace file. Given Path: %s\n", path);
+        free(records);
+        return false;
+    }
+
+    // Header: magic, version, record size, reserved, record count. All little-endian.
+    u8 header[TRACE_HEADER_SIZE] = {0};
+    memcpy(header, TRACE_FILE_MAGIC, 8);
+    write_little_endian_u16(TRACE_FILE_VERSION, &header[8], &header[9]);
+    write_little_endian_u16(TRACE_RECORD_SIZE, &header[10], &header[11]);
+    for (int i = 0; i < 8; i++) {
+        header[16 + i] = (((u64) count) >> (i * 8)) & 0xFF;
+    }
+
+    bool valid = fwrite(header, 1, TRACE_HEADER_SIZE, file) == TRACE_HEADER_SIZE;
+
+    for (size_t i = 0; i < count && valid; i++) {
+        u8 buf[TRACE_RECORD_SIZE];
+        serialize_record(&records[i], buf);
+        valid = fwrite(buf, 1, TRACE_RECORD_SIZE, file) == TRACE_RECORD_SIZE;
+    }
+
+    if (!valid) {
+        fprintf(stderr, "Unable to write the trace file. Given Path: %s\n", path);
+    }
+
+    fclose(file);
+    free(records);
+
+    return valid;
+}
+
+bool read_trace_header(FILE* file, u64* record_count) {
+    u8 header[TRACE_HEADER_SIZE];
+
+    if (fread(header, 1, TRACE_HEADER_SIZE, file) != TRACE_HEADER_SIZE || memcmp(header, TRACE_FILE_MAGIC, 8) != 0) {
+        fprintf(stderr, "Invalid trace file header.\n");
+        return false;
+    }
+
+    const u16 version = read_little_endian_u16(header[8], header[9]);
+    const u16 record_size = read_little_endian_u16(header[10], header[11]);
+
+    if (version != TRACE_FILE_VERSION || record_size != TRACE_RECORD_SIZE) {
+        fprintf(stderr, "Unsupported trace file. Version: %d, Record size: %d\n", version, record_size);
+        return false;
+    }
+
+    *record_count = 0;
+    for (int i = 0; i < 8; i++) {
+        *record_count |= ((u64) header[16 + i]) << (i * 8);
+    }
+
+    return true;
+}
+
+bool read_trace_record(FILE* file, TraceRecord* record) {
+    u8 buf[TRACE_RECORD_SIZE];
+
+    if (fread(buf, 1, TRACE_RECORD_SIZE, file) != TRACE_RECORD_SIZE) {
+        return false;
+    }
+
+    deserialize_record(buf, record);
+    return true;
+}
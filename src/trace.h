@@ -0,0 +1,59 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "types.h"
+#include "cpu.h"
+
+#define TRACE_FILE_MAGIC "PBXTRACE"
+#define TRACE_FILE_VERSION 1
+// Size of a serialized record in a trace dump
+#define TRACE_RECORD_SIZE 18
+// Most records a buffer keeps, 256Mi or a few GiB of memory
+#define TRACE_MAX_RECORDS ((size_t) 1 << 28)
+
+// CPU state right before an instruction executes
+typedef struct TraceRecord {
+    u64 cycles;
+    u16 pc;
+    u8 opcode;
+    u8 operands[2];
+    u8 r_a;
+    u8 r_x;
+    u8 r_y;
+    u8 r_sp;
+    u8 r_sr;
+} TraceRecord;
+
+// Single producer ring buffer that keeps the most recent records. The emulation thread
+// only does a plain store and a release increment per instruction, readers can take a
+// snapshot at any time without stopping it.
+typedef struct TraceBuffer {
+    TraceRecord* records;
+    // Always a power of two
+    size_t capacity;
+    _Atomic u64 head;
+} TraceBuffer;
+
+// capacity is rounded up to a power of two. Returns NULL when it is above
+// TRACE_MAX_RECORDS or the memory is not there.
+TraceBuffer* build_trace_buffer(size_t capacity);
+void free_trace_buffer(TraceBuffer* trace);
+
+void trace_instruction(TraceBuffer* trace, const Cpu* cpu);
+
+// Copies up to max of the most recent records, oldest first, into out. Records that were
+// overwritten by the producer while copying are dropped. Returns the number of records copied.
+size_t trace_snapshot(TraceBuffer* trace, TraceRecord* out, size_t max);
+
+bool dump_trace(TraceBuffer* trace, const char* path);
+
+// Reading back a dump, used by the offline decoder
+bool read_trace_header(FILE* file, u64* record_count);
+bool read_trace_record(FILE* file, TraceRecord* record);
+
+#endif
@@ -1,3 +1,14 @@
+#ifndef WIN32
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#else
+#include <windows.h>
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+
 #include "utils.h"
 
 u16 read_little_endian_u16(u8 lsb, u8 msb) {
@@ -12,3 +23,49 @@ void write_little_endian_u16(const u16 val, u8* lsb, u8* msb) {
     *msb = (val >> 8) & 0xFF;
     *lsb = val & 0x00FF;
 }
+
+u64 get_time_ns(void) {
+#ifndef WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u64) ts.tv_sec) * 1000000000ULL + (u64) ts.tv_nsec;
+#else
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (u64) (counter.QuadPart / freq.QuadPart) * 1000000000ULL
+        + (u64) (counter.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#endif
+}
+
+void sleep_ns(u64 ns) {
+#ifndef WIN32
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    nanosleep(&ts, NULL);
+#else
+    Sleep((DWORD) (ns / 1000000ULL));
+#endif
+}
+
+bool parse_number(const char* str, u64 max, u64* out) {
+    char* end = NULL;
+    const bool dollar_hex = str[0] == '$';
+    const char* digits = dollar_hex ? str + 1 : str;
+
+    // strtoull would skip whitespace and take a sign, "-1" wrapping around to the maximum
+    if (!(dollar_hex ? isxdigit((unsigned char) digits[0]) : isdigit((unsigned char) digits[0]))) {
+        return false;
+    }
+
+    errno = 0;
+    const unsigned long long val = strtoull(digits, &end, dollar_hex ? 16 : 0);
+
+    if (end == digits || *end != '\0' || errno == ERANGE || val > max) {
+        return false;
+    }
+
+    *out = val;
+    return true;
+}
@@ -1,5 +1,6 @@
 #ifndef UTILS_H
 #define UTILS_H
+#include <stdbool.h>
 #include "types.h"
 
 u16 read_little_endian_u16(u8 lsb, u8 msb);
@@ -7,4 +8,12 @@ u32 read_little_endian_u32(u8 msb4, u8 msb3, u8 msb2, u8 msb);
 
 void write_little_endian_u16(const u16 val, u8* lsb, u8* msb);
 
+// Monotonic wall clock in nanoseconds, only meaningful as a difference between two calls.
+u64 get_time_ns(void);
+// Sleeps at least ns nanoseconds, the OS may oversleep by its scheduling granularity.
+void sleep_ns(u64 ns);
+// Accepts decimal, 0x prefixed or $ prefixed hexadecimal numbers up to max, nothing else:
+// no sign, no whitespace and at least one digit
+bool parse_number(const char* str, u64 max, u64* out);
+
 #endif
@@ -0,0 +1,272 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "video.h"
+
+// The byte shuffles the lookups need (SSSE3, AVX2) are not part of the x86-64 baseline, the
+// instruction set is picked at run time. The kernels are compiled for theirs whatever the
+// rest of the build targets.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define VIDEO_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define VIDEO_TARGET(isa)
+#else
+#include <cpuid.h>
+#define VIDEO_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+#define ARGB(rgb) (0xFF000000u | (rgb))
+
+const u32 nes_palette_argb[NES_COLOR_COUNT] = {
+    ARGB(0x666666), ARGB(0x002A88), ARGB(0x1412A7), ARGB(0x3B00A4), ARGB(0x5C007E), ARGB(0x6E0040), ARGB(0x6C0600), ARGB(0x561D00),
+    ARGB(0x333500), ARGB(0x0B4800), ARGB(0x005200), ARGB(0x004F08), ARGB(0x00404D), ARGB(0x000000), ARGB(0x000000), ARGB(0x000000),
+    ARGB(0xADADAD), ARGB(0x155FD9), ARGB(0x4240FF), ARGB(0x7527FE), ARGB(0xA01ACC), ARGB(0xB71E7B), ARGB(0xB53120), ARGB(0x994E00),
+    ARGB(0x6B6D00), ARGB(0x388700), ARGB(0x0C9300), ARGB(0x008F32), ARGB(0x007C8D), ARGB(0x000000), ARGB(0x000000), ARGB(0x000000),
+    ARGB(0xFFFEFF), ARGB(0x64B0FF), ARGB(0x9290FF), ARGB(0xC676FF), ARGB(0xF36AFF), ARGB(0xFE6ECC), ARGB(0xFE8170), ARGB(0xEA9E22),
+    ARGB(0xBCBE00), ARGB(0x88D800), ARGB(0x5CE430), ARGB(0x45E082), ARGB(0x48CDDE), ARGB(0x4F4F4F), ARGB(0x000000), ARGB(0x000000),
+    ARGB(0xFFFEFF), ARGB(0xC0DFFF), ARGB(0xD3D2FF), ARGB(0xE8C8FF), ARGB(0xFBC2FF), ARGB(0xFEC4EA), ARGB(0xFECCC5), ARGB(0xF7D8A5),
+    ARGB(0xE4E594), ARGB(0xCFEF96), ARGB(0xBDF4AB), ARGB(0xB3F3CC), ARGB(0xB5EBF2), ARGB(0xB8B8B8), ARGB(0x000000), ARGB(0x000000)
+};
+
+static inline void convert_pixels(u8* out, const u8* frame, int count, const u32 palette[NES_COLOR_COUNT]) {
+    for (int x = 0; x < count; x++) {
+        memcpy(&out[x * 4], &palette[frame[x] & (NES_COLOR_COUNT - 1)], sizeof(u32));
+    }
+}
+
+void convert_frame_to_argb_scalar(u8* out, size_t pitch, const u8* frame, int width, int height,
+                                  const u32 palette[NES_COLOR_COUNT]) {
+    for (int y = 0; y < height; y++) {
+        convert_pixels(&out[y * pitch], &frame[y * width], width, palette);
+    }
+}
+
+#ifdef VIDEO_X86
+typedef enum VideoIsa {
+    VIDEO_ISA_SCALAR,
+    VIDEO_ISA_SSSE3,
+    VIDEO_ISA_AVX2
+} VideoIsa;
+
+static void cpuid(u32 leaf, u32 subleaf, u32 regs[4]) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuidex(info, (int) leaf, (int) subleaf);
+    for (int i = 0; i < 4; i++) {
+        regs[i] = (u32) info[i];
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Registers the OS saves on a context switch, AVX needs the YMM state (bit 2) as well
+static u32 enabled_register_state(void) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return (u32) _xgetbv(0);
+#else
+    u32 eax, edx;
+    __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return eax;
+#endif
+}
+
+// Asked on every call, a frame is converted in far more time than cpuid takes, and the
+// library keeps no mutable globals
+static VideoIsa detect_video_isa(void) {
+    u32 regs[4];
+
+    cpuid(0, 0, regs);
+    const u32 max_leaf = regs[0];
+
+    if (max_leaf < 1) {
+        return VIDEO_ISA_SCALAR;
+    }
+
+    cpuid(1, 0, regs);
+    const bool ssse3 = regs[2] & (1u << 9);
+    const bool osxsave = regs[2] & (1u << 27);
+    const bool avx = regs[2] & (1u << 28);
+
+    if (max_leaf >= 7 && osxsave && avx && (enabled_register_state() & 0x06) == 0x06) {
+        cpuid(7, 0, regs);
+
+        if (regs[1] & (1u << 5)) {
+            return VIDEO_ISA_AVX2;
+        }
+    }
+
+    return ssse3 ? VIDEO_ISA_SSSE3 : VIDEO_ISA_SCALAR;
+}
+
+// Blue, green and red of every color as byte tables, 16 colors per quarter
+static void split_channels(const u32 palette[NES_COLOR_COUNT], u8 channels[3][NES_COLOR_COUNT]) {
+    for (int color = 0; color < NES_COLOR_COUNT; color++) {
+        for (int channel = 0; channel < 3; channel++) {
+            channels[channel][color] = palette[color] >> (8 * channel);
+        }
+    }
+}
+
+// One byte of the palette colors, looked up for 16 indices. pshufb zeroes the bytes whose
+// index has the top bit set: the XOR clears bits 4 and 5 in the indices of the quarter
+// being looked up, adding 0x70 then sets the top bit of all the others.
+VIDEO_TARGET("ssse3")
+static inline __m128i lookup_channel_ssse3(__m128i index, const __m128i table[4]) {
+    const __m128i outside = _mm_set1_epi8(0x70);
+    __m128i bytes = _mm_setzero_si128();
+
+    for (int quarter = 0; quarter < 4; quarter++) {
+        const __m128i in_quarter = _mm_xor_si128(index, _mm_set1_epi8((char) (quarter << 4)));
+        bytes = _mm_or_si128(bytes, _mm_shuffle_epi8(table[quarter], _mm_adds_epu8(in_quarter, outside)));
+    }
+
+    return bytes;
+}
+
+VIDEO_TARGET("ssse3")
+static void convert_frame_to_argb_ssse3(u8* out, size_t pitch, const u8* frame, int width, int height,
+                                        const u32 palette[NES_COLOR_COUNT]) {
+    u8 channels[3][NES_COLOR_COUNT];
+    __m128i tables[3][4];
+
+    split_channels(palette, channels);
+
+    for (int channel = 0; channel < 3; channel++) {
+        for (int quarter = 0; quarter < 4; quarter++) {
+            tables[channel][quarter] = _mm_loadu_si128((const __m128i*) &channels[channel][quarter * 16]);
+        }
+    }
+
+    // Every color is opaque
+    const __m128i alpha = _mm_set1_epi8((char) 0xFF);
+    const __m128i index_mask = _mm_set1_epi8(NES_COLOR_COUNT - 1);
+
+    for (int y = 0; y < height; y++) {
+        const u8* indices = &frame[y * width];
+        u8* row = &out[y * pitch];
+        int x = 0;
+
+        for (; x + 16 <= width; x += 16) {
+            const __m128i index = _mm_and_si128(_mm_loadu_si128((const __m128i*) &indices[x]), index_mask);
+            const __m128i blue = lookup_channel_ssse3(index, tables[0]);
+            const __m128i green = lookup_channel_ssse3(index, tables[1]);
+            const __m128i red = lookup_channel_ssse3(index, tables[2]);
+            const __m128i blue_green_low = _mm_unpacklo_epi8(blue, green);
+            const __m128i blue_green_high = _mm_unpackhi_epi8(blue, green);
+            const __m128i red_alpha_low = _mm_unpacklo_epi8(red, alpha);
+            const __m128i red_alpha_high = _mm_unpackhi_epi8(red, alpha);
+            __m128i* pixels = (__m128i*) &row[x * 4];
+
+            _mm_storeu_si128(&pixels[0], _mm_unpacklo_epi16(blue_green_low, red_alpha_low));
+            _mm_storeu_si128(&pixels[1], _mm_unpackhi_epi16(blue_green_low, red_alpha_low));
+            _mm_storeu_si128(&pixels[2], _mm_unpacklo_epi16(blue_green_high, red_alpha_high));
+            _mm_storeu_si128(&pixels[3], _mm_unpackhi_epi16(blue_green_high, red_alpha_high));
+        }
+
+        convert_pixels(&row[x * 4], &indices[x], width - x, palette);
+    }
+}
+
+// One byte of the palette colors, looked up for 32 indices: each quarter of the 64 entry
+// table is shuffled in and bits 4 and 5 of the index pick the quarter
+VIDEO_TARGET("avx2")
+static inline __m256i lookup_channel_avx2(__m256i index, __m256i bit4, __m256i bit5, const __m256i table[4]) {
+    const __m256i low = _mm256_blendv_epi8(_mm256_shuffle_epi8(table[0], index),
+                                           _mm256_shuffle_epi8(table[1], index), bit4);
+    const __m256i high = _mm256_blendv_epi8(_mm256_shuffle_epi8(table[2], index),
+                                            _mm256_shuffle_epi8(table[3], index), bit4);
+
+    return _mm256_blendv_epi8(low, high, bit5);
+}
+
+VIDEO_TARGET("avx2")
+static void convert_frame_to_argb_avx2(u8* out, size_t pitch, const u8* frame, int width, int height,
+                                       const u32 palette[NES_COLOR_COUNT]) {
+    u8 channels[3][NES_COLOR_COUNT];
+    __m256i tables[3][4];
+
+    split_channels(palette, channels);
+
+    for (int channel = 0; channel < 3; channel++) {
+        for (int quarter = 0; quarter < 4; quarter++) {
+            tables[channel][quarter] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) &channels[channel][quarter * 16]));
+        }
+    }
+
+    // Every color is opaque
+    const __m256i alpha = _mm256_set1_epi8((char) 0xFF);
+    const __m256i index_mask = _mm256_set1_epi8(NES_COLOR_COUNT - 1);
+
+    for (int y = 0; y < height; y++) {
+        const u8* indices = &frame[y * width];
+        u8* row = &out[y * pitch];
+        int x = 0;
+
+        for (; x + 32 <= width; x += 32) {
+            const __m256i index = _mm256_and_si256(_mm256_loadu_si256((const __m256i*) &indices[x]), index_mask);
+            // blendv only looks at the top bit of each byte
+            const __m256i bit4 = _mm256_slli_epi16(index, 3);
+            const __m256i bit5 = _mm256_slli_epi16(index, 2);
+            const __m256i blue = lookup_channel_avx2(index, bit4, bit5, tables[0]);
+            const __m256i green = lookup_channel_avx2(index, bit4, bit5, tables[1]);
+            const __m256i red = lookup_channel_avx2(index, bit4, bit5, tables[2]);
+
+            // Interleaving works within 128-bit lanes, pixels 0-3 and 16-19 end up in
+            // argb[0] and so on, the lanes are put back in order when storing
+            const __m256i blue_green_low = _mm256_unpacklo_epi8(blue, green);
+            const __m256i blue_green_high = _mm256_unpackhi_epi8(blue, green);
+            const __m256i red_alpha_low = _mm256_unpacklo_epi8(red, alpha);
+            const __m256i red_alpha_high = _mm256_unpackhi_epi8(red, alpha);
+            const __m256i argb[4] = {
+                _mm256_unpacklo_epi16(blue_green_low, red_alpha_low),
+                _mm256_unpackhi_epi16(blue_green_low, red_alpha_low),
+                _mm256_unpacklo_epi16(blue_green_high, red_alpha_high),
+                _mm256_unpackhi_epi16(blue_green_high, red_alpha_high)
+            };
+            __m256i* pixels = (__m256i*) &row[x * 4];
+
+            _mm256_storeu_si256(&pixels[0], _mm256_permute2x128_si256(argb[0], argb[1], 0x20));
+            _mm256_storeu_si256(&pixels[1], _mm256_permute2x128_si256(argb[2], argb[3], 0x20));
+            _mm256_storeu_si256(&pixels[2], _mm256_permute2x128_si256(argb[0], argb[1], 0x31));
+            _mm256_storeu_si256(&pixels[3], _mm256_permute2x128_si256(argb[2], argb[3], 0x31));
+        }
+
+        convert_pixels(&row[x * 4], &indices[x], width - x, palette);
+    }
+}
+
+void convert_frame_to_argb(u8* out, size_t pitch, const u8* frame, int width, int height,
+                           const u32 palette[NES_COLOR_COUNT]) {
+    switch (detect_video_isa()) {
+        case VIDEO_ISA_AVX2:
+            convert_frame_to_argb_avx2(out, pitch, frame, width, height, palette);
+            break;
+        case VIDEO_ISA_SSSE3:
+            convert_frame_to_argb_ssse3(out, pitch, frame, width, height, palette);
+            break;
+        default:
+            convert_frame_to_argb_scalar(out, pitch, frame, width, height, palette);
+            break;
+    }
+}
+
+const char* video_vector_isa(void) {
+    static const char* const names[] = {"scalar", "ssse3", "avx2"};
+    return names[detect_video_isa()];
+}
+#else
+// Without a byte shuffle a vector has nothing to look the colors up with, one load per
+// pixel from the table is as good as it gets
+void convert_frame_to_argb(u8* out, size_t pitch, const u8* frame, int width, int height,
+                           const u32 palette[NES_COLOR_COUNT]) {
+    convert_frame_to_argb_scalar(out, pitch, frame, width, height, palette);
+}
+
+const char* video_vector_isa(void) {
+    return "scalar";
+}
+#endif
@@ -0,0 +1,27 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <stdlib.h>
+#include "types.h"
+
+// Colors the PPU can output, the framebuffer holds indices into them
+#define NES_COLOR_COUNT 64
+
+// 2C02 colors as 0xAARRGGBB, bytes B, G, R, A in memory on little endian machines, the
+// layout of SDL_PIXELFORMAT_ARGB8888
+extern const u32 nes_palette_argb[NES_COLOR_COUNT];
+
+// Converts a width x height frame of color indices (0-63) to 32-bit pixels through
+// palette, whose colors are all opaque. Rows of the output are pitch bytes apart. The
+// vector version picks the best of AVX2 and SSSE3 the CPU has at run time, unlike the PPU
+// kernels, since the byte shuffles it needs are beyond the x86-64 baseline. The scalar one
+// is its reference.
+void convert_frame_to_argb(u8* out, size_t pitch, const u8* frame, int width, int height,
+                           const u32 palette[NES_COLOR_COUNT]);
+void convert_frame_to_argb_scalar(u8* out, size_t pitch, const u8* frame, int width, int height,
+                                  const u32 palette[NES_COLOR_COUNT]);
+
+// "avx2", "ssse3" or "scalar", what convert_frame_to_argb runs on this CPU
+const char* video_vector_isa(void);
+
+#endif
@@ -0,0 +1,1682 @@
+#ifndef WIN32
+#define _POSIX_C_SOURCE 200809L
+#include <unistd.h>
+#endif
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "cpu.h"
+#include "cpu_batch.h"
+#include "frame_queue.h"
+#include "nes.h"
+#include "ntsc.h"
+#include "ppu_kernels.h"
+#include "save_state.h"
+#include "rewind.h"
+#include "io_utils.h"
+#include "utils.h"
+#include "video.h"
+
+// CPU microbenchmarks. Each program is a synthetic 6502 loop that never exits, mapped as
+// ROM at $8000 with plain RAM below, so the numbers measure the CPU core alone.
+//
+// pyrotobox_bench [--core=reference|threaded] [--program=NAME] [--runs=N] [--cycles=N]
+//                 [--no-decode-cache] [--lanes=N] [--save-states] [--rewind] [--load=ROM] [--ppu]
+//                 [--differential=N] [--csv]
+//
+// With --lanes the lockstep batch engine runs N copies of each program, every copy with
+// slightly different data, and is compared against N exec_instruction loops.
+// With --save-states each program runs on a whole NES and the latency of taking and
+// restoring save states between frames is measured instead, with --rewind the memory
+// needed per second of rewind history and the latency of stepping back through it.
+// With --load the programs are skipped, ROM is loaded into many instances at once, both
+// mapped and read into memory, and the startup time and memory of an instance measured.
+// With --ppu the programs are skipped as well and a static scene is rendered, by the PPU
+// alone and on a whole NES running the first (matching) program, and by the PPU alone
+// with a scroll write in the middle of every few scanlines. The vector sprite evaluation
+// and compositing kernels are compared against their scalar references on their own, and
+// so are the conversion of frames to 32-bit pixels, the NTSC filter and the hand-off to
+// the display.
+// With --differential the programs are skipped too and N random programs run on both cores
+// one instruction at a time, the registers, status register and RAM compared after every
+// instruction. Building with PYROTOBOX_CHECK_FLAGS adds the threaded core's own check of
+// its lazy flags on top.
+
+#define INVALID_ARGUMENTS_ERROR_RETURN_CODE -1
+#define BENCHMARK_FAILED_ERROR_RETURN_CODE -2
+
+#define DEFAULT_RUNS 10
+#define DEFAULT_CYCLES_PER_RUN 20000000ULL
+#define PROGRAM_ORIGIN 0x8000
+// Save states taken and restored per run of --save-states
+#define SAVE_STATE_ITERATIONS 1000
+// Frames recorded per run of --rewind
+#define REWIND_FRAMES_PER_RUN 60
+#define REWIND_MEMORY_BUDGET (16 << 20)
+// Instances alive at once per loader of --load
+#define LOAD_INSTANCES 64
+// Frames rendered per run of --ppu
+#define PPU_FRAMES_PER_RUN 120
+// Scanlines of the split scene of --ppu with a mid-scanline write, one in N
+#define PPU_SPLIT_EVERY 4
+#define PPU_SPLIT_DOT 128
+// Instructions run per random program of --differential
+#define DIFFERENTIAL_INSTRUCTIONS 100000
+
+// Bumped whenever the programs or the measurement change, so stored results are only
+// compared against results of the same version
+#define BENCH_FORMAT_VERSION 2
+
+static const u8 PROGRAM_IMMEDIATE[] = {
+    // loop:
+    0xA9, 0x01,         // LDA #$01
+    0x69, 0x02,         // ADC #$02
+    0x29, 0x7F,         // AND #$7F
+    0x09, 0x01,         // ORA #$01
+    0x49, 0x03,         // EOR #$03
+    0xC9, 0x04,         // CMP #$04
+    0xE9, 0x01,         // SBC #$01
+    0xA2, 0x05,         // LDX #$05
+    0xA0, 0x06,         // LDY #$06
+    0xE0, 0x05,         // CPX #$05
+    0xC0, 0x07,         // CPY #$07
+    0x4C, 0x00, 0x80,   // JMP loop
+};
+
+static const u8 PROGRAM_ZERO_PAGE[] = {
+    // loop:
+    0xA5, 0x10,         // LDA $10
+    0x65, 0x11,         // ADC $11
+    0x85, 0x12,         // STA $12
+    0x25, 0x13,         // AND $13
+    0x05, 0x14,         // ORA $14
+    0x45, 0x15,         // EOR $15
+    0x85, 0x16,         // STA $16
+    0xA6, 0x17,         // LDX $17
+    0x86, 0x18,         // STX $18
+    0xA4, 0x19,         // LDY $19
+    0x84, 0x1A,         // STY $1A
+    0xC5, 0x1B,         // CMP $1B
+    0x4C, 0x00, 0x80,   // JMP loop
+};
+
+static const u8 PROGRAM_ZERO_PAGE_X[] = {
+    0xA2, 0x00,         // LDX #$00
+    // loop:
+    0xB5, 0x10,         // LDA $10,X
+    0x75, 0x20,         // ADC $20,X
+    0x95, 0x30,         // STA $30,X
+    0x35, 0x40,         // AND $40,X
+    0x15, 0x50,         // ORA $50,X
+    0xF5, 0x60,         // SBC $60,X
+    0x95, 0x70,         // STA $70,X
+    0xE8,               // INX
+    0x4C, 0x02, 0x80,   // JMP loop
+};
+
+static const u8 PROGRAM_ABSOLUTE[] = {
+    // loop:
+    0xAD, 0x00, 0x02,   // LDA $0200
+    0x6D, 0x01, 0x02,   // ADC $0201
+    0x8D, 0x02, 0x02,   // STA $0202
+    0x2D, 0x03, 0x02,   // AND $0203
+    0x0D, 0x04, 0x02,   // ORA $0204
+    0x4D, 0x05, 0x02,   // EOR $0205
+    0x8D, 0x06, 0x02,   // STA $0206
+    0xCD, 0x07, 0x02,   // CMP $0207
+    0xED, 0x08, 0x02,   // SBC $0208
+    0x4C, 0x00, 0x80,   // JMP loop
+};
+
+static const u8 PROGRAM_ABSOLUTE_INDEXED[] = {
+    0xA2, 0x00,         // LDX #$00
+    0xA0, 0x80,         // LDY #$80
+    // loop:
+    0xBD, 0x00, 0x02,   // LDA $0200,X
+    0x79, 0x00, 0x03,   // ADC $0300,Y
+    0x9D, 0x00, 0x04,   // STA $0400,X
+    0x39, 0xF0, 0x02,   // AND $02F0,Y
+    0x19, 0x80, 0x03,   // ORA $0380,Y
+    0x5D, 0x00, 0x05,   // EOR $0500,X
+    0x99, 0x00, 0x06,   // STA $0600,Y
+    0xE8,               // INX
+    0xC8,               // INY
+    0x4C, 0x04, 0x80,   // JMP loop
+};
+
+static const u8 PROGRAM_INDIRECT[] = {
+    0xA9, 0x00,         // LDA #$00
+    0x85, 0x00,         // STA $00
+    0x85, 0x02,         // STA $02
+    0xA9, 0x03,         // LDA #$03
+    0x85, 0x01,         // STA $01
+    0xA9, 0x04,         // LDA #$04
+    0x85, 0x03,         // STA $03
+    0xA2, 0x00,         // LDX #$00
+    0xA0, 0x00,         // LDY #$00
+    // loop:
+    0xB1, 0x00,         // LDA ($00),Y
+    0x71, 0x02,         // ADC ($02),Y
+    0x91, 0x02,         // STA ($02),Y
+    0x01, 0x00,         // ORA ($00,X)
+    0x81, 0x02,         // STA ($02,X)
+    0x31, 0x00,         // AND ($00),Y
+    0xC8,               // INY
+    0x4C, 0x12, 0x80,   // JMP loop
+};
+
+static const u8 PROGRAM_READ_MODIFY_WRITE[] = {
+    0xA2, 0x00,         // LDX #$00
+    // loop:
+    0xE6, 0x10,         // INC $10
+    0xC6, 0x11,         // DEC $11
+    0x06, 0x12,         // ASL $12
+    0x46, 0x13,         // LSR $13
+    0x26, 0x14,         // ROL $14
+    0x66, 0x15,         // ROR $15
+    0xEE, 0x00, 0x02,   // INC $0200
+    0x2E, 0x01, 0x02,   // ROL $0201
+    0x5E, 0x00, 0x02,   // LSR $0200,X
+    0x7E, 0x00, 0x03,   // ROR $0300,X
+    0xFE, 0x00, 0x04,   // INC $0400,X
+    0x0A,               // ASL A
+    0x6A,               // ROR A
+    0xE8,               // INX
+    0x4C, 0x02, 0x80,   // JMP loop
+};
+
+static const u8 PROGRAM_BRANCHES[] = {
+    0xA2, 0x00,         // LDX #$00
+    0xA0, 0x00,         // LDY #$00
+    // loop:
+    0xE8,               // INX
+    0xE0, 0x80,         // CPX #$80
+    0x90, 0x01,         // BCC below
+    0xC8,               // INY
+    // below:
+    0x8A,               // TXA
+    0x29, 0x03,         // AND #$03
+    0xF0, 0x04,         // BEQ multiple
+    0x69, 0x01,         // ADC #$01
+    0xD0, 0x01,         // BNE next
+    // multiple:
+    0x38,               // SEC
+    // next:
+    0x8A,               // TXA
+    0x30, 0x02,         // BMI negative
+    0x10, 0xEB,         // BPL loop
+    // negative:
+    0x70, 0xE9,         // BVS loop
+    0x18,               // CLC
+    0x90, 0xE6,         // BCC loop
+};
+
+static const u8 PROGRAM_STACK[] = {
+    // loop:
+    0x20, 0x11, 0x80,   // JSR sub
+    0x48,               // PHA
+    0x08,               // PHP
+    0x8A,               // TXA
+    0x48,               // PHA
+    0x68,               // PLA
+    0xAA,               // TAX
+    0x28,               // PLP
+    0x68,               // PLA
+    0x20, 0x11, 0x80,   // JSR sub
+    0x4C, 0x00, 0x80,   // JMP loop
+    // sub:
+    0x48,               // PHA
+    0xE8,               // INX
+    0x68,               // PLA
+    0x60,               // RTS
+};
+
+static const u8 PROGRAM_MEMCPY[] = {
+    // loop:
+    0xA0, 0x00,         // LDY #$00
+    // copy:
+    0xB9, 0x00, 0x03,   // LDA $0300,Y
+    0x99, 0x00, 0x04,   // STA $0400,Y
+    0xC8,               // INY
+    0xD0, 0xF7,         // BNE copy
+    0xA9, 0x00,         // LDA #$00
+    0x85, 0x00,         // STA $00
+    0x85, 0x02,         // STA $02
+    0xA9, 0x04,         // LDA #$04
+    0x85, 0x01,         // STA $01
+    0xA9, 0x05,         // LDA #$05
+    0x85, 0x03,         // STA $03
+    // indirect:
+    0xB1, 0x00,         // LDA ($00),Y
+    0x91, 0x02,         // STA ($02),Y
+    0xC8,               // INY
+    0xD0, 0xF9,         // BNE indirect
+    0x4C, 0x00, 0x80,   // JMP loop
+};
+
+// Data dependent branches, copies with different data take different paths
+static const u8 PROGRAM_DIVERGENT[] = {
+    0xA2, 0x00,         // LDX #$00
+    // loop:
+    0xBD, 0x00, 0x02,   // LDA $0200,X
+    0x30, 0x05,         // BMI negative
+    0x69, 0x01,         // ADC #$01
+    0x4C, 0x10, 0x80,   // JMP join
+    // negative:
+    0xE9, 0x01,         // SBC #$01
+    0x85, 0x10,         // STA $10
+    // join:
+    0xE8,               // INX
+    0x4C, 0x02, 0x80,   // JMP loop
+};
+
+typedef struct BenchProgram {
+    const char* name;
+    const u8* code;
+    size_t size;
+} BenchProgram;
+
+#define BENCH_PROGRAM(name, code) {name, code, sizeof(code)}
+
+static const BenchProgram PROGRAMS[] = {
+    BENCH_PROGRAM("immediate", PROGRAM_IMMEDIATE),
+    BENCH_PROGRAM("zero_page", PROGRAM_ZERO_PAGE),
+    BENCH_PROGRAM("zero_page_x", PROGRAM_ZERO_PAGE_X),
+    BENCH_PROGRAM("absolute", PROGRAM_ABSOLUTE),
+    BENCH_PROGRAM("absolute_indexed", PROGRAM_ABSOLUTE_INDEXED),
+    BENCH_PROGRAM("indirect", PROGRAM_INDIRECT),
+    BENCH_PROGRAM("read_modify_write", PROGRAM_READ_MODIFY_WRITE),
+    BENCH_PROGRAM("branches", PROGRAM_BRANCHES),
+    BENCH_PROGRAM("stack", PROGRAM_STACK),
+    BENCH_PROGRAM("memcpy", PROGRAM_MEMCPY),
+    BENCH_PROGRAM("divergent", PROGRAM_DIVERGENT),
+};
+
+#define PROGRAM_COUNT (sizeof(PROGRAMS) / sizeof(PROGRAMS[0]))
+
+typedef struct BenchResult {
+    bool valid;
+    u64 instructions;
+    u64 cycles;
+    double ns_per_instruction;
+    double ns_per_instruction_stddev;
+    double mhz;
+    double mhz_stddev;
+    double mhz_min;
+    double mhz_max;
+} BenchResult;
+
+typedef struct BatchBenchResult {
+    bool valid;
+    u64 instructions;
+    double scalar_ns_per_instruction;
+    double batch_ns_per_instruction;
+    double lane_utilization;
+    double scalar_fallback;
+} BatchBenchResult;
+
+typedef struct SaveStateBenchResult {
+    bool valid;
+    size_t state_size;
+    double save_ns;
+    double save_p99_ns;
+    double load_ns;
+    double load_p99_ns;
+} SaveStateBenchResult;
+
+typedef struct RewindBenchResult {
+    bool valid;
+    u64 frames;
+    u64 dropped;
+    double bytes_per_second;
+    double compression_ratio;
+    double compress_us;
+    double step_us;
+    double step_max_us;
+} RewindBenchResult;
+
+typedef struct LoadBenchResult {
+    bool valid;
+    size_t rom_size;
+    // Loading plus building an instance
+    double mapped_startup_us;
+    double read_startup_us;
+    // Private resident memory per instance after its first frame, 0 where unknown
+    double mapped_private_kib;
+    double read_private_kib;
+} LoadBenchResult;
+
+typedef struct DifferentialResult {
+    bool valid;
+    u32 programs;
+    u64 instructions;
+    // Programs that ran into an illegal opcode or stopped the CPU, by overflowing the stack
+    // for one, before their last instruction
+    u32 stopped;
+} DifferentialResult;
+
+typedef struct PpuBenchResult {
+    bool valid;
+    u64 frames;
+    // The PPU caught up a frame at a time with nothing else running
+    double ppu_fps;
+    double ppu_ns_per_scanline;
+    // The whole NES, the CPU running a program alongside
+    double nes_fps;
+    // The PPU alone, caught up a scanline at a time with a $2005 write in the middle of
+    // every PPU_SPLIT_EVERY-th one
+    double split_ns_per_scanline;
+    // Scanlines the PPU drew again after a mid-scanline write, in percent
+    double split_redrawn_percent;
+    // Sprite evaluation of the scene's OAM and compositing of random scanlines, vector
+    // kernels and their scalar references
+    double evaluate_ns_per_scanline;
+    double evaluate_scalar_ns_per_scanline;
+    double composite_ns_per_scanline;
+    double composite_scalar_ns_per_scanline;
+    // Frames of random colors converted for the display, and published into a frame queue
+    double convert_us_per_frame;
+    double convert_scalar_us_per_frame;
+    double publish_us_per_frame;
+    // The scene through the NTSC filter, rows on the calling thread and the whole frame
+    // split across a thread per hardware thread
+    double ntsc_us_per_frame;
+    double ntsc_scalar_us_per_frame;
+    double ntsc_threaded_us_per_frame;
+    u32 ntsc_threads;
+} PpuBenchResult;
+
+typedef struct BenchOptions {
+    const char* program;
+    bool reference;
+    bool threaded;
+    bool decode_cache;
+    u32 runs;
+    u64 cycles_per_run;
+    size_t lanes;
+    bool save_states;
+    bool rewind;
+    const char* load_rom;
+    bool ppu;
+    u32 differential;
+    bool csv;
+} BenchOptions;
+
+static const char* core_name(CpuCore core) {
+    return core == CPU_CORE_THREADED ? "threaded" : "reference";
+}
+
+static Cpu* build_bench_cpu(const BenchProgram* program, CpuCore core, bool decode_cache, size_t seed) {
+    u8* mem = calloc(0x10000, 1);
+
+    // Give the data the programs touch some variety
+    for (u16 addr = 0x0200; addr < 0x0800; addr++) {
+        mem[addr] = addr * 7 + seed * 13;
+    }
+
+    memcpy(&mem[PROGRAM_ORIGIN], program->code, program->size);
+    mem[0xFFFC] = PROGRAM_ORIGIN & 0xFF;
+    mem[0xFFFD] = PROGRAM_ORIGIN >> 8;
+
+    Cpu* cpu = build_cpu_from_mem(mem, 0x10000);
+    bus_map_rom(&cpu->bus, 0x80, 0x80, &mem[0x8000]);
+    bus_map_write_handler(&cpu->bus, 0x80, 0x80, bus_ignore_write, NULL);
+
+    cpu->core = core;
+    cpu->cpu_state = CPU_RUNNING;
+
+    if (!decode_cache) {
+        disable_decode_cache(cpu);
+    }
+
+    return cpu;
+}
+
+static void free_bench_cpu(Cpu* cpu) {
+    free(cpu->mem);
+    free_cpu(cpu);
+}
+
+// Wraps the program into an NROM image with 32 KiB of PRG-ROM
+static Nes* build_bench_nes(const BenchProgram* program) {
+    const size_t prg_size = 0x8000;
+    u8* rom_bin = calloc(0x10 + prg_size, 1);
+
+    memcpy(rom_bin, "NES\x1A", 4);
+    rom_bin[4] = prg_size / 0x4000;
+    memcpy(&rom_bin[0x10], program->code, program->size);
+    rom_bin[0x10 + 0x7FFC] = PROGRAM_ORIGIN & 0xFF;
+    rom_bin[0x10 + 0x7FFD] = PROGRAM_ORIGIN >> 8;
+
+    const build_nes_result_t result = build_nes_from_rom_bin(&rom_bin, 0x10 + prg_size);
+
+    if (!result.valid) {
+        return NULL;
+    }
+
+    for (u16 addr = 0x0200; addr < 0x0800; addr++) {
+        result.nes->cpu->mem[addr] = addr * 7;
+    }
+
+    return result.nes;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    const u64 x = *(const u64*) a, y = *(const u64*) b;
+    return x < y ? -1 : x > y;
+}
+
+static void mean_stddev(const double* samples, u32 count, double* mean, double* stddev) {
+    double sum = 0, sq_sum = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+
+    *mean = sum / count;
+
+    for (u32 i = 0; i < count; i++) {
+        sq_sum += (samples[i] - *mean) * (samples[i] - *mean);
+    }
+
+    *stddev = count > 1 ? sqrt(sq_sum / (count - 1)) : 0.0;
+}
+
+static BenchResult run_benchmark(const BenchProgram* program, CpuCore core, const BenchOptions* options) {
+    BenchResult result = {.valid = false};
+    Cpu* cpu = build_bench_cpu(program, core, options->decode_cache, 0);
+    double* ns_per_instruction = malloc(options->runs * sizeof(double));
+    double* mhz = malloc(options->runs * sizeof(double));
+
+    // Warm up caches, branch predictors and the decode cache
+    run_cpu(cpu, options->cycles_per_run / 4);
+
+    for (u32 run = 0; run < options->runs && cpu->cpu_state == CPU_RUNNING; run++) {
+        const u64 start_instructions = cpu->instructions_performed;
+        const u64 start_ns = get_time_ns();
+        const u64 cycles = run_cpu(cpu, options->cycles_per_run);
+        const u64 elapsed_ns = get_time_ns() - start_ns;
+        const u64 instructions = cpu->instructions_performed - start_instructions;
+
+        ns_per_instruction[run] = (double) elapsed_ns / instructions;
+        mhz[run] = cycles / (elapsed_ns / 1e3);
+        result.instructions += instructions;
+        result.cycles += cycles;
+    }
+
+    if (cpu->cpu_state == CPU_RUNNING) {
+        mean_stddev(ns_per_instruction, options->runs, &result.ns_per_instruction, &result.ns_per_instruction_stddev);
+        mean_stddev(mhz, options->runs, &result.mhz, &result.mhz_stddev);
+
+        result.mhz_min = result.mhz_max = mhz[0];
+        for (u32 run = 1; run < options->runs; run++) {
+            result.mhz_min = mhz[run] < result.mhz_min ? mhz[run] : result.mhz_min;
+            result.mhz_max = mhz[run] > result.mhz_max ? mhz[run] : result.mhz_max;
+        }
+
+        result.valid = true;
+    } else {
+        fprintf(stderr, "Program %s stopped the %s core at $%04X\n", program->name, core_name(core), cpu->r_pc);
+    }
+
+    free(ns_per_instruction);
+    free(mhz);
+    free_bench_cpu(cpu);
+
+    return result;
+}
+
+static bool same_cpu_state(const Cpu* a, const Cpu* b) {
+    return a->r_a == b->r_a && a->r_x == b->r_x && a->r_y == b->r_y && a->r_sp == b->r_sp
+        && a->r_sr == b->r_sr && a->r_pc == b->r_pc && a->cycles == b->cycles
+        && a->instructions_performed == b->instructions_performed && a->cpu_state == b->cpu_state
+        && memcmp(a->mem, b->mem, 0x800) == 0;
+}
+
+// Runs the same lanes once as separate exec_instruction loops and once through the batch
+// engine, the final states have to match
+static BatchBenchResult run_batch_benchmark(const BenchProgram* program, const BenchOptions* options) {
+    BatchBenchResult result = {.valid = false};
+    const size_t lanes = options->lanes;
+    Cpu** scalar_cpus = malloc(lanes * sizeof(Cpu*));
+    Cpu** batch_cpus = malloc(lanes * sizeof(Cpu*));
+
+    for (size_t lane = 0; lane < lanes; lane++) {
+        scalar_cpus[lane] = build_bench_cpu(program, CPU_CORE_REFERENCE, false, lane);
+        batch_cpus[lane] = build_bench_cpu(program, CPU_CORE_REFERENCE, false, lane);
+    }
+
+    CpuBatch* batch = build_cpu_batch(batch_cpus, lanes);
+    // The total work per run stays the same whatever the lane count
+    const u64 lane_cycles = options->cycles_per_run / lanes > 0 ? options->cycles_per_run / lanes : 1;
+    u64 scalar_ns = 0, batch_ns = 0;
+
+    for (u32 run = 0; run <= options->runs; run++) {
+        u64 start_ns = get_time_ns();
+        for (size_t lane = 0; lane < lanes; lane++) {
+            run_cpu(scalar_cpus[lane], lane_cycles);
+        }
+        const u64 run_scalar_ns = get_time_ns() - start_ns;
+
+        start_ns = get_time_ns();
+        run_cpu_batch(batch, lane_cycles);
+        const u64 run_batch_ns = get_time_ns() - start_ns;
+
+        // The first run warms up
+        if (run == 0) {
+            batch->stats = (CpuBatchStats) {0};
+            continue;
+        }
+
+        scalar_ns += run_scalar_ns;
+        batch_ns += run_batch_ns;
+    }
+
+    result.valid = true;
+    u64 warmup_instructions = 0;
+
+    for (size_t lane = 0; lane < lanes; lane++) {
+        if (!same_cpu_state(scalar_cpus[lane], batch_cpus[lane])) {
+            fprintf(stderr, "Program %s: lane %zu of the batch engine diverged from exec_instruction\n", program->name, lane);
+            result.valid = false;
+        }
+
+        result.instructions += scalar_cpus[lane]->instructions_performed;
+    }
+
+    warmup_instructions = result.instructions - batch->stats.vector_instructions - batch->stats.scalar_instructions;
+    result.instructions -= warmup_instructions;
+
+    if (result.valid && result.instructions > 0) {
+        result.scalar_ns_per_instruction = (double) scalar_ns / result.instructions;
+        result.batch_ns_per_instruction = (double) batch_ns / result.instructions;
+        result.lane_utilization = batch->stats.lane_slots
+            ? (double) batch->stats.vector_instructions / batch->stats.lane_slots : 0.0;
+        result.scalar_fallback = (double) batch->stats.scalar_instructions / result.instructions;
+    }
+
+    free_cpu_batch(batch);
+    for (size_t lane = 0; lane < lanes; lane++) {
+        free_bench_cpu(scalar_cpus[lane]);
+        free_bench_cpu(batch_cpus[lane]);
+    }
+    free(scalar_cpus);
+    free(batch_cpus);
+
+    return result;
+}
+
+static void print_cpu_state(const char* core, const Cpu* cpu) {
+    fprintf(stderr, "  %-9s PC $%04X A $%02X X $%02X Y $%02X SP $%02X SR $%02X cycles %llu\n",
+            core, cpu->r_pc, cpu->r_a, cpu->r_x, cpu->r_y, cpu->r_sp, cpu->r_sr, (unsigned long long) cpu->cycles);
+}
+
+// Runs random programs on both cores one instruction at a time. Every byte of the ROM is a
+// legal opcode, so wherever the program counter lands in it, operands included, there is
+// something to execute; programs that write themselves an illegal opcode in RAM and jump
+// to it end there, and so do programs that stop both cores.
+static DifferentialResult run_differential_check(const BenchOptions* options) {
+    DifferentialResult result = {.valid = true};
+    u8 legal_opcodes[0x100];
+    size_t legal_count = 0;
+
+    for (u16 opcode = 0; opcode < 0x100; opcode++) {
+        if (get_instruction(opcode)->cycles > 0) {
+            legal_opcodes[legal_count++] = opcode;
+        }
+    }
+
+    u8* code = malloc(0x8000);
+    u32 random = 1;
+
+    for (u32 seed = 0; seed < options->differential && result.valid; seed++) {
+        for (size_t i = 0; i < 0x8000; i++) {
+            random = random * 1103515245 + 12345;
+            code[i] = legal_opcodes[(random >> 16) % legal_count];
+        }
+
+        const BenchProgram program = {"random", code, 0x8000};
+        Cpu* reference = build_bench_cpu(&program, CPU_CORE_REFERENCE, false, seed);
+        Cpu* threaded = build_bench_cpu(&program, CPU_CORE_THREADED, options->decode_cache, seed);
+
+        for (u32 i = 0; i < DIFFERENTIAL_INSTRUCTIONS; i++) {
+            if (reference->cpu_state != CPU_RUNNING
+                || get_instruction(bus_read(&reference->bus, reference->r_pc))->cycles == 0) {
+                result.stopped++;
+                break;
+            }
+
+            const u16 pc = reference->r_pc;
+
+            // A budget of one cycle is exactly one instruction on either core
+            run_cpu(reference, 1);
+            run_cpu(threaded, 1);
+            result.instructions++;
+
+            if (!same_cpu_state(reference, threaded)) {
+                fprintf(stderr, "Random program %u: the threaded core diverged after instruction %u, "
+                        "$%02X at $%04X\n", seed, i, bus_read(&reference->bus, pc), pc);
+                print_cpu_state("reference", reference);
+                print_cpu_state("threaded", threaded);
+                result.valid = false;
+                break;
+            }
+        }
+
+        result.programs++;
+        free_bench_cpu(reference);
+        free_bench_cpu(threaded);
+    }
+
+    free(code);
+
+    return result;
+}
+
+// Runs a frame between each round of snapshots, restores them right away and checks that
+// running on from a restored state ends up exactly where the original run did
+static SaveStateBenchResult run_save_state_benchmark(const BenchProgram* program, const BenchOptions* options) {
+    SaveStateBenchResult result = {.valid = false};
+    Nes* nes = build_bench_nes(program);
+
+    if (!nes) {
+        return result;
+    }
+
+    const StopCondition one_frame = {.max_frames = 1};
+    const size_t state_size = nes_state_size(nes);
+    const size_t samples = (size_t) options->runs * SAVE_STATE_ITERATIONS;
+    u8* state = malloc(state_size);
+    u8* expected = malloc(state_size);
+    u8* actual = malloc(state_size);
+    u64* save_ns = malloc(samples * sizeof(u64));
+    u64* load_ns = malloc(samples * sizeof(u64));
+    u64 save_total_ns = 0, load_total_ns = 0;
+
+    nes->cpu->core = options->threaded ? CPU_CORE_THREADED : CPU_CORE_REFERENCE;
+    set_pacing_mode(&nes->pacer, PACING_UNCAPPED);
+    result.valid = true;
+
+    for (u32 run = 0; run < options->runs && result.valid; run++) {
+        run_nes_until(nes, &one_frame);
+
+        for (size_t i = 0; i < SAVE_STATE_ITERATIONS; i++) {
+            u64 start_ns = get_time_ns();
+            result.state_size = save_nes_state(nes, state, state_size);
+            save_ns[run * SAVE_STATE_ITERATIONS + i] = get_time_ns() - start_ns;
+
+            start_ns = get_time_ns();
+            const SaveStateStatus status = load_nes_state(nes, state, state_size);
+            load_ns[run * SAVE_STATE_ITERATIONS + i] = get_time_ns() - start_ns;
+
+            result.valid &= status == SAVE_STATE_OK;
+        }
+
+        run_nes_until(nes, &one_frame);
+        save_nes_state(nes, expected, state_size);
+
+        result.valid &= load_nes_state(nes, state, state_size) == SAVE_STATE_OK;
+        run_nes_until(nes, &one_frame);
+        save_nes_state(nes, actual, state_size);
+
+        if (memcmp(expected, actual, state_size) != 0) {
+            fprintf(stderr, "Program %s diverged after restoring a save state\n", program->name);
+            result.valid = false;
+        }
+    }
+
+    for (size_t i = 0; i < samples; i++) {
+        save_total_ns += save_ns[i];
+        load_total_ns += load_ns[i];
+    }
+
+    qsort(save_ns, samples, sizeof(u64), compare_u64);
+    qsort(load_ns, samples, sizeof(u64), compare_u64);
+    result.save_ns = (double) save_total_ns / samples;
+    result.load_ns = (double) load_total_ns / samples;
+    result.save_p99_ns = save_ns[samples * 99 / 100];
+    result.load_p99_ns = load_ns[samples * 99 / 100];
+
+    free(state);
+    free(expected);
+    free(actual);
+    free(save_ns);
+    free(load_ns);
+    free_nes(nes);
+
+    return result;
+}
+
+// Records a few seconds of history, then rewinds through all of it and checks every
+// frame stepped back to against the state the frame originally had
+static RewindBenchResult run_rewind_benchmark(const BenchProgram* program, const BenchOptions* options) {
+    RewindBenchResult result = {.valid = false};
+    Nes* nes = build_bench_nes(program);
+
+    if (!nes) {
+        return result;
+    }
+
+    const StopCondition one_frame = {.max_frames = 1};
+    const u64 frames = (u64) options->runs * REWIND_FRAMES_PER_RUN;
+    const size_t state_size = nes_state_size(nes);
+    u8* expected = malloc((frames + 1) * state_size);
+    u64 steps = 0, step_total_ns = 0, step_max_ns = 0;
+
+    nes->cpu->core = options->threaded ? CPU_CORE_THREADED : CPU_CORE_REFERENCE;
+    set_pacing_mode(&nes->pacer, PACING_UNCAPPED);
+    enable_rewind(nes, REWIND_MEMORY_BUDGET);
+
+    for (u64 frame = 0; frame < frames; frame++) {
+        run_nes_until(nes, &one_frame);
+        save_nes_state(nes, &expected[nes->frames * state_size], state_size);
+        // Uncapped frames outrun the compression thread, how many would be dropped then
+        // depends on the scheduling of the two. Every frame is recorded instead.
+        wait_rewind_idle(nes->rewind);
+    }
+
+    const RewindStats stats = get_rewind_stats(nes->rewind);
+    u8* actual = malloc(state_size);
+    result.valid = stats.dropped == 0;
+
+    if (stats.dropped > 0) {
+        fprintf(stderr, "Program %s dropped %llu of %llu frames from the rewind history\n", program->name,
+                (unsigned long long) stats.dropped, (unsigned long long) stats.pushed);
+    }
+
+    while (result.valid) {
+        const u64 start_ns = get_time_ns();
+
+        if (!rewind_frame(nes->rewind, nes)) {
+            break;
+        }
+
+        const u64 elapsed_ns = get_time_ns() - start_ns;
+        step_total_ns += elapsed_ns;
+        step_max_ns = elapsed_ns > step_max_ns ? elapsed_ns : step_max_ns;
+        steps++;
+
+        save_nes_state(nes, actual, state_size);
+
+        if (nes->frames > frames || memcmp(actual, &expected[nes->frames * state_size], state_size) != 0) {
+            fprintf(stderr, "Program %s rewound to a wrong state at frame %llu\n", program->name,
+                    (unsigned long long) nes->frames);
+            result.valid = false;
+            break;
+        }
+    }
+
+    // The frames the history spans, not the entries kept
+    const double seconds = stats.entries > 0 ? (stats.newest_frame - stats.oldest_frame + 1) / nes->pacer.frame_rate : 0.0;
+
+    result.frames = stats.entries;
+    result.dropped = stats.dropped;
+    result.bytes_per_second = seconds > 0 ? stats.bytes / seconds : 0.0;
+    result.compression_ratio = stats.compressed_bytes ? (double) stats.raw_bytes / stats.compressed_bytes : 0.0;
+    result.compress_us = stats.pushed > stats.dropped ? stats.compress_ns / 1e3 / (stats.pushed - stats.dropped) : 0.0;
+    result.step_us = steps ? step_total_ns / 1e3 / steps : 0.0;
+    result.step_max_us = step_max_ns / 1e3;
+
+    free(actual);
+    free(expected);
+    free_nes(nes);
+
+    return result;
+}
+
+// Resident memory that is not shared with other mappings of the same file
+static size_t get_private_resident_bytes(void) {
+#ifdef __linux__
+    FILE* statm = fopen("/proc/self/statm", "r");
+    unsigned long size = 0, resident = 0, shared = 0;
+
+    if (!statm) {
+        return 0;
+    }
+
+    const int fields = fscanf(statm, "%lu %lu %lu", &size, &resident, &shared);
+    fclose(statm);
+
+    return fields == 3 ? (resident - shared) * (size_t) sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+static Nes* build_loaded_nes(const char* rom_path, bool mapped) {
+    build_nes_result_t result = {.valid = false};
+
+    if (mapped) {
+        rom_map_result rom = map_rom_file(rom_path);
+
+        if (rom.valid) {
+            result = build_nes_from_rom_image(&rom.image);
+        }
+    } else {
+        rom_read_result rom = read_rom_bin(rom_path);
+
+        if (rom.valid) {
+            result = build_nes_from_rom_bin(&rom.rom_bin, rom.size);
+        }
+    }
+
+    return result.valid ? result.nes : NULL;
+}
+
+// Keeps LOAD_INSTANCES instances of each loader alive at once, like the job runner does,
+// and runs a frame on each so the ROM pages it uses are resident. Memory is only taken
+// from the first run, later runs reuse the heap the earlier ones freed.
+static LoadBenchResult run_load_benchmark(const char* rom_path, const BenchOptions* options) {
+    LoadBenchResult result = {.valid = true};
+    const StopCondition one_frame = {.max_frames = 1};
+    Nes* instances[2][LOAD_INSTANCES] = {{NULL}};
+    u64 startup_ns[2] = {0, 0};
+    size_t private_bytes[2] = {0, 0};
+
+    for (u32 run = 0; run < options->runs && result.valid; run++) {
+        for (int mapped = 1; mapped >= 0; mapped--) {
+            const size_t resident_before = get_private_resident_bytes();
+
+            for (size_t i = 0; i < LOAD_INSTANCES && result.valid; i++) {
+                const u64 start_ns = get_time_ns();
+                instances[mapped][i] = build_loaded_nes(rom_path, mapped);
+                startup_ns[mapped] += get_time_ns() - start_ns;
+                result.valid = instances[mapped][i] != NULL;
+            }
+
+            for (size_t i = 0; i < LOAD_INSTANCES && instances[mapped][i]; i++) {
+                set_pacing_mode(&instances[mapped][i]->pacer, PACING_UNCAPPED);
+                run_nes_until(instances[mapped][i], &one_frame);
+            }
+
+            const size_t resident_after = get_private_resident_bytes();
+
+            if (run == 0 && resident_after > resident_before) {
+                private_bytes[mapped] = resident_after - resident_before;
+            }
+        }
+
+        for (size_t i = 0; i < LOAD_INSTANCES; i++) {
+            for (int mapped = 0; mapped < 2; mapped++) {
+                if (instances[mapped][i]) {
+                    free_nes(instances[mapped][i]);
+                    instances[mapped][i] = NULL;
+                }
+            }
+        }
+    }
+
+    if (result.valid) {
+        const double loads = (double) options->runs * LOAD_INSTANCES;
+        const rom_read_result rom = read_rom_bin(rom_path);
+
+        result.rom_size = rom.size;
+        free(rom.rom_bin);
+        result.mapped_startup_us = startup_ns[1] / 1e3 / loads;
+        result.read_startup_us = startup_ns[0] / 1e3 / loads;
+        result.mapped_private_kib = private_bytes[1] / 1024.0 / LOAD_INSTANCES;
+        result.read_private_kib = private_bytes[0] / 1024.0 / LOAD_INSTANCES;
+    }
+
+    return result;
+}
+
+// Uploads a static scene through the PPU registers like a game would: CHR-RAM full of
+// varied patterns, both nametables with every attribute palette, all 32 palette entries,
+// fine scrolling and 64 sprites with every flip and priority, some scanlines with more
+// than 8 of them
+static void upload_bench_scene(Nes* nes) {
+    Bus* bus = &nes->cpu->bus;
+
+    bus_write(bus, 0x2006, 0x00);
+    bus_write(bus, 0x2006, 0x00);
+    for (u32 i = 0; i < 0x2000; i++) {
+        bus_write(bus, 0x2007, i * 37 ^ i >> 5);
+    }
+
+    for (u32 i = 0; i < 0x800; i++) {
+        bus_write(bus, 0x2007, i * 7 + (i >> 8));
+    }
+
+    bus_write(bus, 0x2006, 0x3F);
+    bus_write(bus, 0x2006, 0x00);
+    for (u32 i = 0; i < 0x20; i++) {
+        bus_write(bus, 0x2007, (i * 5 + 1) & 0x3F);
+    }
+
+    bus_write(bus, 0x2003, 0x00);
+    for (u32 sprite = 0; sprite < 64; sprite++) {
+        bus_write(bus, 0x2004, 16 + sprite * 3);
+        bus_write(bus, 0x2004, sprite * 5);
+        bus_write(bus, 0x2004, sprite & 0xE3);
+        bus_write(bus, 0x2004, sprite * 29);
+    }
+
+    bus_write(bus, 0x2005, 13);
+    bus_write(bus, 0x2005, 7);
+    // Second nametable, sprites from $1000, rendering on
+    bus_write(bus, 0x2000, 0x09);
+    bus_write(bus, 0x2001, 0x1E);
+}
+
+static Nes* build_ppu_bench_nes(const BenchProgram* program, const BenchOptions* options) {
+    Nes* nes = build_bench_nes(program);
+
+    if (nes) {
+        nes->cpu->core = options->threaded ? CPU_CORE_THREADED : CPU_CORE_REFERENCE;
+        set_pacing_mode(&nes->pacer, PACING_UNCAPPED);
+        upload_bench_scene(nes);
+    }
+
+    return nes;
+}
+
+// Catches the PPU up to the middle of every visible scanline of a frame and changes fine
+// X there on every PPU_SPLIT_EVERY-th one, like a game with raster effects
+static void render_split_frame(Nes* nes) {
+    Ppu* ppu = nes->ppu;
+    Bus* bus = &nes->cpu->bus;
+    // The first frame that starts at or after the PPU's position
+    const u64 frame_start = (ppu->dots + PPU_DOTS_PER_FRAME - 1) / PPU_DOTS_PER_FRAME * PPU_DOTS_PER_FRAME;
+
+    for (u32 scanline = 0; scanline < PPU_FRAME_HEIGHT; scanline++) {
+        // The register writes sync the PPU to the CPU's clock
+        nes->cpu->cycles = (frame_start + scanline * PPU_DOTS_PER_SCANLINE + PPU_SPLIT_DOT) / PPU_DOTS_PER_CPU_CYCLE;
+        sync_component(&ppu->component, nes->cpu->cycles);
+
+        if (scanline % PPU_SPLIT_EVERY == 0) {
+            bus_write(bus, 0x2005, scanline);
+            bus_write(bus, 0x2005, 7);
+        }
+    }
+
+    nes->cpu->cycles = (frame_start + PPU_DOTS_PER_FRAME) / PPU_DOTS_PER_CPU_CYCLE;
+    sync_component(&ppu->component, nes->cpu->cycles);
+}
+
+// The vector kernels have to give the same output as the scalar ones: sprite lists of
+// every scanline with both sprite sizes, and pixels and sprite 0 hits from every first pixel
+static bool check_sprite_kernels(const u8* oam, u8 lines[][2][SPRITE_LINE_SIZE], const u8* colors) {
+    for (int height = 8; height <= 16; height += 8) {
+        for (u16 scanline = 0; scanline < PPU_FRAME_HEIGHT; scanline++) {
+            u8 sprites[2][PPU_SPRITES_PER_SCANLINE];
+            bool overflow[2];
+            const int count = evaluate_sprites(oam, scanline, height, sprites[0], &overflow[0]);
+
+            if (count != evaluate_sprites_scalar(oam, scanline, height, sprites[1], &overflow[1])
+                    || overflow[0] != overflow[1] || memcmp(sprites[0], sprites[1], count) != 0) {
+                return false;
+            }
+        }
+    }
+
+    for (u32 line = 0; line < PPU_FRAME_HEIGHT; line++) {
+        const int first = line % PPU_FRAME_WIDTH;
+        u8 pixels[2][PPU_FRAME_WIDTH];
+
+        for (int with_sprites = 0; with_sprites < 2; with_sprites++) {
+            const u8* sprites = with_sprites ? lines[line][1] : NULL;
+
+            memset(pixels, 0, sizeof(pixels));
+
+            if (composite_pixels(pixels[0], lines[line][0], sprites, colors, first)
+                    != composite_pixels_scalar(pixels[1], lines[line][0], sprites, colors, first)
+                    || memcmp(pixels[0], pixels[1], PPU_FRAME_WIDTH) != 0) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void run_sprite_kernel_benchmark(const Ppu* ppu, const BenchOptions* options, PpuBenchResult* result) {
+    // Background and sprite line of every scanline, a quarter of the pixels has a sprite
+    // with random priority and sprite 0 flags
+    static u8 lines[PPU_FRAME_HEIGHT][2][SPRITE_LINE_SIZE];
+    u8 colors[PPU_PALETTE_SIZE];
+    u32 random = 1;
+    u64 evaluate_ns[2] = {0, 0}, composite_ns[2] = {0, 0};
+    // Sums the outputs so that none of the work can be left out
+    volatile u32 sink = 0;
+
+    for (u32 line = 0; line < PPU_FRAME_HEIGHT; line++) {
+        for (u32 x = 0; x < SPRITE_LINE_SIZE; x++) {
+            random = random * 1103515245 + 12345;
+            lines[line][0][x] = x < PPU_FRAME_WIDTH ? random >> 8 & 0x0F : 0;
+            lines[line][1][x] = random >> 16 & 0x03 ? 0 : 0x10 | (random >> 20 & 0x0F) | (random >> 24 & 0x60);
+        }
+    }
+
+    for (int entry = 0; entry < PPU_PALETTE_SIZE; entry++) {
+        colors[entry] = entry * 5 & 0x3F;
+    }
+
+    if (!check_sprite_kernels(ppu->oam, lines, colors)) {
+        fprintf(stderr, "The %s sprite kernels differ from the scalar ones\n", ppu_vector_isa());
+        result->valid = false;
+        return;
+    }
+
+    for (u32 run = 0; run < options->runs; run++) {
+        for (int scalar = 0; scalar < 2; scalar++) {
+            u64 start_ns = get_time_ns();
+            u32 sum = 0;
+
+            for (u32 frame = 0; frame < PPU_FRAMES_PER_RUN; frame++) {
+                for (u16 scanline = 0; scanline < PPU_FRAME_HEIGHT; scanline++) {
+                    u8 sprites[PPU_SPRITES_PER_SCANLINE];
+                    bool overflow;
+
+                    sum += scalar ? evaluate_sprites_scalar(ppu->oam, scanline, 8, sprites, &overflow)
+                        : evaluate_sprites(ppu->oam, scanline, 8, sprites, &overflow);
+                    sum += sprites[0] + overflow;
+                }
+            }
+
+            evaluate_ns[scalar] += get_time_ns() - start_ns;
+            start_ns = get_time_ns();
+
+            for (u32 frame = 0; frame < PPU_FRAMES_PER_RUN; frame++) {
+                for (u32 line = 0; line < PPU_FRAME_HEIGHT; line++) {
+                    u8 pixels[PPU_FRAME_WIDTH];
+
+                    sum += scalar ? composite_pixels_scalar(pixels, lines[line][0], lines[line][1], colors, 0)
+                        : composite_pixels(pixels, lines[line][0], lines[line][1], colors, 0);
+                    sum += pixels[frame % PPU_FRAME_WIDTH];
+                }
+            }
+
+            composite_ns[scalar] += get_time_ns() - start_ns;
+            sink += sum;
+        }
+    }
+
+    const double scanlines = (double) options->runs * PPU_FRAMES_PER_RUN * PPU_FRAME_HEIGHT;
+
+    result->evaluate_ns_per_scanline = evaluate_ns[0] / scanlines;
+    result->evaluate_scalar_ns_per_scanline = evaluate_ns[1] / scanlines;
+    result->composite_ns_per_scanline = composite_ns[0] / scanlines;
+    result->composite_scalar_ns_per_scanline = composite_ns[1] / scanlines;
+    (void) sink;
+}
+
+static void run_video_benchmark(const BenchOptions* options, PpuBenchResult* result) {
+    // Rows of the output are padded like the rows of a texture can be
+    const size_t pitch = PPU_FRAME_WIDTH * sizeof(u32) + 64;
+    static u8 frame[PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT];
+    static u8 pixels[2][PPU_FRAME_HEIGHT * (PPU_FRAME_WIDTH * sizeof(u32) + 64)];
+    FrameQueue* queue = build_frame_queue(sizeof(frame));
+    u32 random = 1;
+    u64 convert_ns[2] = {0, 0}, publish_ns = 0;
+    volatile u32 sink = 0;
+
+    // Colors past 63 are out of range and have to wrap the same way in both
+    for (size_t i = 0; i < sizeof(frame); i++) {
+        random = random * 1103515245 + 12345;
+        frame[i] = random >> 16;
+    }
+
+    memset(pixels, 0, sizeof(pixels));
+    convert_frame_to_argb(pixels[0], pitch, frame, PPU_FRAME_WIDTH, PPU_FRAME_HEIGHT, nes_palette_argb);
+    convert_frame_to_argb_scalar(pixels[1], pitch, frame, PPU_FRAME_WIDTH, PPU_FRAME_HEIGHT, nes_palette_argb);
+
+    if (memcmp(pixels[0], pixels[1], sizeof(pixels[0])) != 0) {
+        fprintf(stderr, "The %s frame conversion differs from the scalar one\n", video_vector_isa());
+        result->valid = false;
+        free_frame_queue(queue);
+        return;
+    }
+
+    for (u32 run = 0; run < options->runs; run++) {
+        for (int scalar = 0; scalar < 2; scalar++) {
+            const u64 start_ns = get_time_ns();
+
+            for (u32 i = 0; i < PPU_FRAMES_PER_RUN; i++) {
+                frame[i] = i;
+                if (scalar) {
+                    convert_frame_to_argb_scalar(pixels[1], pitch, frame, PPU_FRAME_WIDTH, PPU_FRAME_HEIGHT, nes_palette_argb);
+                } else {
+                    convert_frame_to_argb(pixels[0], pitch, frame, PPU_FRAME_WIDTH, PPU_FRAME_HEIGHT, nes_palette_argb);
+                }
+                sink += pixels[scalar][i * sizeof(u32)];
+            }
+
+            convert_ns[scalar] += get_time_ns() - start_ns;
+        }
+
+        const u64 start_ns = get_time_ns();
+
+        for (u32 i = 0; i < PPU_FRAMES_PER_RUN; i++) {
+            memcpy(back_frame(queue), frame, sizeof(frame));
+            publish_frame(queue);
+        }
+
+        publish_ns += get_time_ns() - start_ns;
+    }
+
+    const double frames = (double) options->runs * PPU_FRAMES_PER_RUN;
+
+    result->convert_us_per_frame = convert_ns[0] / 1e3 / frames;
+    result->convert_scalar_us_per_frame = convert_ns[1] / 1e3 / frames;
+    result->publish_us_per_frame = publish_ns / 1e3 / frames;
+    free_frame_queue(queue);
+    (void) sink;
+}
+
+static void run_ntsc_benchmark(const Ppu* ppu, const BenchOptions* options, PpuBenchResult* result) {
+    const size_t pitch = NTSC_OUTPUT_WIDTH * sizeof(u32);
+    static u8 emphasis[PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT];
+    u8* pixels[2] = {malloc(NTSC_OUTPUT_HEIGHT * pitch), malloc(NTSC_OUTPUT_HEIGHT * pitch)};
+    NtscFilter* filter = build_ntsc_filter(0);
+    u64 rows_ns[2] = {0, 0}, frame_ns = 0;
+
+    // The emphasis bits change every few rows so that all of the 9-bit colors show up
+    for (size_t i = 0; i < sizeof(emphasis); i++) {
+        emphasis[i] = i / (PPU_FRAME_WIDTH * 5) % 8;
+    }
+
+    NtscFrame frames[2] = {
+        {.out = pixels[0], .pitch = pitch, .frame = ppu->framebuffer, .emphasis = emphasis},
+        {.out = pixels[1], .pitch = pitch, .frame = ppu->framebuffer, .emphasis = emphasis}
+    };
+
+    for (int phase = 0; phase < NTSC_PHASES && result->valid; phase++) {
+        frames[0].phase = frames[1].phase = phase;
+        filter_ntsc_frame(filter, &frames[0]);
+        filter_ntsc_rows_scalar(filter, &frames[1], 0, PPU_FRAME_HEIGHT);
+
+        if (memcmp(pixels[0], pixels[1], NTSC_OUTPUT_HEIGHT * pitch) != 0) {
+            fprintf(stderr, "The %s NTSC filter differs from the scalar one\n", ntsc_vector_isa());
+            result->valid = false;
+        }
+    }
+
+    for (u32 run = 0; run < options->runs && result->valid; run++) {
+        for (int scalar = 0; scalar < 2; scalar++) {
+            const u64 start_ns = get_time_ns();
+
+            for (u32 i = 0; i < PPU_FRAMES_PER_RUN; i++) {
+                frames[scalar].phase = i % 2;
+                if (scalar) {
+                    filter_ntsc_rows_scalar(filter, &frames[1], 0, PPU_FRAME_HEIGHT);
+                } else {
+                    filter_ntsc_rows(filter, &frames[0], 0, PPU_FRAME_HEIGHT);
+                }
+            }
+
+            rows_ns[scalar] += get_time_ns() - start_ns;
+        }
+
+        const u64 start_ns = get_time_ns();
+
+        for (u32 i = 0; i < PPU_FRAMES_PER_RUN; i++) {
+            frames[0].phase = i % 2;
+            filter_ntsc_frame(filter, &frames[0]);
+        }
+
+        frame_ns += get_time_ns() - start_ns;
+    }
+
+    const double frame_count = (double) options->runs * PPU_FRAMES_PER_RUN;
+
+    result->ntsc_us_per_frame = rows_ns[0] / 1e3 / frame_count;
+    result->ntsc_scalar_us_per_frame = rows_ns[1] / 1e3 / frame_count;
+    result->ntsc_threaded_us_per_frame = frame_ns / 1e3 / frame_count;
+    result->ntsc_threads = filter->threads;
+    free_ntsc_filter(filter);
+    free(pixels[0]);
+    free(pixels[1]);
+}
+
+static PpuBenchResult run_ppu_benchmark(const BenchProgram* program, const BenchOptions* options) {
+    PpuBenchResult result = {.valid = true};
+    const StopCondition one_frame = {.max_frames = 1};
+    const StopCondition frames = {.max_frames = PPU_FRAMES_PER_RUN};
+    // The PPU alone gets an instance of its own, its clock runs ahead of the CPU's
+    Nes* alone = build_ppu_bench_nes(program, options);
+    Nes* nes = build_ppu_bench_nes(program, options);
+    // The split scene moves the CPU's clock by hand, the CPU never runs on it
+    Nes* split = build_ppu_bench_nes(program, options);
+    u64 ppu_ns = 0, nes_ns = 0, split_ns = 0;
+
+    if (!alone || !nes || !split) {
+        result.valid = false;
+    } else {
+        // Warm up, the first frame also moves the scroll position into v
+        run_nes_until(alone, &one_frame);
+        run_nes_until(nes, &one_frame);
+        run_nes_until(split, &one_frame);
+        render_split_frame(split);
+    }
+
+    const u64 split_drawn = split ? split->ppu->scanlines_drawn : 0;
+    const u64 split_redrawn = split ? split->ppu->scanlines_redrawn : 0;
+
+    for (u32 run = 0; run < options->runs && result.valid; run++) {
+        Component* ppu = &alone->ppu->component;
+        const u64 start_ns = get_time_ns();
+
+        for (u32 frame = 0; frame < PPU_FRAMES_PER_RUN; frame++) {
+            sync_component(ppu, ppu->cycles + PPU_DOTS_PER_FRAME / PPU_DOTS_PER_CPU_CYCLE);
+        }
+
+        ppu_ns += get_time_ns() - start_ns;
+
+        const u64 split_start_ns = get_time_ns();
+
+        for (u32 frame = 0; frame < PPU_FRAMES_PER_RUN; frame++) {
+            render_split_frame(split);
+        }
+
+        split_ns += get_time_ns() - split_start_ns;
+
+        const RunSummary summary = run_nes_until(nes, &frames);
+        nes_ns += summary.wall_ns;
+        result.valid = summary.reason == STOP_FRAME_LIMIT;
+        result.frames += PPU_FRAMES_PER_RUN;
+    }
+
+    if (result.valid) {
+        run_sprite_kernel_benchmark(alone->ppu, options, &result);
+    }
+
+    if (result.valid) {
+        run_video_benchmark(options, &result);
+    }
+
+    if (result.valid) {
+        run_ntsc_benchmark(alone->ppu, options, &result);
+    }
+
+    if (result.valid) {
+        result.ppu_fps = result.frames / (ppu_ns / 1e9);
+        result.ppu_ns_per_scanline = (double) ppu_ns / result.frames / PPU_FRAME_HEIGHT;
+        result.nes_fps = result.frames / (nes_ns / 1e9);
+        result.split_ns_per_scanline = (double) split_ns / result.frames / PPU_FRAME_HEIGHT;
+        result.split_redrawn_percent = 100.0 * (split->ppu->scanlines_redrawn - split_redrawn)
+            / (split->ppu->scanlines_drawn - split_drawn);
+    } else {
+        fprintf(stderr, "Program %s stopped while rendering the scene\n", program->name);
+    }
+
+    if (alone) {
+        free_nes(alone);
+    }
+
+    if (nes) {
+        free_nes(nes);
+    }
+
+    if (split) {
+        free_nes(split);
+    }
+
+    return result;
+}
+
+static void print_differential_result(const DifferentialResult* result, const BenchOptions* options) {
+    if (options->csv) {
+        printf("%d,%u,%d,%llu,%u\n", BENCH_FORMAT_VERSION, result->programs, options->decode_cache,
+               (unsigned long long) result->instructions, result->stopped);
+        return;
+    }
+
+    printf("%u random programs, %llu instructions: reference and threaded (%s decode cache) agree, "
+           "%u stopped early\n",
+           result->programs, (unsigned long long) result->instructions,
+           options->decode_cache ? "with" : "without", result->stopped);
+}
+
+static void print_ppu_result(const BenchProgram* program, const PpuBenchResult* result, const BenchOptions* options) {
+    if (options->csv) {
+        printf("%d,%s,%llu,%.1f,%.1f,%.1f,%.1f,%.2f,%s,%.2f,%.2f,%.2f,%.2f,%s,%.2f,%.2f,%.2f,%s,%.1f,%.1f,%u,%.1f\n",
+               BENCH_FORMAT_VERSION, program->name, (unsigned long long) result->frames,
+               result->ppu_fps, result->ppu_ns_per_scanline, result->nes_fps,
+               result->split_ns_per_scanline, result->split_redrawn_percent, ppu_vector_isa(),
+               result->evaluate_ns_per_scanline, result->evaluate_scalar_ns_per_scanline,
+               result->composite_ns_per_scanline, result->composite_scalar_ns_per_scanline,
+               video_vector_isa(), result->convert_us_per_frame, result->convert_scalar_us_per_frame,
+               result->publish_us_per_frame, ntsc_vector_isa(), result->ntsc_us_per_frame,
+               result->ntsc_scalar_us_per_frame, result->ntsc_threads, result->ntsc_threaded_us_per_frame);
+        return;
+    }
+
+    printf("static scene, %llu frames: PPU alone %9.1f fps (%7.1f ns/scanline), with %s on the CPU %8.1f fps\n",
+           (unsigned long long) result->frames, result->ppu_fps, result->ppu_ns_per_scanline,
+           program->name, result->nes_fps);
+    printf("split scene: %7.1f ns/scanline, %.2f%% of scanlines drawn again after mid-scanline writes\n",
+           result->split_ns_per_scanline, result->split_redrawn_percent);
+    printf("sprite kernels (%s): evaluation %6.1f ns/scanline (scalar %6.1f, %5.2fx), "
+           "compositing %6.1f ns/scanline (scalar %6.1f, %5.2fx)\n",
+           ppu_vector_isa(),
+           result->evaluate_ns_per_scanline, result->evaluate_scalar_ns_per_scanline,
+           result->evaluate_scalar_ns_per_scanline / result->evaluate_ns_per_scanline,
+           result->composite_ns_per_scanline, result->composite_scalar_ns_per_scanline,
+           result->composite_scalar_ns_per_scanline / result->composite_ns_per_scanline);
+    printf("display (%s): conversion to 32-bit pixels %6.1f us/frame (scalar %6.1f, %5.2fx), "
+           "publishing into the frame queue %5.2f us/frame\n",
+           video_vector_isa(),
+           result->convert_us_per_frame, result->convert_scalar_us_per_frame,
+           result->convert_scalar_us_per_frame / result->convert_us_per_frame,
+           result->publish_us_per_frame);
+    printf("NTSC filter (%s) to %dx%d: %7.1f us/frame (scalar %7.1f, %5.2fx), %7.1f us/frame on %u threads\n",
+           ntsc_vector_isa(), NTSC_OUTPUT_WIDTH, NTSC_OUTPUT_HEIGHT,
+           result->ntsc_us_per_frame, result->ntsc_scalar_us_per_frame,
+           result->ntsc_scalar_us_per_frame / result->ntsc_us_per_frame,
+           result->ntsc_threaded_us_per_frame, result->ntsc_threads);
+}
+
+static void print_load_result(const char* rom_path, const LoadBenchResult* result, const BenchOptions* options) {
+    if (options->csv) {
+        printf("%d,%s,%zu,%d,%.3f,%.1f,%.3f,%.1f\n",
+               BENCH_FORMAT_VERSION, rom_path, result->rom_size, LOAD_INSTANCES,
+               result->mapped_startup_us, result->mapped_private_kib,
+               result->read_startup_us, result->read_private_kib);
+        return;
+    }
+
+    printf("%s (%zu bytes), %d instances: mapped startup %8.2f us, %7.1f KiB private per instance; "
+           "read startup %8.2f us, %7.1f KiB private per instance\n",
+           rom_path, result->rom_size, LOAD_INSTANCES,
+           result->mapped_startup_us, result->mapped_private_kib,
+           result->read_startup_us, result->read_private_kib);
+}
+
+static void print_rewind_result(const BenchProgram* program, const RewindBenchResult* result, const BenchOptions* options) {
+    if (options->csv) {
+        printf("%d,%s,%llu,%llu,%.1f,%.2f,%.3f,%.3f,%.3f\n",
+               BENCH_FORMAT_VERSION, program->name,
+               (unsigned long long) result->frames, (unsigned long long) result->dropped,
+               result->bytes_per_second, result->compression_ratio,
+               result->compress_us, result->step_us, result->step_max_us);
+        return;
+    }
+
+    printf("%-18s %llu frames: %8.1f bytes per second of history, compression %6.1fx at %6.2f us/frame, "
+           "step back %6.2f us (max %7.2f), dropped %llu\n",
+           program->name, (unsigned long long) result->frames,
+           result->bytes_per_second, result->compression_ratio, result->compress_us,
+           result->step_us, result->step_max_us, (unsigned long long) result->dropped);
+}
+
+static void print_save_state_result(const BenchProgram* program, const SaveStateBenchResult* result, const BenchOptions* options) {
+    if (options->csv) {
+        printf("%d,%s,%zu,%.1f,%.1f,%.1f,%.1f\n",
+               BENCH_FORMAT_VERSION, program->name, result->state_size,
+               result->save_ns, result->save_p99_ns, result->load_ns, result->load_p99_ns);
+        return;
+    }
+
+    printf("%-18s %zu byte states: save %8.1f ns (p99 %8.1f), load %8.1f ns (p99 %8.1f)\n",
+           program->name, result->state_size,
+           result->save_ns, result->save_p99_ns, result->load_ns, result->load_p99_ns);
+}
+
+static void print_batch_result(const BenchProgram* program, const BatchBenchResult* result, const BenchOptions* options) {
+    const double speedup = result->scalar_ns_per_instruction / result->batch_ns_per_instruction;
+
+    if (options->csv) {
+        printf("%d,%s,%zu,%s,%llu,%.4f,%.4f,%.3f,%.4f,%.4f\n",
+               BENCH_FORMAT_VERSION, program->name, options->lanes, cpu_batch_vector_isa(),
+               (unsigned long long) result->instructions,
+               result->scalar_ns_per_instruction, result->batch_ns_per_instruction, speedup,
+               result->lane_utilization, result->scalar_fallback);
+        return;
+    }
+
+    printf("%-18s %zu lanes (%s): scalar %7.3f ns/instr, batch %7.3f ns/instr, speedup %5.2fx, "
+           "lane utilization %5.1f%%, scalar fallback %5.1f%%\n",
+           program->name, options->lanes, cpu_batch_vector_isa(),
+           result->scalar_ns_per_instruction, result->batch_ns_per_instruction, speedup,
+           100.0 * result->lane_utilization, 100.0 * result->scalar_fallback);
+}
+
+static void print_result(const BenchProgram* program, CpuCore core, const BenchResult* result, const BenchOptions* options) {
+    if (options->csv) {
+        printf("%d,%s,%s,%s,%u,%llu,%llu,%.4f,%.4f,%.3f,%.3f,%.3f,%.3f\n",
+               BENCH_FORMAT_VERSION, program->name, core_name(core),
+               options->decode_cache ? "on" : "off", options->runs,
+               (unsigned long long) result->instructions, (unsigned long long) result->cycles,
+               result->ns_per_instruction, result->ns_per_instruction_stddev,
+               result->mhz, result->mhz_stddev, result->mhz_min, result->mhz_max);
+        return;
+    }
+
+    printf("%-18s %-9s %8.3f ns/instr (+-%5.1f%%) %9.2f MHz (+-%5.1f%%, min %.2f, max %.2f)\n",
+           program->name, core_name(core),
+           result->ns_per_instruction, 100.0 * result->ns_per_instruction_stddev / result->ns_per_instruction,
+           result->mhz, 100.0 * result->mhz_stddev / result->mhz, result->mhz_min, result->mhz_max);
+}
+
+static void print_help(void) {
+    printf("USAGE: pyrotobox_bench [OPTIONS]\n\n");
+    printf("OPTIONS:\n");
+    printf("  --core=<CORE>      Only benchmark CORE (reference or threaded), default both\n");
+    printf("  --program=<NAME>   Only run programs whose name contains NAME\n");
+    printf("  --runs=N           Measured runs per program (default: %d)\n", DEFAULT_RUNS);
+    printf("  --cycles=N         Emulated CPU cycles per run (default: %llu)\n", DEFAULT_CYCLES_PER_RUN);
+    printf("  --no-decode-cache  Disable the decode cache of the threaded core\n");
+    printf("  --lanes=N          Run N copies per program on the lockstep batch engine and\n");
+    printf("                     compare against N exec_instruction loops\n");
+    printf("  --save-states      Measure taking and restoring save states between frames\n");
+    printf("  --rewind           Measure rewind history size and the latency of stepping back\n");
+    printf("  --load=<ROM>       Measure startup time and memory per instance of ROM, mapped\n");
+    printf("                     and read into memory\n");
+    printf("  --ppu              Measure rendering a static scene, alone, with the first\n");
+    printf("                     (matching) program on the CPU and with mid-scanline writes\n");
+    printf("  --differential=N   Run N random programs on both cores and compare their state\n");
+    printf("                     after every instruction\n");
+    printf("  --csv              Print results as CSV with a header line\n\n");
+    printf("PROGRAMS:\n ");
+    for (size_t i = 0; i < PROGRAM_COUNT; i++) {
+        printf(" %s", PROGRAMS[i].name);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options = {
+        .program = NULL,
+        .reference = true,
+        .threaded = true,
+        .decode_cache = true,
+        .runs = DEFAULT_RUNS,
+        .cycles_per_run = DEFAULT_CYCLES_PER_RUN,
+        .lanes = 0,
+        .save_states = false,
+        .rewind = false,
+        .load_rom = NULL,
+        .ppu = false,
+        .differential = 0,
+        .csv = false
+    };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--core=reference") == 0) {
+            options.threaded = false;
+        } else if (strcmp(argv[i], "--core=threaded") == 0) {
+            options.reference = false;
+        } else if (strncmp(argv[i], "--program=", 10) == 0) {
+            options.program = argv[i] + 10;
+        } else if (strncmp(argv[i], "--runs=", 7) == 0) {
+            options.runs = strtoul(argv[i] + 7, NULL, 10);
+        } else if (strncmp(argv[i], "--cycles=", 9) == 0) {
+            options.cycles_per_run = strtoull(argv[i] + 9, NULL, 10);
+        } else if (strcmp(argv[i], "--no-decode-cache") == 0) {
+            options.decode_cache = false;
+        } else if (strncmp(argv[i], "--lanes=", 8) == 0) {
+            options.lanes = strtoul(argv[i] + 8, NULL, 10);
+
+            if (options.lanes == 0) {
+                print_help();
+                return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+            }
+        } else if (strcmp(argv[i], "--save-states") == 0) {
+            options.save_states = true;
+        } else if (strcmp(argv[i], "--rewind") == 0) {
+            options.rewind = true;
+        } else if (strncmp(argv[i], "--load=", 7) == 0) {
+            options.load_rom = argv[i] + 7;
+        } else if (strcmp(argv[i], "--ppu") == 0) {
+            options.ppu = true;
+        } else if (strncmp(argv[i], "--differential=", 15) == 0) {
+            options.differential = strtoul(argv[i] + 15, NULL, 10);
+
+            if (options.differential == 0) {
+                print_help();
+                return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+            }
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            options.csv = true;
+        } else {
+            print_help();
+            return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+        }
+    }
+
+    if (options.runs == 0 || options.cycles_per_run == 0) {
+        print_help();
+        return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+    }
+
+    if (options.load_rom) {
+        if (options.csv) {
+            printf("version,rom,rom_bytes,instances,mapped_startup_us,mapped_private_kib,read_startup_us,read_private_kib\n");
+        }
+
+        const LoadBenchResult result = run_load_benchmark(options.load_rom, &options);
+
+        if (!result.valid) {
+            return BENCHMARK_FAILED_ERROR_RETURN_CODE;
+        }
+
+        print_load_result(options.load_rom, &result, &options);
+        return 0;
+    }
+
+    if (options.differential) {
+        if (options.csv) {
+            printf("version,programs,decode_cache,instructions,stopped\n");
+        }
+
+        const DifferentialResult result = run_differential_check(&options);
+
+        if (!result.valid) {
+            return BENCHMARK_FAILED_ERROR_RETURN_CODE;
+        }
+
+        print_differential_result(&result, &options);
+        return 0;
+    }
+
+    if (options.ppu) {
+        const BenchProgram* program = &PROGRAMS[0];
+
+        for (size_t i = 0; options.program && i < PROGRAM_COUNT; i++) {
+            if (strstr(PROGRAMS[i].name, options.program)) {
+                program = &PROGRAMS[i];
+                break;
+            }
+        }
+
+        if (options.csv) {
+            printf("version,program,frames,ppu_fps,ppu_ns_per_scanline,nes_fps,split_ns_per_scanline,split_redrawn_percent,"
+                   "isa,evaluate_ns_per_scanline,evaluate_scalar_ns_per_scanline,composite_ns_per_scanline,"
+                   "composite_scalar_ns_per_scanline,video_isa,convert_us_per_frame,convert_scalar_us_per_frame,"
+                   "publish_us_per_frame,ntsc_isa,ntsc_us_per_frame,ntsc_scalar_us_per_frame,ntsc_threads,"
+                   "ntsc_threaded_us_per_frame\n");
+        }
+
+        const PpuBenchResult result = run_ppu_benchmark(program, &options);
+
+        if (!result.valid) {
+            return BENCHMARK_FAILED_ERROR_RETURN_CODE;
+        }
+
+        print_ppu_result(program, &result, &options);
+        return 0;
+    }
+
+    if (options.csv && options.rewind) {
+        printf("version,program,frames,dropped,bytes_per_second,compression_ratio,compress_us,step_us,step_max_us\n");
+    } else if (options.csv && options.save_states) {
+        printf("version,program,state_bytes,save_ns,save_p99_ns,load_ns,load_p99_ns\n");
+    } else if (options.csv && options.lanes) {
+        printf("version,program,lanes,isa,instructions,scalar_ns_per_instruction,batch_ns_per_instruction,"
+               "speedup,lane_utilization,scalar_fallback\n");
+    } else if (options.csv) {
+        printf("version,program,core,decode_cache,runs,instructions,cycles,"
+               "ns_per_instruction,ns_per_instruction_stddev,mhz,mhz_stddev,mhz_min,mhz_max\n");
+    }
+
+    int return_code = 0;
+
+    for (size_t i = 0; i < PROGRAM_COUNT; i++) {
+        const BenchProgram* program = &PROGRAMS[i];
+
+        if (options.program && !strstr(program->name, options.program)) {
+            continue;
+        }
+
+        if (options.rewind) {
+            const RewindBenchResult result = run_rewind_benchmark(program, &options);
+
+            if (!result.valid) {
+                return_code = BENCHMARK_FAILED_ERROR_RETURN_CODE;
+                continue;
+            }
+
+            print_rewind_result(program, &result, &options);
+            fflush(stdout);
+            continue;
+        }
+
+        if (options.save_states) {
+            const SaveStateBenchResult result = run_save_state_benchmark(program, &options);
+
+            if (!result.valid) {
+                return_code = BENCHMARK_FAILED_ERROR_RETURN_CODE;
+                continue;
+            }
+
+            print_save_state_result(program, &result, &options);
+            fflush(stdout);
+            continue;
+        }
+
+        if (options.lanes) {
+            const BatchBenchResult result = run_batch_benchmark(program, &options);
+
+            if (!result.valid) {
+                return_code = BENCHMARK_FAILED_ERROR_RETURN_CODE;
+                continue;
+            }
+
+            print_batch_result(program, &result, &options);
+            fflush(stdout);
+            continue;
+        }
+
+        for (CpuCore core = CPU_CORE_REFERENCE; core <= CPU_CORE_THREADED; core++) {
+            if ((core == CPU_CORE_REFERENCE && !options.reference) || (core == CPU_CORE_THREADED && !options.threaded)) {
+                continue;
+            }
+
+            const BenchResult result = run_benchmark(program, core, &options);
+
+            if (!result.valid) {
+                return_code = BENCHMARK_FAILED_ERROR_RETURN_CODE;
+                continue;
+            }
+
+            print_result(program, core, &result, &options);
+            fflush(stdout);
+        }
+    }
+
+    return return_code;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "types.h"
+#include "cpu.h"
+#include "trace.h"
+
+// Decodes a binary trace dump written by `pyrotobox --trace=<file>` into nestest-style text:
+// C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD CYC:7
+
+#define INVALID_ARGUMENTS_ERROR_RETURN_CODE -1
+#define READ_TRACE_FAILED_ERROR_RETURN_CODE -2
+
+static void format_operand(const TraceRecord* record, const Instruction* inst, char* buf, size_t size) {
+    const u8 lo = record->operands[0];
+    const u16 abs_addr = (record->operands[1] << 8) | lo;
+
+    switch (inst->addr_mode) {
+        case IMPLIED:
+            buf[0] = '\0';
+            break;
+        case ACCUMULATOR:
+            snprintf(buf, size, "A");
+            break;
+        case IMMEDIATE:
+            snprintf(buf, size, "#$%02X", lo);
+            break;
+        case ZERO_PAGE:
+            snprintf(buf, size, "$%02X", lo);
+            break;
+        case ZERO_PAGE_X:
+            snprintf(buf, size, "$%02X,X", lo);
+            break;
+        case ZERO_PAGE_Y:
+            snprintf(buf, size, "$%02X,Y", lo);
+            break;
+        case RELATIVE:
+            snprintf(buf, size, "$%04X", (u16) (record->pc + 2 + (i8) lo));
+            break;
+        case ABSOLUTE:
+            snprintf(buf, size, "$%04X", abs_addr);
+            break;
+        case ABSOLUTE_X:
+            snprintf(buf, size, "$%04X,X", abs_addr);
+            break;
+        case ABSOLUTE_Y:
+            snprintf(buf, size, "$%04X,Y", abs_addr);
+            break;
+        case INDIRECT:
+            snprintf(buf, size, "($%04X)", abs_addr);
+            break;
+        case INDIRECT_X:
+            snprintf(buf, size, "($%02X,X)", lo);
+            break;
+        case INDIRECT_Y:
+            snprintf(buf, size, "($%02X),Y", lo);
+            break;
+    }
+}
+
+static void print_record(const TraceRecord* record) {
+    const Instruction* inst = get_instruction(record->opcode);
+    const u8 length = get_instruction_length(record->opcode);
+
+    char bytes[16];
+    switch (length) {
+        case 1:
+            snprintf(bytes, sizeof(bytes), "%02X", record->opcode);
+            break;
+        case 2:
+            snprintf(bytes, sizeof(bytes), "%02X %02X", record->opcode, record->operands[0]);
+            break;
+        default:
+            snprintf(bytes, sizeof(bytes), "%02X %02X %02X", record->opcode, record->operands[0], record->operands[1]);
+            break;
+    }
+
+    char operand[16];
+    format_operand(record, inst, operand, sizeof(operand));
+
+    char disasm[40];
+    snprintf(disasm, sizeof(disasm), "%.3s %s", inst->mnemonic, operand);
+
+    printf("%04X  %-8s  %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu\n",
+            record->pc, bytes, disasm,
+            record->r_a, record->r_x, record->r_y, record->r_sr, record->r_sp,
+            (unsigned long long) record->cycles);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printf("USAGE: pyrotobox_trace <TRACE_FILE_PATH>\n");
+        return INVALID_ARGUMENTS_ERROR_RETURN_CODE;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Unable to open the trace file. Given Path: %s\n", argv[1]);
+        return READ_TRACE_FAILED_ERROR_RETURN_CODE;
+    }
+
+    u64 record_count = 0;
+
+    if (!read_trace_header(file, &record_count)) {
+        fclose(file);
+        return READ_TRACE_FAILED_ERROR_RETURN_CODE;
+    }
+
+    TraceRecord record;
+    for (u64 i = 0; i < record_count; i++) {
+        if (!read_trace_record(file, &record)) {
+            fprintf(stderr, "Trace file is truncated after %llu records.\n", (unsigned long long) i);
+            fclose(file);
+            return READ_TRACE_FAILED_ERROR_RETURN_CODE;
+        }
+
+        print_record(&record);
+    }
+
+    fclose(file);
+    return 0;
+}